@@ -151,7 +151,8 @@ int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8
 }
 
 // http://tools.ietf.org/html/rfc7252#section-3.1
-int coap_parseOptionsAndPayload(coap_option_t *options, uint8_t *numOptions, coap_buffer_t *payload, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
+// index (may be NULL) receives 1 + the position of the first option of each number
+int coap_parseOptionsAndPayload(coap_option_t *options, uint8_t *numOptions, uint8_t *index, coap_buffer_t *payload, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
 {
     size_t optionIndex = 0;
     uint16_t delta = 0;
@@ -168,6 +169,9 @@ int coap_parseOptionsAndPayload(coap_option_t *options, uint8_t *numOptions, coa
     {
         if (0 != (rc = coap_parseOption(&options[optionIndex], &delta, &p, end-p)))
             return rc;
+        if (index && options[optionIndex].num < COAP_OPTION_INDEX_SIZE &&
+            index[options[optionIndex].num] == 0)
+            index[options[optionIndex].num] = optionIndex + 1;
         optionIndex++;
     }
     *numOptions = optionIndex;
@@ -223,7 +227,8 @@ int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen)
     if (0 != (rc = coap_parseToken(&pkt->tok, &pkt->hdr, buf, buflen)))
         return rc;
     pkt->numopts = MAXOPT;
-    if (0 != (rc = coap_parseOptionsAndPayload(pkt->opts, &(pkt->numopts), &(pkt->payload), &pkt->hdr, buf, buflen)))
+    memset(pkt->optidx, 0, sizeof(pkt->optidx));
+    if (0 != (rc = coap_parseOptionsAndPayload(pkt->opts, &(pkt->numopts), pkt->optidx, &(pkt->payload), &pkt->hdr, buf, buflen)))
         return rc;
 //    coap_dumpOptions(opts, numopt);
     return 0;
@@ -232,10 +237,21 @@ int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen)
 // options are always stored consecutively, so can return a block with same option num
 const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint8_t num, uint8_t *count)
 {
-    // FIXME, options is always sorted, can find faster than this
     size_t i;
     const coap_option_t *first = NULL;
     *count = 0;
+
+    // Indexed numbers: jump to the first one, then count the run
+    if (num < COAP_OPTION_INDEX_SIZE)
+    {
+        if (pkt->optidx[num] == 0)
+            return NULL;
+        first = &pkt->opts[pkt->optidx[num] - 1];
+        for (i=pkt->optidx[num]-1;i<pkt->numopts && pkt->opts[i].num == num;i++)
+            (*count)++;
+        return first;
+    }
+
     for (i=0;i<pkt->numopts;i++)
     {
         if (pkt->opts[i].num == num)
@@ -369,7 +385,7 @@ int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint
     pkt->hdr.code = rspcode;
     pkt->hdr.id[0] = msgid_hi;
     pkt->hdr.id[1] = msgid_lo;
-    pkt->numopts = 0; // Start with 0 options
+    coap_clear_options(pkt); // Start with 0 options
 
     // need token in response
     if (tok) {
@@ -396,6 +412,7 @@ int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint
             pkt->opts[0].buf.len = 2;
         }
         pkt->numopts = 1;
+        pkt->optidx[COAP_OPTION_CONTENT_FORMAT] = 1;
     }
 
     pkt->payload.p = content;
@@ -470,12 +487,24 @@ int coap_add_option(coap_packet_t *pkt, uint8_t num, const uint8_t *buf, size_t
     pkt->opts[pkt->numopts].num = num;
     pkt->opts[pkt->numopts].buf.p = buf;
     pkt->opts[pkt->numopts].buf.len = len;
+    if (num < COAP_OPTION_INDEX_SIZE && pkt->optidx[num] == 0)
+        pkt->optidx[num] = pkt->numopts + 1;
     
     pkt->numopts++;
     
     return 0;
 }
 
+/**
+ * @brief Removes every option from a CoAP packet, including the index.
+ * @param pkt   The packet to clear.
+ */
+void coap_clear_options(coap_packet_t *pkt)
+{
+    pkt->numopts = 0;
+    memset(pkt->optidx, 0, sizeof(pkt->optidx));
+}
+
 /**
  * @brief Encodes an integer value into a CoAP option buffer.
  * @param buf   The buffer to write the encoded integer to.
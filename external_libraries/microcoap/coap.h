@@ -10,6 +10,7 @@ extern "C" {
 #include <stddef.h>
 
 #define MAXOPT 16
+#define COAP_OPTION_INDEX_SIZE 32  /* Option numbers 0-31 are indexed; higher ones are scanned */
 
 //http://tools.ietf.org/html/rfc7252#section-3
 typedef struct
@@ -48,6 +49,9 @@ typedef struct
     uint8_t numopts;            /* Number of options */
     coap_option_t opts[MAXOPT]; /* Options of the packet. For possible entries see
                                  * http://tools.ietf.org/html/rfc7252#section-5.10 */
+    uint8_t optidx[COAP_OPTION_INDEX_SIZE]; /* 1 + index in opts of the first option with
+                                 * that number, 0 if absent. Kept by coap_parse(),
+                                 * coap_make_response() and coap_add_option() */
     coap_buffer_t payload;      /* Payload carried by the packet */
 } coap_packet_t;
 
@@ -70,6 +74,7 @@ typedef enum
     COAP_OPTION_ACCEPT = 17,
     COAP_OPTION_LOCATION_QUERY = 20,
     COAP_OPTION_BLOCK2 = 23,        // <-- ADDED
+    COAP_OPTION_BLOCK1 = 27,
     COAP_OPTION_PROXY_URI = 35,
     COAP_OPTION_PROXY_SCHEME = 39
 } coap_option_num_t;
@@ -100,11 +105,17 @@ typedef enum
 #define MAKE_RSPCODE(clas, det) ((clas << 5) | (det))
 typedef enum
 {
+    COAP_RSPCODE_VALID = MAKE_RSPCODE(2, 3),
     COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
     COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
+    COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE = MAKE_RSPCODE(4, 8),
     COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
+    COAP_RSPCODE_NOT_ACCEPTABLE = MAKE_RSPCODE(4, 6),
+    COAP_RSPCODE_PRECONDITION_FAILED = MAKE_RSPCODE(4, 12),
+    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13),
     COAP_RSPCODE_UNSUPPORTED_CONTENT_FORMAT = MAKE_RSPCODE(4, 15),     // 4.15 ✅
     COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
+    COAP_RSPCODE_CONTINUE = MAKE_RSPCODE(2, 31),
     COAP_RSPCODE_SERVICE_UNAVAILABLE = MAKE_RSPCODE(5, 3)
     
 } coap_responsecode_t;
@@ -119,6 +130,7 @@ typedef enum
     COAP_CONTENTTYPE_APPLICATION_OCTECT_STREAM = 42,
     COAP_CONTENTTYPE_APPLICATION_EXI = 47,
     COAP_CONTENTTYPE_APPLICATION_JSON = 50,
+    COAP_CONTENTTYPE_APPLICATION_CBOR = 60,
 } coap_content_type_t;
 
 ///////////////////////
@@ -179,6 +191,7 @@ void endpoint_setup(void);
 
 // Helper functions for options
 int coap_add_option(coap_packet_t *pkt, uint8_t num, const uint8_t *buf, size_t len);
+void coap_clear_options(coap_packet_t *pkt);
 size_t coap_set_option_uint(uint8_t *buf, uint32_t val);
 uint32_t coap_get_option_uint(const coap_buffer_t *buf);
 
@@ -62,9 +62,10 @@ static spi_t spis[] = {  // One for each SPI.
         .mosi_gpio = 11,
         .sck_gpio = 10,
 
-        // .baud_rate = 1000 * 1000
-        .baud_rate = 400 * 1000
-        // .baud_rate = 25 * 1000 * 1000 // Actual frequency: 20833333.
+        // Ceiling for the data-transfer rate. Cards are initialized at
+        // 400 kHz, then sd_init() picks the fastest rate up to this one that
+        // the card supports and reads back without CRC errors.
+        .baud_rate = 25 * 1000 * 1000 // Actual frequency: 20833333.
     }};
 
 // Hardware Configuration of the SD Card "objects"
@@ -105,10 +105,11 @@ specific language governing permissions and limitations under the License.
  * just always use the Standard Capacity cards with a block size of 512 bytes.
  * This is set with CMD16.
  *
- * You can read and write single blocks (CMD17, CMD25) or multiple blocks
- * (CMD18, CMD25). For simplicity, I'll just use single block accesses. When
- * the card gets a read command, it responds with a response token, and then
- * a data token or an error.
+ * You can read and write single blocks (CMD17, CMD24) or multiple blocks
+ * (CMD18, CMD25). A request for more than one sector uses the multiple
+ * block command, with each 512-byte data block moved by DMA, so FatFs runs of
+ * contiguous sectors cost one command. When the card gets a read command, it
+ * responds with a response token, and then a data token or an error.
  *
  * SPI Command Format
  * ------------------
@@ -187,6 +188,18 @@ static bool crc_on = true;
 #define TRACE_PRINTF(fmt, args...)
 // #define TRACE_PRINTF printf
 
+/* Data-transfer rates tried after initialization, fastest first. The PL022
+divides clk_peri by an even number, so 25 MHz comes out as 20.8 MHz and
+12.5 MHz as 12.5 MHz (at 125 MHz clk_peri). The last entry is the init rate,
+which every card supports. */
+static const uint sd_rate_ladder[] = {25 * 1000 * 1000, 12500 * 1000,
+                                      5 * 1000 * 1000, 1000 * 1000, 400 * 1000};
+#define SD_RATE_COUNT (sizeof(sd_rate_ladder) / sizeof(sd_rate_ladder[0]))
+
+#ifndef SD_RATE_VERIFY_READS
+#define SD_RATE_VERIFY_READS 4  // CRC-checked reads a candidate rate must pass
+#endif
+
 #define TRC_PR_ADD(fmt, args...)
 // #define TRC_PR_ADD printf
 
@@ -843,6 +856,18 @@ static int sd_read_block(sd_card_t *pSD, uint8_t *buffer, uint32_t length) {
     return SD_BLOCK_DEVICE_ERROR_NONE;
 }
 
+/* Steps down to the next slower rate after a CRC error. Returns false if
+the card is already at the slowest one. */
+static bool sd_rate_step_down(sd_card_t *pSD) {
+    if (pSD->rate_idx + 1 >= SD_RATE_COUNT) return false;
+    pSD->rate_idx++;
+    pSD->baud_rate = sd_rate_ladder[pSD->rate_idx];
+    pSD->rate_fallbacks++;
+    uint actual = sd_spi_set_frequency(pSD, pSD->baud_rate);
+    printf("SD: CRC error, SPI clock lowered to %u kHz\r\n", actual / 1000);
+    return true;
+}
+
 static int in_sd_read_blocks(sd_card_t *pSD, uint8_t *buffer,
                              uint64_t ulSectorNumber, uint32_t ulSectorCount) {
     uint32_t blockCnt = ulSectorCount;
@@ -874,8 +899,8 @@ static int in_sd_read_blocks(sd_card_t *pSD, uint8_t *buffer,
     // receive the data : one block at a time
     int rd_status = 0;
     while (blockCnt) {
-        if (0 != sd_read_block(pSD, buffer, _block_size)) {
-            rd_status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        rd_status = sd_read_block(pSD, buffer, _block_size);
+        if (0 != rd_status) {
             break;
         }
         buffer += _block_size;
@@ -894,6 +919,13 @@ int sd_read_blocks(sd_card_t *pSD, uint8_t *buffer, uint64_t ulSectorNumber,
     TRACE_PRINTF("sd_read_blocks(0x%p, 0x%llx, 0x%lx)\r\n", buffer,
                  ulSectorNumber, ulSectorCount);
     int status = in_sd_read_blocks(pSD, buffer, ulSectorNumber, ulSectorCount);
+    while (SD_BLOCK_DEVICE_ERROR_CRC == status && sd_rate_step_down(pSD)) {
+        status = in_sd_read_blocks(pSD, buffer, ulSectorNumber, ulSectorCount);
+    }
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status) {
+        pSD->read_cmds++;
+        pSD->read_sectors += ulSectorCount;
+    }
     sd_release(pSD);
     return status;
 }
@@ -975,7 +1007,10 @@ static int in_sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
         response = sd_write_block(pSD, buffer, SPI_START_BLOCK, _block_size);
 
         // Only CRC and general write error are communicated via response token
-        if (response != SPI_DATA_ACCEPTED) {
+        if (response == SPI_DATA_CRC_ERROR) {
+            DBG_PRINTF("Single Block Write CRC error\r\n");
+            status = SD_BLOCK_DEVICE_ERROR_CRC;
+        } else if (response != SPI_DATA_ACCEPTED) {
             DBG_PRINTF("Single Block Write failed: 0x%x \r\n", response);
             status = SD_BLOCK_DEVICE_ERROR_WRITE;
         }
@@ -996,7 +1031,9 @@ static int in_sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
             response = sd_write_block(pSD, buffer, SPI_START_BLK_MUL_WRITE, _block_size);
             if (response != SPI_DATA_ACCEPTED) {
                 DBG_PRINTF("Multiple Block Write failed: 0x%x\r\n", response);
-                status = SD_BLOCK_DEVICE_ERROR_WRITE;
+                status = response == SPI_DATA_CRC_ERROR
+                             ? SD_BLOCK_DEVICE_ERROR_CRC
+                             : SD_BLOCK_DEVICE_ERROR_WRITE;
                 break;
             }
             buffer += _block_size;
@@ -1010,8 +1047,8 @@ static int in_sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
     uint32_t stat = 0;
     // Some SD cards want to be deselected between every bus transaction:
     sd_spi_deselect_pulse(pSD);
-    status = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
-    return status;
+    int cmd13_status = sd_cmd(pSD, CMD13_SEND_STATUS, 0, false, &stat);
+    return status ? status : cmd13_status;
 }
 
 int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
@@ -1020,6 +1057,13 @@ int sd_write_blocks(sd_card_t *pSD, const uint8_t *buffer,
     TRACE_PRINTF("sd_write_blocks(0x%p, 0x%llx, 0x%lx)\r\n", buffer,
                  ulSectorNumber, blockCnt);
     int status = in_sd_write_blocks(pSD, buffer, ulSectorNumber, blockCnt);
+    while (SD_BLOCK_DEVICE_ERROR_CRC == status && sd_rate_step_down(pSD)) {
+        status = in_sd_write_blocks(pSD, buffer, ulSectorNumber, blockCnt);
+    }
+    if (SD_BLOCK_DEVICE_ERROR_NONE == status) {
+        pSD->write_cmds++;
+        pSD->write_sectors += blockCnt;
+    }
     sd_release(pSD);
     return status;
 }
@@ -1128,6 +1172,72 @@ static int sd_init_medium(sd_card_t *pSD) {
 
     return status;
 }
+/* Maximum data-transfer rate from CSD TRAN_SPEED (csd[103:96]), in Hz. */
+static uint sd_csd_max_rate(const uint8_t *csd) {
+    static const uint8_t tenths[16] = {0,  10, 12, 13, 15, 20, 25, 30,
+                                       35, 40, 45, 50, 55, 60, 70, 80};
+    static const uint unit[4] = {10 * 1000, 100 * 1000, 1000 * 1000,
+                                 10 * 1000 * 1000};
+    uint32_t tran_speed = ext_bits((unsigned char *)csd, 103, 96);
+    if ((tran_speed & 7) > 3 || 0 == tenths[(tran_speed >> 3) & 0xF])
+        return 25 * 1000 * 1000;  // Reserved code: assume default speed
+    return unit[tran_speed & 7] * tenths[(tran_speed >> 3) & 0xF];
+}
+
+static int sd_read_csd(sd_card_t *pSD, uint8_t *csd) {
+    if (sd_cmd(pSD, CMD9_SEND_CSD, 0x0, false, 0) != 0x0)
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    return sd_read_bytes(pSD, csd, 16);
+}
+
+/* Checks the link at the current SCK: the CSD must read back unchanged and
+sector 0 must pass SD_RATE_VERIFY_READS CRC-checked reads. */
+static bool sd_verify_rate(sd_card_t *pSD, const uint8_t *csd_ref) {
+    static uint8_t sector[512];
+    uint8_t csd[16];
+
+    if (sd_read_csd(pSD, csd) != 0 || memcmp(csd, csd_ref, sizeof(csd)) != 0)
+        return false;
+    for (int i = 0; i < SD_RATE_VERIFY_READS; i++) {
+        // Sector 0 has address 0 in both byte and block addressing
+        if (sd_cmd(pSD, CMD17_READ_SINGLE_BLOCK, 0, false, 0) != 0 ||
+            sd_read_block(pSD, sector, _block_size) != 0)
+            return false;
+    }
+    return true;
+}
+
+/* Picks the fastest ladder rate up to the configured ceiling and the card's
+TRAN_SPEED that passes sd_verify_rate(). Called at the init rate. */
+static void sd_negotiate_rate(sd_card_t *pSD) {
+    uint8_t csd[16];
+    uint ceiling = pSD->spi->baud_rate;
+
+    pSD->rate_idx = SD_RATE_COUNT - 1;
+    pSD->baud_rate = sd_rate_ladder[pSD->rate_idx];
+    if (sd_read_csd(pSD, csd) != 0) {
+        DBG_PRINTF("%s: CSD read failed, staying at the init rate\r\n",
+                   __FUNCTION__);
+        return;
+    }
+    uint card_max = sd_csd_max_rate(csd);
+    if (card_max < ceiling) ceiling = card_max;
+
+    for (uint i = 0; i + 1 < SD_RATE_COUNT; i++) {
+        if (sd_rate_ladder[i] > ceiling) continue;
+        sd_spi_set_frequency(pSD, sd_rate_ladder[i]);
+        if (sd_verify_rate(pSD, csd)) {
+            pSD->rate_idx = i;
+            pSD->baud_rate = sd_rate_ladder[i];
+            return;
+        }
+        DBG_PRINTF("%s: %u Hz failed verification\r\n", __FUNCTION__,
+                   sd_rate_ladder[i]);
+        pSD->rate_fallbacks++;
+    }
+    sd_spi_go_low_frequency(pSD);
+}
+
 static int sd_init(sd_card_t *pSD);
 static bool sd_test_com(sd_card_t *pSD);
 
@@ -1225,7 +1335,8 @@ static int sd_init(sd_card_t *pSD) {
         sd_unlock(pSD);
         return pSD->m_Status;
     }
-    // Set SCK for data transfer
+    // Set SCK for data transfer: the fastest rate that verifies cleanly
+    sd_negotiate_rate(pSD);
     sd_spi_go_high_frequency(pSD);
 
     // The card is now initialized
@@ -54,6 +54,13 @@ struct sd_card_t {
     mutex_t mutex;
     FATFS fatfs;
     bool mounted;
+    uint baud_rate;       // Negotiated data-transfer SCK (requested Hz); 0 until init
+    uint rate_idx;        // Position in the rate ladder (see sd_card.c)
+    uint rate_fallbacks;  // Rates given up on (failed verification or CRC errors)
+    uint32_t read_cmds;      // Successful CMD17/CMD18 transfers
+    uint32_t read_sectors;   // Sectors moved by them
+    uint32_t write_cmds;     // Successful CMD24/CMD25 transfers
+    uint32_t write_sectors;  // Sectors moved by them
 
     int (*init)(sd_card_t *sd_card_p);
     int (*write_blocks)(sd_card_t *sd_card_p, const uint8_t *buffer,
@@ -30,8 +30,15 @@ specific language governing permissions and limitations under the License.
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-variable"
 
+uint sd_spi_set_frequency(sd_card_t *pSD, uint hz) {
+    uint actual = spi_set_baudrate(pSD->spi->hw_inst, hz);
+    TRACE_PRINTF("%s: Actual frequency: %lu\n", __FUNCTION__, (long)actual);
+    return actual;
+}
+// Uses the rate negotiated by sd_init(), or the configured one before that.
 void sd_spi_go_high_frequency(sd_card_t *pSD) {
-    uint actual = spi_set_baudrate(pSD->spi->hw_inst, pSD->spi->baud_rate);
+    uint hz = pSD->baud_rate ? pSD->baud_rate : pSD->spi->baud_rate;
+    uint actual = spi_set_baudrate(pSD->spi->hw_inst, hz);
     TRACE_PRINTF("%s: Actual frequency: %lu\n", __FUNCTION__, (long)actual);
 }
 void sd_spi_go_low_frequency(sd_card_t *pSD) {
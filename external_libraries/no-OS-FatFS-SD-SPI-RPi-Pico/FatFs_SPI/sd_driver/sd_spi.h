@@ -27,6 +27,8 @@ void sd_spi_acquire(sd_card_t *pSD);
 void sd_spi_release(sd_card_t *pSD);
 void sd_spi_go_low_frequency(sd_card_t *this);
 void sd_spi_go_high_frequency(sd_card_t *this);
+/* Sets SCK to the closest rate not above hz; returns the actual rate. */
+uint sd_spi_set_frequency(sd_card_t *pSD, uint hz);
 
 /* 
 After power up, the host starts the clock and sends the initializing sequence on the CMD line. 
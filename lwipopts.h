@@ -8,6 +8,13 @@
 // Common settings used in most of the pico_w examples
 // (see https://www.nongnu.org/lwip/2_1_x/group__lwip__opts.html for details)
 
+// Profile, set per target by CMake (CS04_<TARGET>_LWIP_PROFILE):
+// 0 keeps the settings below as shipped; 1 is the UDP-only CoAP profile,
+// which drops TCP and puts the memory into the receive pbuf pool.
+#ifndef CS04_LWIP_UDP_ONLY
+#define CS04_LWIP_UDP_ONLY          0
+#endif
+
 // allow override in some examples
 #ifndef NO_SYS
 #define NO_SYS                      1
@@ -26,40 +33,57 @@
 #ifndef MEM_SIZE
 #define MEM_SIZE                    4000
 #endif
-#define MEMP_NUM_TCP_SEG            32
-#define MEMP_NUM_ARP_QUEUE          10
-#define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
 #define LWIP_ICMP                   1
+#define TCP_MSS                     1460  // Also sizes PBUF_POOL_BUFSIZE (one frame)
+#if CS04_LWIP_UDP_ONLY
+// Receive side: a BERT Block2 response is 2 fragments, and a client keeps
+// up to 8 (BLOCK_WINDOW_MAX) in reassembly at once
+#define PBUF_POOL_SIZE              32
+#define IP_REASS_MAX_PBUFS          16
+#define MEMP_NUM_REASSDATA          8
+// Send side: notification fan-out queues one reference pbuf per observer
+// (SUBSCRIBER_MAX) while ARP resolves
+#define MEMP_NUM_PBUF               32
+#define MEMP_NUM_ARP_QUEUE          32
+#define LWIP_RAW                    0
+#else
+#define MEMP_NUM_TCP_SEG            32
+#define MEMP_NUM_ARP_QUEUE          10
+#define PBUF_POOL_SIZE              24
 #define LWIP_RAW                    1
 #define TCP_WND                     (8 * TCP_MSS)
-#define TCP_MSS                     1460
 #define TCP_SND_BUF                 (8 * TCP_MSS)
 #define TCP_SND_QUEUELEN            ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+#endif
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                0
-#define MEM_STATS                   0
+#define MEM_STATS                   1  // Heap usage on /metrics
 #define SYS_STATS                   0
-#define MEMP_STATS                  0
+#define MEMP_STATS                  1  // pbuf pool usage on /metrics
 #define LINK_STATS                  0
 // #define ETH_PAD_SIZE                2
 #define LWIP_CHKSUM_ALGORITHM       3
 #define LWIP_DHCP                   1
 #define LWIP_IPV4                   1
-#define LWIP_TCP                    1
+#define LWIP_TCP                    (!CS04_LWIP_UDP_ONLY)
 #define LWIP_UDP                    1
-#define LWIP_DNS                    1
-#define LWIP_TCP_KEEPALIVE          1
+#define LWIP_DNS                    1  // UDP; DHCP hands it the server
+#define LWIP_TCP_KEEPALIVE          (!CS04_LWIP_UDP_ONLY)
 #define LWIP_NETIF_TX_SINGLE_PBUF   1
+#define LWIP_SUPPORT_CUSTOM_PBUF    1  // Pool-backed pbufs (cs04_packet_pool)
+#define IP_FRAG                     1  // 2 KiB BERT Block2 datagrams span 2 frames
+#define IP_REASSEMBLY               1
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 
-#ifndef NDEBUG
+#define LWIP_STATS                  1  // Counters kept in release builds too
+
+#if !defined(NDEBUG) && !CS04_LWIP_UDP_ONLY
 #define LWIP_DEBUG                  1
-#define LWIP_STATS                  1
 #define LWIP_STATS_DISPLAY          1
 #endif
 
@@ -0,0 +1,89 @@
+# Static RAM budget of a firmware image, grouped by owner.
+#
+#   cmake -DELF=<image.elf> -DNM=<arm-none-eabi-nm> -DOUT=<report.txt>
+#         [-DPROFILE=<lwIP profile>] -P memory_report.cmake
+#
+# Run after every link of the firmware targets (see cs04_lwip_profile() in
+# CMakeLists.txt). Sizes come from the symbol table, so the report needs
+# no map file and matches exactly what was linked.
+
+if (NOT ELF OR NOT NM OR NOT OUT)
+    message(FATAL_ERROR "memory_report.cmake: ELF, NM and OUT are required")
+endif()
+
+execute_process(
+    COMMAND ${NM} --print-size --radix=d ${ELF}
+    OUTPUT_VARIABLE nm_out
+    RESULT_VARIABLE nm_result)
+if (NOT nm_result EQUAL 0)
+    message(FATAL_ERROR "memory_report.cmake: ${NM} failed on ${ELF}")
+endif()
+
+set(RAM_TOTAL 270336)  # RP2040: 256 KiB striped SRAM + 2 x 4 KiB scratch
+
+set(lwip_pools "")
+set(lwip_total 0)
+set(lwip_heap 0)
+set(packet_pool 0)
+set(static_ram 0)
+set(heap_start "")
+set(heap_limit "")
+
+string(REPLACE "\n" ";" nm_lines "${nm_out}")
+foreach (line IN LISTS nm_lines)
+    # Linker symbols bounding the malloc heap (address only, no size)
+    if (line MATCHES "^([0-9]+) [A-Za-z] (__end__|__HeapLimit)$")
+        if (CMAKE_MATCH_2 STREQUAL "__end__")
+            math(EXPR heap_start "${CMAKE_MATCH_1}")
+        else()
+            math(EXPR heap_limit "${CMAKE_MATCH_1}")
+        endif()
+        continue()
+    endif()
+    # RAM objects: <address> <size> <b|B|d|D> <name>
+    if (NOT line MATCHES "^[0-9]+ ([0-9]+) ([bBdD]) (.+)$")
+        continue()
+    endif()
+    math(EXPR size "${CMAKE_MATCH_1}")  # nm pads with zeros
+    set(name ${CMAKE_MATCH_3})
+    math(EXPR static_ram "${static_ram} + ${size}")
+
+    if (name MATCHES "^memp_memory_(.+)_base$")
+        list(APPEND lwip_pools "${CMAKE_MATCH_1}=${size}")
+        math(EXPR lwip_total "${lwip_total} + ${size}")
+    elseif (name STREQUAL "ram_heap")
+        set(lwip_heap ${size})
+        math(EXPR lwip_total "${lwip_total} + ${size}")
+    elseif (name MATCHES "^(small|medium|block|bert)_arena$")
+        math(EXPR packet_pool "${packet_pool} + ${size}")
+    endif()
+endforeach()
+
+get_filename_component(image ${ELF} NAME)
+if (NOT PROFILE)
+    set(PROFILE "default")
+endif()
+math(EXPR static_pct "${static_ram} * 100 / ${RAM_TOTAL}")
+
+set(report "Memory budget: ${image} (lwIP profile ${PROFILE})\n")
+list(SORT lwip_pools)
+foreach (pool IN LISTS lwip_pools)
+    string(REPLACE "=" ";" pool_kv "${pool}")
+    list(GET pool_kv 0 pool_name)
+    list(GET pool_kv 1 pool_size)
+    string(APPEND report "  lwip pool ${pool_name} ${pool_size}\n")
+endforeach()
+if (lwip_heap GREATER 0)
+    string(APPEND report "  lwip heap (MEM_SIZE) ${lwip_heap}\n")
+endif()
+string(APPEND report "  lwip total ${lwip_total}\n")
+string(APPEND report "  cs04 packet pool ${packet_pool}\n")
+string(APPEND report
+    "  static RAM ${static_ram}/${RAM_TOTAL} (${static_pct}%)\n")
+if (heap_start AND heap_limit)
+    math(EXPR heap_size "${heap_limit} - ${heap_start}")
+    string(APPEND report "  malloc heap ${heap_size}\n")
+endif()
+
+file(WRITE ${OUT} "${report}")
+message("${report}")
@@ -12,7 +12,18 @@
 // ✅ Include shared libraries
 #include "cs04_coap_reliability.h"
 #include "cs04_coap_packet.h"
+#include "cs04_packet_pool.h"
 #include "cs04_hardware.h"
+#include "cs04_feedback.h"
+#include "cs04_block_window.h"
+#include "cs04_write_behind.h"
+#include "cs04_event_loop.h"
+#include "cs04_append_batch.h"
+#include "cs04_metrics.h"
+#include "cs04_radio.h"
+#include "cs04_boot.h"
+#include "cs04_proxy_cache.h"
+#include "cs04_log.h"
 
 FATFS client_fs;
 
@@ -38,6 +49,13 @@ FATFS client_fs;
 #define RECEIVED_IMAGE_FILENAME \
     "from_server.jpg"    // Default filename for received images
 #define BLOCK_SIZE 1024  // Must match server
+#define BLOCK_TRANSFER_WINDOW 4  // Block2 requests kept in flight at once
+#define CLIENT_REQUEST_BERT 1    // Ask for BERT (SZX 7) multi-unit payloads
+#define UPLOAD_FILENAME "to_server.txt"  // Uploaded by a long press on GP20
+#define UPLOAD_SZX 5                     // Block1 size (512 bytes)
+#define GET_FILENAME "client_received.txt"        // GET /file lands here
+#define GET_IMAGE_FILENAME "client_received.jpg"  // GET /file?type=image
+#define GET_RETRY_S 2  // Retry after a 5.03 that carries no Max-Age
 
 // --- WS2812 Settings ---
 PIO pio_ws2812 = pio0;
@@ -49,6 +67,8 @@ struct udp_pcb *pcb;
 // --- Client State ---
 static coap_buffer_t client_token;  // CoAP token for matching messages
 static uint8_t client_token_data[MAX_TOKEN_LEN];  // Raw CoAP token value
+static coap_buffer_t tail_token;  // Token of the /file Observe registration
+static uint8_t tail_token_data[MAX_TOKEN_LEN];
 
 // Direct SD card file handling
 static FIL file_handle;         // Handle for SD card file operations
@@ -59,6 +79,7 @@ static uint32_t total_bytes_received = 0;  // Track total received
 // Use shared duplicate detector
 static duplicate_detector_t
     client_dup_detector;  // Duplicate detection for CoAP messages
+static uint32_t duplicates_seen = 0;  // Repeated CONs re-ACKed (metrics)
 static bool subscribed =
     false;  // Tracks subscription state for button notifications
 
@@ -66,25 +87,76 @@ static bool subscribed =
 static bool led_state = false;     // Tracks LED status
 static bool buzzer_state = false;  // Tracks buzzer status
 
+// Lines queued for the next iPATCH, and the batch awaiting its ACK
+static append_batch_t append_batch;
+static uint16_t append_msg_id = 0;  // msg_id of the batch in flight (0: none)
+static uint16_t append_sent_lines = 0;  // Lines in that batch
+
 // Additional state for FETCH
-static bool waiting_for_append_response =
-    false;  // Set if waiting for append confirmation
 static bool waiting_for_fetch_response =
     false;  // Set if waiting for fetch confirmation
 
+// Blockwise FETCH state (every block request repeats the query and token)
+typedef struct {
+    char query[32];       // FETCH payload ("start,end")
+    size_t query_len;     // Payload length
+    uint32_t next_block;  // Block number expected next
+    uint32_t bytes;       // Bytes saved so far
+    uint16_t msg_id;      // Request awaiting its response
+} fetch_transfer_state_t;
+
+static fetch_transfer_state_t fetch_state = { 0 };
+static coap_buffer_t fetch_token;  // Fresh token per FETCH query
+static uint8_t fetch_token_data[MAX_TOKEN_LEN];
+
 // Block transfer state
 typedef struct {
     bool transfer_active;           // True if a file block transfer is ongoing
-    uint32_t current_block;         // Block index being fetched
+    block_window_t window;          // Sliding window of in-flight blocks
+    uint8_t szx;                    // Block size exponent in use
+    bool size_agreed;               // First response has fixed szx/stride
+    uint32_t stride;                // Block numbers per response (BERT units)
     char filename[32];              // File name for received content
     FIL file;                       // FATFS file handle for active transfer
+    bool file_opened;               // file is open (first 2.05 arrived)
+    uint8_t etag[COAP_ETAG_MAX];    // ETag of the local copy, then of the
+    uint8_t etag_len;               // version being downloaded (0 if none)
+    bool resuming;                  // Continuing an interrupted download
+    uint32_t start_block;           // Block number window slot 0 maps to
     bool is_image;                  // True if transferring image file
     uint32_t total_bytes_received;  // Progress tracker for received bytes
+    uint32_t max_age_s;             // Server Max-Age of the version received
+    bool unchanged;                 // Server answered 2.03: local copy current
 } block_transfer_state_t;
 
+// Progress of an interrupted download, saved next to the partial file.
+typedef struct {
+    uint32_t next_block;          // First block not on the card
+    uint8_t szx;                  // Block size the numbers refer to
+    uint8_t etag_len;             // ETag of the version being downloaded
+    uint8_t etag[COAP_ETAG_MAX];
+} resume_record_t;
+
 static block_transfer_state_t block_state = {
     0
 };  // Tracks state for current blockwise transfer
+static int get_retry_timer = -1;  // Re-sends a GET /file answered with 5.03
+static bool get_retry_image;      // ... for the image
+
+// Block1 upload state (every block carries upload_token)
+typedef struct {
+    bool active;            // True if an upload is in progress
+    coap_method_t method;   // PUT (replace) or iPATCH (append)
+    FIL file;               // Local file being sent
+    FSIZE_t size;           // Its size
+    uint8_t szx;            // Block size in use
+    bool size_agreed;       // Block 0 acknowledged; window may open
+    block_window_t window;  // Blocks acknowledged so far
+} upload_transfer_state_t;
+
+static upload_transfer_state_t upload_state = { 0 };
+static coap_buffer_t upload_token;
+static uint8_t upload_token_data[MAX_TOKEN_LEN];
 
 
 // --- Function Prototypes ---
@@ -94,10 +166,16 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
 // Request functions
 void request_get_file(bool request_image);
 void request_subscribe_buttons(void);
+void request_subscribe_file(void);
 void request_get_actuators(void);
 void request_put_actuators(const char *payload);
 void request_ipatch_file(const char *line);
+void request_ipatch_flush(void);
 void request_fetch_file(int start_line, int end_line);
+void request_upload_file(const char *filename, coap_method_t method);
+void handle_block1_response(const coap_packet_t *pkt);
+void handle_fetch_response(const coap_packet_t *pkt, const ip_addr_t *addr,
+                           u16_t port);
 void on_client_retransmit_failure(uint16_t msg_id, const ip_addr_t *ip,
                                   u16_t port);
 
@@ -123,7 +201,11 @@ void init_hardware(void)
 
     uint offset = pio_add_program(pio_ws2812, &ws2812_program);
     ws2812_program_init(pio_ws2812, sm_ws2812, offset, LED_PIN, 800000, false);
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(10, 0, 10, 0.1f));
+    hw_led_put(hw_urgb_u32(10, 0, 10, 0.1f));
+
+    // Buzzer moves to PWM; patterns play from a timer from here on
+    feedback_init(pio_ws2812, sm_ws2812, BUZZER_PIN);
+    feedback_set_idle_color(hw_urgb_u32(0, 10, 10, 0.1f));
 
     if (!hw_sd_init(&client_fs)) {
         while (true)
@@ -139,13 +221,187 @@ void init_hardware(void)
     coap_reliability_init();
     coap_duplicate_detector_init(&client_dup_detector);
     coap_generate_token(&client_token, client_token_data, MAX_TOKEN_LEN);
+    coap_generate_token(&tail_token, tail_token_data, MAX_TOKEN_LEN);
     coap_set_retransmit_failure_callback(on_client_retransmit_failure);
 
-    printf("Client initialized with token: ");
+    LOG_INFO("Client initialized with token: ");
     for (int i = 0; i < client_token.len; i++) {
-        printf("%02X", client_token.p[i]);
+        LOG_INFO("%02X", client_token.p[i]);
     }
-    printf("\n");
+    LOG_INFO("\n");
+}
+
+#if CS04_PROXY
+// Books the end of an origin fetch into the proxy cache: a complete new
+// version, a 2.03 for the copy already on the card, or nothing usable.
+static void proxy_upstream_end(bool complete)
+{
+    proxy_resource_t res = block_state.is_image ? PROXY_RES_IMAGE
+                                                : PROXY_RES_FILE;
+    proxy_entry_t *e = proxy_cache_entry(res);
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (complete) {
+        proxy_fill_content(e, block_state.etag, block_state.etag_len,
+                           block_state.total_bytes_received,
+                           block_state.max_age_s, now);
+    } else if (block_state.unchanged) {
+        // The card copy may predate the cache entry (e.g. its size unknown)
+        FILINFO fno;
+        if (!e->cached && f_stat(block_state.filename, &fno) == FR_OK)
+            proxy_cache_restore(res, block_state.etag, block_state.etag_len,
+                                (uint32_t) fno.fsize, now);
+        proxy_fill_valid(e, block_state.max_age_s, now);
+    } else {
+        proxy_fill_failed(e);
+    }
+}
+#endif
+
+// Writes out whatever the write-behind ring still holds and closes the
+// transfer's file. Requests still in flight are cancelled, so a restarted
+// transfer does not share the link with them. Returns the result of the
+// final drain.
+static FRESULT end_block_transfer(void)
+{
+    uint16_t open_ids[BLOCK_WINDOW_MAX];
+    uint8_t open_count = block_state.transfer_active
+                             ? block_window_open_msg_ids(&block_state.window,
+                                                         open_ids)
+                             : 0;
+    for (uint8_t i = 0; i < open_count; i++)
+        coap_cancel_pending_message(open_ids[i]);
+
+    FRESULT fr = FR_OK;
+    bool opened = block_state.file_opened;
+    if (opened) {
+        fr = write_behind_finish();
+        f_close(&block_state.file);
+        block_state.file_opened = false;
+    }
+    block_state.transfer_active = false;
+#if CS04_PROXY
+    proxy_upstream_end(opened && fr == FR_OK &&
+                       block_window_complete(&block_state.window));
+#endif
+    return fr;
+}
+
+// Name of a sidecar file kept next to the received file (".etag" holds the
+// ETag of a complete copy, ".part" the resume record of a partial one).
+static void sidecar_name(char *buf, size_t len, const char *ext)
+{
+    snprintf(buf, len, "%s%s", block_state.filename, ext);
+}
+
+// Removes a sidecar file; a missing one is fine.
+static void sidecar_remove(const char *ext)
+{
+    char name[40];
+    sidecar_name(name, sizeof(name), ext);
+    f_unlink(name);
+}
+
+// Loads the ETag saved with the last complete download, if that file is
+// still on the card. Leaves etag_len 0 otherwise.
+static void load_local_etag(void)
+{
+    block_state.etag_len = 0;
+
+    FILINFO fno;
+    if (f_stat(block_state.filename, &fno) != FR_OK)
+        return;
+
+    char name[40];
+    sidecar_name(name, sizeof(name), ".etag");
+    FIL f;
+    if (f_open(&f, name, FA_READ) != FR_OK)
+        return;
+    UINT br = 0;
+    if (f_read(&f, block_state.etag, sizeof(block_state.etag), &br) == FR_OK)
+        block_state.etag_len = (uint8_t) br;
+    f_close(&f);
+}
+
+// Records the ETag of a download that completed, next to the file.
+static void save_local_etag(void)
+{
+    if (block_state.etag_len == 0)
+        return;
+
+    char name[40];
+    sidecar_name(name, sizeof(name), ".etag");
+    FIL f;
+    if (f_open(&f, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+        return;
+    UINT bw = 0;
+    f_write(&f, block_state.etag, block_state.etag_len, &bw);
+    f_close(&f);
+}
+
+// Picks up an interrupted download of the current file. Only a record whose
+// block count matches the partial file's size, and which has an ETag for the
+// server to check, is used. Returns true if the transfer resumes.
+static bool load_resume_record(void)
+{
+    char name[40];
+    sidecar_name(name, sizeof(name), ".part");
+    FIL f;
+    if (f_open(&f, name, FA_READ) != FR_OK)
+        return false;
+    resume_record_t rec;
+    UINT br = 0;
+    FRESULT fr = f_read(&f, &rec, sizeof(rec), &br);
+    f_close(&f);
+
+    FILINFO fno;
+    if (fr != FR_OK || br != sizeof(rec) || rec.next_block == 0 ||
+        rec.etag_len == 0 || rec.etag_len > COAP_ETAG_MAX ||
+        f_stat(block_state.filename, &fno) != FR_OK ||
+        fno.fsize != (FSIZE_t) rec.next_block *
+                         coap_block_size_from_szx(rec.szx)) {
+        f_unlink(name);
+        return false;
+    }
+
+    block_state.resuming = true;
+    block_state.start_block = rec.next_block;
+    block_state.szx = rec.szx;
+    block_state.etag_len = rec.etag_len;
+    memcpy(block_state.etag, rec.etag, rec.etag_len);
+    block_state.total_bytes_received = (uint32_t) fno.fsize;
+    return true;
+}
+
+// Stops a transfer the server stopped answering. The blocks below the
+// window base are flushed and a resume record is written, so the next
+// request continues from there instead of block 0.
+static void suspend_block_transfer(void)
+{
+    bool resumable = block_state.file_opened && block_state.etag_len > 0;
+    uint32_t block_size = coap_block_size_from_szx(block_state.szx);
+    FRESULT fr = write_behind_finish();
+    FSIZE_t durable = block_state.file_opened ? f_size(&block_state.file) : 0;
+    end_block_transfer();
+
+    if (!resumable || fr != FR_OK || durable == 0)
+        return;
+
+    resume_record_t rec = { 0 };
+    rec.next_block = (uint32_t) (durable / block_size);
+    rec.szx = block_state.szx;
+    rec.etag_len = block_state.etag_len;
+    memcpy(rec.etag, block_state.etag, rec.etag_len);
+
+    char name[40];
+    sidecar_name(name, sizeof(name), ".part");
+    FIL f;
+    if (f_open(&f, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+        return;
+    UINT bw = 0;
+    f_write(&f, &rec, sizeof(rec), &bw);
+    f_close(&f);
+    LOG_DEBUG("  Saved resume point: block %lu (%lu bytes)\n", rec.next_block,
+           (unsigned long) durable);
 }
 
 // Handles retransmission failures. Provides visual and audio feedback on max
@@ -153,85 +409,189 @@ void init_hardware(void)
 void on_client_retransmit_failure(uint16_t msg_id, const ip_addr_t *ip,
                                   u16_t port)
 {
-    printf("⚠️ Client: Max retransmits reached for msg_id 0x%04X\n", msg_id);
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(50, 0, 0, 0.5f));
-    hw_buzz(BUZZER_PIN, 600, 200);
-    sleep_ms(250);
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(10, 0, 10, 0.1f));
+    LOG_WARN("⚠️ Client: Max retransmits reached for msg_id 0x%04X\n", msg_id);
+
+    // A lost block request leaves a hole the window can never close; keep
+    // what arrived before it for the next attempt
+    if (block_state.transfer_active &&
+        block_window_owns_msg_id(&block_state.window, msg_id)) {
+        LOG_ERROR("✗ Aborting block transfer (window base %lu)\n",
+               block_state.window.base);
+        suspend_block_transfer();
+    }
+    // Only the exchange the lost message belongs to is given up
+    if (waiting_for_fetch_response && msg_id == fetch_state.msg_id) {
+        LOG_ERROR("✗ FETCH lost at block %lu\n", fetch_state.next_block);
+        waiting_for_fetch_response = false;
+    }
+    if (upload_state.active &&
+        block_window_owns_msg_id(&upload_state.window, msg_id)) {
+        LOG_ERROR("✗ Aborting upload (block %lu not acknowledged)\n",
+               upload_state.window.base);
+        f_close(&upload_state.file);
+        upload_state.active = false;
+    }
+    if (msg_id == append_msg_id) {
+        LOG_ERROR("✗ Append batch of %u lines lost\n", append_sent_lines);
+        append_msg_id = 0;
+    }
+
+    feedback_play(FEEDBACK_TIMEOUT);
 }
 
-// Issues a CoAP GET request for a blockwise file or image transfer.
-// Initializes block transfer state and prepares output file. Provides feedback.
-void request_get_file(bool request_image)
+// Sends one Block2 GET for the active transfer and arms its retransmission.
+// Stores the request's message ID in *msg_id_out.
+static bool send_block_request(uint32_t block_num, uint16_t *msg_id_out)
 {
     ip_addr_t server_ip;
     ip4addr_aton(COAP_SERVER_IP, &server_ip);
 
-    printf("\n=== Requesting %s from server ===\n",
-           request_image ? "IMAGE" : "FILE");
+    uint16_t msg_id;
 
-    // Initialize block transfer state
-    block_state.transfer_active = true;
-    block_state.current_block = 0;
-    block_state.is_image = request_image;
-    block_state.total_bytes_received = 0;
+    const char *query = block_state.is_image ? "type=image" : NULL;
 
-    // Create filename for received file
-    snprintf(block_state.filename, sizeof(block_state.filename),
-             request_image ? "client_received.jpg" : "client_received.txt");
+    // Encode straight into the pbuf the retransmission queue will hold
+    struct pbuf *p = packet_pool_alloc_pbuf(PACKET_POOL_SMALL_SIZE);
+    if (!p) {
+        LOG_ERROR("✗ Failed to allocate pbuf\n");
+        return false;
+    }
 
-    // Open file for writing
-    FRESULT fr = f_open(&block_state.file, block_state.filename,
-                        FA_CREATE_ALWAYS | FA_WRITE);
-    if (fr != FR_OK) {
-        printf("✗ Failed to create file: %d\n", fr);
-        block_state.transfer_active = false;
-        return;
+    // Block 0 is conditional on the copy we already have; a resumed
+    // download asks that every block still comes from the same version
+    coap_buffer_t etag = { block_state.etag, block_state.etag_len };
+    bool if_match = block_state.resuming && block_state.etag_len > 0;
+    bool conditional = !if_match && block_num == 0 &&
+                       block_state.etag_len > 0;
+
+    size_t buflen = p->len;
+    if (coap_build_get_with_block2(p->payload, &buflen, &client_token, "file",
+                                   query, block_num, block_state.szx,
+                                   if_match ? &etag : NULL,
+                                   conditional ? &etag : NULL,
+                                   &msg_id) != 0) {
+        LOG_ERROR("✗ Failed to build GET request\n");
+        pbuf_free(p);
+        return false;
     }
+    pbuf_realloc(p, (u16_t) buflen);
 
-    // Visual feedback
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(50, 0, 50, 0.5f));
-    hw_buzz(BUZZER_PIN, 1700, 50);
+    bool sent = coap_send_reliable(pcb, msg_id, &server_ip, COAP_SERVER_PORT,
+                                   p);
+    pbuf_free(p);
 
-    // Build GET request using cs04 helper
-    uint8_t buf[128];
-    size_t buflen = sizeof(buf);
-    uint16_t msg_id;
+    if (!sent) {
+        LOG_ERROR("✗ No pending slot for block %lu\n", block_num);
+        return false;
+    }
+
+    LOG_DEBUG("  → Requesting block %lu\n", block_num);
+    *msg_id_out = msg_id;
+    return true;
+}
 
-    const char *query = request_image ? "type=image" : NULL;
+// Tops the transfer window up (BLOCK_TRANSFER_WINDOW, fewer on a weak link).
+// Window slots count responses; with BERT each covers `stride` block numbers.
+static void fill_block_window(void)
+{
+    uint32_t block_size = coap_block_size_from_szx(block_state.szx);
 
-    if (coap_build_get_with_block2(buf, &buflen, &client_token, "file", query,
-                                   0, 6, &msg_id) != 0) {
-        printf("✗ Failed to build GET request\n");
-        f_close(&block_state.file);
-        block_state.transfer_active = false;
-        return;
+    while (block_state.transfer_active &&
+           block_window_can_request(&block_state.window)) {
+        // The block size is settled by the first response, so pipelining
+        // waits for it
+        if (!block_state.size_agreed && block_state.window.next_block > 0)
+            break;
+
+        // Only ask for a block the write-behind ring has room for
+        FSIZE_t end = ((FSIZE_t) block_state.start_block +
+                       (FSIZE_t) (block_state.window.next_block + 1) *
+                           block_state.stride) *
+                      block_size;
+        if (!write_behind_fits(end)) {
+            write_behind_note_stall();
+            break;
+        }
+
+        uint32_t slot = block_window_next_request(&block_state.window);
+        uint16_t msg_id = 0;
+        if (!send_block_request(block_state.start_block +
+                                    slot * block_state.stride,
+                                &msg_id)) {
+            // Retransmission would not cover an unsent request; rewind so the
+            // next received block retries it.
+            block_state.window.next_block = slot;
+            break;
+        }
+        block_window_set_msg_id(&block_state.window, slot, msg_id);
     }
+}
 
-    coap_store_for_retransmit(msg_id, &server_ip, COAP_SERVER_PORT, buf,
-                              buflen);
+// Issues a CoAP GET request for a blockwise file or image transfer.
+// Initializes block transfer state; the output file is only replaced once the
+// server answers with content, so a 2.03 Valid leaves the local copy alone.
+// A download cut short by retransmit failure continues from its resume
+// record. Provides feedback.
+void request_get_file(bool request_image)
+{
+    LOG_INFO("\n=== Requesting %s from server ===\n",
+           request_image ? "IMAGE" : "FILE");
 
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
-    if (!p) {
-        printf("✗ Failed to allocate pbuf\n");
-        f_close(&block_state.file);
-        block_state.transfer_active = false;
+    if (block_state.transfer_active) {
+        LOG_WARN("⚠ Transfer already in progress, ignoring request\n");
         return;
     }
 
-    memcpy(p->payload, buf, buflen);
-    err_t result = udp_sendto(pcb, p, &server_ip, COAP_SERVER_PORT);
-    pbuf_free(p);
+    // Initialize block transfer state
+    block_state.transfer_active = true;
+    block_window_init(&block_state.window,
+                      radio_window(BLOCK_TRANSFER_WINDOW));
+    block_state.szx = CLIENT_REQUEST_BERT ? COAP_BLOCK_SZX_BERT : 6;
+    if (block_state.szx > radio_szx_limit())
+        block_state.szx = radio_szx_limit();
+    block_state.size_agreed = false;
+    block_state.stride = 1;
+    block_state.is_image = request_image;
+    block_state.total_bytes_received = 0;
+    block_state.file_opened = false;
+    block_state.resuming = false;
+    block_state.start_block = 0;
+    block_state.max_age_s = COAP_DEFAULT_MAX_AGE_S;
+    block_state.unchanged = false;
 
-    if (result == ERR_OK) {
-        printf("✓ GET /file request sent (block 0)\n");
-        sleep_ms(80);
-        ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 10, 10, 0.1f));
+    // Create filename for received file
+    snprintf(block_state.filename, sizeof(block_state.filename), "%s",
+             request_image ? GET_IMAGE_FILENAME : GET_FILENAME);
+#if CS04_PROXY
+    proxy_fill_started(proxy_cache_entry(request_image ? PROXY_RES_IMAGE
+                                                       : PROXY_RES_FILE));
+#endif
+
+    if (load_resume_record()) {
+        LOG_INFO("  Resuming at block %lu (%lu bytes on card)\n",
+               block_state.start_block, block_state.total_bytes_received);
     } else {
-        printf("✗ udp_sendto failed: %d\n", result);
-        f_close(&block_state.file);
-        block_state.transfer_active = false;
+        load_local_etag();
+        if (block_state.etag_len > 0)
+            LOG_INFO("  Have local copy, asking only if it changed\n");
+    }
+    write_behind_init(&block_state.file, block_state.total_bytes_received);
+
+    // Visual feedback
+    hw_led_status(hw_urgb_u32(50, 0, 50, 0.5f));
+    hw_buzz(BUZZER_PIN, 1700, 50);
+
+    fill_block_window();
+
+    if (block_state.window.next_block == 0) {
+        end_block_transfer();
+        return;
     }
+
+    LOG_INFO("✓ GET /file requests sent (blocks %lu-%lu)\n",
+           block_state.start_block,
+           block_state.start_block + block_state.window.next_block - 1);
+    hw_led_status(hw_urgb_u32(0, 10, 10, 0.1f));
 }
 
 // Requests a subscription to button notifications via CoAP Observe.
@@ -241,9 +601,8 @@ void request_subscribe_buttons(void)
     ip_addr_t server_ip;
     ip4addr_aton(COAP_SERVER_IP, &server_ip);
 
-    printf("\n=== Subscribing to /buttons (Observe) ===\n");
+    LOG_INFO("\n=== Subscribing to /buttons (Observe) ===\n");
 
-    uint8_t buf[128];
     coap_packet_t pkt = { 0 };
     pkt.hdr.ver = 1;
     pkt.hdr.t = COAP_TYPE_CON;
@@ -259,32 +618,63 @@ void request_subscribe_buttons(void)
     coap_add_option(&pkt, COAP_OPTION_OBSERVE, obs_buf, 1);
     coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) "buttons", 7);
 
-    size_t buflen = sizeof(buf);
-    if (coap_build(buf, &buflen, &pkt) != COAP_ERR_NONE) {
-        printf("✗ Failed to build subscribe packet\n");
+    struct pbuf *p = coap_build_pbuf(&pkt);
+    if (!p) {
+        LOG_ERROR("✗ Failed to build subscribe packet\n");
         return;
     }
 
-    coap_store_for_retransmit(msg_id, &server_ip, COAP_SERVER_PORT, buf,
-                              buflen);
+    bool sent = coap_send_reliable(pcb, msg_id, &server_ip, COAP_SERVER_PORT,
+                                   p);
+    pbuf_free(p);
+
+    if (sent) {
+        LOG_INFO("✓ Subscribe request sent with msg_id 0x%04X\n", msg_id);
+        subscribed = true;
+        hw_led_status(hw_urgb_u32(0, 0, 10, 0.1f));
+    } else {
+        LOG_ERROR("✗ No pending slot for subscribe request\n");
+    }
+}
+
+// Observes /file so lines appended on the server are pushed instead of
+// polled with FETCH. Uses its own token to tell these notifications apart.
+void request_subscribe_file(void)
+{
+    ip_addr_t server_ip;
+    ip4addr_aton(COAP_SERVER_IP, &server_ip);
+
+    LOG_INFO("\n=== Subscribing to /file (Observe) ===\n");
+
+    coap_packet_t pkt = { 0 };
+    pkt.hdr.ver = 1;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.tkl = tail_token.len;
+    pkt.hdr.code = COAP_METHOD_GET;
+
+    uint16_t msg_id = coap_generate_msg_id();
+    pkt.hdr.id[0] = (uint8_t) (msg_id >> 8);
+    pkt.hdr.id[1] = (uint8_t) (msg_id & 0xFF);
+    pkt.tok = tail_token;
+
+    static uint8_t obs_buf[1] = { 0 };
+    coap_add_option(&pkt, COAP_OPTION_OBSERVE, obs_buf, 1);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) "file", 4);
 
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
+    struct pbuf *p = coap_build_pbuf(&pkt);
     if (!p) {
-        printf("✗ Failed to allocate pbuf\n");
+        LOG_ERROR("✗ Failed to build subscribe packet\n");
         return;
     }
 
-    memcpy(p->payload, buf, buflen);
-    err_t result = udp_sendto(pcb, p, &server_ip, COAP_SERVER_PORT);
+    bool sent = coap_send_reliable(pcb, msg_id, &server_ip, COAP_SERVER_PORT,
+                                   p);
     pbuf_free(p);
 
-    if (result == ERR_OK) {
-        printf("✓ Subscribe request sent with msg_id 0x%04X\n", msg_id);
-        subscribed = true;
-        ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 0, 10, 0.1f));
-    } else {
-        printf("✗ udp_sendto failed: %d\n", result);
-    }
+    if (sent)
+        LOG_INFO("✓ /file subscribe request sent with msg_id 0x%04X\n", msg_id);
+    else
+        LOG_ERROR("✗ No pending slot for subscribe request\n");
 }
 
 // Requests the current status of actuators from the server.
@@ -292,14 +682,14 @@ void request_get_actuators(void)
 {
     ip_addr_t server_ip;
     ip4addr_aton(COAP_SERVER_IP, &server_ip);
-    printf("\n=== Sending GET /actuators ===\n");
+    LOG_INFO("\n=== Sending GET /actuators ===\n");
 
     uint16_t msg_id = coap_send_con_request(pcb, &server_ip, COAP_SERVER_PORT,
                                             COAP_METHOD_GET, "actuators",
                                             &client_token, NULL, 0, true);
 
     if (msg_id) {
-        printf("✓ GET request sent with msg_id 0x%04X\n", msg_id);
+        LOG_INFO("✓ GET request sent with msg_id 0x%04X\n", msg_id);
     }
 }
 
@@ -308,43 +698,203 @@ void request_put_actuators(const char *payload)
 {
     ip_addr_t server_ip;
     ip4addr_aton(COAP_SERVER_IP, &server_ip);
-    printf("\n=== Sending PUT /actuators ===\n");
-    printf("Payload: %s\n", payload);
+    LOG_INFO("\n=== Sending PUT /actuators ===\n");
+    LOG_INFO("Payload: %s\n", payload);
 
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(50, 50, 0, 0.5f));
-    hw_buzz(BUZZER_PIN, 1200, 50);
+    feedback_play(FEEDBACK_PUT_REQUEST);
 
     uint16_t msg_id = coap_send_con_request(
         pcb, &server_ip, COAP_SERVER_PORT, COAP_METHOD_PUT, "actuators",
         &client_token, (const uint8_t *) payload, strlen(payload), true);
 
     if (msg_id) {
-        printf("✓ PUT request sent with msg_id 0x%04X\n", msg_id);
-        sleep_ms(80);
-        ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 10, 10, 0.1f));
+        LOG_INFO("✓ PUT request sent with msg_id 0x%04X\n", msg_id);
     }
 }
 
-// Sends an iPATCH request to append a line to the file on the server.
-void request_ipatch_file(const char *line)
+// Sends the queued lines as one iPATCH /file; the server appends them as a
+// unit and answers with the number of lines written.
+void request_ipatch_flush(void)
 {
+    if (append_batch.lines == 0)
+        return;
+
     ip_addr_t server_ip;
     ip4addr_aton(COAP_SERVER_IP, &server_ip);
-    printf("\n=== Sending iPATCH /file (APPEND) ===\n");
-    printf("Line to append: %s\n", line);
+    LOG_INFO("\n=== Sending iPATCH /file (APPEND %u lines, %u bytes) ===\n",
+           append_batch.lines, append_batch.len);
 
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(50, 20, 0, 0.5f));
-    hw_buzz(BUZZER_PIN, 1400, 50);
-
-    waiting_for_append_response = true;
+    feedback_play(FEEDBACK_IPATCH_REQUEST);
 
+    // The payload is copied into the request pbuf, so the batch can refill
     uint16_t msg_id = coap_send_con_request(
         pcb, &server_ip, COAP_SERVER_PORT, COAP_METHOD_iPATCH, "file",
-        &client_token, (const uint8_t *) line, strlen(line), true);
+        &client_token, append_batch.data, append_batch.len, true);
+
+    if (msg_id) {
+        LOG_INFO("✓ iPATCH request sent with msg_id 0x%04X\n", msg_id);
+        append_msg_id = msg_id;
+        append_sent_lines = append_batch.lines;
+        append_batch_clear(&append_batch);
+    }
+}
+
+// Queues a line to append to the file on the server. Lines go out in
+// batches once APPEND_BATCH_LINES are queued or APPEND_BATCH_MS has passed.
+void request_ipatch_file(const char *line)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    LOG_INFO("Line to append: %s\n", line);
+
+    if (append_batch_add(&append_batch, line, strlen(line), now))
+        return;
+
+    // Batch full: send it now and start the next one with this line
+    if (append_msg_id == 0) {
+        request_ipatch_flush();
+        if (append_batch_add(&append_batch, line, strlen(line), now))
+            return;
+    }
+    LOG_WARN("⚠️ Append batch full, line dropped\n");
+}
+
+// Ends the upload and closes the local file.
+static void end_upload(void)
+{
+    f_close(&upload_state.file);
+    upload_state.active = false;
+}
+
+// Starts (or restarts at a new block size) the upload window. The last
+// block is known from the file size, so the window never runs past it.
+static void reset_upload_window(uint8_t szx)
+{
+    upload_state.szx = szx;
+    upload_state.size_agreed = false;
+    block_window_init(&upload_state.window,
+                      radio_window(BLOCK_TRANSFER_WINDOW));
+    uint32_t size = coap_block_size_from_szx(szx);
+    upload_state.window.last_block =
+        upload_state.size ? (uint32_t) ((upload_state.size - 1) / size) : 0;
+}
+
+// Reads one block of the local file and sends it with Block1. The window
+// keeps the request's message ID.
+static bool send_upload_block(uint32_t block_num)
+{
+    static uint8_t block_buf[1024];  // Copied into the request pbuf
+    uint32_t size = coap_block_size_from_szx(upload_state.szx);
+    UINT n = 0;
+    FRESULT fr = f_lseek(&upload_state.file, (FSIZE_t) block_num * size);
+    if (fr == FR_OK)
+        fr = f_read(&upload_state.file, block_buf, size, &n);
+    if (fr != FR_OK) {
+        LOG_ERROR("✗ Failed to read upload block %lu: %d\n", block_num, fr);
+        return false;
+    }
 
+    ip_addr_t server_ip;
+    ip4addr_aton(COAP_SERVER_IP, &server_ip);
+    bool more = block_num < upload_state.window.last_block;
+    uint16_t msg_id = coap_send_block1_request(
+        pcb, &server_ip, COAP_SERVER_PORT, upload_state.method, "file",
+        &upload_token, block_num, more, upload_state.szx, block_buf, n, true);
     if (msg_id) {
-        printf("✓ iPATCH request sent with msg_id 0x%04X\n", msg_id);
+        block_window_set_msg_id(&upload_state.window, block_num, msg_id);
+        LOG_DEBUG("📤 Upload block %lu%s sent (%u bytes)\n", block_num,
+               more ? "" : " (last)", n);
+    }
+    return msg_id != 0;
+}
+
+// Keeps the window of blocks in flight (BLOCK_TRANSFER_WINDOW, fewer on a
+// weak link). Only block 0 goes out until the server has accepted the block
+// size.
+static void fill_upload_window(void)
+{
+    while (upload_state.active &&
+           block_window_can_request(&upload_state.window) &&
+           (upload_state.size_agreed || upload_state.window.next_block == 0)) {
+        uint32_t block_num = block_window_next_request(&upload_state.window);
+        if (!send_upload_block(block_num)) {
+            end_upload();
+            feedback_play(FEEDBACK_ERROR);
+        }
+    }
+}
+
+// Uploads a local file with Block1: PUT replaces the server's file, iPATCH
+// appends it. Blocks are pipelined like Block2 downloads.
+void request_upload_file(const char *filename, coap_method_t method)
+{
+    if (upload_state.active) {
+        LOG_WARN("⚠️ Upload already in progress\n");
+        return;
+    }
+
+    FRESULT fr = f_open(&upload_state.file, filename, FA_READ);
+    if (fr != FR_OK) {
+        LOG_ERROR("✗ Cannot open %s for upload: %d\n", filename, fr);
+        feedback_play(FEEDBACK_ERROR);
+        return;
+    }
+
+    upload_state.active = true;
+    upload_state.method = method;
+    upload_state.size = f_size(&upload_state.file);
+    reset_upload_window(UPLOAD_SZX);
+    coap_generate_token(&upload_token, upload_token_data, MAX_TOKEN_LEN);
+
+    LOG_INFO("\n=== Uploading %s (%lu bytes, %lu blocks) with %s ===\n",
+           filename, (uint32_t) upload_state.size,
+           upload_state.window.last_block + 1,
+           method == COAP_METHOD_PUT ? "PUT" : "iPATCH");
+    feedback_play(FEEDBACK_IPATCH_REQUEST);
+    fill_upload_window();
+}
+
+// Handles the server's answer to an upload block: 2.31 Continue frees a
+// window slot, 2.04 ends the upload, and a 4.13 on block 0 names the block
+// size to retry with.
+void handle_block1_response(const coap_packet_t *pkt)
+{
+    uint32_t block_num = 0;
+    bool more = false;
+    uint8_t szx = upload_state.szx;
+    uint8_t count = 0;
+    const coap_option_t *block1_opt = coap_findOptions(
+        pkt, COAP_OPTION_BLOCK1, &count);
+    if (block1_opt && count > 0)
+        coap_parse_block1_option(block1_opt, &block_num, &more, &szx);
+
+    if (pkt->hdr.code == COAP_RSPCODE_CONTINUE) {
+        block_window_on_block(&upload_state.window, block_num, true, false);
+        upload_state.size_agreed = true;
+        fill_upload_window();
+        return;
     }
+
+    if (pkt->hdr.code == COAP_RSPCODE_CHANGED) {
+        LOG_INFO("✓ Upload complete: %.*s\n", pkt->payload.len,
+               pkt->payload.p);
+        end_upload();
+        hw_play_append_success_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+        return;
+    }
+
+    if (pkt->hdr.code == COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE &&
+        !upload_state.size_agreed && szx < upload_state.szx) {
+        LOG_WARN("⚠️ Server wants %lu-byte blocks, restarting upload\n",
+               coap_block_size_from_szx(szx));
+        reset_upload_window(szx);
+        fill_upload_window();
+        return;
+    }
+
+    LOG_ERROR("✗ Upload failed at block %lu: %d.%02d\n", block_num,
+           (pkt->hdr.code >> 5) & 0x7, pkt->hdr.code & 0x1F);
+    end_upload();
+    feedback_play(FEEDBACK_ERROR);
 }
 
 // Sends a FETCH request for lines within a file.
@@ -353,117 +903,502 @@ void request_fetch_file(int start_line, int end_line)
     ip_addr_t server_ip;
     ip4addr_aton(COAP_SERVER_IP, &server_ip);
 
-    printf("Sending FETCH /file (requesting lines %d to %d)\n", start_line,
+    LOG_INFO("Sending FETCH /file (requesting lines %d to %d)\n", start_line,
            end_line);
 
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 20, 50, 0.5f));
-    hw_buzz(BUZZER_PIN, 1600, 50);
+    feedback_play(FEEDBACK_FETCH_REQUEST);
 
     waiting_for_fetch_response = true;
 
-    char payload[32];
-    snprintf(payload, sizeof(payload), "%d,%d", start_line,
+    // New token per query: the server keys its resume cursor on it
+    coap_generate_token(&fetch_token, fetch_token_data, MAX_TOKEN_LEN);
+
+    char *payload = fetch_state.query;
+    snprintf(payload, sizeof(fetch_state.query), "%d,%d", start_line,
              end_line);  // ✅ "5,10"
+    fetch_state.query_len = strlen(payload);
+    fetch_state.next_block = 0;
+    fetch_state.bytes = 0;
 
     uint16_t msg_id = coap_send_fetch_request(
-        pcb, &server_ip, COAP_SERVER_PORT, "file", &client_token,
-        (const uint8_t *) payload, strlen(payload), COAP_CONTENTTYPE_TEXT_PLAIN,
-        true);
+        pcb, &server_ip, COAP_SERVER_PORT, "file", &fetch_token,
+        (const uint8_t *) payload, fetch_state.query_len,
+        COAP_CONTENTTYPE_TEXT_PLAIN, true);
+    fetch_state.msg_id = msg_id;
 
     if (msg_id) {
-        printf("FETCH request sent with msg_id 0x%04X\n", msg_id);
-        printf("Payload: %s (lines %d-%d)\n", payload, start_line, end_line);
+        LOG_INFO("FETCH request sent with msg_id 0x%04X\n", msg_id);
+        LOG_INFO("Payload: %s (lines %d-%d)\n", payload, start_line, end_line);
     } else {
-        printf("FETCH request failed to send\n");
+        LOG_ERROR("FETCH request failed to send\n");
         waiting_for_fetch_response = false;
     }
 }
 
+// Handles a FETCH response. Blockwise results are appended to
+// from_server_fetch.txt one block at a time and the next block is requested
+// with the same query and token until the server clears the M bit.
+void handle_fetch_response(const coap_packet_t *pkt, const ip_addr_t *addr,
+                           u16_t port)
+{
+    if (pkt->hdr.code != COAP_RSPCODE_CONTENT) {
+        LOG_ERROR("✗ FETCH failed: %d.%02d\n", (pkt->hdr.code >> 5) & 0x7,
+               pkt->hdr.code & 0x1F);
+        waiting_for_fetch_response = false;
+        feedback_play(FEEDBACK_ERROR);
+        return;
+    }
+
+    uint32_t block_num = 0;
+    uint8_t szx = 6;
+    bool more = false;
+    uint8_t count = 0;
+    const coap_option_t *block2_opt = coap_findOptions(
+        pkt, COAP_OPTION_BLOCK2, &count);
+    if (block2_opt && count > 0) {
+        coap_parse_block2_option(block2_opt, &block_num, &more, &szx);
+    } else if (pkt->payload.len == 0) {
+        LOG_WARN("⚠️ Empty FETCH response\n");
+        waiting_for_fetch_response = false;
+        return;
+    }
+
+    if (block_num != fetch_state.next_block) {
+        LOG_WARN("⚠️ Ignoring FETCH block %lu (expecting %lu)\n", block_num,
+               fetch_state.next_block);
+        return;
+    }
+
+    LOG_DEBUG("✓ Received FETCH response block %lu (%d bytes, more=%d)\n",
+           block_num, pkt->payload.len, more);
+
+    // Open file for writing: truncate on the first block, then append
+    FIL fetch_file_handle;
+    BYTE mode = FA_WRITE | (block_num == 0 ? FA_CREATE_ALWAYS : FA_OPEN_APPEND);
+    FRESULT fr = f_open(&fetch_file_handle, "from_server_fetch.txt", mode);
+    if (fr != FR_OK) {
+        LOG_ERROR("✗ Failed to save file: %d\n", fr);
+        waiting_for_fetch_response = false;
+        // Error feedback - Red
+        feedback_play(FEEDBACK_ERROR);
+        return;
+    }
+
+    UINT bw = 0;
+    f_write(&fetch_file_handle, pkt->payload.p, pkt->payload.len, &bw);
+    f_close(&fetch_file_handle);
+    fetch_state.bytes += bw;
+    fetch_state.next_block = block_num + 1;
+
+    if (more) {
+        uint16_t msg_id = coap_send_fetch_block_request(
+            pcb, addr, port, "file", &fetch_token,
+            (const uint8_t *) fetch_state.query, fetch_state.query_len,
+            COAP_CONTENTTYPE_TEXT_PLAIN, fetch_state.next_block, szx, true);
+        fetch_state.msg_id = msg_id;
+        if (!msg_id) {
+            LOG_ERROR("✗ Failed to request FETCH block %lu\n",
+                   fetch_state.next_block);
+            waiting_for_fetch_response = false;
+        }
+        return;
+    }
+
+    waiting_for_fetch_response = false;
+    LOG_INFO("✓ Saved %lu bytes to from_server_fetch.txt\n", fetch_state.bytes);
+
+    // Success feedback - Cyan triple blink (matching original)
+    hw_play_fetch_success_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+}
+
 // Handles the reception and processing of a Block2 file transfer response.
-// Writes received block to SD card. If more blocks remain, requests next block.
+// Blocks may arrive out of order; each is written at its own offset and the
+// window is refilled so the pipeline stays full until the last block.
 void handle_block2_response(const coap_packet_t *pkt, const ip_addr_t *addr,
                             u16_t port)
 {
     if (!block_state.transfer_active)
         return;
 
+    // Our copy is current: nothing was written, keep the file as it is
+    if (pkt->hdr.code == COAP_RSPCODE_VALID) {
+        LOG_INFO("✓ %s unchanged on server, kept local copy\n",
+               block_state.filename);
+        block_state.unchanged = true;
+        block_state.max_age_s = coap_get_max_age(pkt);
+        end_block_transfer();
+        hw_play_file_complete_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+        return;
+    }
+
+    // The file changed since the interrupted download: the partial copy is
+    // useless, start over from block 0
+    if (pkt->hdr.code == COAP_RSPCODE_PRECONDITION_FAILED) {
+        LOG_WARN("⚠ %s changed on server, restarting download\n",
+               block_state.filename);
+        end_block_transfer();
+        sidecar_remove(".part");
+        request_get_file(block_state.is_image);
+        return;
+    }
+
+    // Not available yet (a proxy still fetching from its origin): keep what
+    // arrived and ask again once the Max-Age it sent is up
+    if (pkt->hdr.code == COAP_RSPCODE_SERVICE_UNAVAILABLE) {
+        uint8_t max_age_count = 0;
+        uint32_t wait_s = coap_findOptions(pkt, COAP_OPTION_MAX_AGE,
+                                           &max_age_count)
+                              ? coap_get_max_age(pkt)
+                              : GET_RETRY_S;
+        LOG_WARN("⚠ %s not available yet, retrying in %lu s\n",
+               block_state.filename, (unsigned long) wait_s);
+        suspend_block_transfer();
+        get_retry_image = block_state.is_image;
+        event_timer_arm(get_retry_timer,
+                        to_ms_since_boot(get_absolute_time()) +
+                            wait_s * 1000);
+        return;
+    }
+
     // Parse Block2 option
     uint8_t count = 0;
     const coap_option_t *block2_opt = coap_findOptions(pkt, COAP_OPTION_BLOCK2,
                                                        &count);
 
-    if (!block2_opt || count == 0) {
-        printf("⚠ No Block2 option in response\n");
+    uint32_t block_num = 0;
+    bool more = false;
+    uint8_t szx = 0;
+    if (!block2_opt || count == 0 ||
+        !coap_parse_block2_option(block2_opt, &block_num, &more, &szx)) {
+        LOG_WARN("⚠ No Block2 option in response\n");
+        return;
+    }
+
+    LOG_DEBUG("  Received block %lu, MORE=%d, SZX=%d (%u bytes)\n", block_num,
+           more, szx, pkt->payload.len);
+
+    // The first response settles the size: the server may have clamped our
+    // SZX, or answered SZX 7 with several units per payload
+    if (!block_state.size_agreed) {
+        block_state.szx = szx;
+        block_state.stride = more ? coap_block_units(szx, pkt->payload.len)
+                                  : 1;
+        block_state.size_agreed = true;
+        block_state.max_age_s = coap_get_max_age(pkt);
+        LOG_DEBUG("  Block size agreed: SZX %u, %lu block(s) per response\n",
+               szx, block_state.stride);
+
+        // A resumed download must continue exactly where the card ends
+        if (block_state.resuming &&
+            (FSIZE_t) block_num * coap_block_size_from_szx(szx) !=
+                block_state.total_bytes_received) {
+            LOG_WARN("⚠ Server block size changed, restarting download\n");
+            end_block_transfer();
+            sidecar_remove(".part");
+            request_get_file(block_state.is_image);
+            return;
+        }
+
+        // New content replaces the local copy, and drops its ETag until the
+        // download completes; a resumed one is appended to
+        FRESULT fr = f_open(&block_state.file, block_state.filename,
+                            block_state.resuming
+                                ? FA_OPEN_APPEND | FA_WRITE
+                                : FA_CREATE_ALWAYS | FA_WRITE);
+        if (fr != FR_OK) {
+            LOG_ERROR("✗ Failed to create file: %d\n", fr);
+            end_block_transfer();
+            feedback_play(FEEDBACK_ERROR);
+            return;
+        }
+        block_state.file_opened = true;
+        sidecar_remove(".etag");
+#if CS04_PROXY
+        proxy_fill_replacing(proxy_cache_entry(
+            block_state.is_image ? PROXY_RES_IMAGE : PROXY_RES_FILE));
+#endif
+
+        if (!block_state.resuming) {
+            sidecar_remove(".part");
+            const coap_option_t *etag_opt = coap_findOptions(
+                pkt, COAP_OPTION_ETAG, &count);
+            block_state.etag_len = 0;
+            if (etag_opt && count > 0 && etag_opt->buf.len <= COAP_ETAG_MAX) {
+                block_state.etag_len = (uint8_t) etag_opt->buf.len;
+                memcpy(block_state.etag, etag_opt->buf.p,
+                       block_state.etag_len);
+            }
+        }
+    }
+    if (szx != block_state.szx || block_num < block_state.start_block ||
+        (block_num - block_state.start_block) % block_state.stride != 0) {
+        LOG_WARN("⚠ Block %lu (SZX %u) does not match the agreed size\n",
+               block_num, szx);
         return;
     }
 
-    // Decode Block2 value
-    uint32_t block_val = 0;
-    for (size_t i = 0; i < block2_opt->buf.len; i++) {
-        block_val = (block_val << 8) | block2_opt->buf.p[i];
+    block_window_result_t res = block_window_on_block(
+        &block_state.window,
+        (block_num - block_state.start_block) / block_state.stride, more,
+        pkt->payload.len == 0);
+
+    uint32_t block_size = coap_block_size_from_szx(szx);
+    if (res == BLOCK_WINDOW_ACCEPTED && pkt->payload.len > 0) {
+        // Copy into RAM only; the main loop drains it to the card
+        if (!write_behind_put((FSIZE_t) block_num * block_size,
+                              pkt->payload.p, pkt->payload.len)) {
+            LOG_ERROR("✗ No write-behind room for block %lu\n", block_num);
+            end_block_transfer();
+            return;
+        }
+
+        block_state.total_bytes_received += pkt->payload.len;
+    } else if (res == BLOCK_WINDOW_DUPLICATE) {
+        LOG_DEBUG("  Block %lu already received, ignoring\n", block_num);
     }
 
-    uint32_t block_num = block_val >> 4;
-    bool more = (block_val & 0x08) != 0;
-    uint8_t szx = block_val & 0x07;
+    if (block_window_complete(&block_state.window)) {
+        // Every block is in; only the last one may be short
+        write_behind_commit(block_state.total_bytes_received);
+        FRESULT fr = end_block_transfer();
+        if (fr != FR_OK) {
+            LOG_ERROR("✗ File write error: %d\n", fr);
+            feedback_play(FEEDBACK_ERROR);
+            return;
+        }
 
-    printf("  Received block %lu, MORE=%d, SZX=%d (%u bytes)\n", block_num,
-           more, szx, pkt->payload.len);
+        save_local_etag();
+        sidecar_remove(".part");
 
-    // Write payload to file
-    UINT bytes_written;
-    FRESULT fr = f_write(&block_state.file, pkt->payload.p, pkt->payload.len,
-                         &bytes_written);
+        const write_behind_stats_t *wb = write_behind_get_stats();
+        LOG_INFO("✓ File transfer complete! Saved to %s (%lu bytes)\n",
+               block_state.filename, block_state.total_bytes_received);
+        LOG_DEBUG("  Write-behind: %lu writes, peak %u bytes, %lu stalls\n",
+               wb->writes, (unsigned) wb->high_water, wb->stalls);
+
+        // Visual feedback
+        hw_play_file_complete_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
 
-    if (fr != FR_OK || bytes_written != pkt->payload.len) {
-        printf("✗ File write error: %d\n", fr);
-        f_close(&block_state.file);
-        block_state.transfer_active = false;
         return;
     }
 
-    block_state.total_bytes_received += bytes_written;
+    write_behind_commit(((FSIZE_t) block_state.start_block +
+                         (FSIZE_t) block_state.window.base *
+                             block_state.stride) *
+                        block_size);
+    fill_block_window();
+}
 
-    if (more) {
-        // Request next block using cs04 helper
-        block_state.current_block = block_num + 1;
+// Idle work for an active Block2 transfer: drains the write-behind ring and
+// sends any block requests that were waiting for room in it.
+static void service_block_transfer(void)
+{
+    if (!block_state.transfer_active)
+        return;
+
+    FRESULT fr = write_behind_poll();
+    if (fr != FR_OK) {
+        LOG_ERROR("✗ File write error: %d\n", fr);
+        end_block_transfer();
+        feedback_play(FEEDBACK_ERROR);
+        return;
+    }
+    fill_block_window();
+}
+
+#if CS04_PROXY
+// --- Caching forward proxy (RFC 7252 section 5.7) ---
+// Downstream clients GET /file from us, or name the origin's URI in
+// Proxy-Uri. Blocks come from the copy GET /file left on the card; while
+// that copy is missing or stale, one origin fetch runs and requests are
+// answered 5.03 with a Max-Age saying when to retry.
 
-        ip_addr_t server_ip;
-        ip4addr_aton(COAP_SERVER_IP, &server_ip);
+// Card file a cached resource lives in.
+static const char *proxy_filename(proxy_resource_t res)
+{
+    return res == PROXY_RES_IMAGE ? GET_IMAGE_FILENAME : GET_FILENAME;
+}
 
-        uint8_t buf[128];
-        size_t buflen = sizeof(buf);
-        uint16_t msg_id;
+// Sends a response to a downstream request: piggybacked on the ACK of a CON,
+// as a NON of its own for a NON.
+static void proxy_send(coap_packet_t *resp, const coap_packet_t *req,
+                       const ip_addr_t *addr, u16_t port)
+{
+    if (req->hdr.t == COAP_TYPE_NONCON) {
+        uint16_t msg_id = coap_generate_msg_id();
+        resp->hdr.t = COAP_TYPE_NONCON;
+        resp->hdr.id[0] = (uint8_t) (msg_id >> 8);
+        resp->hdr.id[1] = (uint8_t) (msg_id & 0xFF);
+    }
 
-        const char *query = block_state.is_image ? "type=image" : NULL;
+    struct pbuf *q = coap_build_pbuf(resp);
+    if (!q) {
+        LOG_ERROR("✗ Failed to build proxy response\n");
+        return;
+    }
+    coap_send_pbuf(pcb, q, addr, port);
+    pbuf_free(q);
+}
 
-        if (coap_build_get_with_block2(buf, &buflen, &client_token, "file",
-                                       query, block_state.current_block, szx,
-                                       &msg_id) == 0) {
-            coap_store_for_retransmit(msg_id, &server_ip, COAP_SERVER_PORT, buf,
-                                      buflen);
+// Answers with a bare response code, plus Max-Age if max_age_s is non-zero.
+static void proxy_send_code(const coap_packet_t *req, const ip_addr_t *addr,
+                            u16_t port, uint8_t code, uint32_t max_age_s)
+{
+    static uint8_t scratch_buf[16];
+    coap_rw_buffer_t scratch = { scratch_buf, sizeof(scratch_buf) };
+    coap_packet_t resp = { 0 };
+    coap_make_response(&scratch, &resp, NULL, 0, req->hdr.id[0],
+                       req->hdr.id[1], &req->tok, (coap_responsecode_t) code,
+                       COAP_CONTENTTYPE_NONE);
+    if (max_age_s > 0)
+        coap_add_max_age(&resp, max_age_s);
+    proxy_send(&resp, req, addr, port);
+}
 
-            struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
-            if (p) {
-                memcpy(p->payload, buf, buflen);
-                udp_sendto(pcb, p, &server_ip, COAP_SERVER_PORT);
-                pbuf_free(p);
-                printf("  → Requesting block %lu\n", block_state.current_block);
-            }
+// Sends one block of the cached copy, read from the card. A block past the
+// end comes back empty with M=0, as the origin answers it.
+static void proxy_serve_block(const coap_packet_t *req, const ip_addr_t *addr,
+                              u16_t port, proxy_resource_t res,
+                              proxy_entry_t *e, uint32_t block_num,
+                              uint8_t szx, uint32_t now)
+{
+    static uint8_t block_buf[1 << (PROXY_MAX_SZX + 4)];
+    uint32_t block_size = coap_block_size_from_szx(szx);
+    FSIZE_t offset = (FSIZE_t) block_num * block_size;
+
+    UINT br = 0;
+    if (offset < e->size) {
+        FIL f;
+        FRESULT fr = f_open(&f, proxy_filename(res), FA_READ);
+        if (fr == FR_OK) {
+            fr = f_lseek(&f, offset);
+            if (fr == FR_OK)
+                fr = f_read(&f, block_buf, block_size, &br);
+            f_close(&f);
         }
-    } else {
-        // Transfer complete
-        f_close(&block_state.file);
-        printf("✓ File transfer complete! Saved to %s (%lu bytes)\n",
-               block_state.filename, block_state.total_bytes_received);
+        if (fr != FR_OK) {
+            // The copy is unreadable: revalidate, which rewrites it
+            LOG_ERROR("✗ Proxy: read of %s failed: %d\n", proxy_filename(res),
+                   fr);
+            proxy_cache_invalidate(res, now);
+            proxy_send_code(req, addr, port,
+                            COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                            PROXY_RETRY_AFTER_S);
+            return;
+        }
+    }
 
-        // Visual feedback
-        // play_file_complete_signal();
-        hw_play_file_complete_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+    bool more = offset + br < e->size;
+    coap_buffer_t etag = { e->etag, e->etag_len };
+    coap_packet_t resp = { 0 };
+    coap_build_block2_response(NULL, &resp, req, req->hdr.id[0],
+                               req->hdr.id[1], block_num, more, szx,
+                               block_buf, br,
+                               res == PROXY_RES_IMAGE ? 42 : 0,
+                               e->etag_len ? &etag : NULL);
+    coap_add_max_age(&resp, proxy_max_age_left(e, now));
+    proxy_send(&resp, req, addr, port);
+    LOG_DEFER("  Proxy: served %s block %lu (%u bytes)\n", proxy_filename(res),
+              block_num, (unsigned) br);
+}
+
+// Answers a request from a downstream client.
+static void proxy_handle_request(const coap_packet_t *req,
+                                 const ip_addr_t *addr, u16_t port)
+{
+    uint8_t count = 0;
+    bool forward = coap_findOptions(req, COAP_OPTION_PROXY_URI, &count);
+    proxy_resource_t res = proxy_resource_for(req, COAP_SERVER_IP);
+    if (res == PROXY_RES_NONE) {
+        // Proxy-Uri for anything but the origin's /file: not proxied
+        proxy_note_refused();
+        proxy_send_code(req, addr, port,
+                        forward ? PROXY_RSPCODE_NOT_SUPPORTED
+                                : COAP_RSPCODE_NOT_FOUND,
+                        0);
+        return;
+    }
+    if (req->hdr.code != COAP_METHOD_GET) {
+        proxy_note_refused();
+        proxy_send_code(req, addr, port, PROXY_RSPCODE_METHOD_NOT_ALLOWED, 0);
+        return;
+    }
+
+    // No Block2 asks for block 0; BERT is answered with one plain block
+    uint32_t block_num = 0;
+    bool more = false;
+    uint8_t szx = PROXY_MAX_SZX;
+    const coap_option_t *block2_opt = coap_findOptions(req, COAP_OPTION_BLOCK2,
+                                                       &count);
+    if (block2_opt && count > 0 &&
+        !coap_parse_block2_option(block2_opt, &block_num, &more, &szx)) {
+        proxy_send_code(req, addr, port, COAP_RSPCODE_BAD_REQUEST, 0);
+        return;
+    }
+    if (szx > PROXY_MAX_SZX)
+        szx = PROXY_MAX_SZX;
+
+    const coap_option_t *opt = coap_findOptions(req, COAP_OPTION_ETAG, &count);
+    const coap_buffer_t *etag = opt && count > 0 ? &opt->buf : NULL;
+    opt = coap_findOptions(req, COAP_OPTION_IF_MATCH, &count);
+    const coap_buffer_t *if_match = opt && count > 0 && opt->buf.len > 0
+                                        ? &opt->buf
+                                        : NULL;
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    proxy_entry_t *e = proxy_cache_entry(res);
+    uint32_t peer = ip4_addr_get_u32(ip_2_ip4(addr));
+    switch (proxy_lookup(e, peer, port, block_num, etag, if_match, now)) {
+    case PROXY_FILL:
+        // One origin transfer at a time; the other resource waits its turn
+        if (!block_state.transfer_active) {
+            LOG_INFO("Proxy: fetching %s from origin\n", proxy_filename(res));
+            request_get_file(res == PROXY_RES_IMAGE);
+        }
+        // fall through
+    case PROXY_WAIT:
+        proxy_send_code(req, addr, port, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                        PROXY_RETRY_AFTER_S);
+        break;
+    case PROXY_MISMATCH:
+        proxy_send_code(req, addr, port, COAP_RSPCODE_PRECONDITION_FAILED, 0);
+        break;
+    case PROXY_VALID: {
+        coap_buffer_t cached = { e->etag, e->etag_len };
+        coap_packet_t resp = { 0 };
+        coap_build_valid_response(&resp, req, req->hdr.id[0], req->hdr.id[1],
+                                  &cached);
+        coap_add_max_age(&resp, proxy_max_age_left(e, now));
+        proxy_send(&resp, req, addr, port);
+        break;
+    }
+    case PROXY_SERVE:
+        proxy_serve_block(req, addr, port, res, e, block_num, szx, now);
+        break;
+    }
+}
 
-        block_state.transfer_active = false;
+// Picks up the complete copies an earlier run left on the card (those with
+// an ETag sidecar). They start stale, so the first request revalidates them
+// and the origin only answers 2.03 if nothing changed.
+static void proxy_prime_from_card(void)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    for (int r = 0; r < PROXY_RES_COUNT; r++) {
+        snprintf(block_state.filename, sizeof(block_state.filename), "%s",
+                 proxy_filename((proxy_resource_t) r));
+        load_local_etag();
+        FILINFO fno;
+        if (block_state.etag_len == 0 ||
+            f_stat(block_state.filename, &fno) != FR_OK)
+            continue;
+        proxy_cache_restore((proxy_resource_t) r, block_state.etag,
+                            block_state.etag_len, (uint32_t) fno.fsize, now);
+        LOG_INFO("Proxy: %s on card (%lu bytes), revalidated on first use\n",
+                 block_state.filename, (unsigned long) fno.fsize);
     }
 }
+#endif
 
 // UDP receive callback – processes all incoming packets.
 // Parses packet type (ACK, notification, block transfer, etc.) and handles
@@ -471,13 +1406,16 @@ void handle_block2_response(const coap_packet_t *pkt, const ip_addr_t *addr,
 void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                        const ip_addr_t *addr, u16_t port)
 {
-    printf("\n--- UDP packet received from %s:%d (%d bytes) ---\n",
-           ip4addr_ntoa(addr), port, p->len);
+    LOG_DEBUG("\n--- UDP packet received from %s:%d (%d bytes) ---\n",
+           ip4addr_ntoa(addr), port, p->tot_len);
 
+    // Fragmented BERT responses arrive reassembled as a pbuf chain; their
+    // payload is gathered here, everything else is parsed in place
+    static uint8_t rx_gather[COAP_RX_GATHER_MAX];
     coap_packet_t pkt = { 0 };
-    int parse_rc = coap_parse(&pkt, (const uint8_t *) p->payload, p->len);
+    int parse_rc = coap_parse_pbuf(&pkt, p, rx_gather, sizeof(rx_gather));
     if (parse_rc != 0) {
-        printf("Parse failed! Error=%d\n", parse_rc);
+        LOG_WARN("Parse failed! Error=%d\n", parse_rc);
         pbuf_free(p);
         return;
     }
@@ -485,27 +1423,52 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
     // Handle ACK responses
     if (pkt.hdr.t == COAP_TYPE_ACK) {
         uint16_t msg_id = coap_extract_msg_id(&pkt);
-        printf("✓ Received ACK for msg_id 0x%04X\n", msg_id);
-        printf("  Response code: %d.%02d\n", (pkt.hdr.code >> 5) & 0x7,
+        LOG_DEFER("✓ Received ACK for msg_id 0x%04X\n", msg_id);
+        LOG_DEBUG("  Response code: %d.%02d\n", (pkt.hdr.code >> 5) & 0x7,
                pkt.hdr.code & 0x1F);
-        printf("  Payload length: %d bytes\n", pkt.payload.len);
-        printf("  Token length: %d bytes\n", pkt.tok.len);
+        LOG_DEBUG("  Payload length: %d bytes\n", pkt.payload.len);
+        LOG_DEBUG("  Token length: %d bytes\n", pkt.tok.len);
         if (pkt.tok.len > 0) {
-            printf("  Token: ");
+            LOG_DEBUG("  Token: ");
             for (int i = 0; i < pkt.tok.len; i++) {
-                printf("%02X", pkt.tok.p[i]);
+                LOG_DEBUG("%02X", pkt.tok.p[i]);
             }
-            printf("\n");
+            LOG_DEBUG("\n");
         }
         coap_clear_pending_message(msg_id);
 
-        // Check if this is a Block2 response for active transfer
-        if (block_state.transfer_active && pkt.payload.len > 0) {
+        // Handle FETCH response - check token FIRST
+        bool fetch_match = (pkt.tok.len == fetch_token.len &&
+                            memcmp(pkt.tok.p, fetch_token.p,
+                                   fetch_token.len) == 0);
+        if (fetch_match && waiting_for_fetch_response) {
+            handle_fetch_response(&pkt, addr, port);
+            pbuf_free(p);
+            return;
+        }
+
+        if (upload_state.active && coap_token_matches(&pkt.tok,
+                                                      &upload_token)) {
+            handle_block1_response(&pkt);
+            pbuf_free(p);
+            return;
+        }
+
+        // Check if this is a Block2 response for active transfer (an empty
+        // final block marks a speculative request past the end of the file).
+        // Only answers to the window's own requests count: a late answer
+        // from a transfer that was restarted or suspended is not taken for
+        // a block of the current one.
+        if (block_state.transfer_active &&
+            block_window_owns_msg_id(&block_state.window, msg_id)) {
             uint8_t block2_count = 0;
             const coap_option_t *block2_opt = coap_findOptions(
                 &pkt, COAP_OPTION_BLOCK2, &block2_count);
 
-            if (block2_opt && block2_count > 0) {
+            if ((block2_opt && block2_count > 0) ||
+                pkt.hdr.code == COAP_RSPCODE_VALID ||
+                pkt.hdr.code == COAP_RSPCODE_PRECONDITION_FAILED ||
+                pkt.hdr.code == COAP_RSPCODE_SERVICE_UNAVAILABLE) {
                 handle_block2_response(&pkt, addr, port);
                 pbuf_free(p);
                 return;
@@ -520,61 +1483,39 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
             const coap_option_t *obs_opt = coap_findOptions(
                 &pkt, COAP_OPTION_OBSERVE, &obs_count);
             if (obs_opt) {
-                printf("✓ Subscription ACK received!\n");
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(0, 10, 10, 0.1f));
+                LOG_INFO("✓ Subscription ACK received!\n");
+                hw_led_status(hw_urgb_u32(0, 10, 10, 0.1f));
             }
         }
 
-        // Handle iPATCH response
-        if (waiting_for_append_response) {
-            printf("✓ Received append confirmation\n");
-            waiting_for_append_response = false;
-
-            // Success feedback - Green double blink (matching original pattern)
-            hw_play_append_success_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
-
+        // /file registration: no lines, the file is read with GET/FETCH
+        if (coap_token_matches(&pkt.tok, &tail_token)) {
+            if (pkt.hdr.code == COAP_RSPCODE_CONTENT)
+                LOG_INFO("✓ /file subscription ACK received!\n");
+            else
+                LOG_ERROR("✗ /file subscription refused: %d.%02d\n",
+                       (pkt.hdr.code >> 5) & 0x7, pkt.hdr.code & 0x1F);
             pbuf_free(p);
             return;
         }
 
-        // Handle FETCH response - check token FIRST
-        bool token_match = (pkt.tok.len == client_token.len &&
-                            memcmp(pkt.tok.p, client_token.p,
-                                   client_token.len) == 0);
-
-        // Process FETCH response regardless of waiting flag if token matches
-        // and payload exists
-        if (token_match && pkt.payload.len > 0 && waiting_for_fetch_response) {
-            printf("✓ Received FETCH response (%d bytes)\n", pkt.payload.len);
-            waiting_for_fetch_response = false;
-
-            // Open file for writing
-            FIL fetch_file_handle;
-            FRESULT fr = f_open(&fetch_file_handle, "from_server_fetch.txt",
-                                FA_WRITE | FA_CREATE_ALWAYS);
-            if (fr == FR_OK) {
-                UINT bw = 0;
-                f_write(&fetch_file_handle, pkt.payload.p, pkt.payload.len,
-                        &bw);
-                f_close(&fetch_file_handle);
-                printf("✓ Saved %d bytes to from_server_fetch.txt\n", bw);
+        // Handle iPATCH response: "Appended <n>" for the batch in flight
+        if (append_msg_id != 0 && msg_id == append_msg_id) {
+            append_msg_id = 0;
+            if (pkt.hdr.code != COAP_RSPCODE_CHANGED) {
+                LOG_ERROR("✗ Append of %u lines failed: %d.%02d\n",
+                       append_sent_lines, (pkt.hdr.code >> 5) & 0x7,
+                       pkt.hdr.code & 0x1F);
+                feedback_play(FEEDBACK_ERROR);
+                pbuf_free(p);
+                return;
+            }
+            LOG_INFO("✓ Received append confirmation: %.*s (%u lines sent)\n",
+                   pkt.payload.len, pkt.payload.p, append_sent_lines);
 
-                // Success feedback - Cyan triple blink (matching original)
-                hw_play_fetch_success_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+            // Success feedback - Green double blink (matching original pattern)
+            hw_play_append_success_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
 
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(0, 10, 10, 0.1f));
-            } else {
-                printf("✗ Failed to save file: %d\n", fr);
-                // Error feedback - Red
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(50, 0, 0, 0.5f));
-                hw_buzz(BUZZER_PIN, 400, 100);
-                sleep_ms(100);
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(0, 10, 10, 0.1f));
-            }
             pbuf_free(p);
             return;
         }
@@ -582,11 +1523,11 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
         // Handle GET /actuators response
         if (pkt.hdr.code >= COAP_RSPCODE_CONTENT &&
             pkt.hdr.code < COAP_RSPCODE_BAD_REQUEST) {
-            printf("✓ Success response code: %d.%02d\n",
+            LOG_DEBUG("✓ Success response code: %d.%02d\n",
                    (pkt.hdr.code >> 5) & 0x7, pkt.hdr.code & 0x1F);
 
             if (pkt.payload.len > 0) {
-                printf("📥 Response payload (%d bytes): %.*s\n",
+                LOG_DEBUG("📥 Response payload (%d bytes): %.*s\n",
                        pkt.payload.len, pkt.payload.len, pkt.payload.p);
 
                 // Parse LED state
@@ -603,7 +1544,7 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                 }
             }
         } else if (pkt.hdr.code >= COAP_RSPCODE_BAD_REQUEST) {
-            printf("⚠️ Error response code: %d.%02d\n",
+            LOG_WARN("⚠️ Error response code: %d.%02d\n",
                    (pkt.hdr.code >> 5) & 0x7, pkt.hdr.code & 0x1F);
         }
 
@@ -611,14 +1552,26 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
         return;
     }
 
-    // Handle CON notifications
-    if (pkt.hdr.t == COAP_TYPE_CON) {
+    // Handle CON and NON notifications (NON ones are not ACKed)
+    if (pkt.hdr.t == COAP_TYPE_CON || pkt.hdr.t == COAP_TYPE_NONCON) {
+#if CS04_PROXY
+        // Requests come from downstream clients; only the origin's
+        // notifications carry on below
+        if (pkt.hdr.code != 0 && (pkt.hdr.code >> 5) == 0) {
+            proxy_handle_request(&pkt, addr, port);
+            pbuf_free(p);
+            return;
+        }
+#endif
+
         uint16_t msg_id = coap_extract_msg_id(&pkt);
-        printf("Received CON notification (msg_id: 0x%04X)\n", msg_id);
+        LOG_DEBUG("Received %s notification (msg_id: 0x%04X)\n",
+               pkt.hdr.t == COAP_TYPE_CON ? "CON" : "NON", msg_id);
 
         // Duplicate detection with re-ACK
         if (coap_is_duplicate_message(&client_dup_detector, msg_id)) {
-            printf("⚠️ Duplicate notification (0x%04X), resending ACK\n",
+            duplicates_seen++;
+            LOG_WARN("⚠️ Duplicate notification (0x%04X), resending ACK\n",
                    msg_id);
 
             // Check if this is a block transfer
@@ -645,7 +1598,30 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
 
         if (obs_opt && obs_count > 0) {
             uint32_t observe_seq = coap_get_option_uint(&obs_opt->buf);
-            printf("📬 Observe notification (seq=%lu)\n", observe_seq);
+            LOG_DEBUG("📬 Observe notification (seq=%lu)\n", observe_seq);
+        }
+
+        // /file: the lines appended since the last notification, or none
+        // if the server could not keep them (catch up with FETCH)
+        if (coap_token_matches(&pkt.tok, &tail_token)) {
+            if (pkt.payload.len > 0) {
+                LOG_INFO("📥 Appended on server (%d bytes):\n%.*s",
+                       pkt.payload.len, (int) pkt.payload.len,
+                       (char *) pkt.payload.p);
+                feedback_play(FEEDBACK_NOTIFY_BYTE);
+            } else {
+                LOG_WARN("⚠️ /file changed; lines were not pushed, FETCH to "
+                       "catch up\n");
+            }
+#if CS04_PROXY
+            // The cached text is out of date; the next transfer revalidates
+            proxy_cache_invalidate(PROXY_RES_FILE,
+                                   to_ms_since_boot(get_absolute_time()));
+#endif
+            if (pkt.hdr.t == COAP_TYPE_CON)
+                coap_send_ack(pcb, addr, port, &pkt, NULL, 0);
+            pbuf_free(p);
+            return;
         }
 
         uint8_t block_count = 0;
@@ -658,13 +1634,11 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
             uint32_t block_num = (block_val >> 4);
             bool more = (block_val & 0x08);
 
-            printf("📥 Received file block #%lu (%d bytes)\n", block_num,
+            LOG_DEFER("📥 Received file block #%lu (%d bytes)\n", block_num,
                    pkt.payload.len);
 
-            // Short buzz feedback per block
-            hw_buzz(BUZZER_PIN, 1500, 30);
-            ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                             hw_urgb_u32(0, 50, 0, 0.5f));
+            // Short tick per block (dropped while a pattern plays)
+            feedback_play(FEEDBACK_BLOCK);
 
             // Check if this is block 0 (first block or restart)
             if (block_num == 0) {
@@ -679,7 +1653,7 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                         uint32_t cf_val = coap_get_option_uint(&cf_opt->buf);
                         if (cf_val == 22) {  // 22 = image/jpeg
                             filename = RECEIVED_IMAGE_FILENAME;
-                            printf("📷 Receiving JPEG image\n");
+                            LOG_DEBUG("📷 Receiving JPEG image\n");
                         }
                     }
 
@@ -690,9 +1664,9 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                         file_open = true;
                         last_block_num = 0;
                         total_bytes_received = 0;
-                        printf("Created new file: %s\n", filename);
+                        LOG_DEBUG("Created new file: %s\n", filename);
                     } else {
-                        printf("Failed to create file: %d\n", fr);
+                        LOG_ERROR("Failed to create file: %d\n", fr);
                         pbuf_free(p);
                         return;
                     }
@@ -703,17 +1677,16 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
             if (file_open && block_num > 0) {
                 if (block_num < last_block_num) {
                     // Duplicate - acknowledge it
-                    printf(
+                    LOG_WARN(
                         "⚠️ Duplicate block %lu (expected %lu), sending ACK\n",
                         block_num, last_block_num);
                     coap_send_block_ack(pcb, addr, port, &pkt, block2_opt);
-                    ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                     hw_urgb_u32(0, 10, 10, 0.1f));
+                    hw_led_status(hw_urgb_u32(0, 10, 10, 0.1f));
                     pbuf_free(p);
                     return;
                 } else if (block_num > last_block_num) {
                     // Gap - reject without ACK
-                    printf("⚠️ Block gap: expected %lu, got %lu\n",
+                    LOG_WARN("⚠️ Block gap: expected %lu, got %lu\n",
                            last_block_num, block_num);
                     pbuf_free(p);
                     return;
@@ -732,7 +1705,7 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                 f_write(&file_handle, pkt.payload.p, pkt.payload.len, &bw);
                 total_bytes_received += bw;
 
-                printf("✓ Wrote block %lu (%d bytes) directly to SD\n",
+                LOG_DEFER("✓ Wrote block %lu (%d bytes) directly to SD\n",
                        block_num, bw);
 
                 // Increment only if this is the expected block
@@ -746,7 +1719,7 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                 sleep_ms(10);
 
                 if (!more) {
-                    printf("✓ File transfer complete! Total bytes: %lu\n",
+                    LOG_INFO("✓ File transfer complete! Total bytes: %lu\n",
                            total_bytes_received);
                     f_close(&file_handle);
                     file_open = false;
@@ -757,43 +1730,28 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                     // play_file_complete_signal();
                     hw_play_file_complete_signal(pio_ws2812, sm_ws2812,
                                                  BUZZER_PIN);
-                } else {
-                    ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                     hw_urgb_u32(0, 10, 10, 0.1f));
                 }
             }
         } else {
             // Non-block notification
             if (pkt.payload.len == 1) {
                 // Byte notification from Button 1
-                printf("📥 Received byte notification: 0x%02X\n",
+                LOG_INFO("📥 Received byte notification: 0x%02X\n",
                        pkt.payload.p[0]);
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(0, 50, 0, 0.5f));
-                hw_buzz(BUZZER_PIN, 1500, 60);
+                feedback_play(FEEDBACK_NOTIFY_BYTE);
                 coap_send_ack(pcb, addr, port, &pkt, pkt.payload.p, 1);
-                sleep_ms(80);
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(0, 10, 10, 0.1f));
             } else if (pkt.payload.len > 1) {
                 // Button state update from Button 2 or 3
-                printf("📥 Button state update (%d bytes): %.*s\n",
+                LOG_INFO("📥 Button state update (%d bytes): %.*s\n",
                        pkt.payload.len, (int) pkt.payload.len,
                        (char *) pkt.payload.p);
 
 
                 // Visual feedback
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(50, 50, 0, 0.5f));
-                // play_string_signal();
                 hw_play_string_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
 
                 coap_send_ack(pcb, addr, port, &pkt, pkt.payload.p,
                               pkt.payload.len);
-
-                sleep_ms(100);
-                ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                                 hw_urgb_u32(0, 10, 10, 0.1f));
             }
         }
 
@@ -804,11 +1762,67 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
     pbuf_free(p);
 }
 
+// Event loop timer: retransmits due CON messages.
+static void on_retransmit_timer(uint32_t now)
+{
+    (void) now;
+    coap_check_retransmissions(pcb);
+}
+
+// Wakes the loop when the oldest queued append line is due.
+static void on_append_timer(uint32_t now)
+{
+    (void) now;
+}
+
+// Retries a GET /file the server answered with 5.03.
+static void on_get_retry_timer(uint32_t now)
+{
+    (void) now;
+    request_get_file(get_retry_image);
+}
+
+// Prints the client's counters in the server's /metrics format.
+static void on_metrics_timer(uint32_t now)
+{
+    static char report[METRICS_REPORT_MAX];
+    metrics_writer_t w;
+    metrics_begin(&w, report, sizeof(report));
+    metrics_line(&w, "uptime ms=%lu\n", (unsigned long) now);
+    metrics_put_common(&w);
+    metrics_line(&w, "dup repeated=%lu\n", (unsigned long) duplicates_seen);
+
+    const write_behind_stats_t *wb = write_behind_get_stats();
+    metrics_line(&w, "write_behind writes=%lu bytes=%lu stalls=%lu hw=%u\n",
+                 (unsigned long) wb->writes, (unsigned long) wb->bytes,
+                 (unsigned long) wb->stalls, (unsigned) wb->high_water);
+    metrics_put_latency(&w, "write_behind f_write", &wb->latency);
+#if CS04_PROXY
+    const proxy_stats_t *ps = proxy_cache_get_stats();
+    metrics_line(&w,
+                 "proxy hits=%lu validated=%lu misses=%lu waits=%lu "
+                 "refused=%lu restarted=%lu\n",
+                 (unsigned long) ps->hits, (unsigned long) ps->validated,
+                 (unsigned long) ps->misses, (unsigned long) ps->waits,
+                 (unsigned long) ps->refused, (unsigned long) ps->restarted);
+    metrics_line(&w, "proxy origin content=%lu valid=%lu failed=%lu\n",
+                 (unsigned long) ps->origin_content,
+                 (unsigned long) ps->origin_valid,
+                 (unsigned long) ps->origin_failed);
+#endif
+    LOG_INFO("\n=== Metrics ===\n%s", report);
+}
+
 bool init_udp_client()
 {
     pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb)
         return false;
+#if CS04_PROXY
+    // Downstream clients expect the proxy on the CoAP port
+    if (udp_bind(pcb, IP_ADDR_ANY, COAP_SERVER_PORT) != ERR_OK)
+        return false;
+#endif
     udp_recv(pcb, udp_recv_callback, NULL);
     return true;
 }
@@ -817,104 +1831,134 @@ bool init_udp_client()
 int main()
 {
     stdio_init_all();
-    printf("\n=== CoAP Client (FIXED - Direct SD Write) ===\n");
+    LOG_INFO("\n=== CoAP Client (FIXED - Direct SD Write) ===\n");
 
     if (cyw43_arch_init()) {
-        printf("Wi-Fi init failed\n");
+        LOG_ERROR("Wi-Fi init failed\n");
         return 1;
     }
 
-    cyw43_arch_enable_sta_mode();
-    printf("Connecting to Wi-Fi (%s)...\n", WIFI_SSID);
-
-    while (1) {
-        if (cyw43_arch_wifi_connect_timeout_ms(
-                WIFI_SSID, WIFI_PASS, CYW43_AUTH_WPA2_AES_PSK, 30000) == 0) {
-            printf("✓ Wi-Fi connected!\n");
-            break;
-        }
-        printf("Wi-Fi connect failed, retrying...\n");
-        sleep_ms(2000);
-    }
-
+    // Associate in the background; the SD card mounts meanwhile
+    boot_wifi_begin(WIFI_SSID, WIFI_PASS);
     init_hardware();
+#if CS04_PROXY
+    proxy_cache_init();
+    proxy_prime_from_card();
+#endif
+    boot_mark_storage_ready();
 
     if (!init_udp_client()) {
-        printf("UDP client init failed\n");
+        LOG_ERROR("UDP client init failed\n");
         return 1;
     }
 
-    printf("✓ CoAP client initialized\n");
-    printf("Server: %s:%d\n", COAP_SERVER_IP, COAP_SERVER_PORT);
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(10, 0, 10, 0.1f));
+    boot_wifi_wait(NULL, NULL, NULL);  // DHCP
+    radio_init();
 
-    // Auto-subscribe on startup
-    sleep_ms(1000);
-    printf("\n📡 Auto-subscribing to /buttons...\n");
-    request_subscribe_buttons();
+    LOG_INFO("✓ CoAP client initialized\n");
+    LOG_INFO("Server: %s:%d\n", COAP_SERVER_IP, COAP_SERVER_PORT);
+#if CS04_PROXY
+    LOG_INFO("Proxy: serving cached /file on port %d\n", COAP_SERVER_PORT);
+#endif
+    hw_led_status(hw_urgb_u32(10, 0, 10, 0.1f));
 
-    button_t btn_toggle, btn_append, btn_fetch;
-    hw_button_init(&btn_toggle, BUTTON_PUT_PIN);
-    hw_button_init(&btn_append, BUTTON_APPEND_PIN);
-    hw_button_init(&btn_fetch, BUTTON_FETCH_PIN);
+    // Auto-subscribe as soon as the link is up
+    LOG_INFO("\n📡 Auto-subscribing to /buttons...\n");
+    request_subscribe_buttons();
+    LOG_INFO("📡 Auto-subscribing to /file...\n");
+    request_subscribe_file();
 
-    printf("\n=== Controls ===\n");
-    printf("GP21: Toggle LED/BUZZER\n");
-    printf("GP20: APPEND to file\n");
-    printf("GP22 (short): FETCH from file\n");
-    printf("GP22 (long):  GET /file (request transfer)\n\n");
+    LOG_INFO("\n=== Controls ===\n");
+    LOG_INFO("GP21: Toggle LED/BUZZER\n");
+    LOG_INFO("GP20 (short): APPEND to file\n");
+    LOG_INFO("GP20 (long):  Upload %s (Block1 iPATCH)\n", UPLOAD_FILENAME);
+    LOG_INFO("GP22 (short): FETCH from file\n");
+    LOG_INFO("GP22 (long):  GET /file (request transfer)\n\n");
 
     bool toggle_action = false;
-    uint32_t fetch_press_start = 0;
     static bool file_type_toggle = false;  // Track text vs image requests
 
+    // Wake on packets, the next retransmission and button edges instead of
+    // polling every 20 ms
+    event_loop_init();
+    int retransmit_timer = event_timer_add(on_retransmit_timer, 0);
+    int append_timer = event_timer_add(on_append_timer, 0);
+    event_timer_add(on_metrics_timer, METRICS_DUMP_MS);
+    get_retry_timer = event_timer_add(on_get_retry_timer, 0);
+    append_batch_clear(&append_batch);
+    const uint button_pins[] = { BUTTON_PUT_PIN, BUTTON_APPEND_PIN,
+                                 BUTTON_FETCH_PIN };
+    hw_buttons_init(button_pins, count_of(button_pins));
+
     while (true) {
         cyw43_arch_poll();
-        coap_check_retransmissions(pcb);
-
-        if (hw_button_pressed(&btn_toggle)) {
-            if (toggle_action) {
-                printf("💡 LED ON, BUZZER ON\n");
-                request_put_actuators("LED=ON,BUZZER=ON");
-            } else {
-                printf("💡 LED OFF\n");
-                request_put_actuators("LED=OFF");
-            }
-            toggle_action = !toggle_action;
+        service_block_transfer();
+
+        // Radio awake while blocks are moving, power-save once idle
+        radio_poll(to_ms_since_boot(get_absolute_time()),
+                   block_state.transfer_active || upload_state.active);
+
+        // Handling packets may have stored or cleared retransmissions
+        uint32_t retry_at;
+        if (coap_next_retransmit_deadline(&retry_at))
+            event_timer_arm(retransmit_timer, retry_at);
+        else
+            event_timer_cancel(retransmit_timer);
+
+        // One batch in flight at a time; the next waits for its ACK
+        if (append_batch.lines > 0) {
+            uint32_t now = to_ms_since_boot(get_absolute_time());
+            if (!append_batch_due(&append_batch, now))
+                event_timer_arm(append_timer,
+                                append_batch.first_ms + APPEND_BATCH_MS);
+            else if (append_msg_id == 0)
+                request_ipatch_flush();
         }
 
-        if (hw_button_pressed(&btn_append)) {
-            printf("📝 Appending to file...\n");
-            static int append_count = 0;
-            char line[64];
-            snprintf(line, sizeof(line), "Client append #%d", ++append_count);
-            request_ipatch_file(line);
-        }
+        // Print deferred packet-path messages before sleeping
+        log_drain(LOG_CORES * LOG_RING_SIZE);
 
-        // Modified FETCH button handler with long-press detection
-        if (gpio_get(BUTTON_FETCH_PIN) == 0) {  // Button pressed (active low)
-            if (fetch_press_start == 0) {
-                fetch_press_start = to_ms_since_boot(get_absolute_time());
-            }
-        } else if (fetch_press_start > 0) {  // Button released
-            uint32_t press_duration = to_ms_since_boot(get_absolute_time()) -
-                                      fetch_press_start;
+        if (!(event_loop_wait() & EVENT_BUTTON))
+            continue;
 
-            if (press_duration > 1000) {  // Long press (>1 second)
-                printf("📥 Long press: Requesting %s from server\n",
+        // The IRQ debounces and times each press; long presses are those
+        // held HW_BUTTON_LONG_MS or more
+        hw_button_event_t ev;
+        while (hw_button_event_get(&ev)) {
+            if (ev.pin == BUTTON_PUT_PIN && ev.kind == HW_BUTTON_PRESS) {
+                if (toggle_action) {
+                    LOG_INFO("💡 LED ON, BUZZER ON\n");
+                    request_put_actuators("LED=ON,BUZZER=ON");
+                } else {
+                    LOG_INFO("💡 LED OFF\n");
+                    request_put_actuators("LED=OFF");
+                }
+                toggle_action = !toggle_action;
+            } else if (ev.pin == BUTTON_APPEND_PIN &&
+                       ev.kind == HW_BUTTON_LONG) {
+                LOG_INFO("📤 Long press: Uploading %s\n", UPLOAD_FILENAME);
+                request_upload_file(UPLOAD_FILENAME, COAP_METHOD_iPATCH);
+            } else if (ev.pin == BUTTON_APPEND_PIN &&
+                       ev.kind == HW_BUTTON_SHORT) {
+                LOG_INFO("📝 Appending to file...\n");
+                static int append_count = 0;
+                char line[64];
+                snprintf(line, sizeof(line), "Client append #%d",
+                         ++append_count);
+                request_ipatch_file(line);
+            } else if (ev.pin == BUTTON_FETCH_PIN &&
+                       ev.kind == HW_BUTTON_LONG) {
+                LOG_INFO("📥 Long press: Requesting %s from server\n",
                        file_type_toggle ? "IMAGE" : "FILE");
                 request_get_file(file_type_toggle);
                 file_type_toggle =
                     !file_type_toggle;  // Alternate between text and image
-            } else if (press_duration > 50) {  // Short press (debounced)
-                printf("📖 Short press: Fetching from file...\n");
+            } else if (ev.pin == BUTTON_FETCH_PIN &&
+                       ev.kind == HW_BUTTON_SHORT) {
+                LOG_INFO("📖 Short press: Fetching from file...\n");
                 request_fetch_file(5, 100);
             }
-
-            fetch_press_start = 0;
         }
-
-        sleep_ms(20);
     }
 
 
@@ -9,11 +9,44 @@
 #include "ws2812.h"
 #include "ff.h"
 #include "sd_card.h"
+#include "hw_config.h"
+#include <stddef.h>
+#include <limits.h>
 
 // ✅ Include shared libraries
 #include "cs04_coap_reliability.h"
 #include "cs04_coap_packet.h"
+#include "cs04_packet_pool.h"
+#include "cs04_block_size.h"
+#include "cs04_exchange_cache.h"
+#include "cs04_dispatch.h"
+#include "cs04_notify.h"
+#include "cs04_payload_template.h"
+#include "cs04_cbor.h"
+#include "cs04_subscribers.h"
+#include "cs04_file_tail.h"
 #include "cs04_hardware.h"
+#include "cs04_feedback.h"
+#include "cs04_file_cache.h"
+#include "cs04_prefetch.h"
+#include "cs04_hot_cache.h"
+#include "cs04_transfer_session.h"
+#include "cs04_line_index.h"
+#include "cs04_fetch_cursor.h"
+#include "cs04_append_journal.h"
+#include "cs04_append_batch.h"
+#include "cs04_upload_session.h"
+#include "cs04_storage_worker.h"
+#include "cs04_event_loop.h"
+#include "cs04_trace.h"
+#include "cs04_metrics.h"
+#include "cs04_radio.h"
+#include "cs04_boot.h"
+#include "cs04_log.h"
+
+#if (16 << UPLOAD_SZX_MAX) > STORAGE_REQUEST_DATA
+#error "A Block1 block must fit in a storage request"
+#endif
 
 FATFS server_fs;
 
@@ -30,18 +63,24 @@ FATFS server_fs;
 
 // --- CoAP Settings ---
 #define COAP_SERVER_PORT 5683  // UDP listening port for CoAP server
-#define MAX_SUBSCRIBERS 5  // Max simultaneous button notification subscribers
-#define MAX_TOKEN_LEN 8    // Maximum supported CoAP token length
 
 // --- Reliability Settings ---
-#define SUBSCRIBER_TIMEOUT_MS \
-    (3 * 60 * 60 * 1000)     // Timeout for dead subscribers (ms)
-#define TIMEOUT_THRESHOLD 3  // Max consecutive missed ACKs before pruning
+#define STORAGE_IDLE_MS 100     // Idle storage tick (read-ahead, journal)
 
 // --- File Transfer Settings ---
 #define FILE_TO_SEND "server.txt"
 #define BLOCK_SIZE 1024
+#define SERVER_BERT_ENABLED 1  // Answer SZX 7 requests with BERT payloads
 #define IMAGE_TO_SEND "server.jpg"
+#define FILE_ETAG_LEN 4  // Bytes of the /file ETag (a 32-bit hash)
+
+// CBOR (Content-Format 60) keys of /actuators and /buttons maps; values are
+// booleans. PUT takes one map or an array of up to ACTUATOR_BATCH_MAX maps.
+#define CBOR_KEY_LED 0
+#define CBOR_KEY_BUZZER 1     // true beeps once
+#define CBOR_KEY_BTN1 1       // Buttons are keys 1..3
+#define ACTUATOR_BATCH_MAX 8  // Commands in one CBOR PUT
+#define STATE_CBOR_LEN 8      // Encoded state map (at most 7 bytes)
 
 // --- Network Static IP Configuration ---
 #define STATIC_IP_ADDR "192.168.137.50"
@@ -59,42 +98,25 @@ static uint8_t global_content_format;  // Holds last used Content-Format value
 static bool led_state = false;     // Tracks current LED state
 static bool buzzer_state = false;  // Tracks current buzzer state
 
-// Use shared duplicate detector
-static duplicate_detector_t
-    server_dup_detector;  // Duplicate detection for CoAP CON requests
+// Payloads kept ready to send; refreshed only when button or actuator state
+// changes. GET /buttons and the notifications keep their documented formats.
+static payload_template_t buttons_payload;  // 'BTN1=0, BTN2=0, BTN3=0'
+static payload_template_t buttons_notify;   // 'BTN1=0,BTN2=0,BTN3=0'
+static payload_template_t actuators_payload;
+static uint8_t buttons_cbor[STATE_CBOR_LEN];  // {1: b1, 2: b2, 3: b3}
+static size_t buttons_cbor_len;
+static uint8_t actuators_cbor[STATE_CBOR_LEN];  // {0: led, 1: buzzer}
+static size_t actuators_cbor_len;
 
-// --- Subscriber Management ---
-typedef struct {
-    bool active;                        // True if slot filled by subscriber
-    ip_addr_t ip;                       // Subscriber's IP address
-    u16_t port;                         // Subscriber's UDP port
-    coap_buffer_t token;                // CoAP observe token
-    uint8_t token_data[MAX_TOKEN_LEN];  // Token data for matching
-    uint16_t observe_seq;               // Current Observe sequence number
-    uint32_t last_ack_time;             // Time (ms) of last ACK from subscriber
-    uint32_t timeout_sessions;          // Count of consecutive missed ACKs
-} coap_subscriber_t;
-
-static coap_subscriber_t
-    subscribers[MAX_SUBSCRIBERS];  // All observe subscribers
-
-// --- File Transfer State ---
-typedef struct {
-    FIL file;              // FATFS file handle for ongoing blockwise transfer
-    uint32_t block_num;    // Current block number being sent
-    uint32_t total_size;   // File size in bytes
-    uint32_t bytes_sent;   // Total bytes sent so far
-    bool transfer_active;  // True if transfer ongoing
-    bool is_image;         // True if sending an image
-    char filename[32];     // Output filename in use
-    bool waiting_for_ack;  // True if awaiting ACK for current block
-} file_transfer_state_t;
-
-static file_transfer_state_t file_state;  // Instance for active file transfer
+// GET /file transfers are tracked per (client, token) in cs04_transfer_session
 
 // --- UDP Control Block ---
 struct udp_pcb *pcb;  // Main UDP listening socket for server
 
+// Payload chain of the response a handler just built (inline GET /file),
+// attached when udp_recv_callback() encodes it
+static struct pbuf *response_payload;
+
 // --- Function Prototypes ---
 void init_hardware(void);
 int handle_get_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
@@ -115,57 +137,102 @@ int handle_ipatch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
 int handle_fetch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                       coap_packet_t *outpkt, uint8_t idhi, uint8_t idlo,
                       const ip_addr_t *addr, u16_t port);
+int handle_put_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                    coap_packet_t *outpkt, uint8_t idhi, uint8_t idlo,
+                    const ip_addr_t *addr, u16_t port);
+int handle_get_metrics(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                       coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
+                       const ip_addr_t *addr, u16_t port);
+#if CS04_TRACE
+int handle_get_stats(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                     coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
+                     const ip_addr_t *addr, u16_t port);
+#endif
 void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                        const ip_addr_t *addr, u16_t port);
-void prune_dead_subscribers(void);
 void on_retransmit_failure(uint16_t msg_id, const ip_addr_t *ip, u16_t port);
+static void storage_forget_peer(const ip_addr_t *ip, u16_t port);
+static void notify_settled(subscriber_t *sub);
 
 // --- Endpoints ---
-static const coap_endpoint_path_t path_buttons = { 1, { "buttons" } };
-static const coap_endpoint_path_t path_actuators = { 1, { "actuators" } };
-static const coap_endpoint_path_t path_file = { 1, { "file" } };
-const coap_endpoint_t endpoints[] = {
-    { COAP_METHOD_GET, (coap_endpoint_func) handle_get_buttons, &path_buttons,
-      "ct=0;obs" },
-    { COAP_METHOD_GET, (coap_endpoint_func) handle_get_actuators,
-      &path_actuators, "ct=0" },
-    { COAP_METHOD_GET, (coap_endpoint_func) handle_get_file, &path_file,
-      "ct=0" },  // NEW
-    { COAP_METHOD_PUT, (coap_endpoint_func) handle_put_actuators,
-      &path_actuators, "ct=0" },
-    { COAP_METHOD_iPATCH, (coap_endpoint_func) handle_ipatch_file, &path_file,
-      "ct=0" },
-    { COAP_METHOD_FETCH, (coap_endpoint_func) handle_fetch_file, &path_file,
-      "ct=0" },
-    { (coap_method_t) 0, NULL, NULL, NULL }
+// Routes are bucketed by method; segment lengths are fixed at compile time.
+static const dispatch_route_t get_routes[] = {
+    DISPATCH_ROUTE(handle_get_buttons, "ct=\"0 60\";obs",
+                   DISPATCH_SEG("buttons")),
+    DISPATCH_ROUTE(handle_get_actuators, "ct=\"0 60\"",
+                   DISPATCH_SEG("actuators")),
+    DISPATCH_ROUTE(handle_get_file, "ct=0", DISPATCH_SEG("file")),
+    DISPATCH_ROUTE(handle_get_metrics, "ct=0", DISPATCH_SEG("metrics")),
+#if CS04_TRACE
+    DISPATCH_ROUTE(handle_get_stats, "ct=0",
+                   DISPATCH_SEG(".well-known"), DISPATCH_SEG("stats")),
+#endif
+};
+static const dispatch_route_t put_routes[] = {
+    DISPATCH_ROUTE(handle_put_actuators, "ct=\"0 60\"",
+                   DISPATCH_SEG("actuators")),
+    DISPATCH_ROUTE(handle_put_file, "ct=0", DISPATCH_SEG("file")),
+};
+static const dispatch_route_t fetch_routes[] = {
+    DISPATCH_ROUTE(handle_fetch_file, "ct=0", DISPATCH_SEG("file")),
+};
+static const dispatch_route_t ipatch_routes[] = {
+    DISPATCH_ROUTE(handle_ipatch_file, "ct=0", DISPATCH_SEG("file")),
+};
+static const dispatch_table_t dispatch_table = {
+    .by_method = {
+        [COAP_METHOD_GET] = DISPATCH_BUCKET(get_routes),
+        [COAP_METHOD_PUT] = DISPATCH_BUCKET(put_routes),
+        [COAP_METHOD_FETCH] = DISPATCH_BUCKET(fetch_routes),
+        [COAP_METHOD_iPATCH] = DISPATCH_BUCKET(ipatch_routes),
+    },
 };
 
 // Called when a retransmission for a subscriber or block fails beyond
-// threshold.
+// threshold. Only that client's transfers and handles are dropped.
 void on_retransmit_failure(uint16_t msg_id, const ip_addr_t *ip, u16_t port)
 {
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(50, 0, 0, 0.5f));
-    hw_buzz(BUZZER_PIN, 800, 300);
-    sleep_ms(350);
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 10, 0, 0.1f));
-
-    if (file_state.transfer_active) {
-        printf("Stopping file transfer due to retransmission failure\n");
-        f_close(&file_state.file);
-        file_state.transfer_active = false;
-        file_state.waiting_for_ack = false;
-        file_state.block_num = 0;
-    }
-
-    for (int j = 0; j < MAX_SUBSCRIBERS; j++) {
-        if (subscribers[j].active && ip_addr_cmp(&subscribers[j].ip, ip) &&
-            subscribers[j].port == port) {
-            subscribers[j].timeout_sessions++;
-            printf("⚠ Subscriber %d timeout session count: %lu\n", j,
-                   subscribers[j].timeout_sessions);
-            break;
-        }
+    feedback_play(FEEDBACK_TIMEOUT);
+
+    storage_forget_peer(ip, port);
+
+    subscriber_t *sub = subscriber_on_timeout(msg_id);
+    if (sub)
+        notify_settled(sub);
+}
+
+// Samples the buttons into the ready-made payloads. pressed_pin reads as
+// pressed even if already released, so a short tap is still reported.
+static void buttons_refresh(uint pressed_pin)
+{
+    const uint pins[] = { BUTTON_1_PIN, BUTTON_2_PIN, BUTTON_3_PIN };
+    cbor_writer_t w;
+    cbor_writer_init(&w, buttons_cbor, sizeof(buttons_cbor));
+    cbor_put_map(&w, count_of(pins));
+    for (uint8_t i = 0; i < count_of(pins); i++) {
+        bool pressed = pins[i] == pressed_pin || !gpio_get(pins[i]);
+        payload_template_set(&buttons_payload, i, pressed ? "1" : "0");
+        payload_template_set(&buttons_notify, i, pressed ? "1" : "0");
+        cbor_put_uint(&w, CBOR_KEY_BTN1 + i);
+        cbor_put_bool(&w, pressed);
     }
+    buttons_cbor_len = w.len;
+}
+
+// Re-encodes the actuator payloads after a state change.
+static void actuators_refresh(void)
+{
+    payload_template_set(&actuators_payload, 0, led_state ? "ON" : "OFF");
+    payload_template_set(&actuators_payload, 1, buzzer_state ? "ON" : "OFF");
+
+    cbor_writer_t w;
+    cbor_writer_init(&w, actuators_cbor, sizeof(actuators_cbor));
+    cbor_put_map(&w, 2);
+    cbor_put_uint(&w, CBOR_KEY_LED);
+    cbor_put_bool(&w, led_state);
+    cbor_put_uint(&w, CBOR_KEY_BUZZER);
+    cbor_put_bool(&w, buzzer_state);
+    actuators_cbor_len = w.len;
 }
 
 // Sets up all required hardware (LED, buttons, buzzer, SD card, WS2812).
@@ -187,88 +254,1198 @@ void init_hardware(void)
     gpio_set_dir(BUTTON_3_PIN, GPIO_IN);
     gpio_pull_up(BUTTON_3_PIN);
 
+    payload_template_init(&buttons_payload, "BTN1=%, BTN2=%, BTN3=%", "0");
+    payload_template_init(&buttons_notify, "BTN1=%,BTN2=%,BTN3=%", "0");
+    payload_template_init(&actuators_payload, "LED=%,BUZZER=%", "OFF");
+    buttons_refresh(UINT_MAX);
+    actuators_refresh();
+
     uint offset = pio_add_program(pio_ws2812, &ws2812_program);
     ws2812_program_init(pio_ws2812, sm_ws2812, offset, LED_PIN, 800000, false);
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(10, 0, 10, 0.1f));
+    hw_led_put(hw_urgb_u32(10, 0, 10, 0.1f));
+
+    // Buzzer moves to PWM; patterns play from a timer from here on
+    feedback_init(pio_ws2812, sm_ws2812, BUZZER_PIN);
+    feedback_set_idle_color(hw_urgb_u32(0, 10, 0, 0.1f));
 
     if (!hw_sd_init(&server_fs)) {
         while (true)
             ;
     }
 
-    file_state.transfer_active = false;
-    file_state.block_num = 0;
-    file_state.waiting_for_ack = false;
-
     // Initialize shared libraries
+    file_cache_init();
+    prefetch_init();
+    hot_cache_init();
+    transfer_session_init();
+    upload_session_init();
+    line_index_init();
+    fetch_cursor_init();
+    append_journal_init(FILE_TO_SEND);
     coap_reliability_init();
-    coap_duplicate_detector_init(&server_dup_detector);
+    exchange_cache_init();
     coap_set_retransmit_failure_callback(on_retransmit_failure);
 }
 
-// Removes dead subscribers who miss too many ACKs/heartbeats.
-void prune_dead_subscribers(void)
+// Indexes the text file while Wi-Fi associates, so the first FETCH seeks
+// instead of scanning the card.
+static void warm_line_index(void)
+{
+    FIL f;
+    if (f_open(&f, FILE_TO_SEND, FA_READ) != FR_OK)
+        return;
+    FRESULT fr = line_index_build(&f, FILE_TO_SEND);
+    f_close(&f);
+    if (fr != FR_OK)
+        LOG_WARN("⚠️ Line index warmup failed: %d\n", fr);
+}
+
+// --- Notifications ---
+// Latest button state, encoded once. Subscribers that are waiting for an
+// ACK or inside NOTIFY_MIN_INTERVAL_MS get it when they are next free.
+static notify_template_t notify_latest;
+static notify_template_t notify_latest_cbor;  // For observers with Accept: 60
+// /file notification: the lines appended since notify_file_from, or a change
+// marker (no payload) for observers the tail ring has moved past. Observers
+// at the same position share it.
+static notify_template_t notify_file;
+static uint32_t notify_file_from;
+static uint32_t notify_file_to;  // file_tail_end() when it was built
+static bool notify_file_delta;
+static int notify_timer = -1;
+static bool notify_flush_armed;
+static uint32_t notify_flush_at;
+
+// Arms the flush timer for `at` unless it already fires earlier.
+static void notify_schedule(uint32_t at)
+{
+    if (notify_flush_armed && (int32_t) (at - notify_flush_at) >= 0)
+        return;
+    notify_flush_armed = true;
+    notify_flush_at = at;
+    event_timer_arm(notify_timer, at);
+}
+
+// Encodes the /file notification for an observer sent up to pos, unless the
+// current one already fits it.
+static bool notify_file_prepare(uint32_t pos)
+{
+    uint32_t end = file_tail_end();
+    bool delta = file_tail_available(pos);
+    if (notify_file.buf && notify_file_to == end &&
+        notify_file_delta == delta && (!delta || notify_file_from == pos))
+        return true;
+
+    static uint8_t lines[FILE_TAIL_BYTES];
+    size_t len = 0;
+    if (delta)
+        file_tail_read(pos, lines, sizeof(lines), &len);
+
+    // Content-Format 0 is an empty uint option
+    coap_packet_t pkt = { 0 };
+    pkt.hdr.code = COAP_RSPCODE_CONTENT;
+    coap_add_option(&pkt, COAP_OPTION_CONTENT_FORMAT, NULL, 0);
+    pkt.payload.p = lines;
+    pkt.payload.len = len;
+
+    notify_template_free(&notify_file);
+    if (!notify_template_init(&notify_file, &pkt))
+        return false;
+    notify_file_from = pos;
+    notify_file_to = end;
+    notify_file_delta = delta;
+    return true;
+}
+
+// Sends the latest state to one subscriber.
+static void notify_deliver(subscriber_t *sub, uint32_t now)
+{
+    uint16_t seq = sub->observe_seq;
+    bool con = notify_wants_con(subscriber_count(), seq,
+                                subscriber_slot(sub));
+    const notify_template_t *tmpl = &notify_latest;
+    if (sub->resource == SUBSCRIBER_FILE) {
+        tmpl = notify_file_prepare(sub->file_pos) ? &notify_file : NULL;
+    } else if (sub->accept == COAP_CONTENTTYPE_APPLICATION_CBOR &&
+               notify_latest_cbor.buf) {
+        tmpl = &notify_latest_cbor;
+    }
+    uint16_t msg_id = 0;
+    if (tmpl)
+        msg_id = notify_send(pcb, tmpl, &sub->ip, sub->port, &sub->token,
+                             seq, con);
+    if (!msg_id) {
+        sub->failed++;
+        notify_gate_failed(&sub->gate, now);
+        notify_schedule(notify_gate_ready_at(&sub->gate));
+        return;
+    }
+
+    if (sub->resource == SUBSCRIBER_FILE)
+        sub->file_pos = notify_file_to;
+    sub->observe_seq++;
+    sub->sent++;
+    notify_gate_sent(&sub->gate, now, con);
+    if (con)
+        subscriber_track_msg(sub, msg_id);
+}
+
+// A subscriber's CON notification was ACKed or given up on; send it any
+// state that arrived meanwhile.
+static void notify_settled(subscriber_t *sub)
 {
     uint32_t now = to_ms_since_boot(get_absolute_time());
-    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
-        if (!subscribers[i].active)
+    if (notify_gate_settle(&sub->gate, now))
+        notify_deliver(sub, now);
+    else if (sub->gate.pending)
+        notify_schedule(notify_gate_ready_at(&sub->gate));
+}
+
+// Flush timer: delivers pending state whose minimum interval has passed.
+static void on_notify_timer(uint32_t now)
+{
+    notify_flush_armed = false;
+    for (subscriber_t *sub = subscriber_first(); sub;
+         sub = subscriber_next(sub)) {
+        if (notify_gate_ready(&sub->gate, now))
+            notify_deliver(sub, now);
+        else if (sub->gate.pending && !sub->gate.in_flight)
+            notify_schedule(notify_gate_ready_at(&sub->gate));
+    }
+}
+
+// Offers new state of a resource to its subscribers. CON/NON is chosen per
+// subscriber by notify_wants_con(), and subscribers that are busy get the
+// state coalesced for later.
+static void notify_offer(subscriber_resource_t resource)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    unsigned sent = 0, held = 0;
+    // /file updates are deltas that merge; on a poor link they wait and go
+    // out as one notification. /buttons state is always sent at once.
+    bool hold = resource == SUBSCRIBER_FILE && radio_defer_non_urgent();
+    for (subscriber_t *sub = subscriber_first(); sub;
+         sub = subscriber_next(sub)) {
+        if (sub->resource != resource)
             continue;
+        bool ready = notify_gate_offer(&sub->gate, now);
+        if (hold) {
+            notify_gate_hold(&sub->gate, now + RADIO_POOR_DEFER_MS);
+            ready = false;
+        }
+        if (ready) {
+            notify_deliver(sub, now);
+            sent++;
+        } else {
+            if (!sub->gate.in_flight)
+                notify_schedule(notify_gate_ready_at(&sub->gate));
+            held++;
+        }
+    }
+    if (sent || held) {
+        LOG_DEBUG("✓ Notified %u %s observer(s), %u deferred\n", sent,
+               resource == SUBSCRIBER_FILE ? "/file" : "/buttons", held);
+    }
+}
+
+// Publishes new button state to every /buttons subscriber. The message is
+// encoded once per format (the CBOR one only if an observer asked for it).
+static void notify_observers(const uint8_t *text, size_t text_len,
+                             const uint8_t *cbor, size_t cbor_len)
+{
+    if (subscriber_count() == 0)
+        return;
+
+    coap_packet_t pkt = { 0 };
+    pkt.hdr.code = COAP_RSPCODE_CONTENT;
+    pkt.payload.p = text;
+    pkt.payload.len = text_len;
+
+    notify_template_free(&notify_latest);
+    if (!notify_template_init(&notify_latest, &pkt)) {
+        LOG_ERROR("✗ Failed to build notification\n");
+        return;
+    }
+
+    // Only /buttons observers get this notification; a /file observer's
+    // Accept does not count
+    notify_template_free(&notify_latest_cbor);
+    bool want_cbor = false;
+    for (subscriber_t *sub = subscriber_first(); sub && !want_cbor;
+         sub = subscriber_next(sub))
+        want_cbor = sub->resource == SUBSCRIBER_BUTTONS &&
+                    sub->accept == COAP_CONTENTTYPE_APPLICATION_CBOR;
+    if (want_cbor) {
+        static const uint8_t cf_cbor = COAP_CONTENTTYPE_APPLICATION_CBOR;
+        coap_add_option(&pkt, COAP_OPTION_CONTENT_FORMAT, &cf_cbor, 1);
+        pkt.payload.p = cbor;
+        pkt.payload.len = cbor_len;
+        if (!notify_template_init(&notify_latest_cbor, &pkt))
+            LOG_WARN("⚠️ No CBOR notification, sending text\n");
+    }
+
+    notify_offer(SUBSCRIBER_BUTTONS);
+}
+
+// --- Storage operations ---
+// GET/FETCH/iPATCH handlers validate the request on the network side and
+// describe the SD work in a storage_request_t. With CS04_STORAGE_CORE1 the
+// request runs on core1 and the piggybacked ACK is sent from the main loop
+// when the result comes back; otherwise it runs inline in the handler.
+
+#define HANDLER_DEFERRED 1  // Handler queued work; response is sent later
+
+// Durations of storage requests, written by whichever core runs them
+static metrics_latency_t storage_read_latency;   // GET and FETCH blocks
+static metrics_latency_t storage_write_latency;  // iPATCH appends, Block1
+
+// Starts a storage request for inpkt, filling in its response route.
+static storage_request_t *storage_request_begin(storage_op_t op,
+                                                const coap_packet_t *inpkt,
+                                                uint8_t id_hi, uint8_t id_lo,
+                                                const ip_addr_t *addr,
+                                                u16_t port)
+{
+    static storage_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    req.route.id_hi = id_hi;
+    req.route.id_lo = id_lo;
+    req.route.token_len = inpkt->tok.len <= STORAGE_TOKEN_LEN
+                              ? (uint8_t) inpkt->tok.len
+                              : 0;
+    memcpy(req.route.token, inpkt->tok.p, req.route.token_len);
+    req.route.ip = *addr;
+    req.route.port = port;
+    req.route.confirmable = (inpkt->hdr.t == COAP_TYPE_CON);
+    return &req;
+}
+
+// Picks the file a GET /file request asks for (?type=image selects the image).
+static const char *file_for_request(const coap_packet_t *inpkt)
+{
+    uint8_t count = 0;
+    const coap_option_t *query_opt = coap_findOptions(
+        inpkt, COAP_OPTION_URI_QUERY, &count);
+    if (query_opt && count > 0 && query_opt->buf.len >= 10 &&
+        strncmp((char *) query_opt->buf.p, "type=image", 10) == 0) {
+        return IMAGE_TO_SEND;
+    }
+    return FILE_TO_SEND;
+}
+
+// Content-Format a file is served with.
+static int16_t file_content_format(const char *filename)
+{
+    return strcmp(filename, IMAGE_TO_SEND) == 0 ? 42 : 0;
+}
+
+// Fills the block-cache key of a GET /file request. Returns false for other
+// requests or an unparsable Block2 option.
+static bool file_block_key(const coap_packet_t *inpkt, const ip_addr_t *addr,
+                           u16_t port, exchange_block_key_t *key)
+{
+    uint8_t count = 0;
+    if (inpkt->hdr.code != COAP_METHOD_GET)
+        return false;
+    const coap_option_t *path_opt = coap_findOptions(
+        inpkt, COAP_OPTION_URI_PATH, &count);
+    if (!path_opt || count != 1 || path_opt->buf.len != 4 ||
+        memcmp(path_opt->buf.p, "file", 4) != 0) {
+        return false;
+    }
+    if (inpkt->tok.len > EXCHANGE_TOKEN_LEN)
+        return false;
+    // A conditional GET may be answered 2.03 or 4.12, which a cached block
+    // is not, and an Observe registration is not a block at all
+    if (coap_findOptions(inpkt, COAP_OPTION_ETAG, &count) ||
+        coap_findOptions(inpkt, COAP_OPTION_IF_MATCH, &count) ||
+        coap_findOptions(inpkt, COAP_OPTION_OBSERVE, &count)) {
+        return false;
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->szx = 6;
+    const coap_option_t *block2_opt = coap_findOptions(
+        inpkt, COAP_OPTION_BLOCK2, &count);
+    bool more = false;
+    if (block2_opt && count > 0 &&
+        !coap_parse_block2_option(block2_opt, &key->block_num, &more,
+                                  &key->szx)) {
+        return false;
+    }
+
+    key->ip = *addr;
+    key->port = port;
+    key->token_len = (uint8_t) inpkt->tok.len;
+    memcpy(key->token, inpkt->tok.p, inpkt->tok.len);
+    key->content_format = file_content_format(file_for_request(inpkt));
+    return true;
+}
+
+#if CS04_STORAGE_CORE1
+// Block-cache key of a GET /file result completed on core1.
+static void result_block_key(const storage_result_t *res,
+                             exchange_block_key_t *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->ip = res->route.ip;
+    key->port = res->route.port;
+    key->token_len = res->route.token_len;
+    memcpy(key->token, res->route.token, res->route.token_len);
+    key->block_num = res->block_num;
+    key->szx = res->szx;
+    key->content_format = res->content_type;
+}
+#endif
+
+// Fills a result with a plain (non-block) response.
+static void storage_result_text(storage_result_t *res, uint8_t code,
+                                const char *text)
+{
+    if (res->payload) {
+        pbuf_free(res->payload);  // Units chained before a later failure
+        res->payload = NULL;
+    }
+    res->code = code;
+    res->len = 0;
+    res->content_type = COAP_CONTENTTYPE_NONE;
+    if (text) {
+        res->len = strlen(text);
+        memcpy(res->data, text, res->len);
+        res->content_type = COAP_CONTENTTYPE_TEXT_PLAIN;
+    }
+}
+
+// Adds a ring slot's bytes to a GET result. Inline, they are chained as a
+// reference to the slot, so the block reaches lwIP without a copy; pbufs are
+// core0-only, so core1 copies into the result instead.
+static bool storage_add_unit(storage_result_t *res,
+                             const prefetch_slot_t *slot)
+{
+#if CS04_STORAGE_CORE1
+    memcpy(&res->data[res->len], slot->data, slot->len);
+#else
+    if (slot->len > 0) {
+        struct pbuf *p = prefetch_payload_pbuf(slot);
+        if (!p)
+            return false;
+        if (res->payload)
+            pbuf_cat(res->payload, p);
+        else
+            res->payload = p;
+    }
+#endif
+    res->len += slot->len;
+    return true;
+}
+
+// Per-file ETag, kept until an append changes the text file. Storage side
+// only, like the appends that invalidate it.
+typedef struct {
+    bool valid;
+    uint8_t tag[FILE_ETAG_LEN];
+} file_etag_t;
+
+static file_etag_t file_etags[2];  // [0] text file, [1] image
+
+// Returns the ETag of a file: FNV-1a over its name, size and timestamp, so
+// an append or a replaced card image changes it. NULL if it cannot be stat'd.
+static const uint8_t *file_etag(const char *filename)
+{
+    file_etag_t *e = &file_etags[strcmp(filename, IMAGE_TO_SEND) == 0];
+    if (e->valid)
+        return e->tag;
+
+    FILINFO fno;
+    if (f_stat(filename, &fno) != FR_OK)
+        return NULL;
+
+    uint32_t h = 2166136261u;
+    for (const char *c = filename; *c; c++)
+        h = (h ^ (uint8_t) *c) * 16777619u;
+    uint32_t fields[3] = { (uint32_t) fno.fsize, fno.fdate, fno.ftime };
+    const uint8_t *b = (const uint8_t *) fields;
+    for (size_t i = 0; i < sizeof(fields); i++)
+        h = (h ^ b[i]) * 16777619u;
+
+    for (int i = 0; i < FILE_ETAG_LEN; i++)
+        e->tag[i] = (uint8_t) (h >> (24 - 8 * i));
+    e->valid = true;
+    return e->tag;
+}
 
-        if (subscribers[i].timeout_sessions >= TIMEOUT_THRESHOLD) {
-            printf("⚠ Removing subscriber %d after %lu timeout sessions\n", i,
-                   subscribers[i].timeout_sessions);
-            subscribers[i].active = false;
+// Reads the units of a GET block through the read-ahead ring, loading a
+// miss synchronously. Returns false with an error response set in res.
+static bool storage_read_ring(const storage_request_t *req,
+                              uint32_t block_size, uint32_t max_units,
+                              storage_result_t *res, FSIZE_t *file_size,
+                              uint32_t *units)
+{
+    const char *filename = req->filename;
+    const ip_addr_t *addr = &req->route.ip;
+    u16_t port = req->route.port;
+    uint32_t block_num = req->block_num;
+
+    // Serve from the read-ahead ring; only a miss touches the SD card here
+    const prefetch_slot_t *slot = prefetch_lookup(filename, addr, port,
+                                                  block_num, block_size);
+    if (!slot) {
+        FRESULT fr = FR_OK;
+        slot = prefetch_load(filename, addr, port, block_num, block_size, &fr);
+        if (!slot && (fr == FR_NO_FILE || fr == FR_NO_PATH)) {
+            LOG_ERROR("✗ Failed to open file %s: %d\n", filename, fr);
+            storage_result_text(res, COAP_RSPCODE_NOT_FOUND, "File not found");
+            return false;
+        }
+        if (!slot) {
+            LOG_ERROR("✗ File read error: %d\n", fr);
+            storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                "Read error");
+            return false;
         }
+    }
+
+    *file_size = slot->file_size;
+    uint32_t total_blocks = (*file_size + block_size - 1) / block_size;
+    if (!storage_add_unit(res, slot)) {
+        storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE, "Busy");
+        return false;
+    }
 
-        if (now - subscribers[i].last_ack_time > SUBSCRIBER_TIMEOUT_MS) {
-            printf("⚠ Subscriber %d timed out (no ACK for %lu ms)\n", i,
-                   now - subscribers[i].last_ack_time);
-            subscribers[i].timeout_sessions++;
-            subscribers[i].last_ack_time = now;
+    // BERT: append the following units while they are full and exist. The
+    // client steps its requests by the unit count of the first response, so
+    // a payload is never cut short in the middle of the file.
+    *units = 1;
+    while (*units < max_units && block_num + *units < total_blocks &&
+           res->len == *units * block_size) {
+        uint32_t unit = block_num + *units;
+        slot = prefetch_lookup(filename, addr, port, unit, block_size);
+        if (!slot) {
+            FRESULT fr = FR_OK;
+            slot = prefetch_load(filename, addr, port, unit, block_size, &fr);
+            if (!slot) {
+                LOG_ERROR("✗ File read error: %d\n", fr);
+                storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                    "Read error");
+                return false;
+            }
+        }
+        if (!storage_add_unit(res, slot)) {
+            storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                "Busy");
+            return false;
         }
+        (*units)++;
     }
+    return true;
 }
 
-// Add new subscribers to CoAP Observe
-int add_subscriber(const ip_addr_t *ip, u16_t port, const coap_buffer_t *token)
+// Reads one Block2 block of a file from the hot cache or the prefetch ring.
+// A BERT (SZX 7) request gets up to COAP_BERT_MAX_UNITS consecutive 1024-byte
+// units. Block 0 carries the file's ETag; a request holding that ETag gets
+// 2.03 Valid, and a resumed download whose If-Match no longer matches gets
+// 4.12.
+static void storage_get_block(const storage_request_t *req,
+                              storage_result_t *res)
 {
-    printf("add_subscriber called from %s:%d\n", ip4addr_ntoa(ip), port);
-
-    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
-        if (!subscribers[i].active) {
-            subscribers[i].active = true;
-            subscribers[i].ip = *ip;
-            subscribers[i].port = port;
-            subscribers[i].observe_seq = 0;
-            subscribers[i].last_ack_time = to_ms_since_boot(
-                get_absolute_time());
-            subscribers[i].timeout_sessions = 0;
-
-            size_t len = token->len > MAX_TOKEN_LEN ? MAX_TOKEN_LEN
-                                                    : token->len;
-            memcpy(subscribers[i].token_data, token->p, len);
-            subscribers[i].token.p = subscribers[i].token_data;
-            subscribers[i].token.len = len;
-
-            printf("✓ Added subscriber at index %d\n", i);
-            return i;
+    const char *filename = req->filename;
+    const ip_addr_t *addr = &req->route.ip;
+    u16_t port = req->route.port;
+    uint32_t block_num = req->block_num;
+    uint8_t szx = req->szx;
+    bool send_image = strcmp(filename, IMAGE_TO_SEND) == 0;
+
+    // Calculate block size from SZX (the unit size for BERT)
+    uint32_t block_size = coap_block_size_from_szx(szx);
+    uint32_t max_units = 1;
+    if (szx == COAP_BLOCK_SZX_BERT && SERVER_BERT_ENABLED) {
+        max_units = COAP_BERT_MAX_UNITS;
+    } else if (szx > COAP_BLOCK_SZX_MAX || block_size > BLOCK_SIZE) {
+        block_size = BLOCK_SIZE;  // Clamp to our maximum
+        szx = coap_szx_from_block_size(BLOCK_SIZE);
+    }
+
+    // Make journaled appends visible (and release the write handle)
+    if (!send_image)
+        append_journal_sync_for_read();
+
+    // A resumed download continues only while the file is the version its
+    // first blocks came from
+    if (req->if_match) {
+        const uint8_t *etag = file_etag(filename);
+        if (!etag || req->etag_len != FILE_ETAG_LEN ||
+            memcmp(req->etag, etag, FILE_ETAG_LEN) != 0) {
+            LOG_WARN("⚠️ %s changed, refusing resume at block %lu\n", filename,
+                   block_num);
+            storage_result_text(res, COAP_RSPCODE_PRECONDITION_FAILED,
+                                "File changed");
+            return;
         }
     }
 
-    printf("✗ No free subscriber slots!\n");
-    return -1;
+    // A client that already has this version needs no payload at all
+    if (block_num == 0 && !req->if_match) {
+        const uint8_t *etag = file_etag(filename);
+        if (etag) {
+            memcpy(res->etag, etag, FILE_ETAG_LEN);
+            res->etag_len = FILE_ETAG_LEN;
+            if (req->etag_len == FILE_ETAG_LEN &&
+                memcmp(req->etag, etag, FILE_ETAG_LEN) == 0) {
+                LOG_DEBUG("✓ %s unchanged, answering 2.03 Valid\n", filename);
+                res->code = COAP_RSPCODE_VALID;
+                res->content_type = COAP_CONTENTTYPE_NONE;
+                return;
+            }
+        }
+    }
+
+    // Each (client, token) transfer holds a session; block 0 starts it over.
+    // A later block without one (a resumed download, or an expired session)
+    // starts one too.
+    coap_buffer_t tok = { req->route.token, req->route.token_len };
+    transfer_session_t *session = transfer_session_find(&tok, addr, port);
+    if (!session || block_num == 0 ||
+        strncmp(session->filename, filename, TRANSFER_SESSION_NAME_LEN) != 0) {
+        session = transfer_session_open(&tok, addr, port, filename);
+        if (!session) {
+            LOG_ERROR("✗ %u transfers active, refusing %s:%d\n",
+                   (unsigned) transfer_session_count(), ip4addr_ntoa(addr),
+                   port);
+            storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                "Too many transfers");
+            return;
+        }
+    }
+
+    // Small files come whole from the hot cache; the rest through the ring
+    FSIZE_t file_size = 0;
+    uint32_t units = 0;
+    UINT hot_len = 0;
+    FRESULT fr = hot_cache_read(filename, (FSIZE_t) block_num * block_size,
+                                res->data, block_size * max_units, &hot_len,
+                                &file_size);
+    bool hot = fr == FR_OK;
+    if (hot) {
+        res->len = hot_len;
+        units = hot_len > block_size ? (hot_len + block_size - 1) / block_size
+                                     : 1;
+    } else if (fr == FR_NO_FILE || fr == FR_NO_PATH) {
+        LOG_ERROR("✗ Failed to open file %s: %d\n", filename, fr);
+        storage_result_text(res, COAP_RSPCODE_NOT_FOUND, "File not found");
+        return;
+    } else if (fr != FR_DENIED) {
+        LOG_ERROR("✗ File read error: %d\n", fr);
+        storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                            "Read error");
+        return;
+    } else if (!storage_read_ring(req, block_size, max_units, res,
+                                  &file_size, &units)) {
+        return;
+    }
+    uint32_t total_blocks = (file_size + block_size - 1) / block_size;
+
+    LOG_DEBUG("  Sending block %lu/%lu (%u bytes, block_size=%lu, units=%lu)\n",
+           block_num + 1, total_blocks, res->len, block_size, units);
+
+    // Determine if there are more blocks
+    uint32_t last_unit = block_num + units - 1;
+    bool more_blocks = (last_unit + 1) < total_blocks;
+    transfer_session_note_block(session, last_unit, res->len);
+
+    res->code = COAP_RSPCODE_CONTENT;
+    res->content_type = file_content_format(filename);
+    res->block2 = true;
+    res->block_num = block_num;
+    res->more = more_blocks;
+    res->szx = szx;
+
+    // Pipelined clients request several blocks back-to-back and may probe
+    // past the end, so only the real last block signals completion.
+    if (more_blocks && !hot) {
+        prefetch_schedule(filename, addr, port, last_unit, block_size,
+                          file_size);
+    } else if (!more_blocks) {
+        file_cache_close(filename, addr, port);
+    }
+    if (last_unit + 1 == total_blocks) {
+        const prefetch_stats_t *ps = prefetch_get_stats();
+        const sd_card_t *sd = sd_get_by_num(0);
+        LOG_DEBUG("  Prefetch: %lu hits, %lu misses, %lu read-ahead in %lu "
+               "reads\n", ps->hits, ps->misses, ps->reads, ps->runs);
+        LOG_DEBUG("  Payloads: %lu sent by reference, %lu copied\n", ps->refs,
+               ps->copies);
+        LOG_DEBUG("  SD: %lu sectors in %lu read commands\n", sd->read_sectors,
+               sd->read_cmds);
+        const hot_cache_stats_t *hs = hot_cache_get_stats();
+        LOG_DEBUG("  Hot cache: %lu hits, %lu misses (%lu blocks loaded)\n",
+               hs->hits, hs->misses, hs->loads);
+        LOG_DEBUG("  Session: %lu responses, %lu bytes in %lu ms (%u active)\n",
+               session->blocks, session->bytes,
+               to_ms_since_boot(get_absolute_time()) - session->started_ms,
+               (unsigned) transfer_session_count());
+        res->complete = true;
+    }
+    if (!more_blocks)
+        transfer_session_close(session);  // Last block, or a probe past it
+}
+
+// Positions an open file at a FETCH start line: seeks to the nearest
+// indexed line, then skips the remainder. *current_line is the line
+// reached, less than line if the file ends first.
+static FRESULT fetch_seek_line(FIL *file, uint32_t line,
+                               uint32_t *current_line)
+{
+    char buf[256];
+    FRESULT fr = line_index_seek(file, FILE_TO_SEND, line, current_line);
+    if (fr != FR_OK)
+        return fr;
+    LOG_DEBUG("📑 Index: line %lu -> %lu (%lu rebuilds)\n", (unsigned long) line,
+           (unsigned long) *current_line,
+           (unsigned long) line_index_get_stats()->rebuilds);
+
+    while (*current_line < line && f_gets(buf, sizeof(buf), file) != NULL)
+        (*current_line)++;
+    return FR_OK;
+}
+
+// Reads one block of a FETCH line range, resuming from the token's cursor.
+static void storage_fetch(const storage_request_t *req, storage_result_t *res)
+{
+    coap_buffer_t tok = { req->route.token, req->route.token_len };
+    const ip_addr_t *addr = &req->route.ip;
+    u16_t port = req->route.port;
+    uint32_t block_num = req->block_num;
+    uint8_t szx = req->szx;
+    int start_line = req->start_line;
+    int end_line = req->end_line;
+
+    // FETCH results are plain blocks; BERT is only offered for GET /file
+    if (szx > COAP_BLOCK_SZX_MAX)
+        szx = COAP_BLOCK_SZX_MAX;
+    uint32_t block_size = coap_block_size_from_szx(szx);
+
+    // ✅ Open file (journaled appends must be on the card first). A small
+    // file is searched and read in the hot cache instead.
+    append_journal_sync_for_read();
+    FSIZE_t hot_size = 0;
+    bool hot = hot_cache_stat(FILE_TO_SEND, &hot_size) == FR_OK;
+    FIL file;
+    FRESULT fr = hot ? FR_OK : f_open(&file, FILE_TO_SEND, FA_READ);
+
+    if (fr != FR_OK) {
+        LOG_ERROR("✗ Failed to open file: %d\n", fr);
+        storage_result_text(res, COAP_RSPCODE_NOT_FOUND, "File not found");
+        return;
+    }
+
+    fetch_cursor_t *cursor = NULL;
+    if (block_num == 0) {
+        FSIZE_t offset = 0;
+        uint32_t current_line = 0;
+        if (hot) {
+            fr = hot_cache_find_line(FILE_TO_SEND, (uint32_t) start_line,
+                                     &offset, &current_line);
+        } else {
+            fr = fetch_seek_line(&file, (uint32_t) start_line, &current_line);
+            offset = f_tell(&file);
+        }
+        if (fr != FR_OK) {
+            if (!hot)
+                f_close(&file);
+            LOG_ERROR("✗ Line seek failed: %d\n", fr);
+            storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                "Read error");
+            return;
+        }
+
+        // Check if we reached start_line or hit EOF early
+        if (current_line < (uint32_t) start_line) {
+            // Started beyond file length
+            if (!hot)
+                f_close(&file);
+            LOG_WARN("⚠️ Start line %d is beyond file length (file has ~%lu "
+                   "lines)\n",
+                   start_line, (unsigned long) current_line);
+            // Return empty payload (graceful)
+            storage_result_text(res, COAP_RSPCODE_CONTENT, NULL);
+            return;
+        }
+
+        cursor = fetch_cursor_open(&tok, addr, port, offset, current_line,
+                                   (uint32_t) end_line);
+    } else {
+        // ✅ Continuation: resume where the previous block stopped
+        cursor = fetch_cursor_find(&tok, addr, port);
+    }
+
+    if (!cursor) {
+        if (!hot)
+            f_close(&file);
+        LOG_ERROR("✗ No FETCH cursor for block %lu\n", block_num);
+        storage_result_text(res, COAP_RSPCODE_BAD_REQUEST, "No FETCH cursor");
+        return;
+    }
+
+    // ✅ Read one block of the result stream
+    UINT bytes_read = 0;
+    bool more_blocks = false;
+    if (hot) {
+        fetch_position_t start;
+        fr = FR_INVALID_PARAMETER;
+        if (fetch_cursor_locate(cursor, block_num, &start)) {
+            fr = hot_cache_read(FILE_TO_SEND, start.offset, res->data,
+                                block_size, &bytes_read, &hot_size);
+        }
+        if (fr == FR_OK) {
+            fetch_cursor_advance(cursor, block_num, &start, res->data,
+                                 &bytes_read, hot_size, &more_blocks);
+        }
+    } else {
+        fr = fetch_cursor_read(cursor, &file, block_num, res->data,
+                               block_size, &bytes_read, &more_blocks);
+        f_close(&file);
+    }
+
+    if (fr == FR_INVALID_PARAMETER) {
+        LOG_ERROR("✗ FETCH block %lu out of sequence (cursor at %lu)\n",
+               block_num, cursor->next_block);
+        storage_result_text(res, COAP_RSPCODE_BAD_REQUEST,
+                            "Block out of order");
+        return;
+    } else if (fr != FR_OK) {
+        LOG_ERROR("✗ File read error: %d\n", fr);
+        fetch_cursor_close(cursor);
+        storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                            "Read error");
+        return;
+    }
+
+    res->code = COAP_RSPCODE_CONTENT;
+    res->content_type = COAP_CONTENTTYPE_TEXT_PLAIN;
+    res->len = bytes_read;
+    res->complete = !more_blocks && (bytes_read > 0 || block_num > 0);
+
+    // ✅ Whole result fits in one response: no Block2 option needed
+    if (block_num == 0 && !more_blocks && !req->blockwise) {
+        if (bytes_read == 0) {
+            LOG_WARN("⚠️ No lines read (file might be empty or start beyond "
+                   "EOF)\n");
+        } else {
+            LOG_DEBUG("✓ Successfully read %u bytes from lines %d to %d\n",
+                   bytes_read, start_line, end_line);
+        }
+        return;
+    }
+
+    LOG_DEBUG("  Sending FETCH block %lu (%u bytes, more=%d)\n", block_num,
+           bytes_read, more_blocks);
+    res->block2 = true;
+    res->block_num = block_num;
+    res->more = more_blocks;
+    res->szx = szx;
+    if (!more_blocks)
+        LOG_INFO("✓ Blockwise FETCH complete (%lu blocks%s)\n", block_num + 1,
+               hot ? " from the hot cache" : "");
+}
+
+// Appends a batch of lines through the journal.
+static void storage_append(const storage_request_t *req,
+                           storage_result_t *res)
+{
+    // Lines are buffered in the journal and written in sector batches
+    FRESULT fr = append_journal_append(req->data, req->len, req->lines,
+                                       req->durable);
+
+    if (fr == FR_INVALID_PARAMETER) {
+        LOG_ERROR("✗ Append payload too large for journal\n");
+        storage_result_text(res, COAP_RSPCODE_BAD_REQUEST, NULL);
+        return;
+    } else if (fr != FR_OK) {
+        LOG_ERROR("✗ Failed to write to file: %d\n", fr);
+        storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE, NULL);
+        return;
+    }
+
+    LOG_DEBUG("✓ Appended %u lines (%u bytes) to %s (%u bytes pending)\n",
+           req->lines, req->len, req->durable ? "file" : "journal",
+           (unsigned) append_journal_pending());
+    file_etags[0].valid = false;  // Next block 0 hashes the new size
+
+    // The client learns how much of its batch landed
+    char text[24];
+    snprintf(text, sizeof(text), "Appended %u", req->lines);
+    storage_result_text(res, COAP_RSPCODE_CHANGED, text);
+    res->complete = true;
+
+    // /file observers are sent the batch once the response is out
+    memcpy(&res->data[res->len], req->data, req->len);
+    res->appended_len = req->len;
+    res->file_changed = true;
+}
+
+// Writes one Block1 block of a PUT/iPATCH upload. Each block is answered
+// 2.31 Continue; the one that completes the upload moves it into place.
+static void storage_upload(const storage_request_t *req,
+                           storage_result_t *res)
+{
+    coap_buffer_t tok = { req->route.token, req->route.token_len };
+    upload_session_t *s = upload_session_find(&tok, &req->route.ip,
+                                              req->route.port);
+    if (req->block_num == 0) {
+        s = upload_session_open(&tok, &req->route.ip, req->route.port,
+                                req->filename, req->replace, req->szx);
+        if (!s) {
+            LOG_ERROR("✗ No upload slot for %s\n", req->filename);
+            storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                "Busy");
+            return;
+        }
+    } else if (!s || s->szx != req->szx) {
+        // Block 0 never arrived here, or the client changed block size
+        storage_result_text(res, COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE,
+                            NULL);
+        return;
+    }
+
+    upload_result_t r = upload_session_put(s, req->block_num, req->more,
+                                           req->data, req->len);
+    switch (r) {
+    case UPLOAD_STORED:
+    case UPLOAD_DUPLICATE:
+        storage_result_text(res, COAP_RSPCODE_CONTINUE, NULL);
+        break;
+    case UPLOAD_OUT_OF_RANGE:
+        storage_result_text(res, COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE,
+                            NULL);
+        break;
+    case UPLOAD_BAD_BLOCK:
+        upload_session_close(s);
+        storage_result_text(res, COAP_RSPCODE_BAD_REQUEST, NULL);
+        break;
+    case UPLOAD_TOO_LARGE:
+        upload_session_close(s);
+        storage_result_text(res, COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE, NULL);
+        break;
+    case UPLOAD_WRITE_ERROR:
+        LOG_ERROR("✗ Upload write failed\n");
+        upload_session_close(s);
+        storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE, NULL);
+        break;
+    case UPLOAD_COMPLETE: {
+        uint32_t bytes = s->bytes;
+        uint32_t lines = 0;
+        FRESULT fr = upload_session_commit(s, &lines);
+        if (fr != FR_OK) {
+            LOG_ERROR("✗ Upload commit failed: %d\n", fr);
+            storage_result_text(res, COAP_RSPCODE_SERVICE_UNAVAILABLE, NULL);
+            break;
+        }
+        LOG_INFO("✓ Upload of %lu bytes %s %s\n", bytes,
+               req->replace ? "replaced" : "appended to", req->filename);
+        file_etags[strcmp(req->filename, IMAGE_TO_SEND) == 0].valid = false;
+
+        char text[24];
+        if (req->replace)
+            snprintf(text, sizeof(text), "Stored %lu", bytes);
+        else
+            snprintf(text, sizeof(text), "Appended %lu", lines);
+        storage_result_text(res, COAP_RSPCODE_CHANGED, text);
+        res->complete = true;
+        res->file_changed = strcmp(req->filename, FILE_TO_SEND) == 0;
+        break;
+    }
+    }
+
+    if (res->code == COAP_RSPCODE_CONTINUE || res->complete) {
+        res->block1 = true;
+        res->block_num = req->block_num;
+        res->more = req->more;
+        res->szx = req->szx;
+    }
+}
+
+// Runs one storage request; returns false if no response is needed.
+static bool storage_execute(const storage_request_t *req,
+                            storage_result_t *res)
+{
+    if (req->op == STORAGE_OP_PEER_LOST) {
+        transfer_session_close_peer(&req->route.ip, req->route.port);
+        prefetch_close_peer(&req->route.ip, req->route.port);
+        file_cache_close_peer(&req->route.ip, req->route.port);
+        upload_session_close_peer(&req->route.ip, req->route.port);
+        return false;
+    }
+
+    memset(res, 0, offsetof(storage_result_t, data));
+    res->op = req->op;
+    res->route = req->route;
+
+    uint32_t t = TRACE_START();
+    uint32_t started = time_us_32();
+    metrics_latency_t *latency = &storage_read_latency;
+    switch (req->op) {
+    case STORAGE_OP_GET_BLOCK:
+        storage_get_block(req, res);
+        break;
+    case STORAGE_OP_FETCH:
+        storage_fetch(req, res);
+        break;
+    case STORAGE_OP_APPEND:
+        storage_append(req, res);
+        latency = &storage_write_latency;
+        break;
+    case STORAGE_OP_UPLOAD:
+        storage_upload(req, res);
+        latency = &storage_write_latency;
+        break;
+    default:
+        return false;
+    }
+    metrics_latency_add(latency, time_us_32() - started);
+    TRACE_LAP(TRACE_STORAGE, t);
+    return true;
+}
+
+// Background SD work: read-ahead, journal flushes and handle expiry.
+static bool storage_idle(uint32_t now)
+{
+    static uint32_t last_expire_time = 0;
+
+    bool busy = prefetch_poll();
+    append_journal_poll(now);
+
+    if (now - last_expire_time > 5000) {
+        file_cache_expire(now);
+        fetch_cursor_expire(now);
+        transfer_session_expire(now);
+        upload_session_expire(now);
+        last_expire_time = now;
+    }
+    return busy;
+}
+
+// Builds the CoAP response described by a storage result.
+static int storage_build_response(coap_rw_buffer_t *scratch,
+                                  coap_packet_t *outpkt,
+                                  const storage_result_t *res)
+{
+    coap_packet_t req_pkt = { 0 };
+    req_pkt.tok.p = res->route.token;
+    req_pkt.tok.len = res->route.token_len;
+    coap_buffer_t etag = { res->etag, res->etag_len };
+
+    if (res->code == COAP_RSPCODE_VALID) {
+        return coap_build_valid_response(outpkt, &req_pkt, res->route.id_hi,
+                                         res->route.id_lo, &etag);
+    }
+    if (res->block2) {
+        // A chained payload is attached when the response is encoded
+        return coap_build_block2_response(
+            scratch, outpkt, &req_pkt, res->route.id_hi, res->route.id_lo,
+            res->block_num, res->more, res->szx,
+            res->payload ? NULL : res->data, res->len,
+            (uint8_t) res->content_type, res->etag_len ? &etag : NULL);
+    }
+    int rc = coap_make_response(scratch, outpkt, res->len ? res->data : NULL,
+                                res->len, res->route.id_hi, res->route.id_lo,
+                                &req_pkt.tok, (coap_responsecode_t) res->code,
+                                (coap_content_type_t) res->content_type);
+    if (rc == 0 && res->block1) {
+        // Encoded after this returns, so it must persist
+        static uint8_t block1_buf[3];
+        size_t len = coap_encode_block1_option(block1_buf, res->block_num,
+                                               res->more, res->szx);
+        coap_add_option(outpkt, COAP_OPTION_BLOCK1, block1_buf, len);
+    }
+    return rc;
+}
+
+// LED/buzzer feedback once a storage request has completed.
+static void storage_feedback(const storage_result_t *res)
+{
+    switch (res->op) {
+    case STORAGE_OP_GET_BLOCK:
+        if (res->complete) {
+            LOG_INFO("✓ File transfer complete (last block)\n");
+            hw_play_file_complete_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+        }
+        break;
+    case STORAGE_OP_FETCH:
+        if (res->complete)
+            hw_play_fetch_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+        break;
+    case STORAGE_OP_APPEND:
+        if (res->complete)
+            hw_play_string_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+        break;
+    case STORAGE_OP_UPLOAD:
+        if (res->complete)
+            hw_play_file_complete_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+        break;
+    default:
+        break;
+    }
+}
+
+// Pushes a change to the text file to /file observers. An append is sent as
+// a delta; an upload is too large for the tail ring and sends a marker.
+static void storage_publish(const storage_result_t *res)
+{
+    if (!res->file_changed)
+        return;
+    if (res->appended_len)
+        file_tail_append(&res->data[res->len], res->appended_len);
+    else
+        file_tail_changed();
+    notify_offer(SUBSCRIBER_FILE);
+}
+
+// Runs a storage request inline, or queues it for core1 and defers the ACK.
+static int storage_dispatch(coap_rw_buffer_t *scratch, coap_packet_t *outpkt,
+                            const storage_request_t *req)
+{
+#if CS04_STORAGE_CORE1
+    if (!storage_worker_submit(req)) {
+        LOG_ERROR("✗ Storage queue full\n");
+        coap_packet_t req_pkt = { 0 };
+        req_pkt.tok.p = req->route.token;
+        req_pkt.tok.len = req->route.token_len;
+        return coap_make_response(scratch, outpkt, (uint8_t *) "Busy", 4,
+                                  req->route.id_hi, req->route.id_lo,
+                                  &req_pkt.tok,
+                                  COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                  COAP_CONTENTTYPE_TEXT_PLAIN);
+    }
+    return HANDLER_DEFERRED;
+#else
+    static storage_result_t result;  // Response payload points into this
+    storage_execute(req, &result);
+    int rc = storage_build_response(scratch, outpkt, &result);
+    if (result.payload) {
+        // Only a sent response takes the chain; otherwise it is dropped
+        if (rc == 0)
+            response_payload = result.payload;
+        else
+            pbuf_free(result.payload);
+        result.payload = NULL;
+    }
+    storage_feedback(&result);
+    storage_publish(&result);
+    event_post(EVENT_STORAGE);  // Read-ahead once the response is out
+    return rc;
+#endif
+}
+
+// Drops storage state held for a client (cached handles).
+static void storage_forget_peer(const ip_addr_t *ip, u16_t port)
+{
+    storage_request_t req = { 0 };
+    req.op = STORAGE_OP_PEER_LOST;
+    req.route.ip = *ip;
+    req.route.port = port;
+#if CS04_STORAGE_CORE1
+    storage_worker_submit(&req);  // Best effort; handles also expire
+#else
+    storage_execute(&req, NULL);
+#endif
+}
+
+#if CS04_STORAGE_CORE1
+// Sends the deferred piggybacked ACK for a result completed on core1.
+static void storage_send_result(const storage_result_t *res)
+{
+    if (res->route.confirmable) {
+        uint8_t scratch_buf[16];
+        coap_rw_buffer_t scratch = { scratch_buf, sizeof(scratch_buf) };
+        coap_packet_t resp;
+
+        storage_build_response(&scratch, &resp, res);
+        struct pbuf *q = coap_build_pbuf(&resp);
+        if (q) {
+            uint16_t msg_id = (uint16_t) ((res->route.id_hi << 8) |
+                                          res->route.id_lo);
+            if (res->op == STORAGE_OP_GET_BLOCK &&
+                res->code == COAP_RSPCODE_CONTENT) {
+                exchange_block_key_t key;
+                result_block_key(res, &key);
+                exchange_cache_store_block(&key, q);
+            }
+            exchange_cache_store_response(
+                &res->route.ip, res->route.port, msg_id,
+                res->op == STORAGE_OP_GET_BLOCK ? NULL : q);
+            if (coap_send_pbuf(pcb, q, &res->route.ip, res->route.port) ==
+                ERR_OK)
+                boot_mark_first_response();
+            LOG_DEBUG("✓ Sent deferred response (%u bytes)\n", q->len);
+            pbuf_free(q);
+        } else {
+            LOG_ERROR("✗ coap_build failed\n");
+        }
+    }
+    storage_feedback(res);
+    storage_publish(res);
+}
+#endif
+
+// Registers a /file observer. The response carries no lines (the change
+// marker): the observer reads the file as it is with GET or FETCH, and is
+// notified of each append from then on.
+static int file_observe(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                        coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
+                        const ip_addr_t *addr, u16_t port)
+{
+    LOG_INFO("\n>>> /file Observe registration from: %s:%d\n\n",
+           ip4addr_ntoa(addr), port);
+
+    subscriber_t *sub = subscriber_add(addr, port, &inpkt->tok);
+    if (!sub) {
+        LOG_ERROR("✗ No free subscriber slots!\n");
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
+                                  &inpkt->tok, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                  COAP_CONTENTTYPE_NONE);
+    }
+    sub->resource = SUBSCRIBER_FILE;
+    sub->file_pos = file_tail_end();
+    LOG_DEBUG("✓ /file subscriber in slot %d (%u active)\n", subscriber_slot(sub),
+           (unsigned) subscriber_count());
+
+    int rc = coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
+                                &inpkt->tok, COAP_RSPCODE_CONTENT,
+                                COAP_CONTENTTYPE_TEXT_PLAIN);
+
+    // Encoded after this handler returns, so it must persist
+    static uint8_t obs_buf[3];
+    size_t obs_len = coap_set_option_uint(obs_buf, sub->observe_seq);
+    coap_add_option(outpkt, COAP_OPTION_OBSERVE, obs_buf, obs_len);
+    return rc;
 }
 
 // Handles incoming GET file requests; processes Block2 and sends correct block
-// or error.
+// or error. With Observe: 0 the client registers for appended lines instead.
 int handle_get_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                     coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
                     const ip_addr_t *addr, u16_t port)
 {
-    printf("Received GET /file from %s:%d\n", ip4addr_ntoa(addr), port);
+    LOG_DEBUG("Received GET /file from %s:%d\n", ip4addr_ntoa(addr), port);
 
-    // Parse Block2 option to see which block client is requesting
     uint8_t count = 0;
+    const coap_option_t *observe_opt = coap_findOptions(
+        inpkt, COAP_OPTION_OBSERVE, &count);
+    if (observe_opt && count > 0) {
+        uint32_t observe_val = coap_get_option_uint(&observe_opt->buf);
+        if (observe_val == 0) {
+            return file_observe(scratch, inpkt, outpkt, id_hi, id_lo, addr,
+                                port);
+        } else if (observe_val == 1) {
+            // Deregistration; answered like a plain GET below
+            subscriber_remove(subscriber_find(addr, port, &inpkt->tok));
+            LOG_INFO("✓ /file Observe deregistration from %s:%d\n",
+                   ip4addr_ntoa(addr), port);
+        }
+    }
+
+    // Parse Block2 option to see which block client is requesting
     const coap_option_t *block2_opt = coap_findOptions(
         inpkt, COAP_OPTION_BLOCK2, &count);
 
@@ -280,94 +1457,142 @@ int handle_get_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
         // Use cs04 helper to parse Block2 option
         if (!coap_parse_block2_option(block2_opt, &block_num, &more_requested,
                                       &szx)) {
-            printf("✗ Failed to parse Block2 option\n");
+            LOG_ERROR("✗ Failed to parse Block2 option\n");
             return coap_make_response(
                 scratch, outpkt, (uint8_t *) "Invalid Block2", 14, id_hi, id_lo,
                 &inpkt->tok, COAP_RSPCODE_BAD_REQUEST,
                 COAP_CONTENTTYPE_TEXT_PLAIN);
         }
-        printf("  Client requesting block %lu (SZX=%d)\n", block_num, szx);
+        LOG_DEFER("  Client requesting block %lu (SZX=%d)\n", block_num, szx);
     } else {
-        printf("  Initial GET request, starting from block 0\n");
+        LOG_DEBUG("  Initial GET request, starting from block 0\n");
     }
 
-    // Determine file to send based on query parameter
-    bool send_image = false;
-    const coap_option_t *query_opt = coap_findOptions(
-        inpkt, COAP_OPTION_URI_QUERY, &count);
-    if (query_opt && count > 0) {
-        if (strncmp((char *) query_opt->buf.p, "type=image", 10) == 0) {
-            send_image = true;
+    // The first block fixes the size of the whole transfer; later requests
+    // carry the size the client adopted from it
+    if (block_num == 0) {
+        uint8_t chosen = block_size_choose(addr, port, szx);
+        if (chosen != szx) {
+            LOG_DEBUG("  Block size lowered: SZX %u -> %u\n", szx, chosen);
+            szx = chosen;
         }
     }
 
-    const char *filename = send_image ? IMAGE_TO_SEND : FILE_TO_SEND;
-
-    // Visual feedback
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 50, 0, 0.5f));
-
-    hw_buzz(BUZZER_PIN, 1500, 50);
-
-    // Open file
-    FIL fil;
-    FRESULT res = f_open(&fil, filename, FA_READ);
-    if (res != FR_OK) {
-        printf("✗ Failed to open file %s: %d\n", filename, res);
-        return coap_make_response(
-            scratch, outpkt, (uint8_t *) "File not found", 14, id_hi, id_lo,
-            &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_TEXT_PLAIN);
-    }
-
-    // Calculate block size from SZX
-    uint32_t block_size = coap_block_size_from_szx(szx);
-    if (block_size > BLOCK_SIZE) {
-        block_size = BLOCK_SIZE;  // Clamp to our maximum
-        szx = 6;                  // Adjust SZX
+    // Determine file to send based on query parameter
+    const char *filename = file_for_request(inpkt);
+
+    // Visual feedback (dropped if a pattern is already playing)
+    feedback_play(FEEDBACK_GET_REQUEST);
+
+    // SD work runs in storage_get_block(), inline or on core1
+    storage_request_t *req = storage_request_begin(STORAGE_OP_GET_BLOCK, inpkt,
+                                                   id_hi, id_lo, addr, port);
+    strncpy(req->filename, filename, STORAGE_NAME_LEN - 1);
+    req->filename[STORAGE_NAME_LEN - 1] = '\0';
+    req->block_num = block_num;
+    req->szx = szx;
+
+    // Conditional GET: ETag asks for 2.03 if the client's copy is current,
+    // If-Match (a resumed download) for 4.12 if the file has changed. Only
+    // the first value is compared; our client sends one.
+    const coap_option_t *etag_opt = coap_findOptions(
+        inpkt, COAP_OPTION_IF_MATCH, &count);
+    req->if_match = etag_opt && count > 0 && etag_opt->buf.len > 0;
+    if (!req->if_match)
+        etag_opt = coap_findOptions(inpkt, COAP_OPTION_ETAG, &count);
+    if (etag_opt && count > 0 && etag_opt->buf.len > 0 &&
+        etag_opt->buf.len <= STORAGE_ETAG_LEN) {
+        req->etag_len = (uint8_t) etag_opt->buf.len;
+        memcpy(req->etag, etag_opt->buf.p, req->etag_len);
     }
+    return storage_dispatch(scratch, outpkt, req);
+}
 
-    FSIZE_t file_size = f_size(&fil);
-    uint32_t total_blocks = (file_size + block_size - 1) / block_size;
-
-    // Seek to requested block position
-    f_lseek(&fil, block_num * block_size);
+// --- Sensor/actuator representations ---
+// Text (Content-Format 0) as before, or a CBOR map (60). GETs pick with
+// Accept, PUT with Content-Format.
 
-    // Read one block
-    static uint8_t block_data[BLOCK_SIZE];
-    UINT bytes_read = 0;
-    res = f_read(&fil, block_data, block_size, &bytes_read);
-    f_close(&fil);
+// Returns the Content-Format a GET wants: text, CBOR, or -1 for an Accept
+// this server cannot produce.
+static int accept_format(const coap_packet_t *inpkt)
+{
+    uint8_t count = 0;
+    const coap_option_t *opt = coap_findOptions(inpkt, COAP_OPTION_ACCEPT,
+                                                &count);
+    if (!opt || count == 0)
+        return COAP_CONTENTTYPE_TEXT_PLAIN;
+    uint32_t fmt = coap_get_option_uint(&opt->buf);
+    if (fmt == COAP_CONTENTTYPE_TEXT_PLAIN ||
+        fmt == COAP_CONTENTTYPE_APPLICATION_CBOR)
+        return (int) fmt;
+    return -1;
+}
 
-    if (res != FR_OK) {
-        printf("✗ File read error: %d\n", res);
-        return coap_make_response(scratch, outpkt, (uint8_t *) "Read error", 10,
-                                  id_hi, id_lo, &inpkt->tok,
-                                  COAP_RSPCODE_SERVICE_UNAVAILABLE,
-                                  COAP_CONTENTTYPE_TEXT_PLAIN);
+// Bounded search for a command in a payload that is not NUL-terminated.
+static bool payload_has(const coap_buffer_t *payload, const char *word)
+{
+    size_t n = strlen(word);
+    for (size_t i = 0; i + n <= payload->len; i++) {
+        if (memcmp(&payload->p[i], word, n) == 0)
+            return true;
     }
+    return false;
+}
 
-    printf("  Sending block %lu/%lu (%u bytes, block_size=%lu)\n",
-           block_num + 1, total_blocks, bytes_read, block_size);
-
-    // Determine if there are more blocks
-    bool more_blocks = (block_num + 1) < total_blocks;
-
-    // Use cs04 helper to build Block2 response
-    uint8_t content_format = send_image ? 42 : 0;
-    coap_build_block2_response(scratch, outpkt, inpkt, id_hi, id_lo, block_num,
-                               more_blocks, szx, block_data, bytes_read,
-                               content_format);
-
-    // Visual feedback
-    if (!more_blocks) {
-        printf("✓ File transfer complete (last block)\n");
-        sleep_ms(80);
-        hw_play_file_complete_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
-    } else {
-        sleep_ms(50);
-        ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 10, 10, 0.1f));
+typedef struct {
+    uint8_t key;  // CBOR_KEY_LED or CBOR_KEY_BUZZER
+    bool on;
+} actuator_cmd_t;
+
+// Decodes a CBOR PUT /actuators body in one pass: a {key: bool} map, or an
+// array of such maps applied in order. Returns the command count, or -1 if
+// the body is malformed or holds more than ACTUATOR_BATCH_MAX commands.
+static int actuator_cbor_decode(const coap_buffer_t *payload,
+                                actuator_cmd_t *cmds)
+{
+    cbor_reader_t r;
+    cbor_reader_init(&r, payload->p, payload->len);
+
+    uint8_t major;
+    uint32_t arg;
+    if (!cbor_get_head(&r, &major, &arg))
+        return -1;
+    bool batch = major == CBOR_MAJOR_ARRAY;
+    uint32_t maps = batch ? arg : 1;
+
+    int count = 0;
+    for (uint32_t m = 0; m < maps; m++) {
+        if (batch && !cbor_get_head(&r, &major, &arg))
+            return -1;
+        if (major != CBOR_MAJOR_MAP)
+            return -1;
+        for (uint32_t e = 0; e < arg; e++) {
+            uint32_t key;
+            bool on;
+            if (count == ACTUATOR_BATCH_MAX || !cbor_get_uint(&r, &key) ||
+                key > CBOR_KEY_BUZZER || !cbor_get_bool(&r, &on))
+                return -1;
+            cmds[count].key = (uint8_t) key;
+            cmds[count++].on = on;
+        }
     }
+    return cbor_reader_done(&r) ? count : -1;
+}
 
-    return 0;  // Success
+// Drives one actuator. BUZZER off is a no-op: the buzzer only beeps.
+static void actuator_apply(const actuator_cmd_t *cmd)
+{
+    if (cmd->key == CBOR_KEY_LED) {
+        if (cmd->on)
+            hw_led_status(hw_urgb_u32(50, 50, 50, 0.5f));
+        else
+            hw_led_status(hw_urgb_u32(0, 0, 0, 0.0f));
+        led_state = cmd->on;
+    } else if (cmd->on) {
+        hw_buzz(BUZZER_PIN, 1200, 100);
+        buzzer_state = true;
+        buzzer_state = false;
+    }
 }
 
 // Handles Observe/GET for button status/notifications.
@@ -375,8 +1600,15 @@ int handle_get_buttons(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                        coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
                        const ip_addr_t *addr, u16_t port)
 {
-    printf("\n=== handle_get_buttons ===\n");
-    printf("Request from: %s:%d\n", ip4addr_ntoa(addr), port);
+    LOG_DEBUG("\n=== handle_get_buttons ===\n");
+    LOG_DEBUG("Request from: %s:%d\n", ip4addr_ntoa(addr), port);
+
+    int fmt = accept_format(inpkt);
+    if (fmt < 0) {
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
+                                  &inpkt->tok, COAP_RSPCODE_NOT_ACCEPTABLE,
+                                  COAP_CONTENTTYPE_NONE);
+    }
 
     uint8_t count = 0;
     const coap_option_t *observe_opt = coap_findOptions(
@@ -384,41 +1616,56 @@ int handle_get_buttons(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
 
     if (observe_opt && count > 0) {
         uint32_t observe_val = coap_get_option_uint(&observe_opt->buf);
-        printf("Observe value: %lu\n", observe_val);
+        LOG_DEBUG("Observe value: %lu\n", observe_val);
 
         if (observe_val == 0) {
-            printf("\n>>> Observe registration from: %s:%d\n\n",
+            LOG_INFO("\n>>> Observe registration from: %s:%d\n\n",
                    ip4addr_ntoa(addr), port);
 
-            int sub_index = add_subscriber(addr, port, &inpkt->tok);
-            if (sub_index != -1) {
+            subscriber_t *sub = subscriber_add(addr, port, &inpkt->tok);
+            if (sub) {
+                sub->resource = SUBSCRIBER_BUTTONS;
+                sub->accept = (uint16_t) fmt;
+                LOG_INFO("✓ Subscriber in slot %d (%u active, %s)\n",
+                       subscriber_slot(sub), (unsigned) subscriber_count(),
+                       fmt ? "CBOR" : "text");
                 coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
                                    &inpkt->tok, COAP_RSPCODE_CONTENT,
                                    COAP_CONTENTTYPE_TEXT_PLAIN);
 
-                uint8_t obs_buf[2];
-                size_t obs_len = coap_set_option_uint(
-                    obs_buf, subscribers[sub_index].observe_seq);
+                // Encoded after this handler returns, so it must persist
+                static uint8_t obs_buf[3];
+                size_t obs_len = coap_set_option_uint(obs_buf,
+                                                      sub->observe_seq);
                 coap_add_option(outpkt, COAP_OPTION_OBSERVE, obs_buf, obs_len);
 
-                printf("Subscription acknowledged.\n\n");
+                LOG_INFO("Subscription acknowledged.\n\n");
                 return 0;
             } else {
+                LOG_ERROR("✗ No free subscriber slots!\n");
                 return coap_make_response(
                     scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok,
                     COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_NONE);
             }
+        } else if (observe_val == 1) {
+            // Deregistration; answered like a plain GET below
+            subscriber_remove(subscriber_find(addr, port, &inpkt->tok));
+            LOG_INFO("✓ Observe deregistration from %s:%d\n",
+                   ip4addr_ntoa(addr), port);
         }
     }
 
-    char payload[64];
-    snprintf(payload, sizeof(payload), "BTN1=%d, BTN2=%d, BTN3=%d",
-             !gpio_get(BUTTON_1_PIN), !gpio_get(BUTTON_2_PIN),
-             !gpio_get(BUTTON_3_PIN));
-
+    // Kept current by the main loop's debounced button events
+    if (fmt == COAP_CONTENTTYPE_APPLICATION_CBOR) {
+        return coap_make_response(scratch, outpkt, buttons_cbor,
+                                  buttons_cbor_len, id_hi, id_lo, &inpkt->tok,
+                                  COAP_RSPCODE_CONTENT,
+                                  COAP_CONTENTTYPE_APPLICATION_CBOR);
+    }
     return coap_make_response(
-        scratch, outpkt, (const uint8_t *) payload, strlen(payload), id_hi,
-        id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+        scratch, outpkt, (const uint8_t *) buttons_payload.text,
+        buttons_payload.len, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT,
+        COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
 // Handles GET for actuator status (LED/buzzer).
@@ -426,49 +1673,76 @@ int handle_get_actuators(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                          coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
                          const ip_addr_t *addr, u16_t port)
 {
-    printf("Received GET /actuators from %s:%d\n", ip4addr_ntoa(addr), port);
-
-    char payload[64];
-    snprintf(payload, sizeof(payload), "LED=%s,BUZZER=%s",
-             led_state ? "ON" : "OFF", buzzer_state ? "ON" : "OFF");
+    LOG_DEBUG("Received GET /actuators from %s:%d\n", ip4addr_ntoa(addr), port);
 
-    printf("📤 Sending actuator status: %s\n", payload);
+    LOG_DEBUG("📤 Sending actuator status: %s\n", actuators_payload.text);
 
+    int fmt = accept_format(inpkt);
+    if (fmt < 0) {
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
+                                  &inpkt->tok, COAP_RSPCODE_NOT_ACCEPTABLE,
+                                  COAP_CONTENTTYPE_NONE);
+    } else if (fmt == COAP_CONTENTTYPE_APPLICATION_CBOR) {
+        return coap_make_response(scratch, outpkt, actuators_cbor,
+                                  actuators_cbor_len, id_hi, id_lo,
+                                  &inpkt->tok, COAP_RSPCODE_CONTENT,
+                                  COAP_CONTENTTYPE_APPLICATION_CBOR);
+    }
     return coap_make_response(
-        scratch, outpkt, (const uint8_t *) payload, strlen(payload), id_hi,
-        id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+        scratch, outpkt, (const uint8_t *) actuators_payload.text,
+        actuators_payload.len, id_hi, id_lo, &inpkt->tok,
+        COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
-// Handles PUT requests to modify actuator state.
+// Handles PUT requests to modify actuator state. A text body is scanned
+// for LED=ON/LED=OFF/BUZZER=ON; a CBOR body may batch several commands.
 int handle_put_actuators(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                          coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
                          const ip_addr_t *addr, u16_t port)
 {
-    printf("Received PUT /actuators from %s:%d\n", ip4addr_ntoa(addr), port);
-
-    if (inpkt->payload.len > 0) {
-        printf("📥 Received payload (%d bytes): %.*s\n", inpkt->payload.len,
-               inpkt->payload.len, inpkt->payload.p);
-    }
+    LOG_DEBUG("Received PUT /actuators from %s:%d\n", ip4addr_ntoa(addr), port);
 
     if (inpkt->payload.len == 0)
         return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
                                   &inpkt->tok, COAP_RSPCODE_BAD_REQUEST,
                                   COAP_CONTENTTYPE_NONE);
 
-    if (strstr((char *) inpkt->payload.p, "LED=ON")) {
-        ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(50, 50, 50, 0.5f));
-        led_state = true;
-    } else if (strstr((char *) inpkt->payload.p, "LED=OFF")) {
-        ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 0, 0, 0.0f));
-        led_state = false;
+    uint8_t count = 0;
+    const coap_option_t *cf_opt = coap_findOptions(
+        inpkt, COAP_OPTION_CONTENT_FORMAT, &count);
+    uint32_t cf = (cf_opt && count > 0) ? coap_get_option_uint(&cf_opt->buf)
+                                        : COAP_CONTENTTYPE_TEXT_PLAIN;
+
+    actuator_cmd_t cmds[ACTUATOR_BATCH_MAX];
+    int n = 0;
+    if (cf == COAP_CONTENTTYPE_APPLICATION_CBOR) {
+        n = actuator_cbor_decode(&inpkt->payload, cmds);
+        LOG_DEBUG("📥 Received CBOR payload (%d bytes, %d commands)\n",
+               inpkt->payload.len, n);
+        if (n < 0)
+            return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
+                                      &inpkt->tok, COAP_RSPCODE_BAD_REQUEST,
+                                      COAP_CONTENTTYPE_NONE);
+    } else if (cf == COAP_CONTENTTYPE_TEXT_PLAIN) {
+        LOG_DEBUG("📥 Received payload (%d bytes): %.*s\n", inpkt->payload.len,
+               inpkt->payload.len, inpkt->payload.p);
+        if (payload_has(&inpkt->payload, "LED=ON")) {
+            cmds[n++] = (actuator_cmd_t) { CBOR_KEY_LED, true };
+        } else if (payload_has(&inpkt->payload, "LED=OFF")) {
+            cmds[n++] = (actuator_cmd_t) { CBOR_KEY_LED, false };
+        }
+        if (payload_has(&inpkt->payload, "BUZZER=ON"))
+            cmds[n++] = (actuator_cmd_t) { CBOR_KEY_BUZZER, true };
+    } else {
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo,
+                                  &inpkt->tok,
+                                  COAP_RSPCODE_UNSUPPORTED_CONTENT_FORMAT,
+                                  COAP_CONTENTTYPE_NONE);
     }
 
-    if (strstr((char *) inpkt->payload.p, "BUZZER=ON")) {
-        hw_buzz(BUZZER_PIN, 1200, 100);
-        buzzer_state = true;
-        buzzer_state = false;
-    }
+    for (int i = 0; i < n; i++)
+        actuator_apply(&cmds[i]);
+    actuators_refresh();
 
     const char *resp = "OK";
     return coap_make_response(scratch, outpkt, (uint8_t *) resp, strlen(resp),
@@ -476,57 +1750,125 @@ int handle_put_actuators(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                               COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
-// Handles iPATCH requests to append lines to file.
+// Queues one block of a PUT/iPATCH upload for the storage side. A request
+// without Block1 is a one-block upload. A block too big for a storage
+// request gets 4.13 with the Block1 size to use (RFC 7959 section 2.9.3).
+static int upload_dispatch(coap_rw_buffer_t *scratch,
+                           const coap_packet_t *inpkt, coap_packet_t *outpkt,
+                           uint8_t idhi, uint8_t idlo, const ip_addr_t *addr,
+                           u16_t port, const char *target, bool replace)
+{
+    uint32_t block_num = 0;
+    bool more = false;
+    uint8_t szx = UPLOAD_SZX_MAX;
+    uint8_t count = 0;
+    const coap_option_t *block1_opt = coap_findOptions(
+        inpkt, COAP_OPTION_BLOCK1, &count);
+    if (block1_opt && count > 0)
+        coap_parse_block1_option(block1_opt, &block_num, &more, &szx);
+
+    if (szx > UPLOAD_SZX_MAX || inpkt->payload.len > STORAGE_REQUEST_DATA) {
+        LOG_ERROR("✗ Upload block too large (SZX %u, %d bytes)\n", szx,
+               inpkt->payload.len);
+        int rc = coap_make_response(scratch, outpkt, NULL, 0, idhi, idlo,
+                                    &inpkt->tok,
+                                    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE,
+                                    COAP_CONTENTTYPE_NONE);
+        static uint8_t hint_buf[3];  // Encoded after this returns
+        size_t len = coap_encode_block1_option(hint_buf, 0, false,
+                                               UPLOAD_SZX_MAX);
+        if (rc == 0)
+            coap_add_option(outpkt, COAP_OPTION_BLOCK1, hint_buf, len);
+        return rc;
+    }
+
+    LOG_DEBUG("📥 Upload block %lu%s (%d bytes) for %s\n", block_num,
+           more ? "" : " (last)", inpkt->payload.len, target);
+
+    // Blocks sent before the upload lands are stale
+    if (!more)
+        exchange_cache_forget_blocks();
+
+    storage_request_t *req = storage_request_begin(STORAGE_OP_UPLOAD, inpkt,
+                                                   idhi, idlo, addr, port);
+    strncpy(req->filename, target, STORAGE_NAME_LEN - 1);
+    req->block_num = block_num;
+    req->more = more;
+    req->szx = szx;
+    req->replace = replace;
+    req->len = inpkt->payload.len;
+    memcpy(req->data, inpkt->payload.p, inpkt->payload.len);
+    return storage_dispatch(scratch, outpkt, req);
+}
+
+// Handles PUT requests that replace the file (?type=image for the image).
+// The body may be sent in Block1 blocks; the file is swapped in once the
+// last one has arrived.
+int handle_put_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                    coap_packet_t *outpkt, uint8_t idhi, uint8_t idlo,
+                    const ip_addr_t *addr, u16_t port)
+{
+    LOG_DEBUG("Received PUT /file from %s:%d\n", ip4addr_ntoa(addr), port);
+    return upload_dispatch(scratch, inpkt, outpkt, idhi, idlo, addr, port,
+                           file_for_request(inpkt), true);
+}
+
+// Handles iPATCH requests to append lines to file. The payload is one line,
+// or a batch of lines separated by '\n' that is appended as a unit. Larger
+// batches arrive as a Block1 upload and are appended once complete.
 int handle_ipatch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                        coap_packet_t *outpkt, uint8_t idhi, uint8_t idlo,
                        const ip_addr_t *addr, u16_t port)
 {
-    printf("Received iPATCH /file from %s:%d\n", ip4addr_ntoa(addr), port);
+    LOG_DEBUG("Received iPATCH /file from %s:%d\n", ip4addr_ntoa(addr), port);
+
+    feedback_play(FEEDBACK_IPATCH_REQUEST);
 
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(50, 20, 0, 0.5f));
-    hw_buzz(BUZZER_PIN, 1400, 50);
+    uint8_t block1_count = 0;
+    if (coap_findOptions(inpkt, COAP_OPTION_BLOCK1, &block1_count) &&
+        block1_count > 0) {
+        return upload_dispatch(scratch, inpkt, outpkt, idhi, idlo, addr, port,
+                               FILE_TO_SEND, false);
+    }
 
     if (inpkt->payload.len == 0) {
-        printf("⚠️ No payload in iPATCH request\n");
+        LOG_WARN("⚠️ No payload in iPATCH request\n");
         return coap_make_response(scratch, outpkt, NULL, 0, idhi, idlo,
                                   &inpkt->tok, COAP_RSPCODE_BAD_REQUEST,
                                   COAP_CONTENTTYPE_NONE);
     }
 
-    printf("📥 Received append payload (%d bytes): '%.*s'\n",
+    LOG_DEBUG("📥 Received append payload (%d bytes): '%.*s'\n",
            inpkt->payload.len, inpkt->payload.len, inpkt->payload.p);
 
-    FIL file;
-    FRESULT fr = f_open(&file, FILE_TO_SEND, FA_OPEN_APPEND | FA_WRITE);
+    // The journal adds the final newline itself
+    size_t len = inpkt->payload.len;
+    if (inpkt->payload.p[len - 1] == '\n')
+        len--;
 
-    if (fr != FR_OK) {
-        printf("✗ Failed to open file for append: %d\n", fr);
+    if (len > STORAGE_REQUEST_DATA) {
+        LOG_ERROR("✗ Append payload too large (%d bytes)\n", inpkt->payload.len);
         return coap_make_response(scratch, outpkt, NULL, 0, idhi, idlo,
-                                  &inpkt->tok, COAP_RSPCODE_SERVICE_UNAVAILABLE,
+                                  &inpkt->tok,
+                                  COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE,
                                   COAP_CONTENTTYPE_NONE);
     }
 
-    UINT bytes_written = 0;
-    fr = f_write(&file, inpkt->payload.p, inpkt->payload.len, &bytes_written);
-
-    if (fr == FR_OK) {
-        f_write(&file, "\n", 1, &bytes_written);
-        f_close(&file);
-        printf("✓ Appended %d bytes to file\n", inpkt->payload.len);
-
-        hw_play_string_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
-
-        const char *resp = "Appended";
-        return coap_make_response(
-            scratch, outpkt, (uint8_t *) resp, strlen(resp), idhi, idlo,
-            &inpkt->tok, COAP_RSPCODE_CHANGED, COAP_CONTENTTYPE_TEXT_PLAIN);
-    } else {
-        f_close(&file);
-        printf("✗ Failed to write to file: %d\n", fr);
-        return coap_make_response(scratch, outpkt, NULL, 0, idhi, idlo,
-                                  &inpkt->tok, COAP_RSPCODE_SERVICE_UNAVAILABLE,
-                                  COAP_CONTENTTYPE_NONE);
-    }
+    // Client may ask for the ACK only once the line is on the card
+    uint8_t count = 0;
+    bool durable = coap_findOptions(inpkt, CS04_OPTION_DURABLE, &count) &&
+                   count > 0;
+
+    // Blocks sent before this append are stale
+    exchange_cache_forget_blocks();
+
+    storage_request_t *req = storage_request_begin(STORAGE_OP_APPEND, inpkt,
+                                                   idhi, idlo, addr, port);
+    req->durable = durable;
+    req->lines = (uint16_t) append_batch_count_lines(inpkt->payload.p, len);
+    req->len = (uint16_t) len;
+    memcpy(req->data, inpkt->payload.p, len);
+    return storage_dispatch(scratch, outpkt, req);
 }
 
 // Handles FETCH requests for specific file lines.
@@ -534,10 +1876,9 @@ int handle_fetch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
                       coap_packet_t *outpkt, uint8_t idhi, uint8_t idlo,
                       const ip_addr_t *addr, u16_t port)
 {
-    printf("Received FETCH /file from %s:%d\n", ip4addr_ntoa(addr), port);
+    LOG_DEBUG("Received FETCH /file from %s:%d\n", ip4addr_ntoa(addr), port);
 
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 20, 50, 0.5f));
-    hw_buzz(BUZZER_PIN, 1600, 50);
+    feedback_play(FEEDBACK_FETCH_REQUEST);
 
     // ✅ Step 1: Validate Content-Format option is present
     uint8_t count = 0;
@@ -545,7 +1886,7 @@ int handle_fetch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
         inpkt, COAP_OPTION_CONTENT_FORMAT, &count);
 
     if (!cf_opt || count == 0) {
-        printf("✗ Missing Content-Format option\n");
+        LOG_ERROR("✗ Missing Content-Format option\n");
         return coap_make_response(
             scratch, outpkt, (uint8_t *) "Content-Format required", 23, idhi,
             idlo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST,
@@ -556,7 +1897,7 @@ int handle_fetch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
     uint32_t content_format = coap_get_option_uint(&cf_opt->buf);
 
     if (content_format != COAP_CONTENTTYPE_TEXT_PLAIN) {
-        printf(
+        LOG_ERROR(
             "✗ Unsupported Content-Format: %lu (expected 0 for text/plain)\n",
             content_format);
         return coap_make_response(
@@ -567,7 +1908,7 @@ int handle_fetch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
 
     // ✅ Step 3: Validate payload is not empty
     if (inpkt->payload.len == 0) {
-        printf("✗ Empty FETCH payload\n");
+        LOG_ERROR("✗ Empty FETCH payload\n");
         return coap_make_response(
             scratch, outpkt, (uint8_t *) "Empty payload", 13, idhi, idlo,
             &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
@@ -587,13 +1928,13 @@ int handle_fetch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
         *comma = '\0';
         start_line = atoi(line_count_str);
         end_line = atoi(comma + 1);
-        printf("📖 Parsed: lines %d to %d (inclusive)\n", start_line, end_line);
+        LOG_DEBUG("📖 Parsed: lines %d to %d (inclusive)\n", start_line, end_line);
     } else {
         int num = atoi(line_count_str);
         if (num > 0) {
             end_line = num - 1;
         }
-        printf("📖 Parsed: first %d lines (0-%d)\n", num, end_line);
+        LOG_DEBUG("📖 Parsed: first %d lines (0-%d)\n", num, end_line);
     }
 
     // ✅ Calculate number of lines requested
@@ -601,152 +1942,187 @@ int handle_fetch_file(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
 
     // ✅ Step 5: Validate ONLY invalid inputs (negative or reversed)
     if (start_line < 0) {
-        printf("✗ Invalid start line: %d (must be >= 0)\n", start_line);
+        LOG_ERROR("✗ Invalid start line: %d (must be >= 0)\n", start_line);
         return coap_make_response(
             scratch, outpkt, (uint8_t *) "Invalid start line", 18, idhi, idlo,
             &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
     }
 
     if (end_line < 0) {
-        printf("✗ Invalid end line: %d (must be >= 0)\n", end_line);
+        LOG_ERROR("✗ Invalid end line: %d (must be >= 0)\n", end_line);
         return coap_make_response(
             scratch, outpkt, (uint8_t *) "Invalid end line", 16, idhi, idlo,
             &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
     }
 
     if (end_line < start_line) {
-        printf("✗ End line (%d) must be >= start line (%d)\n", end_line,
+        LOG_ERROR("✗ End line (%d) must be >= start line (%d)\n", end_line,
                start_line);
         return coap_make_response(
             scratch, outpkt, (uint8_t *) "Invalid range", 13, idhi, idlo,
             &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
     }
 
-    printf("📖 Fetching lines %d to %d (%d lines requested)\n", start_line,
+    LOG_DEBUG("📖 Fetching lines %d to %d (%d lines requested)\n", start_line,
            end_line, num_lines);
 
-    // ✅ Step 6: Open file and start reading
-    FIL file;
-    FRESULT fr = f_open(&file, FILE_TO_SEND, FA_READ);
-
-    if (fr != FR_OK) {
-        printf("✗ Failed to open file: %d\n", fr);
+    // ✅ Step 6: Block2 option selects a continuation block of the result
+    uint32_t block_num = 0;
+    uint8_t szx = 6;
+    bool more_requested = false;
+    const coap_option_t *block2_opt = coap_findOptions(
+        inpkt, COAP_OPTION_BLOCK2, &count);
+    bool blockwise = block2_opt && count > 0;
+    if (blockwise && !coap_parse_block2_option(block2_opt, &block_num,
+                                               &more_requested, &szx)) {
+        LOG_ERROR("✗ Failed to parse Block2 option\n");
         return coap_make_response(
-            scratch, outpkt, (uint8_t *) "File not found", 14, idhi, idlo,
-            &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_TEXT_PLAIN);
-    }
-
-#define FETCH_BUFFER_SIZE 1024
-    static char fetch_buffer[FETCH_BUFFER_SIZE];
-    int buffer_pos = 0;
-    int lines_read = 0;
-    char line[256];
-    bool buffer_full = false;
-
-    // ✅ Skip to start_line
-    int current_line = 0;
-    while (current_line < start_line &&
-           f_gets(line, sizeof(line), &file) != NULL) {
-        current_line++;
-    }
-
-    // Check if we reached start_line or hit EOF early
-    if (current_line < start_line) {
-        // Started beyond file length
-        f_close(&file);
-        printf("⚠️ Start line %d is beyond file length (file has ~%d lines)\n",
-               start_line, current_line);
-        // Return empty payload (graceful)
-        return coap_make_response(scratch, outpkt, NULL, 0, idhi, idlo,
-                                  &inpkt->tok, COAP_RSPCODE_CONTENT,
-                                  COAP_CONTENTTYPE_TEXT_PLAIN);
+            scratch, outpkt, (uint8_t *) "Invalid Block2", 14, idhi, idlo,
+            &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
     }
 
-    // ✅ Read from start_line to end_line (or until buffer full)
-    while (lines_read < num_lines &&
-           f_gets(line, sizeof(line), &file) != NULL) {
-        int line_len = strlen(line);
-
-        // ✅ Check if adding this line would overflow buffer
-        if (buffer_pos + line_len >= FETCH_BUFFER_SIZE) {
-            printf("⚠️ Buffer would overflow! Stopping at line %d (read %d of "
-                   "%d requested)\n",
-                   start_line + lines_read, lines_read, num_lines);
-            buffer_full = true;
-            break;  // Stop reading, send what we have
-        }
+    storage_request_t *req = storage_request_begin(STORAGE_OP_FETCH, inpkt,
+                                                   idhi, idlo, addr, port);
+    req->block_num = block_num;
+    req->szx = szx;
+    req->blockwise = blockwise;
+    req->start_line = start_line;
+    req->end_line = end_line;
+    return storage_dispatch(scratch, outpkt, req);
+}
 
-        // Add line to buffer
-        memcpy(&fetch_buffer[buffer_pos], line, line_len);
-        buffer_pos += line_len;
-        lines_read++;
+// Handles GET /metrics: runtime counters for the fleet collector, one
+// "<group> key=value ..." line per group. Counters kept by core1 (storage
+// latency, caches) are read without a lock and may be one request behind.
+// Subscribers that do not fit in METRICS_REPORT_MAX are left out.
+int handle_get_metrics(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                       coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
+                       const ip_addr_t *addr, u16_t port)
+{
+    (void) addr;
+    (void) port;
+
+    // Encoded after this handler returns, so it must persist
+    static char report[METRICS_REPORT_MAX];
+    metrics_writer_t w;
+    metrics_begin(&w, report, sizeof(report));
+    metrics_line(&w, "uptime ms=%lu\n",
+                 (unsigned long) to_ms_since_boot(get_absolute_time()));
+    metrics_put_common(&w);
+
+    const exchange_cache_stats_t *ex = exchange_cache_get_stats();
+    metrics_line(&w,
+                 "dup replays=%lu in_progress=%lu no_response=%lu "
+                 "block_hits=%lu\n",
+                 (unsigned long) ex->replays, (unsigned long) ex->in_progress,
+                 (unsigned long) ex->no_response,
+                 (unsigned long) ex->block_hits);
+    metrics_put_latency(&w, "storage read", &storage_read_latency);
+    metrics_put_latency(&w, "storage write", &storage_write_latency);
+
+    const hot_cache_stats_t *hs = hot_cache_get_stats();
+    metrics_line(&w, "cache hot hits=%lu misses=%lu loads=%lu evictions=%lu\n",
+                 (unsigned long) hs->hits, (unsigned long) hs->misses,
+                 (unsigned long) hs->loads, (unsigned long) hs->evictions);
+    const prefetch_stats_t *ps = prefetch_get_stats();
+    metrics_line(&w, "cache prefetch hits=%lu misses=%lu reads=%lu\n",
+                 (unsigned long) ps->hits, (unsigned long) ps->misses,
+                 (unsigned long) ps->reads);
+
+    notify_stats_t ns;
+    notify_get_stats(&ns);
+    metrics_line(&w,
+                 "notify con=%lu non=%lu coalesced=%lu rate_limited=%lu "
+                 "dropped=%lu\n",
+                 (unsigned long) ns.sent_con, (unsigned long) ns.sent_non,
+                 (unsigned long) ns.coalesced,
+                 (unsigned long) ns.rate_limited, (unsigned long) ns.dropped);
+    metrics_line(&w, "subscribers active=%u/%u\n",
+                 (unsigned) subscriber_count(), SUBSCRIBER_MAX);
+    for (subscriber_t *sub = subscriber_first(); sub;
+         sub = subscriber_next(sub)) {
+        if (!metrics_line(&w,
+                          "sub %d res=%s seq=%u sent=%lu acked=%lu "
+                          "failed=%lu timeouts=%lu\n",
+                          subscriber_slot(sub),
+                          sub->resource == SUBSCRIBER_FILE ? "file"
+                                                           : "buttons",
+                          sub->observe_seq, (unsigned long) sub->sent,
+                          (unsigned long) sub->acked,
+                          (unsigned long) sub->failed,
+                          (unsigned long) sub->timeout_sessions))
+            break;
     }
 
-    f_close(&file);
-
-    // ✅ Determine response based on what happened
-    if (buffer_full) {
-        // Buffer filled before completing request
-        printf("⚠️ Buffer full! Returning %d lines (requested %d)\n", lines_read,
-               num_lines);
-
-        return coap_make_response(
-            scratch, outpkt, (uint8_t *) fetch_buffer, buffer_pos, idhi, idlo,
-            &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
-
-    } else if (lines_read == 0) {
-        // No lines read (start was beyond EOF or file empty)
-        printf("⚠️ No lines read (file might be empty or start beyond EOF)\n");
-        return coap_make_response(scratch, outpkt, NULL, 0, idhi, idlo,
-                                  &inpkt->tok, COAP_RSPCODE_CONTENT,
-                                  COAP_CONTENTTYPE_TEXT_PLAIN);
-
-    } else {
-        // Success: got all requested lines (or file ended naturally)
-        printf("✓ Successfully read %d lines (%d bytes) from lines %d to %d\n",
-               lines_read, buffer_pos, start_line, start_line + lines_read - 1);
-
-        hw_play_fetch_signal(pio_ws2812, sm_ws2812, BUZZER_PIN);
+    return coap_make_response(scratch, outpkt, (const uint8_t *) report, w.len,
+                              id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT,
+                              COAP_CONTENTTYPE_TEXT_PLAIN);
+}
 
-        return coap_make_response(
-            scratch, outpkt, (uint8_t *) fetch_buffer, buffer_pos, idhi, idlo,
-            &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
-    }
+#if CS04_TRACE
+// Handles GET /.well-known/stats: per-stage latency summary from cs04_trace,
+// one line per stage. Read it without the USB console attached for timings
+// that printf does not distort.
+int handle_get_stats(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                     coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo,
+                     const ip_addr_t *addr, u16_t port)
+{
+    (void) addr;
+    (void) port;
+
+    // Encoded after this handler returns, so it must persist
+    static char report[512];
+    size_t len = trace_format(report, sizeof(report));
+    return coap_make_response(scratch, outpkt, (const uint8_t *) report, len,
+                              id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT,
+                              COAP_CONTENTTYPE_TEXT_PLAIN);
 }
+#endif
 
 // UDP packet receive callback. Handles all incoming UDP/CoAP packets.
 void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                        const ip_addr_t *addr, u16_t port)
 {
-    printf("\n--- UDP packet from %s:%d ---\n", ip4addr_ntoa(addr), port);
+    uint32_t t_rx = TRACE_START();
+    LOG_DEBUG("\n--- UDP packet from %s:%d ---\n", ip4addr_ntoa(addr), port);
 
+    // Chained (reassembled) datagrams are parsed in place where possible;
+    // only a payload that spans segments is gathered here
+    static uint8_t rx_gather[COAP_RX_GATHER_MAX];
     coap_packet_t pkt = { 0 };
-    int parse_rc = coap_parse(&pkt, (const uint8_t *) p->payload, p->len);
+    int parse_rc = coap_parse_pbuf(&pkt, p, rx_gather, sizeof(rx_gather));
 
     if (parse_rc != 0) {
-        printf("Parse failed! Error=%d\n", parse_rc);
+        LOG_WARN("Parse failed! Error=%d\n", parse_rc);
         pbuf_free(p);
         return;
     }
+    uint32_t t = TRACE_LAP(TRACE_PARSE, t_rx);
 
     // Handle ACK
     if (pkt.hdr.t == COAP_TYPE_ACK) {
         uint16_t msg_id = coap_extract_msg_id(&pkt);
-        printf("✓ Received ACK for msg_id 0x%04X\n", msg_id);
+        LOG_DEFER("✓ Received ACK for msg_id 0x%04X\n", msg_id);
         coap_clear_pending_message(msg_id);
 
-        for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
-            if (subscribers[i].active &&
-                ip_addr_cmp(&subscribers[i].ip, addr) &&
-                subscribers[i].port == port) {
-                subscribers[i].last_ack_time = to_ms_since_boot(
-                    get_absolute_time());
-                subscribers[i].timeout_sessions = 0;
-                printf("✓ Subscriber %d timeout session count reset to 0\n", i);
-                break;
-            }
+        subscriber_t *sub = subscriber_on_ack(msg_id);
+        if (sub) {
+            LOG_DEBUG("✓ Subscriber %d timeout session count reset to 0\n",
+                   subscriber_slot(sub));
+            notify_settled(sub);
         }
 
+        TRACE_LAP(TRACE_ACK, t);
+        pbuf_free(p);
+        return;
+    }
+
+    // Handle RST (observer rejected a notification)
+    if (pkt.hdr.t == COAP_TYPE_RESET) {
+        uint16_t msg_id = coap_extract_msg_id(&pkt);
+        LOG_WARN("⚠️ Received RST for msg_id 0x%04X\n", msg_id);
+        coap_clear_pending_message(msg_id);
+        subscriber_on_reset(msg_id);
         pbuf_free(p);
         return;
     }
@@ -755,91 +2131,90 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
     if (pkt.hdr.t == COAP_TYPE_CON || pkt.hdr.t == COAP_TYPE_NONCON) {
         uint16_t msg_id = coap_extract_msg_id(&pkt);
 
-        // Check if it's a GET request to /file (skip duplicate detection for
-        // block transfers)
-        bool is_get_file_request = false;
-        if (pkt.hdr.code == COAP_METHOD_GET) {
-            uint8_t path_count = 0;
-            const coap_option_t *path_opt = coap_findOptions(
-                &pkt, COAP_OPTION_URI_PATH, &path_count);
-            if (path_opt && path_count > 0) {
-                if (path_opt->buf.len == 4 &&
-                    strncmp((char *) path_opt->buf.p, "file", 4) == 0) {
-                    is_get_file_request = true;
-                    printf("  GET /file request (bypassing duplicate "
-                           "detection)\n");
-                }
-            }
+        // ✅ Duplicate detection per (ip, port, msg_id)
+        struct pbuf *cached = NULL;
+        exchange_state_t state = exchange_cache_lookup(addr, port, msg_id,
+                                                       &cached);
+        bool safe_method = pkt.hdr.code == COAP_METHOD_GET ||
+                           pkt.hdr.code == COAP_METHOD_FETCH;
+
+        // A repeat means the request or our response was lost on the way
+        if (state != EXCHANGE_NEW)
+            coap_peer_note_request(addr, port, true);
+
+        if (state == EXCHANGE_REPLAY) {
+            LOG_WARN("⚠️ Duplicate request (0x%04X), replaying response\n",
+                   msg_id);
+            coap_send_pbuf(pcb, cached, addr, port);
+            pbuf_free(p);
+            return;
         }
-
-        // ✅ Duplicate detection (but SKIP for GET /file)
-        if (!is_get_file_request &&
-            coap_is_duplicate_message(&server_dup_detector, msg_id)) {
-            printf("⚠️ Duplicate CON request (0x%04X), sending ACK\n", msg_id);
+        if (state == EXCHANGE_IN_PROGRESS ||
+            (state == EXCHANGE_NO_RESPONSE && pkt.hdr.t != COAP_TYPE_CON)) {
+            LOG_WARN("⚠️ Duplicate request (0x%04X), ignored\n", msg_id);
+            pbuf_free(p);
+            return;
+        }
+        if (state == EXCHANGE_NO_RESPONSE && !safe_method) {
+            // Response no longer cached; re-running would repeat the write
+            LOG_WARN("⚠️ Duplicate CON request (0x%04X), sending ACK\n", msg_id);
             coap_send_ack(pcb, addr, port, &pkt, NULL, 0);
             pbuf_free(p);
             return;
         }
 
-
-        // Record message ID (but skip GET /file to avoid blocking subsequent
-        // blocks)
-        if (!is_get_file_request) {
-            coap_record_message_id(&server_dup_detector, msg_id);
+        if (state == EXCHANGE_NEW) {
+            exchange_cache_record(addr, port, msg_id);
         }
 
+        // A GET /file block that was already sent (re-requested under a new
+        // message ID, or its exchange kept no copy) is answered from the
+        // last-sent response instead of reading the SD card again
+        exchange_block_key_t block_key;
+        bool is_file_block = pkt.hdr.t == COAP_TYPE_CON &&
+                             file_block_key(&pkt, addr, port, &block_key);
+        bool block_sent = is_file_block &&
+                          exchange_cache_find_block(&block_key, &cached);
+        if (state == EXCHANGE_NEW)
+            coap_peer_note_request(addr, port, block_sent);
+        if (block_sent) {
+            struct pbuf *q = exchange_cache_rebind(cached, msg_id);
+            if (q) {
+                err_t send_result = coap_send_pbuf(pcb, q, addr, port);
+                pbuf_free(q);
+                if (send_result == ERR_OK) {
+                    exchange_cache_store_response(addr, port, msg_id, NULL);
+                    LOG_DEFER("✓ Block %lu resent from cache\n",
+                              block_key.block_num);
+                    pbuf_free(p);
+                    return;
+                }
+                // Not answered: the handler below builds the block again
+                LOG_WARN("⚠️ Resend of cached block %lu failed: %d\n",
+                         block_key.block_num, send_result);
+            }
+        }
 
-        uint8_t scratch_buf[1536];  // ⚡ INCREASED from 256 to 1536 for FETCH
-                                    // responses
-        coap_rw_buffer_t scratch = { scratch_buf, sizeof(scratch_buf) };
+        // Handler scratch (option values) comes from the packet pool; the
+        // response is encoded into its own pool pbuf below
+        uint8_t *scratch_buf = packet_pool_alloc(PACKET_POOL_SMALL_SIZE);
+        if (!scratch_buf) {
+            LOG_ERROR("✗ Packet pool exhausted, dropping request\n");
+            pbuf_free(p);
+            return;
+        }
+        coap_rw_buffer_t scratch = { scratch_buf, PACKET_POOL_SMALL_SIZE };
         coap_packet_t resp;
 
         int handler_result = -1;
-        const coap_endpoint_t *ep = endpoints;
-
-        while (ep->handler != NULL) {
-            if (ep->method != pkt.hdr.code) {
-                ep++;
-                continue;
-            }
-
-            const coap_option_t *opt;
-            uint8_t count;
-
-            if (NULL !=
-                (opt = coap_findOptions(&pkt, COAP_OPTION_URI_PATH, &count))) {
-                if (count != ep->path->count) {
-                    ep++;
-                    continue;
-                }
-
-                bool path_match = true;
-                for (int i = 0; i < count; i++) {
-                    if (opt[i].buf.len != strlen(ep->path->elems[i]) ||
-                        memcmp(ep->path->elems[i], opt[i].buf.p,
-                               opt[i].buf.len) != 0) {
-                        path_match = false;
-                        break;
-                    }
-                }
-
-                if (!path_match) {
-                    ep++;
-                    continue;
-                }
-
-            } else if (ep->path->count > 0) {
-                ep++;
-                continue;
-            }
-
-            printf("MATCH FOUND! Dispatching to handler...\n");
-            handler_result = ((int (*)(
-                coap_rw_buffer_t *, const coap_packet_t *, coap_packet_t *,
-                uint8_t, uint8_t, const ip_addr_t *, u16_t)) ep->handler)(
-                &scratch, &pkt, &resp, pkt.hdr.id[0], pkt.hdr.id[1], addr,
-                port);
-            break;
+        t = TRACE_START();
+        const dispatch_route_t *route = dispatch_lookup(&dispatch_table, &pkt);
+
+        if (route) {
+            LOG_DEFER("MATCH FOUND! Dispatching to handler...\n");
+            handler_result = route->handler(&scratch, &pkt, &resp,
+                                            pkt.hdr.id[0], pkt.hdr.id[1], addr,
+                                            port);
         }
 
         if (handler_result == -1) {
@@ -848,34 +2223,51 @@ void udp_recv_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
                                COAP_CONTENTTYPE_NONE);
             handler_result = 0;
         }
+        t = TRACE_LAP(TRACE_HANDLER, t);
 
         // ⚡ FIX: Send response if handler succeeded AND request was CON
         if (handler_result == 0 && pkt.hdr.t == COAP_TYPE_CON) {
-            size_t resplen = sizeof(scratch_buf);
-            int build_rc = coap_build(scratch_buf, &resplen, &resp);
-
-            // printf("🔍 DEBUG: handler_result=%d, build_rc=%d, resplen=%zu\n",
-            //    handler_result, build_rc, resplen);
-
-            if (build_rc == 0) {
-                struct pbuf *q = pbuf_alloc(PBUF_TRANSPORT, resplen, PBUF_RAM);
-                if (q) {
-                    memcpy(q->payload, scratch_buf, resplen);
-                    err_t send_result = udp_sendto(pcb, q, addr, port);
-                    pbuf_free(q);
-
-                    if (send_result == ERR_OK) {
-                        printf("✓ Sent response (%zu bytes)\n", resplen);
-                    } else {
-                        printf("✗ udp_sendto failed: %d\n", send_result);
-                    }
+            struct pbuf *q = response_payload
+                                 ? coap_build_pbuf_chain(&resp,
+                                                         response_payload)
+                                 : coap_build_pbuf(&resp);
+            response_payload = NULL;
+            t = TRACE_LAP(TRACE_BUILD, t);
+            if (q) {
+                u16_t resplen = q->tot_len;
+                if (is_file_block && resp.hdr.code == COAP_RSPCODE_CONTENT) {
+                    // Blocks are kept once, in the block cache
+                    exchange_cache_store_block(&block_key, q);
+                    exchange_cache_store_response(addr, port, msg_id, NULL);
+                } else {
+                    exchange_cache_store_response(addr, port, msg_id, q);
+                }
+                // Cached for replay, so send through a reference view
+                err_t send_result = coap_send_pbuf(pcb, q, addr, port);
+                TRACE_LAP(TRACE_SEND, t);
+                TRACE_LAP(TRACE_REQUEST, t_rx);
+                pbuf_free(q);
+
+                if (send_result == ERR_OK) {
+                    boot_mark_first_response();
+                    LOG_DEFER("✓ Sent response (%u bytes)\n", resplen);
                 } else {
-                    printf("✗ pbuf_alloc failed!\n");
+                    LOG_ERROR("✗ udp_sendto failed: %d\n", send_result);
                 }
             } else {
-                printf("✗ coap_build failed: %d\n", build_rc);
+                LOG_ERROR("✗ coap_build failed!\n");
+                exchange_cache_store_response(addr, port, msg_id, NULL);
             }
+        } else if (handler_result != HANDLER_DEFERRED) {
+            // Nothing to replay (NON or failed handler); stop treating
+            // duplicates as in progress
+            exchange_cache_store_response(addr, port, msg_id, NULL);
+        }
+        if (response_payload) {
+            pbuf_free(response_payload);  // Built for a NON, not sent
+            response_payload = NULL;
         }
+        packet_pool_free(scratch_buf);
     }
 
     pbuf_free(p);
@@ -894,161 +2286,159 @@ bool init_udp_server()
     return true;
 }
 
+// --- Event loop timers ---
+
+// Retransmits due CON messages; the main loop re-arms the deadline.
+static void on_retransmit_timer(uint32_t now)
+{
+    (void) now;
+    coap_check_retransmissions(pcb);
+}
+
+// Handles subscribers that stopped acknowledging; the main loop re-arms the
+// deadline.
+static void on_prune_timer(uint32_t now)
+{
+    subscribers_expire(now);
+}
+
+#if !CS04_STORAGE_CORE1
+static int storage_timer = -1;
+
+// Idle storage work; runs again straight away while read-ahead is busy.
+static void on_storage_timer(uint32_t now)
+{
+    if (storage_idle(now))
+        event_timer_arm(storage_timer, now);
+}
+#endif
+
 int main()
 {
     stdio_init_all();
-    printf("Starting CoAP Server (FIXED Response Sending)...\n");
+    LOG_INFO("Starting CoAP Server (FIXED Response Sending)...\n");
 
     if (cyw43_arch_init()) {
-        printf("Wi-Fi init failed\n");
+        LOG_ERROR("Wi-Fi init failed\n");
         return 1;
     }
 
-    cyw43_arch_enable_sta_mode();
-    printf("Connecting to Wi-Fi (%s)...\n", WIFI_SSID);
-
-    while (1) {
-        if (cyw43_arch_wifi_connect_timeout_ms(
-                WIFI_SSID, WIFI_PASS, CYW43_AUTH_WPA2_AES_PSK, 30000) == 0) {
-            printf("Wi-Fi connected successfully!\n");
-            break;
-        }
-
-        printf("Wi-Fi connect failed, retrying in 2 seconds...\n");
-        sleep_ms(2000);
-    }
-
-    struct netif *netif = &cyw43_state.netif[CYW43_ITF_STA];
-    sleep_ms(2000);
-    dhcp_stop(netif);
-
-    ip_addr_t ip, mask, gw;
-    ip4addr_aton(STATIC_IP_ADDR, &ip);
-    ip4addr_aton(STATIC_NETMASK, &mask);
-    ip4addr_aton(STATIC_GATEWAY, &gw);
-
-    netif_set_addr(netif_default, &ip, &mask, &gw);
-    netif_set_up(netif);
-
-    printf("Static IP set to: %s\n", ip4addr_ntoa(netif_ip4_addr(netif)));
+    // Associate in the background; the SD card mounts meanwhile
+    boot_wifi_begin(WIFI_SSID, WIFI_PASS);
 
     init_hardware();
+    cyw43_arch_poll();
 
+#if CS04_LOG_LEVEL >= LOG_LEVEL_DEBUG
     DIR dir;
     FILINFO fno;
-    FRESULT fr = f_opendir(&dir, "/");
-    if (fr == FR_OK) {
-        printf("\nFiles on SD card:\n");
+    if (f_opendir(&dir, "/") == FR_OK) {
+        LOG_DEBUG("\nFiles on SD card:\n");
         while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != 0) {
-            printf("  - %s (%lu bytes)\n", fno.fname, fno.fsize);
+            LOG_DEBUG("  - %s (%lu bytes)\n", fno.fname, fno.fsize);
         }
         f_closedir(&dir);
     }
+#endif
 
-    memset(subscribers, 0, sizeof(subscribers));
-    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
-        subscribers[i].active = false;
-    }
+    subscribers_init();
+    file_tail_init();
+    trace_init();
+    warm_line_index();
+    boot_mark_storage_ready();
 
+    // Bound before the link is up, so the first request is answered at once
     if (!init_udp_server()) {
-        printf("UDP server init failed\n");
+        LOG_ERROR("UDP server init failed\n");
         return 1;
     }
 
-    printf("CoAP server listening on port %d\n", COAP_SERVER_PORT);
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(0, 10, 0, 0.1f));
-
-    bool btn1_state = true, btn2_state = true, btn3_state = true;
-    uint32_t last_prune_time = 0;
+    // Static address as soon as the radio associates (no DHCP round first)
+    boot_wifi_wait(STATIC_IP_ADDR, STATIC_NETMASK, STATIC_GATEWAY);
+    radio_init();
+
+    LOG_INFO("CoAP server listening on port %d\n", COAP_SERVER_PORT);
+    hw_led_status(hw_urgb_u32(0, 10, 0, 0.1f));
+
+    // SD/FATFS work: on core1 if enabled, otherwise from this loop
+    storage_worker_init(storage_execute, storage_idle);
+#if CS04_STORAGE_CORE1
+    storage_worker_launch();
+    LOG_INFO("Storage worker: core1\n");
+#endif
+
+    // Wake on packets, timers and button edges instead of a fixed poll
+    event_loop_init();
+    int retransmit_timer = event_timer_add(on_retransmit_timer, 0);
+    int prune_timer = event_timer_add(on_prune_timer, 0);
+    notify_timer = event_timer_add(on_notify_timer, 0);
+#if !CS04_STORAGE_CORE1
+    storage_timer = event_timer_add(on_storage_timer, STORAGE_IDLE_MS);
+#endif
+    const uint button_pins[] = { BUTTON_1_PIN, BUTTON_2_PIN, BUTTON_3_PIN };
+    hw_buttons_init(button_pins, count_of(button_pins));
 
     while (true) {
         cyw43_arch_poll();
-        coap_check_retransmissions(pcb);
 
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        if (now - last_prune_time > 5000) {
-            prune_dead_subscribers();
-            last_prune_time = now;
+        // Handling packets may have stored or cleared retransmissions
+        uint32_t retry_at;
+        if (coap_next_retransmit_deadline(&retry_at))
+            event_timer_arm(retransmit_timer, retry_at);
+        else
+            event_timer_cancel(retransmit_timer);
+
+        // ...and registered, ACKed or dropped subscribers
+        uint32_t idle_at;
+        if (subscriber_next_deadline(&idle_at))
+            event_timer_arm(prune_timer, idle_at);
+        else
+            event_timer_cancel(prune_timer);
+
+        // Print deferred packet-path messages before sleeping
+        log_drain(LOG_CORES * LOG_RING_SIZE);
+
+        uint32_t events = event_loop_wait();
+#if CS04_STORAGE_CORE1
+        // Send piggybacked ACKs for requests core1 has finished
+        static storage_result_t completed;
+        while (storage_worker_poll(&completed)) {
+            storage_send_result(&completed);
         }
+#else
+        if (events & EVENT_STORAGE)
+            on_storage_timer(to_ms_since_boot(get_absolute_time()));
+#endif
+        // Radio awake while blocks are moving, power-save once idle
+        radio_poll(to_ms_since_boot(get_absolute_time()),
+                   transfer_session_count() > 0 || upload_session_count() > 0);
+        if (!(events & EVENT_BUTTON))
+            continue;
 
-        bool btn1_pressed = !gpio_get(BUTTON_1_PIN);
-        bool btn2_pressed = !gpio_get(BUTTON_2_PIN);
-        bool btn3_pressed = !gpio_get(BUTTON_3_PIN);
-
-        if (btn1_pressed && btn1_state) {
-            printf("\n=== Button 1: Sending byte ===\n");
-            uint8_t payload = 0x42;
-            for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
-                if (subscribers[i].active) {
-                    coap_send_con_notification(
-                        pcb, &subscribers[i].ip, subscribers[i].port,
-                        &subscribers[i].token, subscribers[i].observe_seq++,
-                        &payload, 1, false, 0, false, false);
-                }
-            }
-            ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                             hw_urgb_u32(0, 50, 0, 0.5f));
-            sleep_ms(100);
-            ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                             hw_urgb_u32(0, 10, 0, 0.1f));
-        }
-        btn1_state = !btn1_pressed;
-
-        if (btn2_pressed && btn2_state) {
-            printf("\n=== Button 2: Sending button state update ===\n");
-
-            char button_payload[64];
-            snprintf(button_payload, sizeof(button_payload),
-                     "BTN1=%d,BTN2=1,BTN3=%d", !gpio_get(BUTTON_1_PIN),
-                     !gpio_get(BUTTON_3_PIN));
-
-            for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
-                if (subscribers[i].active) {
-                    coap_send_con_notification(
-                        pcb, &subscribers[i].ip, subscribers[i].port,
-                        &subscribers[i].token, subscribers[i].observe_seq++,
-                        (const uint8_t *) button_payload,
-                        strlen(button_payload), false, 0, false, false);
-                }
-            }
-            ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                             hw_urgb_u32(0, 50, 0, 0.5f));
-            sleep_ms(100);
-            ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                             hw_urgb_u32(0, 10, 0, 0.1f));
-        }
-        btn2_state = !btn2_pressed;
-
-
-        if (btn3_pressed && btn3_state) {
-            printf("\n=== Button 3: Sending button state update ===\n");
-
-            char button_payload[64];
-            snprintf(button_payload, sizeof(button_payload),
-                     "BTN1=%d,BTN2=%d,BTN3=1", !gpio_get(BUTTON_1_PIN),
-                     !gpio_get(BUTTON_2_PIN));
+        // Presses are queued by the IRQ, so a tap shorter than a loop pass
+        // is still seen
+        hw_button_event_t ev;
+        while (hw_button_event_get(&ev)) {
+            bool press = ev.kind == HW_BUTTON_PRESS;
+            buttons_refresh(press ? ev.pin : UINT_MAX);
+            if (!press)
+                continue;
 
-            for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
-                if (subscribers[i].active) {
-                    coap_send_con_notification(
-                        pcb, &subscribers[i].ip, subscribers[i].port,
-                        &subscribers[i].token, subscribers[i].observe_seq++,
-                        (const uint8_t *) button_payload,
-                        strlen(button_payload), false, 0, false, false);
-                }
+            if (ev.pin == BUTTON_1_PIN) {
+                LOG_INFO("\n=== Button 1: Sending byte ===\n");
+                static const uint8_t payload = 0x42;
+                static const uint8_t payload_cbor[] = { 0x41, 0x42 };  // h'42'
+                notify_observers(&payload, 1, payload_cbor,
+                                 sizeof(payload_cbor));
+            } else {
+                LOG_INFO("\n=== Button %d: Sending button state update ===\n",
+                         ev.pin == BUTTON_2_PIN ? 2 : 3);
+                notify_observers((const uint8_t *) buttons_notify.text,
+                                 buttons_notify.len, buttons_cbor,
+                                 buttons_cbor_len);
             }
-
-            // Visual feedback
-            ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                             hw_urgb_u32(0, 50, 0, 0.5f));
-            sleep_ms(150);
-            ws2812_put_pixel(pio_ws2812, sm_ws2812,
-                             hw_urgb_u32(0, 10, 0, 0.1f));
+            feedback_play(FEEDBACK_BUTTON);
         }
-        btn3_state = !btn3_pressed;
-
-
-        sleep_ms(20);
     }
 
     cyw43_arch_deinit();
@@ -0,0 +1,76 @@
+#include "cs04_append_batch.h"
+#include <string.h>
+
+/**
+ * @brief Empty a batch.
+ * @param batch Batch
+ */
+void append_batch_clear(append_batch_t *batch)
+{
+    batch->len = 0;
+    batch->lines = 0;
+    batch->first_ms = 0;
+}
+
+/**
+ * @brief Queue one line for the next iPATCH.
+ * @param batch Batch
+ * @param line Line contents (without newline)
+ * @param len Line length
+ * @param now_ms Current time in ms since boot
+ * @return false if the line does not fit or contains a newline
+ */
+bool append_batch_add(append_batch_t *batch, const char *line, size_t len,
+                      uint32_t now_ms)
+{
+    if (memchr(line, '\n', len))
+        return false;
+
+    size_t sep = batch->lines > 0 ? 1 : 0;
+    if (batch->len + sep + len > APPEND_BATCH_BYTES)
+        return false;
+
+    if (batch->lines == 0)
+        batch->first_ms = now_ms;
+    if (sep)
+        batch->data[batch->len++] = '\n';
+    memcpy(&batch->data[batch->len], line, len);
+    batch->len += len;
+    batch->lines++;
+    return true;
+}
+
+/**
+ * @brief Check whether a batch should be sent now.
+ * @param batch Batch
+ * @param now_ms Current time in ms since boot
+ * @return true if full or old enough
+ */
+bool append_batch_due(const append_batch_t *batch, uint32_t now_ms)
+{
+    if (batch->lines == 0)
+        return false;
+    return batch->lines >= APPEND_BATCH_LINES ||
+           now_ms - batch->first_ms >= APPEND_BATCH_MS;
+}
+
+/**
+ * @brief Count the lines in a batch payload.
+ * @param data Payload
+ * @param len Payload length
+ * @return Number of lines ('\n'-separated, trailing newline optional)
+ */
+uint32_t append_batch_count_lines(const uint8_t *data, size_t len)
+{
+    if (len == 0)
+        return 0;
+    if (data[len - 1] == '\n')
+        len--;
+
+    uint32_t lines = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n')
+            lines++;
+    }
+    return lines;
+}
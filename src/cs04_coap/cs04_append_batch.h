@@ -0,0 +1,39 @@
+#ifndef CS04_APPEND_BATCH_H
+#define CS04_APPEND_BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define APPEND_BATCH_BYTES 512  // One iPATCH payload (STORAGE_REQUEST_DATA)
+#define APPEND_BATCH_LINES 32   // Send once this many lines are queued
+#define APPEND_BATCH_MS 500     // ...or once the oldest line is this old
+
+// Lines queued for one iPATCH /file. The payload is the lines joined with
+// '\n' (no trailing newline), so a one-line batch is the old single-line
+// request.
+typedef struct {
+    uint8_t data[APPEND_BATCH_BYTES];  // Payload being built
+    uint16_t len;                      // Bytes in data
+    uint16_t lines;                    // Lines in data
+    uint32_t first_ms;                 // Time the oldest line was queued
+} append_batch_t;
+
+// Empties a batch.
+void append_batch_clear(append_batch_t *batch);
+
+// Queues one line (without newline). Returns false if it does not fit; send
+// the batch and retry. A line containing '\n' is rejected.
+bool append_batch_add(append_batch_t *batch, const char *line, size_t len,
+                      uint32_t now_ms);
+
+// Returns true if the batch should be sent: the line limit is reached or the
+// oldest line has waited APPEND_BATCH_MS.
+bool append_batch_due(const append_batch_t *batch, uint32_t now_ms);
+
+// Counts the lines in a received batch payload, ignoring one trailing
+// newline. Returns 0 for an empty payload.
+uint32_t append_batch_count_lines(const uint8_t *data, size_t len);
+
+#endif  // CS04_APPEND_BATCH_H
@@ -0,0 +1,225 @@
+#include "cs04_append_journal.h"
+#include "cs04_file_cache.h"
+#include "cs04_prefetch.h"
+#include "cs04_hot_cache.h"
+#include "cs04_line_index.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+static char journal_filename[JOURNAL_NAME_LEN];
+static uint8_t journal_buf[JOURNAL_BUF_SIZE];
+static size_t journal_len;
+static uint32_t journal_first_ms;  // Time the oldest buffered byte arrived
+static uint32_t journal_last_ms;   // Time of the last write to the card
+static FIL journal_file;
+static bool journal_open;
+static bool journal_failed;  // Last flush failed; poll backs off
+static append_journal_stats_t journal_stats;
+
+/**
+ * @brief Open the file for appending, keeping readers' caches coherent.
+ *
+ * Cached read handles must be closed first (FF_FS_LOCK would reject the
+ * write open) and cached blocks, read-ahead or hot, are dropped because the
+ * file is changing.
+ *
+ * @return FATFS result
+ */
+static FRESULT journal_open_file(void)
+{
+    if (journal_open)
+        return FR_OK;
+
+    file_cache_invalidate(journal_filename);
+    prefetch_invalidate(journal_filename);
+    hot_cache_invalidate(journal_filename);
+
+    FRESULT res = f_open(&journal_file, journal_filename,
+                         FA_OPEN_APPEND | FA_WRITE);
+    if (res == FR_OK)
+        journal_open = true;
+    return res;
+}
+
+/**
+ * @brief Close the write handle (f_close also syncs).
+ */
+static void journal_close_file(void)
+{
+    if (!journal_open)
+        return;
+    f_close(&journal_file);
+    journal_open = false;
+}
+
+/**
+ * @brief Bind the journal to a file and reset its state.
+ * @param filename File that receives appended lines
+ */
+void append_journal_init(const char *filename)
+{
+    journal_close_file();
+    strncpy(journal_filename, filename, JOURNAL_NAME_LEN - 1);
+    journal_filename[JOURNAL_NAME_LEN - 1] = '\0';
+    journal_len = 0;
+    journal_first_ms = 0;
+    journal_last_ms = 0;
+    journal_failed = false;
+    memset(&journal_stats, 0, sizeof(journal_stats));
+}
+
+/**
+ * @brief Buffer a batch of lines for appending.
+ *
+ * The batch is copied in one piece, so it is either wholly buffered or
+ * rejected, and a durable batch reaches the card in a single f_write.
+ *
+ * @param data Lines separated by '\n' (without the final newline)
+ * @param len Batch length
+ * @param lines Lines in the batch
+ * @param durable Write and sync the journal before returning
+ * @return FR_OK, FR_INVALID_PARAMETER if the batch can never fit, or the
+ *         result of the flush made to free space or for durability
+ */
+FRESULT append_journal_append(const uint8_t *data, size_t len, uint32_t lines,
+                              bool durable)
+{
+    if (len + 1 > JOURNAL_BUF_SIZE)
+        return FR_INVALID_PARAMETER;
+
+    if (journal_len + len + 1 > JOURNAL_BUF_SIZE) {
+        FRESULT res = append_journal_flush(true);
+        if (res != FR_OK)
+            return res;
+    }
+
+    if (journal_len == 0)
+        journal_first_ms = to_ms_since_boot(get_absolute_time());
+
+    memcpy(&journal_buf[journal_len], data, len);
+    journal_len += len;
+    journal_buf[journal_len++] = '\n';
+
+    journal_stats.lines += lines;
+    journal_stats.bytes += len + 1;
+
+    if (!durable)
+        return FR_OK;
+
+    journal_stats.durable++;
+    return append_journal_flush(true);
+}
+
+/**
+ * @brief Write buffered lines to the card and sync.
+ *
+ * A threshold flush only writes up to the next sector boundary of the file,
+ * so each batch fills whole sectors and the card is not asked to
+ * read-modify-write the same partial sector on every line. A full flush
+ * (time threshold, durable ACK, or before a read) writes everything.
+ *
+ * @param all Write the partial-sector tail as well
+ * @return FATFS result
+ */
+FRESULT append_journal_flush(bool all)
+{
+    if (journal_len == 0)
+        return FR_OK;
+
+    FRESULT res = journal_open_file();
+    if (res != FR_OK)
+        return res;
+
+    FSIZE_t offset = f_size(&journal_file);
+    size_t n = journal_len;
+    if (!all) {
+        FSIZE_t end = offset + journal_len;
+        FSIZE_t aligned = end - (end % JOURNAL_SECTOR_SIZE);
+        if (aligned <= offset)
+            return FR_OK;  // Not a whole sector yet
+        n = (size_t) (aligned - offset);
+    }
+
+    UINT bytes_written = 0;
+    res = f_write(&journal_file, journal_buf, n, &bytes_written);
+    if (res == FR_OK && bytes_written != n)
+        res = FR_DENIED;  // Card full
+    if (res == FR_OK) {
+        res = f_sync(&journal_file);
+        journal_stats.syncs++;
+    }
+
+    if (res != FR_OK) {
+        LOG_ERROR("✗ Journal flush failed: %d\n", res);
+        journal_close_file();
+        line_index_invalidate();
+        journal_failed = true;
+        journal_last_ms = to_ms_since_boot(get_absolute_time());
+        return res;
+    }
+
+    line_index_append(journal_filename, offset, journal_buf, n);
+    journal_stats.flushes++;
+    journal_failed = false;
+    journal_last_ms = to_ms_since_boot(get_absolute_time());
+
+    journal_len -= n;
+    memmove(journal_buf, &journal_buf[n], journal_len);
+
+    LOG_DEBUG("🗂️ Journal flushed %u bytes (%u pending)\n", (unsigned) n,
+           (unsigned) journal_len);
+    return FR_OK;
+}
+
+/**
+ * @brief Make every accepted line visible to readers of the file.
+ * @return FATFS result of the flush
+ */
+FRESULT append_journal_sync_for_read(void)
+{
+    FRESULT res = append_journal_flush(true);
+    journal_close_file();
+    return res;
+}
+
+/**
+ * @brief Flush on size/time thresholds and close an idle write handle.
+ * @param now_ms Current time in ms since boot
+ */
+void append_journal_poll(uint32_t now_ms)
+{
+    // After a failed write, retry no more than once per JOURNAL_FLUSH_MS
+    if (journal_failed && now_ms - journal_last_ms < JOURNAL_FLUSH_MS)
+        return;
+
+    if (journal_len >= JOURNAL_FLUSH_BYTES) {
+        append_journal_flush(false);
+    }
+    if (journal_len > 0 && now_ms - journal_first_ms >= JOURNAL_FLUSH_MS) {
+        append_journal_flush(true);
+    }
+    if (journal_open && journal_len == 0 &&
+        now_ms - journal_last_ms >= JOURNAL_IDLE_CLOSE_MS) {
+        journal_close_file();
+    }
+}
+
+/**
+ * @brief Get the number of buffered bytes.
+ * @return Bytes accepted but not yet written
+ */
+size_t append_journal_pending(void)
+{
+    return journal_len;
+}
+
+/**
+ * @brief Get journal counters.
+ * @return Pointer to the live counters
+ */
+const append_journal_stats_t *append_journal_get_stats(void)
+{
+    return &journal_stats;
+}
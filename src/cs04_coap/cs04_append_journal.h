@@ -0,0 +1,56 @@
+#ifndef CS04_APPEND_JOURNAL_H
+#define CS04_APPEND_JOURNAL_H
+
+#include "ff.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define JOURNAL_SECTOR_SIZE 512      // SD sector; batches end on this boundary
+#define JOURNAL_BUF_SIZE 2048        // RAM buffer for appended lines
+#define JOURNAL_FLUSH_BYTES 1536     // Flush once 3 sectors are pending
+#define JOURNAL_FLUSH_MS 1000        // ...or once the oldest line is this old
+#define JOURNAL_IDLE_CLOSE_MS 5000   // Close the write handle when idle
+#define JOURNAL_NAME_LEN 32
+
+// Elective option asking for the ACK only after the line is on the card.
+// microcoap stores option numbers in a uint8_t, so this sits below 256
+// instead of in the 65000+ experimental range.
+#define CS04_OPTION_DURABLE 250
+
+// Journal counters.
+typedef struct {
+    uint32_t lines;    // Lines accepted
+    uint32_t bytes;    // Bytes accepted (including newlines)
+    uint32_t flushes;  // Batches written to the card
+    uint32_t syncs;    // f_sync calls
+    uint32_t durable;  // Appends acknowledged after a sync
+} append_journal_stats_t;
+
+// Binds the journal to a file and clears the buffer and counters.
+void append_journal_init(const char *filename);
+
+// Buffers data (lines lines joined by '\n') plus a trailing newline, all or
+// nothing. Flushes first if the buffer is full; with durable set, also
+// writes and syncs before returning.
+FRESULT append_journal_append(const uint8_t *data, size_t len, uint32_t lines,
+                              bool durable);
+
+// Writes buffered lines and syncs. With all == false only whole sectors are
+// written and the tail stays buffered.
+FRESULT append_journal_flush(bool all);
+
+// Flushes everything and closes the write handle so the file can be read.
+FRESULT append_journal_sync_for_read(void);
+
+// Flushes on the size/time thresholds and closes an idle handle.
+void append_journal_poll(uint32_t now_ms);
+
+// Returns the number of buffered bytes not yet written.
+size_t append_journal_pending(void);
+
+// Returns the journal counters.
+const append_journal_stats_t *append_journal_get_stats(void);
+
+#endif  // CS04_APPEND_JOURNAL_H
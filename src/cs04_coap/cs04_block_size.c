@@ -0,0 +1,101 @@
+#include "cs04_block_size.h"
+#include "cs04_coap_packet.h"
+#include "cs04_radio.h"
+
+/**
+ * @brief Payload bytes of one response at an SZX.
+ */
+static uint32_t block_size_payload(uint8_t szx)
+{
+    if (szx == COAP_BLOCK_SZX_BERT)
+        return COAP_BERT_PAYLOAD_MAX;
+    return coap_block_size_from_szx(szx);
+}
+
+/**
+ * @brief Count free pool buffers big enough for one response.
+ *
+ * The pool spills into larger classes, so every class that fits counts.
+ *
+ * @param pool Pool snapshot
+ * @param len Encoded response length
+ * @return Free buffers of at least len bytes
+ */
+static uint32_t block_size_free_buffers(const packet_pool_stats_t *pool,
+                                        uint32_t len)
+{
+    uint32_t free_bufs = 0;
+    for (int i = 0; i < PACKET_POOL_CLASSES; i++) {
+        const packet_pool_class_stats_t *c = &pool->cls[i];
+        if (c->size >= len && c->count > c->in_use)
+            free_bufs += c->count - c->in_use;
+    }
+    return free_bufs;
+}
+
+/**
+ * @brief Pick a block size from memory, retransmit and loss pressure.
+ *
+ * Every limit only lowers the size, since RFC 7959 lets the server answer
+ * with a smaller block than asked for but never a larger one. A BERT payload
+ * is two IP fragments, so losing either loses both; lossy peers are moved
+ * down to blocks that fit one small datagram.
+ *
+ * @param szx Size the client asked for
+ * @param pool Packet pool snapshot
+ * @param pending Messages in the pending table
+ * @param loss_x256 Peer loss estimate
+ * @return SZX to answer with
+ */
+uint8_t block_size_pick(uint8_t szx, const packet_pool_stats_t *pool,
+                        uint16_t pending, uint16_t loss_x256)
+{
+    // Retransmit table pressure: every block in flight holds a slot
+    uint8_t limit = COAP_BLOCK_SZX_BERT;
+    if (pending >= BLOCK_SIZE_PENDING_FULL)
+        limit = 5;
+    else if (pending >= BLOCK_SIZE_PENDING_BUSY)
+        limit = COAP_BLOCK_SZX_MAX;
+
+    uint8_t loss_limit = COAP_BLOCK_SZX_BERT;
+    if (loss_x256 >= BLOCK_SIZE_LOSS_256)
+        loss_limit = 4;
+    else if (loss_x256 >= BLOCK_SIZE_LOSS_512)
+        loss_limit = 5;
+    else if (loss_x256 >= BLOCK_SIZE_LOSS_BERT)
+        loss_limit = COAP_BLOCK_SZX_MAX;
+    if (loss_limit < limit)
+        limit = loss_limit;
+
+    if (szx > limit)
+        szx = limit;
+
+    // Step down while the response would spill into the lwIP heap
+    while (szx > BLOCK_SIZE_SZX_MIN &&
+           block_size_free_buffers(pool, block_size_payload(szx) +
+                                             BLOCK_SIZE_HEADER_ROOM) <
+               BLOCK_SIZE_POOL_FREE_MIN) {
+        szx--;
+    }
+    return szx;
+}
+
+/**
+ * @brief Pick the SZX for the first block of a transfer.
+ * @param ip Client address
+ * @param port Client port
+ * @param szx Size the client asked for
+ * @return SZX to answer with
+ */
+uint8_t block_size_choose(const ip_addr_t *ip, u16_t port, uint8_t szx)
+{
+    packet_pool_stats_t pool;
+    packet_pool_get_stats(&pool);
+
+    const coap_peer_t *peer = coap_peer_lookup(ip, port);
+    uint16_t loss = peer ? peer->loss_x256 : 0;
+    uint8_t radio_limit = radio_szx_limit();  // Our own link's RSSI
+    if (szx > radio_limit)
+        szx = radio_limit;
+    return block_size_pick(szx, &pool, coap_pending_count(), loss);
+}
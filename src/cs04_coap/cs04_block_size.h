@@ -0,0 +1,31 @@
+#ifndef CS04_BLOCK_SIZE_H
+#define CS04_BLOCK_SIZE_H
+
+#include "cs04_packet_pool.h"
+#include "cs04_coap_reliability.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+
+// Configuration
+#define BLOCK_SIZE_HEADER_ROOM 64   // Header, token and options of a block
+#define BLOCK_SIZE_SZX_MIN 4        // Never pick below 256 bytes (SZX 4)
+#define BLOCK_SIZE_POOL_FREE_MIN 1  // Free pool buffers the response needs
+#define BLOCK_SIZE_PENDING_BUSY (MAX_PENDING_MESSAGES / 2)      // No BERT
+#define BLOCK_SIZE_PENDING_FULL (MAX_PENDING_MESSAGES * 3 / 4)  // <= 512 bytes
+#define BLOCK_SIZE_LOSS_BERT 13     // Loss x256 (5%) that rules out BERT
+#define BLOCK_SIZE_LOSS_512 26      // 10%: at most 512-byte blocks
+#define BLOCK_SIZE_LOSS_256 51      // 20%: at most 256-byte blocks
+
+// Returns the largest SZX, at most szx, that the given state allows: a pool
+// buffer free for the whole response, a pending table below the pressure
+// marks, and the peer's loss rate (loss_x256). Sizes are not lowered below
+// BLOCK_SIZE_SZX_MIN.
+uint8_t block_size_pick(uint8_t szx, const packet_pool_stats_t *pool,
+                        uint16_t pending, uint16_t loss_x256);
+
+// Picks the SZX for the first block of a transfer to a peer from the live
+// packet pool, pending table, peer loss estimate and radio link quality.
+// Core0 only.
+uint8_t block_size_choose(const ip_addr_t *ip, u16_t port, uint8_t szx);
+
+#endif  // CS04_BLOCK_SIZE_H
@@ -0,0 +1,167 @@
+#include "cs04_block_window.h"
+#include <string.h>
+
+/**
+ * @brief Reset a block window for a new transfer.
+ * @param win Window state to initialize
+ * @param window_size Number of block requests allowed in flight
+ */
+void block_window_init(block_window_t *win, uint8_t window_size)
+{
+    memset(win, 0, sizeof(*win));
+    if (window_size == 0)
+        window_size = 1;
+    if (window_size > BLOCK_WINDOW_MAX)
+        window_size = BLOCK_WINDOW_MAX;
+    win->window_size = window_size;
+    win->last_block = BLOCK_WINDOW_LAST_UNKNOWN;
+}
+
+/**
+ * @brief Check whether another block request fits in the window.
+ * @param win Window state
+ * @return true if a request for next_block may be sent
+ */
+bool block_window_can_request(const block_window_t *win)
+{
+    if (win->next_block >= win->base + win->window_size)
+        return false;
+    return win->last_block == BLOCK_WINDOW_LAST_UNKNOWN ||
+           win->next_block <= win->last_block;
+}
+
+/**
+ * @brief Take the next block number to request.
+ * @param win Window state
+ * @return Block number the caller should request
+ */
+uint32_t block_window_next_request(block_window_t *win)
+{
+    return win->next_block++;
+}
+
+/**
+ * @brief Feed a received Block2 response into the window.
+ *
+ * Blocks may arrive in any order while several requests are in flight. The
+ * window base only advances over a contiguous run of received blocks, so
+ * base always names the oldest hole in the transfer.
+ *
+ * @param win Window state
+ * @param block_num Block number from the Block2 option
+ * @param more M bit from the Block2 option
+ * @param empty True if the response carried no payload
+ * @return Whether the caller should store the payload
+ */
+block_window_result_t block_window_on_block(block_window_t *win,
+                                            uint32_t block_num, bool more,
+                                            bool empty)
+{
+    if (block_num < win->base)
+        return BLOCK_WINDOW_DUPLICATE;
+
+    if (win->last_block != BLOCK_WINDOW_LAST_UNKNOWN &&
+        block_num > win->last_block)
+        return BLOCK_WINDOW_OUT_OF_RANGE;
+
+    uint32_t offset = block_num - win->base;
+    if (offset >= win->window_size)
+        return BLOCK_WINDOW_OUT_OF_RANGE;
+
+    if (win->received_mask & (1u << offset))
+        return BLOCK_WINDOW_DUPLICATE;
+
+    // Speculative request past the end of the resource: the server answers
+    // with an empty final block, which tells us where the resource ends.
+    if (empty && !more && block_num > 0) {
+        if (win->last_block == BLOCK_WINDOW_LAST_UNKNOWN ||
+            block_num - 1 < win->last_block) {
+            win->last_block = block_num - 1;
+        }
+        return BLOCK_WINDOW_OUT_OF_RANGE;
+    }
+
+    win->received_mask |= (uint8_t) (1u << offset);
+    if (!more)
+        win->last_block = block_num;
+
+    while (win->received_mask & 0x01) {
+        win->received_mask >>= 1;
+        win->base++;
+    }
+
+    return BLOCK_WINDOW_ACCEPTED;
+}
+
+/**
+ * @brief Check whether the whole resource has been received.
+ * @param win Window state
+ * @return true when all blocks up to last_block are in
+ */
+bool block_window_complete(const block_window_t *win)
+{
+    return win->last_block != BLOCK_WINDOW_LAST_UNKNOWN &&
+           win->base > win->last_block;
+}
+
+/**
+ * @brief Remember the message ID of a block request.
+ * @param win Window state
+ * @param block_num Block number the request asked for
+ * @param msg_id Message ID it was sent with
+ */
+void block_window_set_msg_id(block_window_t *win, uint32_t block_num,
+                             uint16_t msg_id)
+{
+    win->msg_ids[block_num % BLOCK_WINDOW_MAX] = msg_id;
+}
+
+/**
+ * @brief Check whether a message ID is one of the window's open requests.
+ *
+ * Only slots between base and next_block that have not been answered are
+ * open; IDs of answered or abandoned slots are ignored.
+ *
+ * @param win Window state
+ * @param msg_id Message ID, e.g. of a request that ran out of retransmits
+ * @return true if an open request was sent with msg_id
+ */
+bool block_window_owns_msg_id(const block_window_t *win, uint16_t msg_id)
+{
+    if (msg_id == 0)
+        return false;
+    for (uint32_t n = win->base; n < win->next_block; n++) {
+        uint32_t offset = n - win->base;
+        if (offset < BLOCK_WINDOW_MAX && (win->received_mask & (1u << offset)))
+            continue;
+        if (win->msg_ids[n % BLOCK_WINDOW_MAX] == msg_id)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief List the message IDs of the window's open requests.
+ *
+ * Used to cancel them when a transfer is abandoned, so they are not
+ * retransmitted and their late answers are not taken for a new window.
+ *
+ * @param win Window state
+ * @param ids Output array with room for BLOCK_WINDOW_MAX IDs
+ * @return Number of IDs written
+ */
+uint8_t block_window_open_msg_ids(const block_window_t *win, uint16_t *ids)
+{
+    uint8_t count = 0;
+    for (uint32_t n = win->base; n < win->next_block; n++) {
+        uint32_t offset = n - win->base;
+        if (offset >= BLOCK_WINDOW_MAX)
+            break;
+        if (win->received_mask & (1u << offset))
+            continue;
+        uint16_t msg_id = win->msg_ids[n % BLOCK_WINDOW_MAX];
+        if (msg_id != 0)
+            ids[count++] = msg_id;
+    }
+    return count;
+}
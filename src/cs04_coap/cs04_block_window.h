@@ -0,0 +1,61 @@
+#ifndef CS04_BLOCK_WINDOW_H
+#define CS04_BLOCK_WINDOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define BLOCK_WINDOW_MAX 8  // Upper bound on blocks in flight per transfer
+#define BLOCK_WINDOW_LAST_UNKNOWN UINT32_MAX
+
+// Result of feeding a received block into the window.
+typedef enum {
+    BLOCK_WINDOW_ACCEPTED = 0,  // New block inside the window, write it
+    BLOCK_WINDOW_DUPLICATE,     // Block already received (or behind base)
+    BLOCK_WINDOW_OUT_OF_RANGE,  // Block outside window or past the last block
+} block_window_result_t;
+
+// Sliding-window state for a pipelined Block2 transfer.
+// All blocks below base have been received. Bit i of received_mask marks
+// block (base + i) as received out of order. msg_ids[n % BLOCK_WINDOW_MAX]
+// is the message ID the request for block n went out with.
+typedef struct {
+    uint32_t base;          // Lowest block not yet received
+    uint32_t next_block;    // Next block number to request
+    uint32_t last_block;    // Final block number, once known
+    uint8_t window_size;    // Max outstanding requests (1..BLOCK_WINDOW_MAX)
+    uint8_t received_mask;  // Out-of-order receive bitmap relative to base
+    uint16_t msg_ids[BLOCK_WINDOW_MAX];  // Message ID per in-flight request
+} block_window_t;
+
+// Resets the window for a new transfer with the given number of slots.
+void block_window_init(block_window_t *win, uint8_t window_size);
+
+// Returns true if another block request may be issued now.
+bool block_window_can_request(const block_window_t *win);
+
+// Returns the next block number to request and advances the send edge.
+uint32_t block_window_next_request(block_window_t *win);
+
+// Records a received block. Empty payloads past the end of the resource
+// shrink the known last block instead of being written.
+block_window_result_t block_window_on_block(block_window_t *win,
+                                            uint32_t block_num, bool more,
+                                            bool empty);
+
+// Returns true once every block up to the final one has been received.
+bool block_window_complete(const block_window_t *win);
+
+// Records the message ID the request for block_num was sent with.
+void block_window_set_msg_id(block_window_t *win, uint32_t block_num,
+                             uint16_t msg_id);
+
+// Returns true if msg_id belongs to a request still in flight (sent, not
+// yet answered), so a retransmit failure for it concerns this transfer.
+bool block_window_owns_msg_id(const block_window_t *win, uint16_t msg_id);
+
+// Copies the message IDs of the requests still in flight into ids (room for
+// BLOCK_WINDOW_MAX) and returns how many there are.
+uint8_t block_window_open_msg_ids(const block_window_t *win, uint16_t *ids);
+
+#endif  // CS04_BLOCK_WINDOW_H
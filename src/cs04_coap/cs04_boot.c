@@ -0,0 +1,159 @@
+#include "cs04_boot.h"
+#include "cs04_log.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/dhcp.h"
+#include "lwip/netif.h"
+#include "lwip/ip_addr.h"
+
+static boot_stats_t stats;
+static const char *wifi_ssid;
+static const char *wifi_pass;
+static uint32_t attempt_ms;  // Current attempt started (or failed) at
+static bool attempt_failed;
+static bool static_applied;
+
+/**
+ * @brief Milliseconds since boot, never 0 (0 marks "not reached").
+ */
+static uint32_t boot_now_ms(void)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    return now ? now : 1;
+}
+
+/**
+ * @brief Issue one association attempt.
+ */
+static void boot_wifi_attempt(uint32_t now)
+{
+    stats.wifi_attempts++;
+    attempt_ms = now;
+    attempt_failed = false;
+    static_applied = false;
+    if (cyw43_arch_wifi_connect_async(wifi_ssid, wifi_pass,
+                                      CYW43_AUTH_WPA2_AES_PSK) != 0) {
+        attempt_failed = true;
+    }
+}
+
+/**
+ * @brief Start joining the network in the background.
+ * @param ssid Network name
+ * @param pass WPA2 passphrase
+ */
+void boot_wifi_begin(const char *ssid, const char *pass)
+{
+    wifi_ssid = ssid;
+    wifi_pass = pass;
+    cyw43_arch_enable_sta_mode();
+    LOG_INFO("Connecting to Wi-Fi (%s)...\n", ssid);
+
+    uint32_t now = boot_now_ms();
+    stats.wifi_start_ms = now;
+    boot_wifi_attempt(now);
+}
+
+/**
+ * @brief Apply the static address on the station interface.
+ *
+ * cyw43 starts DHCP on the interface; stopping it as soon as the radio has
+ * associated means no DISCOVER goes out and no lease is replaced later.
+ */
+static void boot_apply_static(const char *ip_str, const char *mask_str,
+                              const char *gw_str)
+{
+    struct netif *netif = &cyw43_state.netif[CYW43_ITF_STA];
+    ip4_addr_t ip, mask, gw;
+    ip4addr_aton(ip_str, &ip);
+    ip4addr_aton(mask_str, &mask);
+    ip4addr_aton(gw_str, &gw);
+
+    dhcp_stop(netif);
+    netif_set_addr(netif, &ip, &mask, &gw);
+    netif_set_up(netif);
+    static_applied = true;
+    LOG_INFO("Static IP set to: %s\n", ip4addr_ntoa(netif_ip4_addr(netif)));
+}
+
+/**
+ * @brief Advance the association.
+ * @param ip Static address, or NULL to keep DHCP
+ * @param mask Netmask (with ip)
+ * @param gw Gateway (with ip)
+ * @return true once the link is up
+ */
+bool boot_wifi_poll(const char *ip, const char *mask, const char *gw)
+{
+    if (stats.link_up_ms)
+        return true;
+
+    uint32_t now = boot_now_ms();
+    int wifi = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
+    if (wifi == CYW43_LINK_JOIN) {
+        if (ip && !static_applied)
+            boot_apply_static(ip, mask, gw);
+        if (cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) !=
+            CYW43_LINK_UP)
+            return false;  // DHCP still running
+        stats.link_up_ms = now;
+        LOG_INFO("Wi-Fi connected successfully! (%lu ms after boot, "
+                 "%lu attempt(s))\n",
+                 (unsigned long) now, (unsigned long) stats.wifi_attempts);
+        return true;
+    }
+
+    if (!attempt_failed &&
+        (wifi < 0 || now - attempt_ms >= BOOT_WIFI_TIMEOUT_MS)) {
+        LOG_ERROR("Wi-Fi connect failed (%d), retrying in %u ms...\n", wifi,
+                  (unsigned) BOOT_WIFI_RETRY_MS);
+        attempt_failed = true;
+        attempt_ms = now;
+    }
+    if (attempt_failed && now - attempt_ms >= BOOT_WIFI_RETRY_MS)
+        boot_wifi_attempt(now);
+    return false;
+}
+
+/**
+ * @brief Block until the link is up, servicing the radio meanwhile.
+ */
+void boot_wifi_wait(const char *ip, const char *mask, const char *gw)
+{
+    while (!boot_wifi_poll(ip, mask, gw)) {
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(make_timeout_time_ms(10));
+    }
+}
+
+/**
+ * @brief Record that storage and caches are ready.
+ */
+void boot_mark_storage_ready(void)
+{
+    if (stats.storage_ready_ms)
+        return;
+    stats.storage_ready_ms = boot_now_ms();
+    LOG_INFO("Storage ready (%lu ms after boot)\n",
+             (unsigned long) stats.storage_ready_ms);
+}
+
+/**
+ * @brief Record the first CoAP response sent.
+ */
+void boot_mark_first_response(void)
+{
+    if (stats.first_response_ms)
+        return;
+    stats.first_response_ms = boot_now_ms();
+    LOG_INFO("First CoAP response %lu ms after boot (%lu ms after link up)\n",
+             (unsigned long) stats.first_response_ms,
+             (unsigned long) (stats.first_response_ms - stats.link_up_ms));
+}
+
+/**
+ * @brief Get the boot milestones.
+ */
+const boot_stats_t *boot_get_stats(void)
+{
+    return &stats;
+}
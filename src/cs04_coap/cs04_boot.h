@@ -0,0 +1,39 @@
+#ifndef CS04_BOOT_H
+#define CS04_BOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define BOOT_WIFI_TIMEOUT_MS 30000  // One association attempt
+#define BOOT_WIFI_RETRY_MS 2000     // Wait after a failed attempt
+
+// Boot milestones, in ms since boot (0 until reached).
+typedef struct {
+    uint32_t wifi_start_ms;      // First association attempt issued
+    uint32_t storage_ready_ms;   // SD mounted and caches warmed
+    uint32_t link_up_ms;         // Associated and addressed
+    uint32_t first_response_ms;  // First CoAP response sent
+    uint32_t wifi_attempts;
+} boot_stats_t;
+
+// Starts joining ssid in the background (STA mode). Returns at once; the
+// caller does the rest of its setup and then calls boot_wifi_poll().
+void boot_wifi_begin(const char *ssid, const char *pass);
+
+// Advances the join; retries after failures. With ip non-NULL the static
+// address (ip, mask, gw) is applied as soon as the radio has associated
+// and DHCP is stopped, so no lease is requested first. Returns true once
+// the link is up.
+bool boot_wifi_poll(const char *ip, const char *mask, const char *gw);
+
+// Runs cyw43_arch_poll() and boot_wifi_poll() until the link is up.
+void boot_wifi_wait(const char *ip, const char *mask, const char *gw);
+
+// Records a milestone. Only the first call of each counts.
+void boot_mark_storage_ready(void);
+void boot_mark_first_response(void);
+
+const boot_stats_t *boot_get_stats(void);
+
+#endif  // CS04_BOOT_H
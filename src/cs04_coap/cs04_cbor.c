@@ -0,0 +1,192 @@
+#include "cs04_cbor.h"
+#include <string.h>
+
+/**
+ * @brief Append raw bytes, or flag an overflow.
+ */
+static void cbor_write(cbor_writer_t *w, const uint8_t *data, size_t len)
+{
+    if (w->error || w->len + len > w->cap) {
+        w->error = true;
+        return;
+    }
+    memcpy(&w->buf[w->len], data, len);
+    w->len += len;
+}
+
+/**
+ * @brief Append an item head in its shortest form (RFC 8949 section 4.2.1).
+ */
+static void cbor_put_head(cbor_writer_t *w, uint8_t major, uint32_t arg)
+{
+    uint8_t head[5];
+    size_t n = 1;
+    if (arg < 24) {
+        head[0] = (uint8_t) (major << 5 | arg);
+    } else if (arg <= 0xFF) {
+        head[0] = (uint8_t) (major << 5 | 24);
+        head[1] = (uint8_t) arg;
+        n = 2;
+    } else if (arg <= 0xFFFF) {
+        head[0] = (uint8_t) (major << 5 | 25);
+        head[1] = (uint8_t) (arg >> 8);
+        head[2] = (uint8_t) arg;
+        n = 3;
+    } else {
+        head[0] = (uint8_t) (major << 5 | 26);
+        head[1] = (uint8_t) (arg >> 24);
+        head[2] = (uint8_t) (arg >> 16);
+        head[3] = (uint8_t) (arg >> 8);
+        head[4] = (uint8_t) arg;
+        n = 5;
+    }
+    cbor_write(w, head, n);
+}
+
+/**
+ * @brief Start encoding into a buffer.
+ * @param w Writer
+ * @param buf Output buffer
+ * @param cap Buffer size
+ */
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t cap)
+{
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->error = false;
+}
+
+/**
+ * @brief Append an unsigned integer.
+ */
+void cbor_put_uint(cbor_writer_t *w, uint32_t value)
+{
+    cbor_put_head(w, CBOR_MAJOR_UINT, value);
+}
+
+/**
+ * @brief Append true or false.
+ */
+void cbor_put_bool(cbor_writer_t *w, bool value)
+{
+    cbor_put_head(w, CBOR_MAJOR_SIMPLE, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+/**
+ * @brief Append a byte string.
+ */
+void cbor_put_bytes(cbor_writer_t *w, const uint8_t *data, size_t len)
+{
+    cbor_put_head(w, CBOR_MAJOR_BYTES, (uint32_t) len);
+    cbor_write(w, data, len);
+}
+
+/**
+ * @brief Append an array head; the items follow.
+ */
+void cbor_put_array(cbor_writer_t *w, uint32_t items)
+{
+    cbor_put_head(w, CBOR_MAJOR_ARRAY, items);
+}
+
+/**
+ * @brief Append a map head; key/value pairs follow.
+ */
+void cbor_put_map(cbor_writer_t *w, uint32_t entries)
+{
+    cbor_put_head(w, CBOR_MAJOR_MAP, entries);
+}
+
+/**
+ * @brief Start decoding a payload.
+ * @param r Reader
+ * @param data Payload
+ * @param len Payload length
+ */
+void cbor_reader_init(cbor_reader_t *r, const uint8_t *data, size_t len)
+{
+    r->p = data;
+    r->end = data + len;
+    r->error = false;
+}
+
+/**
+ * @brief Read the head of the next item.
+ *
+ * Only definite lengths with up to 32-bit arguments are accepted. For a
+ * byte string the data is not skipped; the resources never receive one.
+ *
+ * @param r Reader
+ * @param major Output: major type
+ * @param arg Output: argument
+ * @return true on success
+ */
+bool cbor_get_head(cbor_reader_t *r, uint8_t *major, uint32_t *arg)
+{
+    if (r->error || r->p >= r->end) {
+        r->error = true;
+        return false;
+    }
+
+    uint8_t initial = *r->p++;
+    uint8_t info = initial & 0x1F;
+    *major = initial >> 5;
+
+    size_t n = 0;
+    if (info < 24) {
+        *arg = info;
+        return true;
+    } else if (info == 24) {
+        n = 1;
+    } else if (info == 25) {
+        n = 2;
+    } else if (info == 26) {
+        n = 4;
+    }
+    if (n == 0 || (size_t) (r->end - r->p) < n) {
+        r->error = true;  // 64-bit, reserved, indefinite or truncated
+        return false;
+    }
+
+    *arg = 0;
+    for (size_t i = 0; i < n; i++)
+        *arg = (*arg << 8) | *r->p++;
+    return true;
+}
+
+/**
+ * @brief Read an unsigned integer item.
+ */
+bool cbor_get_uint(cbor_reader_t *r, uint32_t *value)
+{
+    uint8_t major;
+    if (!cbor_get_head(r, &major, value))
+        return false;
+    if (major != CBOR_MAJOR_UINT)
+        r->error = true;
+    return !r->error;
+}
+
+/**
+ * @brief Read a boolean item.
+ */
+bool cbor_get_bool(cbor_reader_t *r, bool *value)
+{
+    uint8_t major;
+    uint32_t arg;
+    if (!cbor_get_head(r, &major, &arg))
+        return false;
+    if (major != CBOR_MAJOR_SIMPLE || (arg != CBOR_TRUE && arg != CBOR_FALSE))
+        r->error = true;
+    *value = arg == CBOR_TRUE;
+    return !r->error;
+}
+
+/**
+ * @brief Check that a payload was consumed exactly.
+ */
+bool cbor_reader_done(const cbor_reader_t *r)
+{
+    return !r->error && r->p == r->end;
+}
@@ -0,0 +1,59 @@
+#ifndef CS04_CBOR_H
+#define CS04_CBOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// RFC 8949 major types used by the resources
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_FALSE 20  // Simple values
+#define CBOR_TRUE 21
+
+// Encoder over a caller buffer. An overflow sets error and stops writing.
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    bool error;
+} cbor_writer_t;
+
+// Decoder over a received payload. Every read checks the remaining length,
+// and indefinite lengths are rejected, so a payload is read in one bounded
+// pass.
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool error;
+} cbor_reader_t;
+
+// Starts encoding into buf.
+void cbor_writer_init(cbor_writer_t *w, uint8_t *buf, size_t cap);
+
+// Appends one item (map/array heads take the number of entries/items).
+void cbor_put_uint(cbor_writer_t *w, uint32_t value);
+void cbor_put_bool(cbor_writer_t *w, bool value);
+void cbor_put_bytes(cbor_writer_t *w, const uint8_t *data, size_t len);
+void cbor_put_array(cbor_writer_t *w, uint32_t items);
+void cbor_put_map(cbor_writer_t *w, uint32_t entries);
+
+// Starts decoding len bytes at data.
+void cbor_reader_init(cbor_reader_t *r, const uint8_t *data, size_t len);
+
+// Reads the next item's head: major type and argument (value, length or
+// count). Returns false and sets error if the item is malformed or cut off.
+bool cbor_get_head(cbor_reader_t *r, uint8_t *major, uint32_t *arg);
+
+// Reads an unsigned integer or a boolean; false (and error) otherwise.
+bool cbor_get_uint(cbor_reader_t *r, uint32_t *value);
+bool cbor_get_bool(cbor_reader_t *r, bool *value);
+
+// Returns true once every byte has been consumed without error.
+bool cbor_reader_done(const cbor_reader_t *r);
+
+#endif  // CS04_CBOR_H
@@ -0,0 +1,339 @@
+#include "cs04_coap_codec.h"
+#include <string.h>
+
+/**
+ * @brief Compare two CoAP tokens for equality.
+ * @param tok1 First token
+ * @param tok2 Second token
+ * @return true if tokens identical, false otherwise
+ */
+bool coap_token_matches(const coap_buffer_t *tok1, const coap_buffer_t *tok2)
+{
+    if (tok1->len != tok2->len)
+        return false;
+    return memcmp(tok1->p, tok2->p, tok1->len) == 0;
+}
+
+/**
+ * @brief Extract the message ID from a CoAP packet.
+ * @param pkt Pointer to the CoAP packet struct
+ * @return 16-bit message ID extracted from header
+ */
+uint16_t coap_extract_msg_id(const coap_packet_t *pkt)
+{
+    return (pkt->hdr.id[0] << 8) | pkt->hdr.id[1];
+}
+
+/**
+ * @brief Upper bound on the encoded size of a packet.
+ *
+ * Each option costs at most 5 bytes of delta/length header on top of its
+ * value, which is enough to pick a pool size class without encoding twice.
+ *
+ * @param pkt Packet to measure
+ * @return Worst-case encoded length in bytes
+ */
+size_t coap_packet_max_len(const coap_packet_t *pkt)
+{
+    size_t len = 4 + pkt->hdr.tkl;
+
+    for (int i = 0; i < pkt->numopts; i++)
+        len += 5 + pkt->opts[i].buf.len;
+    if (pkt->payload.len > 0)
+        len += 1 + pkt->payload.len;
+    return len;
+}
+
+/**
+ * @brief Extract block number, more bit, and block size from Block2 option.
+ * @param block2_opt Block2 option pointer
+ * @param block_num Output block number
+ * @param more Output: true if more blocks to follow
+ * @param block_size Output: block size in bytes
+ * @return True if successfully parsed; false otherwise
+ */
+bool coap_extract_block2_info(const coap_option_t *block2_opt,
+                              uint32_t *block_num, bool *more,
+                              uint32_t *block_size)
+{
+    if (!block2_opt)
+        return false;
+
+    uint32_t block_val = coap_get_option_uint(&block2_opt->buf);
+    *block_num = (block_val >> 4);
+    *more = (block_val & 0x08);
+
+    *block_size = coap_block_size_from_szx(block_val & 0x07);
+
+    return true;
+}
+
+// Global buffers for Block2 encoding (must persist after function returns)
+static uint8_t cs04_block2_buf[3];
+static uint8_t cs04_content_format;
+static uint8_t cs04_max_age_buf[3];
+
+bool coap_parse_block2_option(const coap_option_t *block2_opt,
+                              uint32_t *block_num, bool *more, uint8_t *szx)
+{
+    if (!block2_opt || !block_num || !more || !szx) {
+        return false;
+    }
+
+    uint32_t block_val = 0;
+    for (size_t i = 0; i < block2_opt->buf.len; i++) {
+        block_val = (block_val << 8) | block2_opt->buf.p[i];
+    }
+
+    *block_num = block_val >> 4;
+    *more = (block_val & 0x08) != 0;
+    *szx = block_val & 0x07;
+
+    return true;
+}
+
+/**
+ * @brief Parse Block2 option to extract block number, more bit, and SZX value.
+ * @param block2_opt Block2 option pointer
+ * @param block_num Output: block number
+ * @param more Output: true if more blocks are available
+ * @param szx Output: block size exponent
+ * @return true on success, false if input invalid
+ */
+size_t coap_encode_block2_option(uint8_t *buf, uint32_t block_num, bool more,
+                                 uint8_t szx)
+{
+    if (!buf)
+        return 0;
+
+    uint32_t block2_value = (block_num << 4) | (more ? 0x08 : 0x00) | szx;
+
+    if (block2_value < 256) {
+        buf[0] = (uint8_t) block2_value;
+        return 1;
+    } else if (block2_value < 65536) {
+        buf[0] = (uint8_t) (block2_value >> 8);
+        buf[1] = (uint8_t) (block2_value & 0xFF);
+        return 2;
+    } else {
+        buf[0] = (uint8_t) (block2_value >> 16);
+        buf[1] = (uint8_t) ((block2_value >> 8) & 0xFF);
+        buf[2] = (uint8_t) (block2_value & 0xFF);
+        return 3;
+    }
+}
+
+/**
+ * @brief Parse a Block1 option (RFC 7959 section 2.2).
+ *
+ * Block1 uses the same NUM/M/SZX layout as Block2; in a request M says more
+ * request blocks follow, in a response it echoes the block acknowledged.
+ *
+ * @param block1_opt Block1 option pointer
+ * @param block_num Output: block number
+ * @param more Output: M bit
+ * @param szx Output: block size exponent
+ * @return true on success, false if input invalid
+ */
+bool coap_parse_block1_option(const coap_option_t *block1_opt,
+                              uint32_t *block_num, bool *more, uint8_t *szx)
+{
+    return coap_parse_block2_option(block1_opt, block_num, more, szx);
+}
+
+/**
+ * @brief Encode a Block1 option value.
+ * @param buf Output buffer (at least 3 bytes)
+ * @param block_num Block number
+ * @param more M bit
+ * @param szx Block size exponent
+ * @return Encoded length
+ */
+size_t coap_encode_block1_option(uint8_t *buf, uint32_t block_num, bool more,
+                                 uint8_t szx)
+{
+    return coap_encode_block2_option(buf, block_num, more, szx);
+}
+
+/**
+ * @brief Build a CoAP blockwise response with Block2 and Content-Format
+ * options.
+ * @param scratch Scratch buffer for packet building
+ * @param outpkt Output: CoAP response to fill in
+ * @param inpkt Incoming request (for tokens, etc.)
+ * @param idhi Message ID MSB
+ * @param idlo Message ID LSB
+ * @param block_num Block number to use
+ * @param more True if more blocks are to follow
+ * @param szx Block size exponent
+ * @param payload Pointer to block payload
+ * @param payload_len Payload length in bytes
+ * @param content_format Content-Format value to use
+ * @param etag ETag of the representation, or NULL to send none
+ * @return 0 on success, nonzero on error
+ */
+int coap_build_block2_response(coap_rw_buffer_t *scratch, coap_packet_t *outpkt,
+                               const coap_packet_t *inpkt, uint8_t id_hi,
+                               uint8_t id_lo, uint32_t block_num, bool more,
+                               uint8_t szx, const uint8_t *payload,
+                               size_t payload_len, uint8_t content_format,
+                               const coap_buffer_t *etag)
+{
+    // A BERT payload is whole units; only the final block may be short
+    if (szx == COAP_BLOCK_SZX_BERT &&
+        (payload_len > COAP_BERT_PAYLOAD_MAX ||
+         (more && (payload_len == 0 || payload_len % COAP_BERT_UNIT != 0)))) {
+        return -1;
+    }
+
+    // Initialize response packet
+    outpkt->hdr.ver = 1;
+    outpkt->hdr.t = COAP_TYPE_ACK;
+    outpkt->hdr.tkl = inpkt->tok.len;
+    outpkt->hdr.code = COAP_RSPCODE_CONTENT;
+    outpkt->hdr.id[0] = id_hi;
+    outpkt->hdr.id[1] = id_lo;
+    outpkt->tok = inpkt->tok;
+    coap_clear_options(outpkt);
+
+    // Options go in ascending order: ETag (4) comes first
+    if (etag && etag->len > 0 && etag->len <= COAP_ETAG_MAX)
+        coap_add_option(outpkt, COAP_OPTION_ETAG, etag->p, etag->len);
+
+    // Add Content-Format option if needed
+    if (content_format != 0 || block_num > 0) {
+        cs04_content_format = content_format;
+        coap_add_option(outpkt, COAP_OPTION_CONTENT_FORMAT,
+                        &cs04_content_format, 1);
+    }
+
+    // Add Block2 option
+    size_t block2_len = coap_encode_block2_option(cs04_block2_buf, block_num,
+                                                  more, szx);
+    coap_add_option(outpkt, COAP_OPTION_BLOCK2, cs04_block2_buf, block2_len);
+
+    // Set payload
+    outpkt->payload.p = (uint8_t *) payload;
+    outpkt->payload.len = payload_len;
+
+    return 0;
+}
+
+/**
+ * @brief Build a 2.03 Valid response to a conditional GET.
+ * @param outpkt Output: CoAP response to fill in
+ * @param inpkt Incoming request (for the token)
+ * @param id_hi Message ID MSB
+ * @param id_lo Message ID LSB
+ * @param etag ETag the request matched (must stay valid until encoded)
+ * @return 0 on success, -1 if the ETag is missing or too long
+ */
+int coap_build_valid_response(coap_packet_t *outpkt,
+                              const coap_packet_t *inpkt, uint8_t id_hi,
+                              uint8_t id_lo, const coap_buffer_t *etag)
+{
+    if (!etag || etag->len == 0 || etag->len > COAP_ETAG_MAX)
+        return -1;
+
+    outpkt->hdr.ver = 1;
+    outpkt->hdr.t = COAP_TYPE_ACK;
+    outpkt->hdr.tkl = inpkt->tok.len;
+    outpkt->hdr.code = COAP_RSPCODE_VALID;
+    outpkt->hdr.id[0] = id_hi;
+    outpkt->hdr.id[1] = id_lo;
+    outpkt->tok = inpkt->tok;
+    coap_clear_options(outpkt);
+    coap_add_option(outpkt, COAP_OPTION_ETAG, etag->p, etag->len);
+    outpkt->payload.p = NULL;
+    outpkt->payload.len = 0;
+    return 0;
+}
+
+/**
+ * @brief Calculate block size in bytes from SZX value.
+ * @param szx Block size exponent (0–7; 7 is the BERT unit)
+ * @return Block size in bytes
+ */
+uint32_t coap_block_size_from_szx(uint8_t szx)
+{
+    if (szx > COAP_BLOCK_SZX_MAX)
+        szx = COAP_BLOCK_SZX_MAX;  // SZX 7 (BERT) counts 1024-byte units
+    return (1 << (szx + 4));       // 2^(SZX+4)
+}
+
+/**
+ * @brief Pick the largest plain SZX whose block size fits a byte budget.
+ * @param size Largest block size allowed in bytes
+ * @return SZX (0-6); 0 if size is below 16 bytes
+ */
+uint8_t coap_szx_from_block_size(uint32_t size)
+{
+    uint8_t szx = 0;
+    while (szx < COAP_BLOCK_SZX_MAX && coap_block_size_from_szx(szx + 1) <= size)
+        szx++;
+    return szx;
+}
+
+/**
+ * @brief Count the block numbers a Block2 payload covers.
+ *
+ * A plain block covers one number. A BERT (SZX 7) payload covers one per
+ * 1024-byte unit, rounding a short final unit up, so the next request asks
+ * for block_num + units.
+ *
+ * @param szx Block size exponent of the response
+ * @param payload_len Payload length in bytes
+ * @return Block numbers covered (at least 1)
+ */
+uint32_t coap_block_units(uint8_t szx, size_t payload_len)
+{
+    if (szx != COAP_BLOCK_SZX_BERT || payload_len <= COAP_BERT_UNIT)
+        return 1;
+    return (uint32_t) ((payload_len + COAP_BERT_UNIT - 1) / COAP_BERT_UNIT);
+}
+
+/**
+ * @brief Read the freshness lifetime of a response.
+ * @param pkt Parsed response
+ * @return Max-Age option value in seconds, or COAP_DEFAULT_MAX_AGE_S
+ */
+uint32_t coap_get_max_age(const coap_packet_t *pkt)
+{
+    uint8_t count = 0;
+    const coap_option_t *opt = coap_findOptions(pkt, COAP_OPTION_MAX_AGE,
+                                                &count);
+    if (!opt || count == 0)
+        return COAP_DEFAULT_MAX_AGE_S;
+    return coap_get_option_uint(&opt->buf);
+}
+
+/**
+ * @brief Add Max-Age to a response that may already carry later options.
+ * @param pkt Response built by one of the helpers above
+ * @param max_age_s Freshness lifetime in seconds
+ * @return 0 on success, -1 if all MAXOPT options are used
+ */
+int coap_add_max_age(coap_packet_t *pkt, uint32_t max_age_s)
+{
+    if (pkt->numopts >= MAXOPT)
+        return -1;
+
+    // Options stay sorted: the ones numbered above Max-Age move up a slot
+    uint8_t at = pkt->numopts;
+    while (at > 0 && pkt->opts[at - 1].num > COAP_OPTION_MAX_AGE) {
+        pkt->opts[at] = pkt->opts[at - 1];
+        at--;
+    }
+    pkt->opts[at].num = COAP_OPTION_MAX_AGE;
+    pkt->opts[at].buf.p = cs04_max_age_buf;
+    pkt->opts[at].buf.len = coap_set_option_uint(cs04_max_age_buf, max_age_s);
+    pkt->numopts++;
+
+    memset(pkt->optidx, 0, sizeof(pkt->optidx));
+    for (uint8_t i = 0; i < pkt->numopts; i++) {
+        uint8_t num = pkt->opts[i].num;
+        if (num < COAP_OPTION_INDEX_SIZE && pkt->optidx[num] == 0)
+            pkt->optidx[num] = i + 1;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef CS04_COAP_CODEC_H
+#define CS04_COAP_CODEC_H
+
+// Option encoders and response builders that only touch memory: no lwIP,
+// no Pico SDK. cs04_coap_packet.h includes this header, and host tools
+// (test/host) link cs04_coap_codec.c with microcoap on its own.
+
+#include "coap.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define COAP_BLOCK_SZX_MAX 6         // Largest plain Block2 size (1024 bytes)
+#define COAP_BLOCK_SZX_BERT 7        // BERT: payload of several 1024-byte units
+#define COAP_BERT_UNIT 1024          // Block numbers count these under SZX 7
+#define COAP_BERT_MAX_UNITS 2        // Units per BERT payload (2 IP fragments)
+#define COAP_BERT_PAYLOAD_MAX (COAP_BERT_MAX_UNITS * COAP_BERT_UNIT)
+#define COAP_ETAG_MAX 8              // Longest ETag option value (RFC 7252)
+#define COAP_DEFAULT_MAX_AGE_S 60    // Max-Age when the option is absent
+
+// Upper bound on a packet's encoded length, for sizing buffers.
+size_t coap_packet_max_len(const coap_packet_t *pkt);
+
+// Extracts the message ID from a CoAP packet.
+uint16_t coap_extract_msg_id(const coap_packet_t *pkt);
+
+// Compares two CoAP tokens for equality.
+bool coap_token_matches(const coap_buffer_t *tok1, const coap_buffer_t *tok2);
+
+// Helper to parse block transfer option and extract parameters. For SZX 7
+// (BERT) block_size is the 1024-byte unit; the payload may hold several.
+bool coap_extract_block2_info(const coap_option_t *block2_opt,
+                              uint32_t *block_num, bool *more,
+                              uint32_t *block_size);
+
+// Helper to parse Block2 option and extract parameters for blockwise transfer.
+bool coap_parse_block2_option(const coap_option_t *block2_opt,
+                              uint32_t *block_num, bool *more, uint8_t *szx);
+
+// Helper to encode Block2 option for a packet.
+size_t coap_encode_block2_option(uint8_t *buf, uint32_t block_num, bool more,
+                                 uint8_t szx);
+
+// Block1 counterparts of the above (same NUM/M/SZX layout as Block2).
+bool coap_parse_block1_option(const coap_option_t *block1_opt,
+                              uint32_t *block_num, bool *more, uint8_t *szx);
+size_t coap_encode_block1_option(uint8_t *buf, uint32_t block_num, bool more,
+                                 uint8_t szx);
+
+// Helper to build a blockwise transfer response with Block2 and Content-Format
+// options, plus an ETag option unless etag is NULL. With SZX 7 the payload is
+// a BERT run of whole 1024-byte units (only the last block may be shorter);
+// returns -1 if it is not.
+int coap_build_block2_response(coap_rw_buffer_t *scratch, coap_packet_t *outpkt,
+                               const coap_packet_t *inpkt, uint8_t id_hi,
+                               uint8_t id_lo, uint32_t block_num, bool more,
+                               uint8_t szx, const uint8_t *payload,
+                               size_t payload_len, uint8_t content_format,
+                               const coap_buffer_t *etag);
+
+// Builds a 2.03 Valid ACK for a conditional GET: the ETag the request matched
+// and no payload (RFC 7252 section 5.10.6.2).
+int coap_build_valid_response(coap_packet_t *outpkt,
+                              const coap_packet_t *inpkt, uint8_t id_hi,
+                              uint8_t id_lo, const coap_buffer_t *etag);
+
+// Computes the block size given SZX value (the unit size for SZX 7).
+uint32_t coap_block_size_from_szx(uint8_t szx);
+
+// Returns the largest SZX whose block fits in size bytes (0 if below 16).
+uint8_t coap_szx_from_block_size(uint32_t size);
+
+// Returns how many block numbers a payload covers: 1, or the number of
+// 1024-byte units for a BERT (SZX 7) payload.
+uint32_t coap_block_units(uint8_t szx, size_t payload_len);
+
+// Returns a response's Max-Age option, or COAP_DEFAULT_MAX_AGE_S without one.
+uint32_t coap_get_max_age(const coap_packet_t *pkt);
+
+// Adds a Max-Age option to a built response, in option order ahead of e.g.
+// Block2. The value lives in a static buffer until the next call. Returns -1
+// if the packet has no room for another option.
+int coap_add_max_age(coap_packet_t *pkt, uint32_t max_age_s);
+
+#endif  // CS04_COAP_CODEC_H
@@ -1,57 +1,193 @@
 #include "cs04_coap_packet.h"
 #include "cs04_coap_reliability.h"
+#include "cs04_packet_pool.h"
+#include "cs04_log.h"
 #include "lwip/pbuf.h"
-#include "pico/stdlib.h"
+#include "cs04_platform.h"
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #define BLOCK_SIZE 1024
 
+static uint16_t next_msg_id;
+static bool msg_id_started;
+static uint8_t token_pool[COAP_TOKEN_POOL_BYTES];
+static size_t token_pool_left;
+
 /**
- * @brief Generate a random CoAP message ID.
- * @return Pseudorandom 16-bit message ID.
+ * @brief Allocate the next CoAP message ID.
+ *
+ * The first call picks a random start, so a reboot does not reuse the IDs
+ * of the previous run; after that IDs go up by one, so the peer's recent-ID
+ * history never sees a repeat within 65535 messages. An ID still in the
+ * pending table is skipped. At most MAX_PENDING_MESSAGES are, so the loop
+ * ends within that many steps. 0 is skipped because the send functions
+ * return it for "not sent".
+ *
+ * @return Message ID not currently awaiting an ACK
  */
 uint16_t coap_generate_msg_id(void)
 {
-    return (uint16_t) rand();
+    if (!msg_id_started) {
+        next_msg_id = (uint16_t) platform_random64();
+        msg_id_started = true;
+    }
+
+    uint16_t id;
+    do {
+        id = next_msg_id++;
+    } while (id == 0 || coap_msg_id_pending(id));
+    return id;
 }
 
 /**
  * @brief Generate a random token for CoAP messages.
+ *
+ * Each byte is used once. The pool is refilled in one batch from the
+ * hardware RNG, so a token costs a few copies rather than an RNG call
+ * per byte.
+ *
  * @param token Resulting coap_buffer_t to fill
- * @param tokendata Buffer to receive token bytes
+ * @param token_data Buffer to receive token bytes
  * @param len Length of token to generate (bytes)
  */
 void coap_generate_token(coap_buffer_t *token, uint8_t *token_data, size_t len)
 {
     for (size_t i = 0; i < len; i++) {
-        token_data[i] = (uint8_t) rand();
+        if (token_pool_left == 0) {
+            for (size_t w = 0; w < COAP_TOKEN_POOL_BYTES; w += 8) {
+                uint64_t r = platform_random64();
+                memcpy(&token_pool[w], &r, 8);
+            }
+            token_pool_left = COAP_TOKEN_POOL_BYTES;
+        }
+        token_data[i] = token_pool[--token_pool_left];
     }
     token->p = token_data;
     token->len = len;
 }
 
 /**
- * @brief Compare two CoAP tokens for equality.
- * @param tok1 First token
- * @param tok2 Second token
- * @return true if tokens identical, false otherwise
+ * @brief Parse a received pbuf (chain) without copying the datagram.
+ *
+ * A single segment is parsed in place. For a chain, the header, token and
+ * options are parsed from the first segment when they end there and are
+ * followed by the payload marker (or nothing); the payload is then taken
+ * with pbuf_get_contiguous(), which only copies when it spans segments.
+ * Anything else (options cut by a segment boundary, or more than MAXOPT in
+ * the first segment) is gathered whole into buf and parsed from there.
+ *
+ * @param pkt Output: parsed packet, pointing into p or buf
+ * @param p Received datagram
+ * @param buf Gather buffer, used only for data that spans segments
+ * @param buf_len Size of buf
+ * @return 0 on success, else a coap_error_t code
  */
-bool coap_token_matches(const coap_buffer_t *tok1, const coap_buffer_t *tok2)
+int coap_parse_pbuf(coap_packet_t *pkt, const struct pbuf *p, uint8_t *buf,
+                    size_t buf_len)
 {
-    if (tok1->len != tok2->len)
-        return false;
-    return memcmp(tok1->p, tok2->p, tok1->len) == 0;
+    const uint8_t *first = (const uint8_t *) p->payload;
+    if (p->len == p->tot_len)
+        return coap_parse(pkt, first, p->len);
+
+    if (coap_parse(pkt, first, p->len) == 0 && pkt->numopts < MAXOPT) {
+        const uint8_t *opt_end = first + 4 + pkt->hdr.tkl;
+        if (pkt->numopts > 0) {
+            const coap_buffer_t *last = &pkt->opts[pkt->numopts - 1].buf;
+            opt_end = last->p + last->len;
+        }
+
+        u16_t off = (u16_t) (opt_end - first);
+        if (off < p->len || pbuf_get_at(p, off) == 0xFF) {
+            // opt_end < p->len means microcoap stopped at the marker
+            u16_t start = (u16_t) (off + 1);
+            pkt->payload.p = NULL;
+            pkt->payload.len = 0;
+            if (start < p->tot_len) {
+                u16_t len = (u16_t) (p->tot_len - start);
+                pkt->payload.p = pbuf_get_contiguous(p, buf, buf_len, len,
+                                                     start);
+                if (!pkt->payload.p)
+                    return COAP_ERR_BUFFER_TOO_SMALL;
+                pkt->payload.len = len;
+            }
+            return 0;
+        }
+    }
+
+    // Options continue past the first segment: gather the whole datagram
+    const uint8_t *data = pbuf_get_contiguous(p, buf, buf_len, p->tot_len, 0);
+    if (!data)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    return coap_parse(pkt, data, p->tot_len);
 }
 
 /**
- * @brief Extract the message ID from a CoAP packet.
- * @param pkt Pointer to the CoAP packet struct
- * @return 16-bit message ID extracted from header
+ * @brief Encode a CoAP packet straight into a new pool-backed pbuf.
+ *
+ * The pbuf is trimmed to the encoded length, so it can be sent with
+ * coap_send_pbuf() and kept by the retransmission queue without a copy.
+ *
+ * @param pkt Packet to encode
+ * @return pbuf holding the message (caller frees), or NULL on error
  */
-uint16_t coap_extract_msg_id(const coap_packet_t *pkt)
+struct pbuf *coap_build_pbuf(const coap_packet_t *pkt)
 {
-    return (pkt->hdr.id[0] << 8) | pkt->hdr.id[1];
+    size_t max_len = coap_packet_max_len(pkt);
+    struct pbuf *p = packet_pool_alloc_pbuf(max_len);
+    if (!p) {
+        LOG_ERROR("ERROR: Failed to allocate pbuf\n");
+        return NULL;
+    }
+
+    size_t buflen = max_len;
+    if (coap_build(p->payload, &buflen, pkt) != COAP_ERR_NONE) {
+        pbuf_free(p);
+        return NULL;
+    }
+    pbuf_realloc(p, (u16_t) buflen);
+    return p;
+}
+
+/**
+ * @brief Encode a packet around a payload that is already in pbufs.
+ *
+ * Only the header, token and options are written; the payload chain is
+ * attached behind the marker so lwIP reads it where it lies (a prefetch
+ * slot, for example).
+ *
+ * @param pkt Packet to encode; its payload pointer is not read
+ * @param payload Payload chain of pkt->payload.len bytes (reference taken)
+ * @return Message chain (caller frees), or NULL on error
+ */
+struct pbuf *coap_build_pbuf_chain(const coap_packet_t *pkt,
+                                   struct pbuf *payload)
+{
+    if (payload->tot_len != pkt->payload.len) {
+        pbuf_free(payload);
+        return NULL;
+    }
+
+    coap_packet_t head = *pkt;
+    head.payload.p = NULL;
+    head.payload.len = 0;
+
+    size_t max_len = coap_packet_max_len(&head) + 1;  // + payload marker
+    struct pbuf *p = packet_pool_alloc_pbuf(max_len);
+    size_t buflen = max_len;
+    if (!p || coap_build(p->payload, &buflen, &head) != COAP_ERR_NONE) {
+        if (p)
+            pbuf_free(p);
+        pbuf_free(payload);
+        return NULL;
+    }
+
+    if (payload->tot_len > 0)
+        ((uint8_t *) p->payload)[buflen++] = 0xFF;
+    pbuf_realloc(p, (u16_t) buflen);
+    pbuf_cat(p, payload);
+    return p;
 }
 
 /**
@@ -75,7 +211,6 @@ uint16_t coap_send_con_request(struct udp_pcb *pcb, const ip_addr_t *dest_ip,
                                const uint8_t *payload, size_t payload_len,
                                bool store_for_retransmit)
 {
-    uint8_t buf[128];
     coap_packet_t pkt = { 0 };
 
     pkt.hdr.ver = 1;
@@ -101,35 +236,30 @@ uint16_t coap_send_con_request(struct udp_pcb *pcb, const ip_addr_t *dest_ip,
         pkt.payload.len = payload_len;
     }
 
-    size_t buflen = sizeof(buf);
-    if (coap_build(buf, &buflen, &pkt) != COAP_ERR_NONE) {
-        printf("ERROR: Failed to build CON request\n");
+    struct pbuf *p = coap_build_pbuf(&pkt);
+    if (!p) {
+        LOG_ERROR("ERROR: Failed to build CON request\n");
         return 0;
     }
 
-    // Store for retransmission if requested
+    // Stored requests go through the peer's congestion window (the queue
+    // keeps its own reference)
+    bool sent;
     if (store_for_retransmit) {
-        coap_store_for_retransmit(msg_id, dest_ip, dest_port, buf, buflen);
-    }
-
-    // Send packet
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
-    if (!p) {
-        printf("ERROR: Failed to allocate pbuf\n");
-        return 0;
+        sent = coap_send_reliable(pcb, msg_id, dest_ip, dest_port, p);
+    } else {
+        err_t result = coap_send_pbuf(pcb, p, dest_ip, dest_port);
+        if (result != ERR_OK)
+            LOG_ERROR("ERROR: udp_sendto failed: %d\n", result);
+        sent = result == ERR_OK;
     }
-
-    memcpy(p->payload, buf, buflen);
-    err_t result = udp_sendto(pcb, p, dest_ip, dest_port);
     pbuf_free(p);
 
-    if (result == ERR_OK) {
-        printf("✓ CON request sent (msg_id: 0x%04X)\n", msg_id);
-    } else {
-        printf("ERROR: udp_sendto failed: %d\n", result);
+    if (sent) {
+        LOG_DEFER("✓ CON request sent (msg_id: 0x%04X)\n", msg_id);
     }
 
-    return msg_id;
+    return sent ? msg_id : 0;
 }
 
 /**
@@ -156,7 +286,6 @@ uint16_t coap_send_con_notification(struct udp_pcb *pcb,
                                     bool is_block, uint32_t block_num,
                                     bool more_blocks, bool is_image)
 {
-    uint8_t buf[BLOCK_SIZE + 200];
     coap_packet_t pkt = { 0 };
 
     pkt.hdr.ver = 1;
@@ -188,9 +317,7 @@ uint16_t coap_send_con_notification(struct udp_pcb *pcb,
         if (more_blocks)
             block_val |= 0x08;
 
-#if BLOCK_SIZE == 1024
-        block_val |= 0x06;  // SZX = 6
-#endif
+        block_val |= coap_szx_from_block_size(BLOCK_SIZE);
 
         size_t block_len = coap_set_option_uint(block_buf, block_val);
         coap_add_option(&pkt, COAP_OPTION_BLOCK2, block_buf, block_len);
@@ -199,31 +326,22 @@ uint16_t coap_send_con_notification(struct udp_pcb *pcb,
     pkt.payload.p = payload;
     pkt.payload.len = payload_len;
 
-    size_t buflen = sizeof(buf);
-    if (coap_build(buf, &buflen, &pkt) != COAP_ERR_NONE) {
-        printf("ERROR: Failed to build notification\n");
-        return 0;
-    }
-
-    // Store for retransmission
-    coap_store_for_retransmit(msg_id, dest_ip, dest_port, buf, buflen);
-
-    // Send packet
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
+    struct pbuf *p = coap_build_pbuf(&pkt);
     if (!p) {
-        printf("ERROR: Failed to allocate pbuf\n");
+        LOG_ERROR("ERROR: Failed to build notification\n");
         return 0;
     }
 
-    memcpy(p->payload, buf, buflen);
-    err_t result = udp_sendto(pcb, p, dest_ip, dest_port);
+    // Send through the peer's congestion window (the queue keeps its own
+    // reference)
+    bool sent = coap_send_reliable(pcb, msg_id, dest_ip, dest_port, p);
     pbuf_free(p);
 
-    if (result == ERR_OK) {
-        printf("✓ Notification sent (msg_id: 0x%04X)\n", msg_id);
+    if (sent) {
+        LOG_DEFER("✓ Notification sent (msg_id: 0x%04X)\n", msg_id);
     }
 
-    return msg_id;
+    return sent ? msg_id : 0;
 }
 
 /**
@@ -239,7 +357,9 @@ void coap_send_ack(struct udp_pcb *pcb, const ip_addr_t *addr, u16_t port,
                    const coap_packet_t *req, const uint8_t *payload,
                    size_t payload_len)
 {
-    uint8_t buf[64];
+    if (req->hdr.t != COAP_TYPE_CON)
+        return;  // NON messages are never acknowledged
+
     coap_packet_t pkt = { 0 };
 
     pkt.hdr.ver = 1;
@@ -252,22 +372,17 @@ void coap_send_ack(struct udp_pcb *pcb, const ip_addr_t *addr, u16_t port,
     pkt.payload.p = payload;
     pkt.payload.len = payload_len;
 
-    size_t buflen = sizeof(buf);
-    if (coap_build(buf, &buflen, &pkt) != COAP_ERR_NONE) {
-        printf("Failed to build ACK\n");
+    struct pbuf *p = coap_build_pbuf(&pkt);
+    if (!p) {
+        LOG_ERROR("Failed to build ACK\n");
         return;
     }
 
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
-    if (!p)
-        return;
-
-    memcpy(p->payload, buf, buflen);
-    udp_sendto(pcb, p, addr, port);
+    platform_udp_send(pcb, p, addr, port);
     pbuf_free(p);
 
     uint16_t msg_id = coap_extract_msg_id(req);
-    printf("✓ Sent ACK for msg_id 0x%04X\n", msg_id);
+    LOG_DEFER("✓ Sent ACK for msg_id 0x%04X\n", msg_id);
 }
 
 /**
@@ -282,7 +397,9 @@ void coap_send_block_ack(struct udp_pcb *pcb, const ip_addr_t *addr, u16_t port,
                          const coap_packet_t *req,
                          const coap_option_t *block2_opt)
 {
-    uint8_t buf[64];
+    if (req->hdr.t != COAP_TYPE_CON)
+        return;  // NON messages are never acknowledged
+
     coap_packet_t pkt = { 0 };
 
     pkt.hdr.ver = 1;
@@ -295,18 +412,13 @@ void coap_send_block_ack(struct udp_pcb *pcb, const ip_addr_t *addr, u16_t port,
     coap_add_option(&pkt, COAP_OPTION_BLOCK2, block2_opt->buf.p,
                     block2_opt->buf.len);
 
-    size_t buflen = sizeof(buf);
-    if (coap_build(buf, &buflen, &pkt) != COAP_ERR_NONE) {
-        printf("Failed to build Block ACK\n");
+    struct pbuf *p = coap_build_pbuf(&pkt);
+    if (!p) {
+        LOG_ERROR("Failed to build Block ACK\n");
         return;
     }
 
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
-    if (!p)
-        return;
-
-    memcpy(p->payload, buf, buflen);
-    udp_sendto(pcb, p, addr, port);
+    platform_udp_send(pcb, p, addr, port);
     pbuf_free(p);
 }
 
@@ -331,7 +443,38 @@ uint16_t coap_send_fetch_request(struct udp_pcb *pcb, const ip_addr_t *dest_ip,
                                  uint8_t content_format,
                                  bool store_for_retransmit)
 {
-    uint8_t buf[256];  // Larger buffer for FETCH
+    return coap_send_fetch_block_request(pcb, dest_ip, dest_port, uri_path,
+                                         token, payload, payload_len,
+                                         content_format, 0, 6,
+                                         store_for_retransmit);
+}
+
+/**
+ * @brief Send a FETCH request for one Block2 block of the result.
+ *
+ * RFC 8132 requires every block request of a FETCH to repeat the original
+ * payload and token. Block 0 at the default size omits the Block2 option,
+ * like coap_build_get_with_block2().
+ *
+ * @param pcb UDP control block
+ * @param dest_ip Destination address
+ * @param dest_port UDP port
+ * @param uri_path Resource path
+ * @param token CoAP token (same for every block)
+ * @param payload FETCH query payload
+ * @param payload_len Payload size
+ * @param content_format Content-Format number
+ * @param block_num Requested block number
+ * @param szx Requested block size exponent
+ * @param store_for_retransmit If true, enables retransmit tracking
+ * @return Message ID assigned, or 0 on error
+ */
+uint16_t coap_send_fetch_block_request(
+    struct udp_pcb *pcb, const ip_addr_t *dest_ip, u16_t dest_port,
+    const char *uri_path, const coap_buffer_t *token, const uint8_t *payload,
+    size_t payload_len, uint8_t content_format, uint32_t block_num,
+    uint8_t szx, bool store_for_retransmit)
+{
     coap_packet_t pkt = { 0 };
 
     // Build header
@@ -364,6 +507,14 @@ uint16_t coap_send_fetch_request(struct udp_pcb *pcb, const ip_addr_t *dest_ip,
     size_t accept_len = coap_set_option_uint(accept_buf, content_format);
     coap_add_option(&pkt, COAP_OPTION_ACCEPT, accept_buf, accept_len);
 
+    // Add Block2 option for continuation blocks
+    uint8_t block2_buf[3];
+    if (block_num > 0 || szx != 6) {
+        size_t block2_len = coap_encode_block2_option(block2_buf, block_num,
+                                                      false, szx);
+        coap_add_option(&pkt, COAP_OPTION_BLOCK2, block2_buf, block2_len);
+    }
+
     // Add payload
     if (payload && payload_len > 0) {
         pkt.payload.p = (uint8_t *) payload;
@@ -371,171 +522,113 @@ uint16_t coap_send_fetch_request(struct udp_pcb *pcb, const ip_addr_t *dest_ip,
     }
 
     // Build packet
-    size_t buflen = sizeof(buf);
-    if (coap_build(buf, &buflen, &pkt) != COAP_ERR_NONE) {
-        printf("ERROR: Failed to build FETCH request\n");
+    struct pbuf *p = coap_build_pbuf(&pkt);
+    if (!p) {
+        LOG_ERROR("ERROR: Failed to build FETCH request\n");
         return 0;
     }
 
-    // Store for retransmission if requested
+    // Stored requests go through the peer's congestion window (the queue
+    // keeps its own reference)
+    bool sent;
     if (store_for_retransmit) {
-        coap_store_for_retransmit(msg_id, dest_ip, dest_port, buf, buflen);
-    }
-
-    // Send packet
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, buflen, PBUF_RAM);
-    if (!p) {
-        printf("ERROR: Failed to allocate pbuf\n");
-        return 0;
+        sent = coap_send_reliable(pcb, msg_id, dest_ip, dest_port, p);
+    } else {
+        err_t result = coap_send_pbuf(pcb, p, dest_ip, dest_port);
+        if (result != ERR_OK)
+            LOG_ERROR("ERROR: udp_sendto failed: %d\n", result);
+        sent = result == ERR_OK;
     }
-
-    memcpy(p->payload, buf, buflen);
-    err_t result = udp_sendto(pcb, p, dest_ip, dest_port);
     pbuf_free(p);
 
-    if (result == ERR_OK) {
-        printf("✓ FETCH request sent (msg_id: 0x%04X, Content-Format: %d)\n",
+    if (sent) {
+        LOG_DEBUG("✓ FETCH request sent (msg_id: 0x%04X, Content-Format: %d)\n",
                msg_id, content_format);
-    } else {
-        printf("ERROR: udp_sendto failed: %d\n", result);
     }
 
-    return msg_id;
+    return sent ? msg_id : 0;
 }
 
 /**
- * @brief Extract block number, more bit, and block size from Block2 option.
- * @param block2_opt Block2 option pointer
- * @param block_num Output block number
- * @param more Output: true if more blocks to follow
- * @param block_size Output: block size in bytes
- * @return True if successfully parsed; false otherwise
+ * @brief Send one block of a Block1 upload (RFC 7959 section 2.5).
+ *
+ * Every block carries the same token so the server can tie it to its
+ * upload session; the payload is copied into the message pbuf.
+ *
+ * @param pcb UDP control block
+ * @param dest_ip Destination address
+ * @param dest_port UDP port
+ * @param method PUT or iPATCH
+ * @param uri_path Resource path
+ * @param token CoAP token (same for every block)
+ * @param block_num Block number
+ * @param more True if more blocks follow
+ * @param szx Block size exponent
+ * @param payload Block payload (the block size, or less for the last block)
+ * @param payload_len Payload size
+ * @param store_for_retransmit If true, enables retransmit tracking
+ * @return Message ID assigned, or 0 on error
  */
-bool coap_extract_block2_info(const coap_option_t *block2_opt,
-                              uint32_t *block_num, bool *more,
-                              uint32_t *block_size)
+uint16_t coap_send_block1_request(struct udp_pcb *pcb,
+                                  const ip_addr_t *dest_ip, u16_t dest_port,
+                                  coap_method_t method, const char *uri_path,
+                                  const coap_buffer_t *token,
+                                  uint32_t block_num, bool more, uint8_t szx,
+                                  const uint8_t *payload, size_t payload_len,
+                                  bool store_for_retransmit)
 {
-    if (!block2_opt)
-        return false;
-
-    uint32_t block_val = coap_get_option_uint(&block2_opt->buf);
-    *block_num = (block_val >> 4);
-    *more = (block_val & 0x08);
-
-    uint32_t szx = block_val & 0x07;
-    *block_size = (1 << (szx + 4));
+    coap_packet_t pkt = { 0 };
 
-    return true;
-}
+    pkt.hdr.ver = 1;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.tkl = token ? token->len : 0;
+    pkt.hdr.code = method;
 
-// Global buffers for Block2 encoding (must persist after function returns)
-static uint8_t cs04_block2_buf[3];
-static uint8_t cs04_content_format;
+    uint16_t msg_id = coap_generate_msg_id();
+    pkt.hdr.id[0] = (uint8_t) (msg_id >> 8);
+    pkt.hdr.id[1] = (uint8_t) (msg_id & 0xFF);
 
-bool coap_parse_block2_option(const coap_option_t *block2_opt,
-                              uint32_t *block_num, bool *more, uint8_t *szx)
-{
-    if (!block2_opt || !block_num || !more || !szx) {
-        return false;
+    if (token) {
+        pkt.tok = *token;
     }
 
-    uint32_t block_val = 0;
-    for (size_t i = 0; i < block2_opt->buf.len; i++) {
-        block_val = (block_val << 8) | block2_opt->buf.p[i];
+    if (uri_path) {
+        coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) uri_path,
+                        strlen(uri_path));
     }
 
-    *block_num = block_val >> 4;
-    *more = (block_val & 0x08) != 0;
-    *szx = block_val & 0x07;
+    uint8_t cf_buf[1];
+    size_t cf_len = coap_set_option_uint(cf_buf, COAP_CONTENTTYPE_TEXT_PLAIN);
+    coap_add_option(&pkt, COAP_OPTION_CONTENT_FORMAT, cf_buf, cf_len);
 
-    return true;
-}
+    uint8_t block1_buf[3];
+    size_t block1_len = coap_encode_block1_option(block1_buf, block_num, more,
+                                                  szx);
+    coap_add_option(&pkt, COAP_OPTION_BLOCK1, block1_buf, block1_len);
 
-/**
- * @brief Parse Block2 option to extract block number, more bit, and SZX value.
- * @param block2_opt Block2 option pointer
- * @param block_num Output: block number
- * @param more Output: true if more blocks are available
- * @param szx Output: block size exponent
- * @return true on success, false if input invalid
- */
-size_t coap_encode_block2_option(uint8_t *buf, uint32_t block_num, bool more,
-                                 uint8_t szx)
-{
-    if (!buf)
-        return 0;
+    if (payload && payload_len > 0) {
+        pkt.payload.p = payload;
+        pkt.payload.len = payload_len;
+    }
 
-    uint32_t block2_value = (block_num << 4) | (more ? 0x08 : 0x00) | szx;
+    struct pbuf *p = coap_build_pbuf(&pkt);
+    if (!p) {
+        LOG_ERROR("ERROR: Failed to build Block1 request\n");
+        return 0;
+    }
 
-    if (block2_value < 256) {
-        buf[0] = (uint8_t) block2_value;
-        return 1;
-    } else if (block2_value < 65536) {
-        buf[0] = (uint8_t) (block2_value >> 8);
-        buf[1] = (uint8_t) (block2_value & 0xFF);
-        return 2;
+    bool sent;
+    if (store_for_retransmit) {
+        sent = coap_send_reliable(pcb, msg_id, dest_ip, dest_port, p);
     } else {
-        buf[0] = (uint8_t) (block2_value >> 16);
-        buf[1] = (uint8_t) ((block2_value >> 8) & 0xFF);
-        buf[2] = (uint8_t) (block2_value & 0xFF);
-        return 3;
+        err_t result = coap_send_pbuf(pcb, p, dest_ip, dest_port);
+        if (result != ERR_OK)
+            LOG_ERROR("ERROR: udp_sendto failed: %d\n", result);
+        sent = result == ERR_OK;
     }
-}
+    pbuf_free(p);
 
-/**
- * @brief Build a CoAP blockwise response with Block2 and Content-Format
- * options.
- * @param scratch Scratch buffer for packet building
- * @param outpkt Output: CoAP response to fill in
- * @param inpkt Incoming request (for tokens, etc.)
- * @param idhi Message ID MSB
- * @param idlo Message ID LSB
- * @param block_num Block number to use
- * @param more True if more blocks are to follow
- * @param szx Block size exponent
- * @param payload Pointer to block payload
- * @param payload_len Payload length in bytes
- * @param content_format Content-Format value to use
- * @return 0 on success, nonzero on error
- */
-int coap_build_block2_response(coap_rw_buffer_t *scratch, coap_packet_t *outpkt,
-                               const coap_packet_t *inpkt, uint8_t id_hi,
-                               uint8_t id_lo, uint32_t block_num, bool more,
-                               uint8_t szx, const uint8_t *payload,
-                               size_t payload_len, uint8_t content_format)
-{
-    // Initialize response packet
-    outpkt->hdr.ver = 1;
-    outpkt->hdr.t = COAP_TYPE_ACK;
-    outpkt->hdr.tkl = inpkt->tok.len;
-    outpkt->hdr.code = COAP_RSPCODE_CONTENT;
-    outpkt->hdr.id[0] = id_hi;
-    outpkt->hdr.id[1] = id_lo;
-    outpkt->tok = inpkt->tok;
-    outpkt->numopts = 0;
-
-    // Add Content-Format option if needed
-    if (content_format != 0 || block_num > 0) {
-        cs04_content_format = content_format;
-        outpkt->opts[outpkt->numopts].num = COAP_OPTION_CONTENT_FORMAT;
-        outpkt->opts[outpkt->numopts].buf.p = &cs04_content_format;
-        outpkt->opts[outpkt->numopts].buf.len = 1;
-        outpkt->numopts++;
-    }
-
-    // Add Block2 option
-    size_t block2_len = coap_encode_block2_option(cs04_block2_buf, block_num,
-                                                  more, szx);
-    outpkt->opts[outpkt->numopts].num = COAP_OPTION_BLOCK2;
-    outpkt->opts[outpkt->numopts].buf.p = cs04_block2_buf;
-    outpkt->opts[outpkt->numopts].buf.len = block2_len;
-    outpkt->numopts++;
-
-    // Set payload
-    outpkt->payload.p = (uint8_t *) payload;
-    outpkt->payload.len = payload_len;
-
-    return 0;
+    return sent ? msg_id : 0;
 }
 
 /**
@@ -547,13 +640,16 @@ int coap_build_block2_response(coap_rw_buffer_t *scratch, coap_packet_t *outpkt,
  * @param uri_query Optional URI query (NULL if none, e.g., "type=image")
  * @param block_num Block number to request
  * @param szx Size exponent
+ * @param if_match ETag the block must belong to (resume), or NULL
+ * @param etag ETag of the copy the client holds, or NULL
  * @param msg_id Output: generated message ID
  * @return 0 on success, error code otherwise
  */
 int coap_build_get_with_block2(uint8_t *buf, size_t *buflen,
                                const coap_buffer_t *token, const char *uri_path,
                                const char *uri_query, uint32_t block_num,
-                               uint8_t szx, uint16_t *msg_id)
+                               uint8_t szx, const coap_buffer_t *if_match,
+                               const coap_buffer_t *etag, uint16_t *msg_id)
 {
     if (!buf || !buflen || !token || !uri_path || !msg_id) {
         return -1;
@@ -570,6 +666,14 @@ int coap_build_get_with_block2(uint8_t *buf, size_t *buflen,
     pkt.hdr.id[1] = (uint8_t) (*msg_id & 0xFF);
     pkt.tok = *token;
 
+    // If-Match (1) and ETag (4) precede Uri-Path (11)
+    if (if_match && if_match->len > 0 && if_match->len <= COAP_ETAG_MAX) {
+        coap_add_option(&pkt, COAP_OPTION_IF_MATCH, if_match->p,
+                        if_match->len);
+    }
+    if (etag && etag->len > 0 && etag->len <= COAP_ETAG_MAX)
+        coap_add_option(&pkt, COAP_OPTION_ETAG, etag->p, etag->len);
+
     // Add URI-Path option
     coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) uri_path,
                     strlen(uri_path));
@@ -590,16 +694,3 @@ int coap_build_get_with_block2(uint8_t *buf, size_t *buflen,
 
     return coap_build(buf, buflen, &pkt);
 }
-
-
-/**
- * @brief Calculate block size in bytes from SZX value.
- * @param szx Block size exponent (0–6)
- * @return Block size in bytes
- */
-uint32_t coap_block_size_from_szx(uint8_t szx)
-{
-    if (szx > 6)
-        szx = 6;              // Cap at maximum
-    return (1 << (szx + 4));  // 2^(SZX+4)
-}
@@ -2,11 +2,34 @@
 #define CS04_COAP_PACKET_H
 
 #include "coap.h"
+#include "cs04_coap_codec.h"
 #include "lwip/udp.h"
+#include "lwip/pbuf.h"
 #include "lwip/ip_addr.h"
 #include <stdint.h>
 #include <stdbool.h>
 
+// Configuration
+#define COAP_RX_GATHER_MAX (COAP_BERT_PAYLOAD_MAX + 64)  // Chained rx payload
+#define COAP_TOKEN_POOL_BYTES 32  // Random bytes fetched per token refill
+
+// Parses a received datagram, which may be a pbuf chain (e.g. reassembled IP
+// fragments). The packet points into the pbuf; only a payload that spans
+// segments, or a header that does, is gathered into buf. Returns a
+// coap_error_t (COAP_ERR_BUFFER_TOO_SMALL if buf cannot hold what is needed).
+int coap_parse_pbuf(coap_packet_t *pkt, const struct pbuf *p, uint8_t *buf,
+                    size_t buf_len);
+
+// Encodes a packet into a pool-backed pbuf trimmed to its length (NULL on
+// error).
+struct pbuf *coap_build_pbuf(const coap_packet_t *pkt);
+
+// Encodes a packet's header and options into a pool-backed pbuf and chains
+// payload (pkt->payload.len bytes) behind the payload marker, so the payload
+// is sent without a copy. Takes over the reference to payload. NULL on error.
+struct pbuf *coap_build_pbuf_chain(const coap_packet_t *pkt,
+                                   struct pbuf *payload);
+
 // Sends a confirmable (CON) CoAP request.
 // Optionally stores the message for retransmission.
 uint16_t coap_send_con_request(struct udp_pcb *pcb, const ip_addr_t *dest_ip,
@@ -42,49 +65,40 @@ uint16_t coap_send_fetch_request(struct udp_pcb *pcb, const ip_addr_t *dest_ip,
                                  uint8_t content_format,
                                  bool store_for_retransmit);
 
-// Extracts the message ID from a CoAP packet.
-uint16_t coap_extract_msg_id(const coap_packet_t *pkt);
-
-// Generate message ID
+// Sends a FETCH request for one Block2 block of the result (RFC 8132/7959).
+uint16_t coap_send_fetch_block_request(
+    struct udp_pcb *pcb, const ip_addr_t *dest_ip, u16_t dest_port,
+    const char *uri_path, const coap_buffer_t *token, const uint8_t *payload,
+    size_t payload_len, uint8_t content_format, uint32_t block_num,
+    uint8_t szx, bool store_for_retransmit);
+
+// Sends one block of a Block1 (RFC 7959) PUT/iPATCH upload; more says more
+// blocks follow. Returns the message ID, or 0 if it was not sent.
+uint16_t coap_send_block1_request(struct udp_pcb *pcb,
+                                  const ip_addr_t *dest_ip, u16_t dest_port,
+                                  coap_method_t method, const char *uri_path,
+                                  const coap_buffer_t *token,
+                                  uint32_t block_num, bool more, uint8_t szx,
+                                  const uint8_t *payload, size_t payload_len,
+                                  bool store_for_retransmit);
+
+// Returns the next message ID: a random start, then +1 per message
+// (RFC 7252 section 4.4), skipping 0 and any ID still in the pending table.
 uint16_t coap_generate_msg_id(void);
 
-// Generates a random token of specified length and stores it in
-// token/tokendata.
+// Fills token_data with len random bytes and points token at them. Bytes come
+// from a pool refilled COAP_TOKEN_POOL_BYTES at a time from the hardware RNG.
 void coap_generate_token(coap_buffer_t *token, uint8_t *token_data, size_t len);
 
-// Compares two CoAP tokens for equality.
-bool coap_token_matches(const coap_buffer_t *tok1, const coap_buffer_t *tok2);
-
-// Helper to parse block transfer option and extract parameters.
-bool coap_extract_block2_info(const coap_option_t *block2_opt,
-                              uint32_t *block_num, bool *more,
-                              uint32_t *block_size);
-
-// Helper to parse Block2 option and extract parameters for blockwise transfer.
-bool coap_parse_block2_option(const coap_option_t *block2_opt,
-                              uint32_t *block_num, bool *more, uint8_t *szx);
-
-// Helper to encode Block2 option for a packet.
-size_t coap_encode_block2_option(uint8_t *buf, uint32_t block_num, bool more,
-                                 uint8_t szx);
-
-// Helper to build a blockwise transfer response with Block2 and Content-Format
-// options.
-int coap_build_block2_response(coap_rw_buffer_t *scratch, coap_packet_t *outpkt,
-                               const coap_packet_t *inpkt, uint8_t id_hi,
-                               uint8_t id_lo, uint32_t block_num, bool more,
-                               uint8_t szx, const uint8_t *payload,
-                               size_t payload_len, uint8_t content_format);
-
 // Helper to build a GET request with Block2 option for a specific block.
-// Used by client for blockwise file or image transfer.
+// Used by client for blockwise file or image transfer. A non-NULL if_match
+// adds If-Match (the block must come from that representation, else 4.12);
+// a non-NULL etag adds ETag (2.03 Valid if the client's copy is current).
 int coap_build_get_with_block2(uint8_t *buf, size_t *buflen,
                                const coap_buffer_t *token, const char *uri_path,
                                const char *uri_query, uint32_t block_num,
-                               uint8_t szx, uint16_t *msg_id);
-
-// Computes the block size given SZX value.
-uint32_t coap_block_size_from_szx(uint8_t szx);
+                               uint8_t szx, const coap_buffer_t *if_match,
+                               const coap_buffer_t *etag, uint16_t *msg_id);
 
 
 #endif  // CS04_COAP_PACKET_H
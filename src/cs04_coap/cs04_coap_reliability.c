@@ -1,133 +1,894 @@
 #include "cs04_coap_reliability.h"
+#include "cs04_packet_pool.h"
+#include "cs04_log.h"
 #include "lwip/pbuf.h"
-#include "pico/stdlib.h"
+#include "cs04_platform.h"
 #include <string.h>
 #include <stdio.h>
 
+#define PENDING_HASH_MASK (PENDING_HASH_SIZE - 1)
+#define PENDING_EMPTY (-1)
 
 static pending_message_t pending_messages[MAX_PENDING_MESSAGES];
 static retransmit_failure_cb_t failure_callback = NULL;
 
+// Slots ordered by next_retry_ms (binary min-heap of slot indices)
+static uint16_t retry_heap[MAX_PENDING_MESSAGES];
+static uint16_t heap_len;
+
+// msg_id -> slot, open addressing with linear probing
+static int16_t msg_index[PENDING_HASH_SIZE];
+
+// Stack of unused slots
+static uint16_t free_slots[MAX_PENDING_MESSAGES];
+static uint16_t free_count;
+
+// Per-destination RTT and congestion state
+static coap_peer_t peers[COAP_PEER_TABLE_SIZE];
+static uint32_t queue_seq;  // Next FIFO number for a queued message
+
+static coap_reliability_stats_t rel_stats;
+
+static void peer_detach(int idx, uint32_t now);
+static void peer_release_window(int idx);
+
+/**
+ * @brief Compare two slots by retry time (wrap-safe).
+ * @return true if slot a is due before slot b
+ */
+static bool retry_before(uint16_t a, uint16_t b)
+{
+    return (int32_t) (pending_messages[a].next_retry_ms -
+                      pending_messages[b].next_retry_ms) < 0;
+}
+
+/**
+ * @brief Put a slot at a heap position and record the position.
+ */
+static void heap_place(uint16_t pos, uint16_t slot)
+{
+    retry_heap[pos] = slot;
+    pending_messages[slot].heap_pos = pos;
+}
+
+/**
+ * @brief Move the entry at pos towards the root while it is due earlier.
+ */
+static void heap_sift_up(uint16_t pos)
+{
+    uint16_t slot = retry_heap[pos];
+    while (pos > 0) {
+        uint16_t parent = (pos - 1) / 2;
+        if (!retry_before(slot, retry_heap[parent]))
+            break;
+        heap_place(pos, retry_heap[parent]);
+        pos = parent;
+    }
+    heap_place(pos, slot);
+}
+
+/**
+ * @brief Move the entry at pos towards the leaves while a child is due
+ * earlier.
+ */
+static void heap_sift_down(uint16_t pos)
+{
+    uint16_t slot = retry_heap[pos];
+    while (true) {
+        uint16_t child = 2 * pos + 1;
+        if (child >= heap_len)
+            break;
+        if (child + 1 < heap_len &&
+            retry_before(retry_heap[child + 1], retry_heap[child]))
+            child++;
+        if (!retry_before(retry_heap[child], slot))
+            break;
+        heap_place(pos, retry_heap[child]);
+        pos = child;
+    }
+    heap_place(pos, slot);
+}
+
+/**
+ * @brief Remove the entry at a heap position.
+ */
+static void heap_remove(uint16_t pos)
+{
+    heap_len--;
+    if (pos == heap_len)
+        return;
+
+    heap_place(pos, retry_heap[heap_len]);
+    if (pos > 0 && retry_before(retry_heap[pos], retry_heap[(pos - 1) / 2]))
+        heap_sift_up(pos);
+    else
+        heap_sift_down(pos);
+}
+
+/**
+ * @brief Find the index bucket holding a message ID.
+ * @return Bucket number, or -1 if the ID is not pending
+ */
+static int index_find(uint16_t msg_id)
+{
+    uint16_t bucket = msg_id & PENDING_HASH_MASK;
+    for (int probes = 0; probes < PENDING_HASH_SIZE; probes++) {
+        int16_t slot = msg_index[bucket];
+        if (slot == PENDING_EMPTY)
+            return -1;
+        if (pending_messages[slot].msg_id == msg_id)
+            return bucket;
+        bucket = (bucket + 1) & PENDING_HASH_MASK;
+    }
+    return -1;
+}
+
+/**
+ * @brief Add a slot to the message ID index.
+ *
+ * PENDING_HASH_SIZE is larger than MAX_PENDING_MESSAGES, so a free bucket
+ * always exists.
+ */
+static void index_insert(uint16_t msg_id, uint16_t slot)
+{
+    uint16_t bucket = msg_id & PENDING_HASH_MASK;
+    while (msg_index[bucket] != PENDING_EMPTY)
+        bucket = (bucket + 1) & PENDING_HASH_MASK;
+    msg_index[bucket] = (int16_t) slot;
+}
+
+/**
+ * @brief Remove a bucket from the index.
+ *
+ * Uses backward-shift deletion: later entries of the same probe run are
+ * moved into the hole, so lookups never need tombstones.
+ */
+static void index_remove(uint16_t bucket)
+{
+    uint16_t hole = bucket;
+    uint16_t next = (hole + 1) & PENDING_HASH_MASK;
+
+    while (msg_index[next] != PENDING_EMPTY) {
+        uint16_t home = pending_messages[msg_index[next]].msg_id &
+                        PENDING_HASH_MASK;
+        // Move the entry if the hole lies on its probe path
+        if (((next - home) & PENDING_HASH_MASK) >=
+            ((next - hole) & PENDING_HASH_MASK)) {
+            msg_index[hole] = msg_index[next];
+            hole = next;
+        }
+        next = (next + 1) & PENDING_HASH_MASK;
+    }
+    msg_index[hole] = PENDING_EMPTY;
+}
+
+/**
+ * @brief Drop a pending slot from the heap and the index.
+ * @param bucket Index bucket of the slot (from index_find)
+ */
+static void pending_release(int bucket)
+{
+    uint16_t slot = (uint16_t) msg_index[bucket];
+    pending_message_t *msg = &pending_messages[slot];
+
+    index_remove((uint16_t) bucket);
+    if (!msg->queued)
+        heap_remove(msg->heap_pos);
+    msg->active = false;
+    pbuf_free(msg->packet);
+    msg->packet = NULL;
+    free_slots[free_count++] = slot;
+
+    if (msg->peer >= 0) {
+        if (msg->queued) {
+            peers[msg->peer].queued--;
+        } else {
+            peers[msg->peer].in_flight--;
+            peer_release_window(msg->peer);
+        }
+    }
+}
+
+/**
+ * @brief Add a slot to the retry heap, due at a given time.
+ */
+static void pending_schedule(uint16_t slot, uint32_t due_ms)
+{
+    pending_messages[slot].next_retry_ms = due_ms;
+    heap_place(heap_len, slot);
+    heap_len++;
+    heap_sift_up(pending_messages[slot].heap_pos);
+}
+
+/**
+ * @brief Find the table entry for a destination.
+ * @return Entry, or NULL if the destination is not tracked
+ */
+static coap_peer_t *peer_find(const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < COAP_PEER_TABLE_SIZE; i++) {
+        if (peers[i].used && peers[i].port == port &&
+            ip_addr_cmp(&peers[i].ip, ip))
+            return &peers[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Find or create the entry for a destination.
+ *
+ * A new destination takes a free entry, or else the one least recently
+ * used, and starts from COAP_RTO_INITIAL_MS.
+ */
+static coap_peer_t *peer_get(const ip_addr_t *ip, u16_t port, uint32_t now)
+{
+    coap_peer_t *peer = peer_find(ip, port);
+    if (!peer) {
+        for (int i = 0; i < COAP_PEER_TABLE_SIZE; i++) {
+            coap_peer_t *c = &peers[i];
+            if (!c->used) {
+                peer = c;
+                break;
+            }
+            // Idle peers go first, then the least recently used
+            bool idle = c->in_flight == 0 && c->queued == 0;
+            bool peer_idle = peer && peer->in_flight == 0 && peer->queued == 0;
+            if (!peer || (idle && !peer_idle) ||
+                (idle == peer_idle &&
+                 (int32_t) (c->last_used_ms - peer->last_used_ms) < 0))
+                peer = c;
+        }
+        if (peer->used)
+            peer_detach((int) (peer - peers), now);
+
+        memset(peer, 0, sizeof(*peer));
+        peer->used = true;
+        peer->ip = *ip;
+        peer->port = port;
+        peer->rto_ms = COAP_RTO_INITIAL_MS;
+        peer->rto_updated_ms = now;
+        peer->cwnd_x16 = COAP_NSTART * 16;
+        peer->ssthresh_x16 = COAP_CWND_MAX * 16;
+        peer->cwnd_reduced_ms = now;
+    }
+    peer->last_used_ms = now;
+    return peer;
+}
+
+/**
+ * @brief Fold one delivered-or-lost outcome into the peer's loss estimate.
+ * @param peer Peer entry
+ * @param lost true for a retransmit timeout or a repeated request
+ */
+static void peer_loss_sample(coap_peer_t *peer, bool lost)
+{
+    peer->loss_x256 -= peer->loss_x256 >> COAP_LOSS_GAIN_SHIFT;
+    if (lost)
+        peer->loss_x256 += 256 >> COAP_LOSS_GAIN_SHIFT;
+}
+
+/**
+ * @brief Clamp an RTO to [COAP_RTO_MIN_MS, COAP_RTO_MAX_MS].
+ */
+static uint32_t rto_clamp(uint32_t rto)
+{
+    if (rto < COAP_RTO_MIN_MS)
+        return COAP_RTO_MIN_MS;
+    if (rto > COAP_RTO_MAX_MS)
+        return COAP_RTO_MAX_MS;
+    return rto;
+}
+
+/**
+ * @brief Move a stale RTO back towards the initial value (CoCoA aging).
+ *
+ * A small RTO that has not been confirmed for 16 RTOs is doubled, and a
+ * large one left alone for 4 RTOs is averaged with 2 s, so one quiet
+ * period does not leave a peer with a timeout that no longer fits.
+ */
+static void peer_age(coap_peer_t *peer, uint32_t now)
+{
+    uint32_t idle = now - peer->rto_updated_ms;
+
+    if (peer->rto_ms < 1000 && idle > 16 * peer->rto_ms) {
+        peer->rto_ms = rto_clamp(peer->rto_ms * 2);
+        peer->rto_updated_ms = now;
+    } else if (peer->rto_ms > 3000 && idle > 4 * peer->rto_ms) {
+        peer->rto_ms = (2000 + peer->rto_ms) / 2;
+        peer->rto_updated_ms = now;
+    }
+}
+
+/**
+ * @brief Fold one RTT sample into a smoothed estimator (RFC 6298).
+ * @param srtt Smoothed RTT x8
+ * @param rttvar RTT variation x4
+ * @param samples Samples taken so far
+ * @param rtt Measured RTT in ms
+ */
+static void rtt_update(uint32_t *srtt, uint32_t *rttvar, uint16_t *samples,
+                       uint32_t rtt)
+{
+    if (*samples == 0) {
+        *srtt = rtt << 3;
+        *rttvar = rtt << 1;  // RTT / 2, x4
+    } else {
+        int32_t delta = (int32_t) rtt - (int32_t) (*srtt >> 3);
+        if (delta < 0)
+            delta = -delta;
+        *rttvar = *rttvar - (*rttvar >> 2) + (uint32_t) delta;
+        *srtt = *srtt - (*srtt >> 3) + rtt;
+    }
+    if (*samples < UINT16_MAX)
+        (*samples)++;
+}
+
+/**
+ * @brief Update a peer's RTO from an answered exchange.
+ *
+ * Exchanges answered on the first transmission feed the strong estimator
+ * (RTO = SRTT + 4 RTTVAR, weight 1/2). Retransmitted ones are ambiguous,
+ * so they feed the weak estimator (RTO = SRTT + RTTVAR, weight 1/4), and
+ * only up to COAP_WEAK_RTT_MAX_RETRIES retransmits.
+ *
+ * @param msg Answered message
+ * @param now Current time
+ */
+static void peer_sample(const pending_message_t *msg, uint32_t now)
+{
+    if (msg->peer < 0 || msg->retransmit_count > COAP_WEAK_RTT_MAX_RETRIES)
+        return;
+
+    coap_peer_t *peer = &peers[msg->peer];
+    uint32_t rtt = now - msg->first_sent_ms;
+    if (msg->retransmit_count == 0) {
+        rtt_update(&peer->srtt_strong, &peer->rttvar_strong,
+                   &peer->strong_samples, rtt);
+        uint32_t estimate = (peer->srtt_strong >> 3) + peer->rttvar_strong;
+        peer->rto_ms = rto_clamp((estimate + peer->rto_ms) / 2);
+    } else {
+        rtt_update(&peer->srtt_weak, &peer->rttvar_weak, &peer->weak_samples,
+                   rtt);
+        uint32_t estimate = (peer->srtt_weak >> 3) +
+                            (peer->rttvar_weak >> 2);
+        peer->rto_ms = rto_clamp((estimate + 3 * peer->rto_ms) / 4);
+    }
+    peer->rto_updated_ms = now;
+}
+
+/**
+ * @brief Pick the first timeout and backoff factor for a transmission.
+ *
+ * The timeout is the peer's RTO scaled by a random factor in
+ * [1, ACK_RANDOM_FACTOR), so clients that lost the same packet do not
+ * retransmit in lockstep. The factor is drawn from platform_random64(), as
+ * an unseeded rand() gives every device the same sequence. The backoff
+ * factor is picked from the RTO as in CoCoA: 3 below 1 s, 1.5 above 3 s, 2
+ * otherwise.
+ *
+ * @param msg Message being sent for the first time
+ * @param now Current time
+ */
+static void pending_arm(pending_message_t *msg, uint32_t now)
+{
+    uint32_t rto = msg->peer >= 0 ? peers[msg->peer].rto_ms
+                                  : COAP_RTO_INITIAL_MS;
+    uint32_t spread = rto * (ACK_RANDOM_FACTOR_PCT - 100) / 100;
+
+    msg->timeout_ms = rto + (spread ? (uint32_t) platform_random64() % spread : 0);
+    msg->backoff_x2 = rto < 1000 ? 6 : (rto > 3000 ? 3 : 4);
+    msg->first_sent_ms = now;
+    msg->next_retry_ms = now + msg->timeout_ms;
+}
+
+/**
+ * @brief Open a peer's window on an ACK of a first transmission.
+ *
+ * Below the slow-start threshold every ACK adds one message; above it the
+ * window grows by about one message per window's worth of ACKs.
+ */
+static void cwnd_on_ack(coap_peer_t *peer)
+{
+    if (peer->cwnd_x16 < peer->ssthresh_x16) {
+        peer->cwnd_x16 += 16;
+    } else {
+        uint16_t step = (uint16_t) (256 / peer->cwnd_x16);
+        peer->cwnd_x16 += step ? step : 1;
+    }
+    if (peer->cwnd_x16 > COAP_CWND_MAX * 16)
+        peer->cwnd_x16 = COAP_CWND_MAX * 16;
+}
+
+/**
+ * @brief Halve a peer's window after a retransmit timeout.
+ *
+ * Only messages first sent after the previous cut can cut it again, so one
+ * burst of losses costs one halving.
+ *
+ * @param peer Peer entry
+ * @param msg Message that timed out
+ * @param now Current time
+ */
+static void cwnd_on_timeout(coap_peer_t *peer, const pending_message_t *msg,
+                            uint32_t now)
+{
+    if ((int32_t) (msg->first_sent_ms - peer->cwnd_reduced_ms) < 0)
+        return;
+
+    peer->ssthresh_x16 = peer->cwnd_x16 / 2;
+    if (peer->ssthresh_x16 < COAP_NSTART * 16)
+        peer->ssthresh_x16 = COAP_NSTART * 16;
+    peer->cwnd_x16 = peer->ssthresh_x16;
+    peer->cwnd_reduced_ms = now;
+}
+
+/**
+ * @brief Let queued messages out while the peer's window has room.
+ *
+ * Released messages go to the top of the retry heap marked unsent, and
+ * the next coap_check_retransmissions() call transmits them.
+ *
+ * @param idx Peer table index
+ */
+static void peer_release_window(int idx)
+{
+    coap_peer_t *peer = &peers[idx];
+    uint32_t now = platform_now_ms();
+
+    while (peer->queued > 0 && peer->in_flight * 16 < peer->cwnd_x16) {
+        pending_message_t *first = NULL;
+        uint16_t first_slot = 0;
+        for (uint16_t i = 0; i < MAX_PENDING_MESSAGES; i++) {
+            pending_message_t *m = &pending_messages[i];
+            if (m->active && m->queued && m->peer == idx &&
+                (!first || (int32_t) (m->queue_seq - first->queue_seq) < 0)) {
+                first = m;
+                first_slot = i;
+            }
+        }
+        if (!first)
+            break;
+
+        first->queued = false;
+        first->unsent = true;
+        peer->queued--;
+        peer->in_flight++;
+        pending_schedule(first_slot, now);
+    }
+}
+
+/**
+ * @brief Unlink a peer entry that is being reused from its messages.
+ *
+ * Its queued messages are let out at once, since nothing would release
+ * them later.
+ *
+ * @param idx Peer table index
+ * @param now Current time
+ */
+static void peer_detach(int idx, uint32_t now)
+{
+    for (uint16_t i = 0; i < MAX_PENDING_MESSAGES; i++) {
+        pending_message_t *m = &pending_messages[i];
+        if (!m->active || m->peer != idx)
+            continue;
+        m->peer = -1;
+        if (m->queued) {
+            m->queued = false;
+            m->unsent = true;
+            pending_schedule(i, now);
+        }
+    }
+}
+
+/**
+ * @brief Take a pending slot for a message and link it to its peer.
+ * @return Slot, or -1 if the table is full
+ */
+static int pending_alloc(uint16_t msg_id, const ip_addr_t *dest_ip,
+                         u16_t dest_port, struct pbuf *p, uint32_t now)
+{
+    int bucket = index_find(msg_id);
+    if (bucket >= 0)
+        pending_release(bucket);
+
+    if (free_count == 0) {
+        rel_stats.table_full++;
+        LOG_WARN("⚠ No free pending slots\n");
+        return -1;
+    }
+
+    uint16_t slot = free_slots[--free_count];
+    pending_message_t *msg = &pending_messages[slot];
+    memset(msg, 0, sizeof(*msg));
+    msg->active = true;
+    msg->msg_id = msg_id;
+    msg->dest_ip = *dest_ip;
+    msg->dest_port = dest_port;
+
+    coap_peer_t *peer = peer_get(dest_ip, dest_port, now);
+    peer_age(peer, now);
+    msg->peer = (int8_t) (peer - peers);
+
+    pbuf_ref(p);
+    msg->packet = p;
+    index_insert(msg_id, slot);
+
+    rel_stats.stored++;
+    if (coap_pending_count() > rel_stats.high_water)
+        rel_stats.high_water = coap_pending_count();
+    return slot;
+}
+
 /**
  * @brief Initialize internal state for CoAP message retransmission.
  */
 void coap_reliability_init(void)
 {
+    for (int i = 0; i < MAX_PENDING_MESSAGES; i++) {
+        if (pending_messages[i].active && pending_messages[i].packet)
+            pbuf_free(pending_messages[i].packet);
+    }
     memset(pending_messages, 0, sizeof(pending_messages));
+    heap_len = 0;
+    for (int i = 0; i < PENDING_HASH_SIZE; i++)
+        msg_index[i] = PENDING_EMPTY;
+    free_count = 0;
+    for (int i = MAX_PENDING_MESSAGES - 1; i >= 0; i--)
+        free_slots[free_count++] = (uint16_t) i;
+    memset(peers, 0, sizeof(peers));
+    queue_seq = 0;
+    memset(&rel_stats, 0, sizeof(rel_stats));
 }
 
 /**
- * @brief Store a message in the retransmission queue.
- * @param msgid CoAP message ID
- * @param destip Destination IP address
- * @param destport UDP port
+ * @brief Send a CON message through its peer's congestion window.
+ *
+ * With room in the window the message is sent now; otherwise it waits in
+ * the pending table and goes out, in order, as earlier messages to the
+ * same peer are answered or given up. Either way the queue holds its own
+ * reference, so the caller still frees its reference.
+ *
+ * A failed first send is treated like a lost datagram and left to the
+ * retransmission timer, except ERR_MEM, which is retried on the next
+ * coap_check_retransmissions() call.
+ *
+ * @param pcb UDP protocol control block
+ * @param msg_id CoAP message ID
+ * @param dest_ip Destination IP address
+ * @param dest_port UDP port
+ * @param p Encoded message (single PBUF_RAM pbuf)
+ * @return true if sent or queued, false if the pending table is full
+ */
+bool coap_send_reliable(struct udp_pcb *pcb, uint16_t msg_id,
+                        const ip_addr_t *dest_ip, u16_t dest_port,
+                        struct pbuf *p)
+{
+    uint32_t now = platform_now_ms();
+    int slot = pending_alloc(msg_id, dest_ip, dest_port, p, now);
+    if (slot < 0)
+        return false;
+
+    pending_message_t *msg = &pending_messages[slot];
+    coap_peer_t *peer = &peers[msg->peer];
+
+    if (peer->in_flight * 16 >= peer->cwnd_x16) {
+        msg->queued = true;
+        msg->queue_seq = queue_seq++;
+        peer->queued++;
+        rel_stats.queued++;
+        LOG_DEBUG("⏳ Queued msg_id 0x%04X (window %u, %u in flight)\n", msg_id,
+               peer->cwnd_x16 / 16, peer->in_flight);
+        return true;
+    }
+
+    peer->in_flight++;
+    if (coap_send_pbuf(pcb, p, dest_ip, dest_port) == ERR_MEM) {
+        msg->unsent = true;
+        pending_schedule((uint16_t) slot, now);
+        return true;
+    }
+
+    pending_arm(msg, now);
+    pending_schedule((uint16_t) slot, msg->next_retry_ms);
+    return true;
+}
+
+/**
+ * @brief Store an encoded message the caller has already sent.
+ *
+ * The message counts against its peer's window but is not held back by
+ * it. The queue takes its own reference to the pbuf, so the caller still
+ * frees its reference after sending. Storing an ID that is already pending
+ * replaces the earlier copy.
+ *
+ * @param msg_id CoAP message ID
+ * @param dest_ip Destination IP address
+ * @param dest_port UDP port
+ * @param p Encoded message (single PBUF_RAM pbuf)
+ * @return true if stored, false if table full
+ */
+bool coap_store_pbuf_for_retransmit(uint16_t msg_id, const ip_addr_t *dest_ip,
+                                    u16_t dest_port, struct pbuf *p)
+{
+    uint32_t now = platform_now_ms();
+    int slot = pending_alloc(msg_id, dest_ip, dest_port, p, now);
+    if (slot < 0)
+        return false;
+
+    pending_message_t *msg = &pending_messages[slot];
+    peers[msg->peer].in_flight++;
+    pending_arm(msg, now);
+    pending_schedule((uint16_t) slot, msg->next_retry_ms);
+
+    LOG_DEBUG("📝 Stored msg_id 0x%04X for retransmission (slot %d)\n", msg_id,
+           slot);
+    return true;
+}
+
+/**
+ * @brief Store a message held in a plain buffer (copied once into a pbuf).
+ * @param msg_id CoAP message ID
+ * @param dest_ip Destination IP address
+ * @param dest_port UDP port
  * @param packet CoAP packet data
  * @param len Packet length
- * @return true if stored, false if table full
+ * @return true if stored, false if table full or out of memory
  */
 bool coap_store_for_retransmit(uint16_t msg_id, const ip_addr_t *dest_ip,
                                u16_t dest_port, const uint8_t *packet,
                                size_t len)
 {
-    // Find free slot
-    int slot = -1;
-    for (int i = 0; i < MAX_PENDING_MESSAGES; i++) {
-        if (!pending_messages[i].active) {
-            slot = i;
-            break;
-        }
-    }
-
-    if (slot < 0) {
-        printf("⚠ No free pending slots\n");
+    struct pbuf *p = packet_pool_alloc_pbuf(len);
+    if (!p) {
+        rel_stats.no_memory++;
+        LOG_WARN("⚠ No memory to store msg_id 0x%04X\n", msg_id);
         return false;
     }
+    memcpy(p->payload, packet, len);
+    bool stored = coap_store_pbuf_for_retransmit(msg_id, dest_ip, dest_port, p);
+    pbuf_free(p);
+    return stored;
+}
 
-    pending_messages[slot].active = true;
-    pending_messages[slot].msg_id = msg_id;
-    pending_messages[slot].dest_ip = *dest_ip;
-    pending_messages[slot].dest_port = dest_port;
-    pending_messages[slot].retransmit_count = 0;
-    pending_messages[slot].next_retry_ms = to_ms_since_boot(
-                                               get_absolute_time()) +
-                                           ACK_TIMEOUT_MS;
-    memcpy(pending_messages[slot].packet_buf, packet, len);
-    pending_messages[slot].packet_len = len;
+/**
+ * @brief Send an encoded message through a PBUF_REF view of it.
+ *
+ * udp_sendto() prepends its headers in place when the pbuf has room, and
+ * ARP may queue the pbuf itself. A reference pbuf has no header room and
+ * is copied if queued, so the encoded bytes stay intact for the next
+ * retransmission without a copy per send. The view of a chain shares the
+ * later segments, which lwIP never writes into.
+ *
+ * @param pcb UDP protocol control block
+ * @param p Encoded message (may be a chain from coap_build_pbuf_chain())
+ * @param dest_ip Destination IP address
+ * @param dest_port UDP port
+ * @return lwIP error code
+ */
+err_t coap_send_pbuf(struct udp_pcb *pcb, struct pbuf *p,
+                     const ip_addr_t *dest_ip, u16_t dest_port)
+{
+    struct pbuf *ref = pbuf_alloc(PBUF_TRANSPORT, p->len, PBUF_REF);
+    if (!ref)
+        return ERR_MEM;
 
-    printf("📝 Stored msg_id 0x%04X for retransmission (slot %d)\n", msg_id,
-           slot);
-    return true;
+    ref->payload = p->payload;
+    if (p->next)
+        pbuf_chain(ref, p->next);  // lwIP only prepends to the first pbuf
+    err_t result = platform_udp_send(pcb, ref, dest_ip, dest_port);
+    pbuf_free(ref);
+    return result;
 }
 
 /**
- * @brief Clear a message from retransmission queue by message ID.
- * @param msgid CoAP message ID
+ * @brief Clear an acknowledged message from the retransmission queue.
+ *
+ * The time since its first transmission is an RTT sample for the
+ * destination.
+ *
+ * @param msg_id CoAP message ID
  */
 void coap_clear_pending_message(uint16_t msg_id)
 {
-    for (int i = 0; i < MAX_PENDING_MESSAGES; i++) {
-        if (pending_messages[i].active &&
-            pending_messages[i].msg_id == msg_id) {
-            pending_messages[i].active = false;
-            printf("✓ Cleared pending message 0x%04X\n", msg_id);
-            return;
+    int bucket = index_find(msg_id);
+    if (bucket < 0)
+        return;
+
+    // A message that never left the queue tells nothing about the path
+    const pending_message_t *msg = &pending_messages[msg_index[bucket]];
+    if (!msg->queued && !msg->unsent) {
+        peer_sample(msg, platform_now_ms());
+        if (msg->peer >= 0 && msg->retransmit_count == 0) {
+            cwnd_on_ack(&peers[msg->peer]);
+            peer_loss_sample(&peers[msg->peer], false);
         }
     }
+    pending_release(bucket);
+    rel_stats.acked++;
+    LOG_DEBUG("✓ Cleared pending message 0x%04X\n", msg_id);
 }
 
 /**
- * @brief Periodically check and perform retransmissions with exponential
- * backoff.
+ * @brief Drop a message that will not be answered, without an RTT sample.
+ * @param msg_id CoAP message ID
+ */
+void coap_cancel_pending_message(uint16_t msg_id)
+{
+    int bucket = index_find(msg_id);
+    if (bucket >= 0)
+        pending_release(bucket);
+}
+
+/**
+ * @brief Perform due retransmissions with exponential backoff.
+ *
+ * Each retransmit multiplies the timeout by the message's backoff factor,
+ * up to COAP_RTO_MAX_MS.
+ *
+ * Only entries at the top of the retry heap are touched, so a call with
+ * nothing due costs one comparison.
+ *
  * @param pcb UDP protocol control block
  */
 void coap_check_retransmissions(struct udp_pcb *pcb)
 {
-    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint32_t now = platform_now_ms();
 
-    for (int i = 0; i < MAX_PENDING_MESSAGES; i++) {
-        if (!pending_messages[i].active)
-            continue;
+    while (heap_len > 0) {
+        uint16_t slot = retry_heap[0];
+        pending_message_t *msg = &pending_messages[slot];
+        if ((int32_t) (msg->next_retry_ms - now) > 0)
+            break;
 
-        if (now >= pending_messages[i].next_retry_ms) {
-            if (pending_messages[i].retransmit_count >= MAX_RETRANSMITS) {
-                printf("⚠ Max retransmits (%d) reached for msg_id 0x%04X\n",
-                       MAX_RETRANSMITS, pending_messages[i].msg_id);
+        if (msg->unsent) {
+            // First transmission of a message let out of the queue
+            if (coap_send_pbuf(pcb, msg->packet, &msg->dest_ip,
+                               msg->dest_port) == ERR_MEM)
+                break;
+            msg->unsent = false;
+            pending_arm(msg, now);
+            heap_sift_down(0);
+            LOG_DEBUG("📤 Sent queued msg_id 0x%04X\n", msg->msg_id);
+            continue;
+        }
 
-                // Call failure callback if set
-                if (failure_callback) {
-                    failure_callback(pending_messages[i].msg_id,
-                                     &pending_messages[i].dest_ip,
-                                     pending_messages[i].dest_port);
-                }
+        if (msg->retransmit_count >= MAX_RETRANSMITS) {
+            LOG_WARN("⚠ Max retransmits (%d) reached for msg_id 0x%04X\n",
+                   MAX_RETRANSMITS, msg->msg_id);
+            rel_stats.timeouts++;
 
-                pending_messages[i].active = false;
-                continue;
+            if (msg->peer >= 0) {
+                coap_peer_t *peer = &peers[msg->peer];
+                cwnd_on_timeout(peer, msg, now);
+                peer->cwnd_x16 = COAP_NSTART * 16;
+                peer_loss_sample(peer, true);
             }
 
-            // Retransmit with exponential backoff
-            struct pbuf *p = pbuf_alloc(
-                PBUF_TRANSPORT, pending_messages[i].packet_len, PBUF_RAM);
-            if (p) {
-                memcpy(p->payload, pending_messages[i].packet_buf,
-                       pending_messages[i].packet_len);
-                udp_sendto(pcb, p, &pending_messages[i].dest_ip,
-                           pending_messages[i].dest_port);
-                pbuf_free(p);
-
-                pending_messages[i].retransmit_count++;
-                uint32_t backoff = ACK_TIMEOUT_MS *
-                                   (1 << pending_messages[i].retransmit_count);
-                pending_messages[i].next_retry_ms = now + backoff;
-
-                printf(
-                    "🔄 Retransmit #%d for msg_id 0x%04X (timeout: %lu ms)\n",
-                    pending_messages[i].retransmit_count,
-                    pending_messages[i].msg_id, backoff);
+            // Release first: the callback may store or clear messages
+            uint16_t msg_id = msg->msg_id;
+            ip_addr_t ip = msg->dest_ip;
+            u16_t port = msg->dest_port;
+            pending_release(index_find(msg_id));
+
+            if (failure_callback) {
+                failure_callback(msg_id, &ip, port);
             }
+            continue;
+        }
+
+        // Retransmit the stored pbuf with exponential backoff
+        if (coap_send_pbuf(pcb, msg->packet, &msg->dest_ip, msg->dest_port) ==
+            ERR_MEM)
+            break;  // Out of pbufs; retry on the next call
+
+        msg->retransmit_count++;
+        rel_stats.retransmits++;
+        if (msg->peer >= 0) {
+            cwnd_on_timeout(&peers[msg->peer], msg, now);
+            peer_loss_sample(&peers[msg->peer], true);
         }
+        msg->timeout_ms = msg->timeout_ms * msg->backoff_x2 / 2;
+        if (msg->timeout_ms > COAP_RTO_MAX_MS)
+            msg->timeout_ms = COAP_RTO_MAX_MS;
+        msg->next_retry_ms = now + msg->timeout_ms;
+        heap_sift_down(0);
+
+        LOG_DEBUG("🔄 Retransmit #%d for msg_id 0x%04X (timeout: %lu ms)\n",
+               msg->retransmit_count, msg->msg_id,
+               (unsigned long) msg->timeout_ms);
     }
 }
 
+/**
+ * @brief Count a request from a destination towards its loss estimate.
+ *
+ * A peer repeats a request when the earlier copy or the answer to it was
+ * lost, so repeats measure the path towards the peer as well as ours.
+ *
+ * @param ip Sender IP address
+ * @param port Sender port
+ * @param duplicate true for a retransmitted or re-issued request
+ */
+void coap_peer_note_request(const ip_addr_t *ip, u16_t port, bool duplicate)
+{
+    uint32_t now = platform_now_ms();
+    peer_loss_sample(peer_get(ip, port, now), duplicate);
+}
+
+/**
+ * @brief Count the messages held in the pending table.
+ * @return Entries in use, including queued ones
+ */
+uint16_t coap_pending_count(void)
+{
+    return (uint16_t) (MAX_PENDING_MESSAGES - free_count);
+}
+
+/**
+ * @brief Check whether a message ID is awaiting an ACK.
+ * @param msg_id Message ID
+ * @return true if the ID is in the pending table
+ */
+bool coap_msg_id_pending(uint16_t msg_id)
+{
+    return index_find(msg_id) >= 0;
+}
+
+/**
+ * @brief Get the retransmission counters.
+ * @return Pointer to the counters
+ */
+const coap_reliability_stats_t *coap_reliability_get_stats(void)
+{
+    return &rel_stats;
+}
+
+/**
+ * @brief Find when coap_check_retransmissions() next has work to do.
+ * @param deadline_ms Output: next_retry_ms of the earliest entry
+ * @return false if no message is awaiting an ACK
+ */
+bool coap_next_retransmit_deadline(uint32_t *deadline_ms)
+{
+    if (heap_len == 0)
+        return false;
+    *deadline_ms = pending_messages[retry_heap[0]].next_retry_ms;
+    return true;
+}
+
+/**
+ * @brief RTO a new exchange with a destination would start from.
+ * @param ip Destination IP address
+ * @param port UDP port
+ * @return RTO in ms (COAP_RTO_INITIAL_MS for an unknown destination)
+ */
+uint32_t coap_peer_rto(const ip_addr_t *ip, u16_t port)
+{
+    const coap_peer_t *peer = peer_find(ip, port);
+    return peer ? peer->rto_ms : COAP_RTO_INITIAL_MS;
+}
+
+/**
+ * @brief Look up the RTT state for a destination.
+ * @param ip Destination IP address
+ * @param port UDP port
+ * @return Entry, or NULL if the destination is not tracked
+ */
+const coap_peer_t *coap_peer_lookup(const ip_addr_t *ip, u16_t port)
+{
+    return peer_find(ip, port);
+}
+
+/**
+ * @brief Access the peer table, e.g. for diagnostics.
+ * @return COAP_PEER_TABLE_SIZE entries; unused ones have used == false
+ */
+const coap_peer_t *coap_peer_table(void)
+{
+    return peers;
+}
+
 /**
  * @brief Set a callback for max retransmission failure.
  * @param callback Function pointer to call on failure
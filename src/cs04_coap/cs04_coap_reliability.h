@@ -3,14 +3,25 @@
 
 #include "lwip/ip_addr.h"
 #include "lwip/udp.h"
+#include "lwip/pbuf.h"
 #include <stdint.h>
 #include <stdbool.h>
 
 // Configuration
 #define MAX_RETRANSMITS 4
 #define ACK_TIMEOUT_MS 2000
-#define MAX_PENDING_MESSAGES 10
+#define MAX_PENDING_MESSAGES 32
+#define PENDING_HASH_SIZE 64  // msg_id index buckets (power of 2, > slots)
 #define RECENT_MSG_HISTORY 16
+#define COAP_PEER_TABLE_SIZE 16    // Destinations with RTT state (LRU reuse)
+#define COAP_RTO_INITIAL_MS ACK_TIMEOUT_MS  // RTO before any RTT sample
+#define COAP_RTO_MIN_MS 100        // Floor; covers SD reads behind an ACK
+#define COAP_RTO_MAX_MS 32000
+#define ACK_RANDOM_FACTOR_PCT 150  // RFC 7252 ACK_RANDOM_FACTOR (1.5)
+#define COAP_WEAK_RTT_MAX_RETRIES 2  // Retransmitted exchanges still sampled
+#define COAP_NSTART 1              // Initial window (RFC 7252 NSTART)
+#define COAP_CWND_MAX 8            // Most CONs outstanding to one peer
+#define COAP_LOSS_GAIN_SHIFT 3     // Loss estimate moves 1/8 per sample
 
 // Structure for a pending CoAP message (awaiting retransmission).
 typedef struct {
@@ -20,16 +31,70 @@ typedef struct {
     u16_t dest_port;           // Destination port
     uint8_t retransmit_count;  // Number of transmissions so far
     uint32_t next_retry_ms;    // Time for next transmission
-    uint8_t packet_buf[1224];  // BLOCK_SIZE + 200
-    size_t packet_len;         // Message length
+    uint32_t first_sent_ms;    // First transmission (RTT sample start)
+    uint32_t timeout_ms;       // Current timeout, grows with each retry
+    uint8_t backoff_x2;        // Backoff factor x2 picked from the RTO
+    bool queued;               // Waiting for room in the peer's window
+    bool unsent;               // Let out of the queue, not yet transmitted
+    int8_t peer;               // Peer table entry, -1 if evicted
+    uint32_t queue_seq;        // FIFO order among queued messages
+    struct pbuf *packet;       // Encoded message (reference held until ACK)
+    uint16_t heap_pos;         // Position in the retry-time heap
 } pending_message_t;
 
+// RTT and RTO state for one destination, CoCoA style. The strong
+// estimator takes ACKs of first transmissions; the weak one takes exchanges
+// that needed retransmits, timed from the first transmission. SRTT is kept
+// scaled by 8 and RTTVAR by 4, as in Linux TCP.
+//
+// The congestion window (in 1/16 messages) caps how many CONs are
+// outstanding to the peer; more wait in the pending table until an ACK or a
+// give-up frees room. It starts at NSTART, grows on ACKs of first
+// transmissions (slow start, then about one message per window), and halves
+// on a retransmit timeout.
+//
+// The loss estimate (in 1/256) averages exchanges in both directions: a
+// retransmit timeout or a request the peer sends again counts as a loss, an
+// ACK of a first transmission or a new request as a delivery.
+typedef struct {
+    bool used;
+    ip_addr_t ip;
+    u16_t port;
+    uint32_t rto_ms;          // Overall RTO for new exchanges
+    uint32_t srtt_strong;     // Smoothed RTT x8
+    uint32_t rttvar_strong;   // RTT variation x4
+    uint32_t srtt_weak;
+    uint32_t rttvar_weak;
+    uint16_t strong_samples;
+    uint16_t weak_samples;
+    uint32_t rto_updated_ms;  // Last estimator update (drives RTO aging)
+    uint32_t last_used_ms;    // Last exchange started (LRU reuse)
+    uint16_t cwnd_x16;        // Congestion window x16
+    uint16_t ssthresh_x16;    // Slow-start threshold x16
+    uint32_t cwnd_reduced_ms; // Last window cut (one cut per window of data)
+    uint8_t in_flight;        // Messages counted against the window
+    uint8_t queued;           // Messages waiting for the window
+    uint16_t loss_x256;       // Smoothed loss rate, 256 = every message lost
+} coap_peer_t;
+
 // Duplicate detector: keeps a small circular buffer of recent message IDs.
 typedef struct {
     uint16_t recent_msg_ids[RECENT_MSG_HISTORY];  // Circular buffer
     uint8_t recent_msg_idx;                       // Buffer pointer
 } duplicate_detector_t;
 
+// Retransmission counters.
+typedef struct {
+    uint32_t stored;       // Messages taken into the pending table
+    uint32_t table_full;   // Stores refused: no free slot
+    uint32_t no_memory;    // Stores refused: no buffer for the copy
+    uint32_t queued;       // Messages held back by a congestion window
+    uint32_t retransmits;  // Retransmissions sent
+    uint32_t timeouts;     // Messages given up after MAX_RETRANSMITS
+    uint32_t acked;        // Messages cleared by an ACK
+    uint16_t high_water;   // Most entries in the table at once
+} coap_reliability_stats_t;
+
 // Retransmission failure callback
 typedef void (*retransmit_failure_cb_t)(uint16_t msg_id, const ip_addr_t *ip,
                                         u16_t port);
@@ -37,17 +102,60 @@ typedef void (*retransmit_failure_cb_t)(uint16_t msg_id, const ip_addr_t *ip,
 // Initialize reliability system
 void coap_reliability_init(void);
 
-// Store packet for retransmission
+// Send a CON through the peer's congestion window: now if there is room,
+// otherwise queued until an outstanding message is answered or given up.
+// Takes a pbuf reference. Returns false if the pending table is full.
+bool coap_send_reliable(struct udp_pcb *pcb, uint16_t msg_id,
+                        const ip_addr_t *dest_ip, u16_t dest_port,
+                        struct pbuf *p);
+
+// Store packet for retransmission (the caller has sent it; not gated)
 bool coap_store_for_retransmit(uint16_t msg_id, const ip_addr_t *dest_ip,
                                u16_t dest_port, const uint8_t *packet,
                                size_t len);
 
-// Clear pending message (on ACK received)
+// Store an encoded message the caller has sent, taking a pbuf reference
+bool coap_store_pbuf_for_retransmit(uint16_t msg_id, const ip_addr_t *dest_ip,
+                                    u16_t dest_port, struct pbuf *p);
+
+// Send an encoded message without lwIP modifying it (safe for stored pbufs)
+err_t coap_send_pbuf(struct udp_pcb *pcb, struct pbuf *p,
+                     const ip_addr_t *dest_ip, u16_t dest_port);
+
+// Clear pending message (on ACK received); feeds the peer's RTT estimate
 void coap_clear_pending_message(uint16_t msg_id);
 
+// Drop a pending message that was never answered (e.g. the send failed)
+void coap_cancel_pending_message(uint16_t msg_id);
+
 // Check and handle retransmissions (call in main loop)
 void coap_check_retransmissions(struct udp_pcb *pcb);
 
+// Count a request received from a destination; duplicate is true if the
+// peer sent it again (its earlier copy or our answer was lost)
+void coap_peer_note_request(const ip_addr_t *ip, u16_t port, bool duplicate);
+
+// Messages in the pending table (sent or queued, out of MAX_PENDING_MESSAGES)
+uint16_t coap_pending_count(void);
+
+// True if a message with this ID is in the pending table
+bool coap_msg_id_pending(uint16_t msg_id);
+
+// Retransmission counters (cleared by coap_reliability_init())
+const coap_reliability_stats_t *coap_reliability_get_stats(void);
+
+// Earliest pending retransmission time. Returns false if nothing is pending.
+bool coap_next_retransmit_deadline(uint32_t *deadline_ms);
+
+// RTO that a new exchange with this destination would start from
+uint32_t coap_peer_rto(const ip_addr_t *ip, u16_t port);
+
+// State for one destination, or NULL if it is not tracked
+const coap_peer_t *coap_peer_lookup(const ip_addr_t *ip, u16_t port);
+
+// The whole peer table (COAP_PEER_TABLE_SIZE entries; check used)
+const coap_peer_t *coap_peer_table(void);
+
 // Set callback for retransmission failure
 void coap_set_retransmit_failure_callback(retransmit_failure_cb_t callback);
 
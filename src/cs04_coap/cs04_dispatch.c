@@ -0,0 +1,59 @@
+#include "cs04_dispatch.h"
+#include <string.h>
+
+/**
+ * @brief Compare a route's path with the request's Uri-Path options.
+ * @param route Candidate route
+ * @param path First Uri-Path option of the request (NULL if none)
+ * @param count Number of Uri-Path options
+ * @return true if every segment matches
+ */
+static bool dispatch_path_matches(const dispatch_route_t *route,
+                                  const coap_option_t *path, uint8_t count)
+{
+    if (route->segment_count != count)
+        return false;
+
+    for (uint8_t i = 0; i < count; i++) {
+        const dispatch_segment_t *seg = &route->segments[i];
+        if (path[i].buf.len != seg->len ||
+            memcmp(seg->str, path[i].buf.p, seg->len) != 0)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Find the handler for a request.
+ *
+ * Only routes registered for the request's method are looked at, and the
+ * Uri-Path options are located once. Segment lengths were computed at
+ * compile time, so a mismatch is usually rejected on length alone.
+ *
+ * @param table Dispatch table
+ * @param pkt Parsed request
+ * @return Matching route, or NULL
+ */
+const dispatch_route_t *dispatch_lookup(const dispatch_table_t *table,
+                                        const coap_packet_t *pkt)
+{
+    uint8_t method = pkt->hdr.code;
+    if (method >= DISPATCH_METHODS)
+        return NULL;
+
+    const dispatch_bucket_t *bucket = &table->by_method[method];
+    if (bucket->count == 0)
+        return NULL;
+
+    uint8_t count = 0;
+    const coap_option_t *path = coap_findOptions(pkt, COAP_OPTION_URI_PATH,
+                                                 &count);
+    if (count > DISPATCH_MAX_SEGMENTS)
+        return NULL;
+
+    for (uint8_t i = 0; i < bucket->count; i++) {
+        if (dispatch_path_matches(&bucket->routes[i], path, count))
+            return &bucket->routes[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef CS04_DISPATCH_H
+#define CS04_DISPATCH_H
+
+#include "coap.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define DISPATCH_MAX_SEGMENTS 4  // Deepest Uri-Path a route can match
+#define DISPATCH_METHODS 8       // Method codes 0.00-0.07 (GET..iPATCH)
+
+// Request handler. Returns 0 when outpkt holds the response.
+typedef int (*dispatch_handler_t)(coap_rw_buffer_t *scratch,
+                                  const coap_packet_t *inpkt,
+                                  coap_packet_t *outpkt, uint8_t id_hi,
+                                  uint8_t id_lo, const ip_addr_t *addr,
+                                  u16_t port);
+
+// One Uri-Path segment with its length worked out at compile time.
+typedef struct {
+    const char *str;
+    uint8_t len;
+} dispatch_segment_t;
+
+// A resource path and the handler for one method on it.
+typedef struct {
+    dispatch_handler_t handler;
+    uint8_t segment_count;
+    dispatch_segment_t segments[DISPATCH_MAX_SEGMENTS];
+    const char *core_attr;  // CoRE link attributes, e.g. "ct=0;obs"
+} dispatch_route_t;
+
+// Routes sharing one method.
+typedef struct {
+    const dispatch_route_t *routes;
+    uint8_t count;
+} dispatch_bucket_t;
+
+// Routes bucketed by method code.
+typedef struct {
+    dispatch_bucket_t by_method[DISPATCH_METHODS];
+} dispatch_table_t;
+
+// Builds a segment from a string literal.
+#define DISPATCH_SEG(s) { (s), sizeof(s) - 1 }
+
+// Builds a route: DISPATCH_ROUTE(handler, "ct=0", DISPATCH_SEG("file")).
+#define DISPATCH_ROUTE(fn, attr, ...)                                        \
+    { (fn),                                                                  \
+      sizeof((dispatch_segment_t[]){ __VA_ARGS__ }) /                        \
+          sizeof(dispatch_segment_t),                                        \
+      { __VA_ARGS__ },                                                       \
+      (attr) }
+
+// Builds a bucket from a route array.
+#define DISPATCH_BUCKET(routes) { (routes), sizeof(routes) / sizeof((routes)[0]) }
+
+// Finds the route for a request's method and Uri-Path, or NULL if none.
+const dispatch_route_t *dispatch_lookup(const dispatch_table_t *table,
+                                        const coap_packet_t *pkt);
+
+#endif  // CS04_DISPATCH_H
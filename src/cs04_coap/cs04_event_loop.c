@@ -0,0 +1,204 @@
+#include "cs04_event_loop.h"
+#include "cs04_log.h"
+#include "pico/cyw43_arch.h"
+#include "pico/async_context.h"
+#include "pico/critical_section.h"
+#include <string.h>
+#include <stdio.h>
+
+// Timer entry. Deadlines are ms since boot compared with wrap-safe math.
+typedef struct {
+    bool used;
+    bool armed;
+    uint32_t deadline_ms;
+    uint32_t period_ms;  // 0 = one-shot
+    event_timer_fn fn;
+} event_timer_t;
+
+static event_timer_t timers[EVENT_MAX_TIMERS];
+static critical_section_t event_lock;
+static bool event_ready;
+static volatile uint32_t pending_events;
+static async_when_pending_worker_t wake_worker;
+
+/**
+ * @brief Check whether a deadline has been reached.
+ */
+static bool deadline_due(uint32_t deadline_ms, uint32_t now_ms)
+{
+    return (int32_t) (deadline_ms - now_ms) <= 0;
+}
+
+/**
+ * @brief Async-context worker used only to wake the loop.
+ *
+ * Marking it pending releases cyw43_arch_wait_for_work_until(); the real
+ * work is done by the caller of event_loop_wait().
+ */
+static void event_wake_work(async_context_t *context,
+                            async_when_pending_worker_t *worker)
+{
+    (void) context;
+    (void) worker;
+}
+
+/**
+ * @brief Wake a sleeping event_loop_wait().
+ */
+static void event_wake(void)
+{
+    if (event_ready)
+        async_context_set_work_pending(cyw43_arch_async_context(),
+                                       &wake_worker);
+}
+
+/**
+ * @brief Run every armed timer whose deadline has passed.
+ */
+static void event_run_timers(uint32_t now_ms)
+{
+    for (int i = 0; i < EVENT_MAX_TIMERS; i++) {
+        event_timer_t *t = &timers[i];
+        if (!t->used || !t->armed || !deadline_due(t->deadline_ms, now_ms))
+            continue;
+
+        // Re-arm before the callback so it can override the deadline
+        if (t->period_ms) {
+            t->deadline_ms += t->period_ms;
+            if (deadline_due(t->deadline_ms, now_ms))
+                t->deadline_ms = now_ms + t->period_ms;  // Fell behind
+        } else {
+            t->armed = false;
+        }
+        t->fn(now_ms);
+    }
+}
+
+/**
+ * @brief Earliest time the loop must wake without an external event.
+ */
+static uint32_t event_next_deadline(uint32_t now_ms)
+{
+    uint32_t next = now_ms + EVENT_MAX_SLEEP_MS;
+
+    for (int i = 0; i < EVENT_MAX_TIMERS; i++) {
+        if (timers[i].used && timers[i].armed &&
+            (int32_t) (timers[i].deadline_ms - next) < 0)
+            next = timers[i].deadline_ms;
+    }
+    return next;
+}
+
+/**
+ * @brief Initialize the timer table and hook the wakeup worker into the
+ * cyw43 async context.
+ */
+void event_loop_init(void)
+{
+    if (!event_ready)
+        critical_section_init(&event_lock);
+
+    memset(timers, 0, sizeof(timers));
+    pending_events = 0;
+
+    memset(&wake_worker, 0, sizeof(wake_worker));
+    wake_worker.do_work = event_wake_work;
+    async_context_add_when_pending_worker(cyw43_arch_async_context(),
+                                          &wake_worker);
+    event_ready = true;
+}
+
+/**
+ * @brief Register a timer.
+ * @param fn Callback run from event_loop_wait()
+ * @param period_ms Repeat interval; 0 for a one-shot armed with
+ *        event_timer_arm()
+ * @return Timer id, or -1 if the table is full
+ */
+int event_timer_add(event_timer_fn fn, uint32_t period_ms)
+{
+    for (int i = 0; i < EVENT_MAX_TIMERS; i++) {
+        if (timers[i].used)
+            continue;
+        timers[i].used = true;
+        timers[i].fn = fn;
+        timers[i].period_ms = period_ms;
+        timers[i].armed = period_ms > 0;
+        timers[i].deadline_ms = to_ms_since_boot(get_absolute_time()) +
+                                period_ms;
+        return i;
+    }
+    LOG_WARN("⚠️ Event loop: timer table full\n");
+    return -1;
+}
+
+/**
+ * @brief Set a timer's next deadline.
+ * @param id Timer id from event_timer_add()
+ * @param deadline_ms Time (ms since boot) to run the callback
+ */
+void event_timer_arm(int id, uint32_t deadline_ms)
+{
+    if (id < 0 || id >= EVENT_MAX_TIMERS || !timers[id].used)
+        return;
+    timers[id].deadline_ms = deadline_ms;
+    timers[id].armed = true;
+}
+
+/**
+ * @brief Disarm a timer.
+ * @param id Timer id from event_timer_add()
+ */
+void event_timer_cancel(int id)
+{
+    if (id < 0 || id >= EVENT_MAX_TIMERS)
+        return;
+    timers[id].armed = false;
+}
+
+/**
+ * @brief Post event bits and wake the loop.
+ * @param events EVENT_* bits
+ */
+void event_post(uint32_t events)
+{
+    if (!event_ready)
+        return;
+
+    critical_section_enter_blocking(&event_lock);
+    pending_events |= events;
+    critical_section_exit(&event_lock);
+    event_wake();
+}
+
+/**
+ * @brief Wait for the next packet, timer or event.
+ *
+ * Returns straight away if something is already pending. Otherwise sleeps
+ * in cyw43_arch_wait_for_work_until(), which wakes on Wi-Fi work, on
+ * event_post() (button IRQs included), or at the earliest timer deadline. The caller
+ * runs cyw43_arch_poll() before calling this again.
+ *
+ * @return Event bits posted since the last call
+ */
+uint32_t event_loop_wait(void)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    event_run_timers(now);
+
+    if (pending_events == 0) {
+        uint32_t deadline = event_next_deadline(now);
+        if (!deadline_due(deadline, now))
+            cyw43_arch_wait_for_work_until(
+                make_timeout_time_ms(deadline - now));
+
+        now = to_ms_since_boot(get_absolute_time());
+        event_run_timers(now);
+    }
+
+    critical_section_enter_blocking(&event_lock);
+    uint32_t events = pending_events;
+    pending_events = 0;
+    critical_section_exit(&event_lock);
+    return events;
+}
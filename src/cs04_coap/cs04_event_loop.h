@@ -0,0 +1,41 @@
+#ifndef CS04_EVENT_LOOP_H
+#define CS04_EVENT_LOOP_H
+
+#include "pico/stdlib.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define EVENT_MAX_TIMERS 8
+#define EVENT_MAX_SLEEP_MS 1000  // Upper bound on a single wait
+
+// Event bits returned by event_loop_wait().
+#define EVENT_BUTTON (1u << 0)   // Button events queued (hw_button_event_get())
+#define EVENT_STORAGE (1u << 1)  // Storage work or results are ready
+#define EVENT_USER (1u << 8)     // First bit free for application use
+
+// Timer callback, run from event_loop_wait().
+typedef void (*event_timer_fn)(uint32_t now_ms);
+
+// Hooks the loop's wakeup into the cyw43 async context. Call after
+// cyw43_arch_init().
+void event_loop_init(void);
+
+// Registers a timer. A non-zero period re-arms it after each run; the first
+// deadline is one period from now. Returns the timer id, or -1 if full.
+int event_timer_add(event_timer_fn fn, uint32_t period_ms);
+
+// Sets the next deadline of a timer (replaces any earlier one).
+void event_timer_arm(int id, uint32_t deadline_ms);
+
+// Disarms a timer until it is armed again.
+void event_timer_cancel(int id);
+
+// Posts event bits and wakes the loop. Safe from IRQs and from core1.
+void event_post(uint32_t events);
+
+// Sleeps until a packet, due timer or posted event, runs due timers, then
+// returns (and clears) the posted event bits.
+uint32_t event_loop_wait(void);
+
+#endif  // CS04_EVENT_LOOP_H
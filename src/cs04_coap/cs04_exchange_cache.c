@@ -0,0 +1,332 @@
+#include "cs04_exchange_cache.h"
+#include "cs04_packet_pool.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+#define EXCHANGE_HASH_MASK (EXCHANGE_HASH_SIZE - 1)
+#define EXCHANGE_NONE (-1)
+
+// One remembered exchange. Entries are reused in arrival order, and every
+// entry gets the same lifetime, so the ring head is always the oldest.
+typedef struct {
+    bool used;
+    bool answered;          // Response stored (or deliberately none)
+    ip_addr_t ip;
+    u16_t port;
+    uint16_t msg_id;
+    uint32_t expires_ms;
+    struct pbuf *response;  // Encoded response, NULL if none kept
+    int8_t next;            // Next entry in the same hash bucket
+} exchange_entry_t;
+
+// One last-sent Block2 response.
+typedef struct {
+    bool used;
+    exchange_block_key_t key;
+    struct pbuf *response;
+} exchange_block_t;
+
+static exchange_entry_t entries[EXCHANGE_CACHE_SIZE];
+static exchange_block_t blocks[EXCHANGE_BLOCK_SLOTS];
+static uint8_t block_next;     // Block slot to reuse next
+static int8_t buckets[EXCHANGE_HASH_SIZE];
+static uint8_t ring_head;      // Next entry to reuse (the oldest)
+static size_t cached_bytes;    // Sum of response lengths held
+static exchange_cache_stats_t exchange_stats;
+
+/**
+ * @brief Hash an exchange key to a bucket.
+ */
+static uint8_t exchange_hash(const ip_addr_t *ip, u16_t port, uint16_t msg_id)
+{
+    uint32_t h = ip4_addr_get_u32(ip_2_ip4(ip));
+    h ^= ((uint32_t) port << 16) | msg_id;
+    h *= 0x9E3779B1u;  // Fibonacci hashing spreads sequential IDs
+    return (uint8_t) ((h >> 24) & EXCHANGE_HASH_MASK);
+}
+
+/**
+ * @brief Drop an entry's cached response.
+ */
+static void exchange_drop_response(exchange_entry_t *e)
+{
+    if (e->response) {
+        cached_bytes -= e->response->tot_len;
+        pbuf_free(e->response);
+        e->response = NULL;
+    }
+}
+
+/**
+ * @brief Unlink an entry from its bucket and free it.
+ * @param idx Entry index
+ */
+static void exchange_release(int idx)
+{
+    exchange_entry_t *e = &entries[idx];
+    if (!e->used)
+        return;
+
+    int8_t *link = &buckets[exchange_hash(&e->ip, e->port, e->msg_id)];
+    while (*link != EXCHANGE_NONE && *link != idx)
+        link = &entries[*link].next;
+    if (*link == idx)
+        *link = e->next;
+
+    exchange_drop_response(e);
+    e->used = false;
+}
+
+/**
+ * @brief Find a live entry, releasing it instead if it has expired.
+ * @return Entry index, or EXCHANGE_NONE
+ */
+static int exchange_find(const ip_addr_t *ip, u16_t port, uint16_t msg_id)
+{
+    int idx = buckets[exchange_hash(ip, port, msg_id)];
+
+    while (idx != EXCHANGE_NONE) {
+        exchange_entry_t *e = &entries[idx];
+        if (e->msg_id == msg_id && e->port == port && ip_addr_cmp(&e->ip, ip))
+            break;
+        idx = e->next;
+    }
+    if (idx == EXCHANGE_NONE)
+        return EXCHANGE_NONE;
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if ((int32_t) (entries[idx].expires_ms - now) <= 0) {
+        exchange_release(idx);
+        return EXCHANGE_NONE;
+    }
+    return idx;
+}
+
+/**
+ * @brief Reset the cache, freeing any held responses.
+ */
+void exchange_cache_init(void)
+{
+    for (int i = 0; i < EXCHANGE_CACHE_SIZE; i++) {
+        if (entries[i].used)
+            exchange_drop_response(&entries[i]);
+    }
+    memset(entries, 0, sizeof(entries));
+    memset(buckets, EXCHANGE_NONE, sizeof(buckets));
+    ring_head = 0;
+    cached_bytes = 0;
+    memset(&exchange_stats, 0, sizeof(exchange_stats));
+    exchange_cache_forget_blocks();
+}
+
+/**
+ * @brief Classify a received message by its (ip, port, msg_id) key.
+ * @param ip Sender address
+ * @param port Sender port
+ * @param msg_id CoAP message ID
+ * @param response Output: cached response on EXCHANGE_REPLAY
+ * @return Deduplication state of the message
+ */
+exchange_state_t exchange_cache_lookup(const ip_addr_t *ip, u16_t port,
+                                       uint16_t msg_id,
+                                       struct pbuf **response)
+{
+    int idx = exchange_find(ip, port, msg_id);
+    if (idx == EXCHANGE_NONE)
+        return EXCHANGE_NEW;
+
+    exchange_entry_t *e = &entries[idx];
+    if (!e->answered) {
+        exchange_stats.in_progress++;
+        return EXCHANGE_IN_PROGRESS;
+    }
+    if (!e->response) {
+        exchange_stats.no_response++;
+        return EXCHANGE_NO_RESPONSE;
+    }
+
+    exchange_stats.replays++;
+    *response = e->response;
+    return EXCHANGE_REPLAY;
+}
+
+/**
+ * @brief Remember a new exchange for EXCHANGE_LIFETIME_MS.
+ *
+ * The oldest entry is reused when the table is full, which only shortens
+ * how long the oldest exchange is remembered.
+ *
+ * @param ip Sender address
+ * @param port Sender port
+ * @param msg_id CoAP message ID
+ */
+void exchange_cache_record(const ip_addr_t *ip, u16_t port, uint16_t msg_id)
+{
+    int old = exchange_find(ip, port, msg_id);
+    if (old != EXCHANGE_NONE)
+        exchange_release(old);
+
+    int idx = ring_head;
+    ring_head = (uint8_t) ((ring_head + 1) % EXCHANGE_CACHE_SIZE);
+    exchange_release(idx);
+
+    exchange_entry_t *e = &entries[idx];
+    e->used = true;
+    e->answered = false;
+    e->ip = *ip;
+    e->port = port;
+    e->msg_id = msg_id;
+    e->expires_ms = to_ms_since_boot(get_absolute_time()) +
+                    EXCHANGE_LIFETIME_MS;
+    e->response = NULL;
+
+    int8_t *bucket = &buckets[exchange_hash(ip, port, msg_id)];
+    e->next = *bucket;
+    *bucket = (int8_t) idx;
+}
+
+/**
+ * @brief Keep the encoded response of a recorded exchange.
+ *
+ * Oldest responses are dropped first to stay within
+ * EXCHANGE_RESPONSE_BUDGET; their exchanges are still remembered and then
+ * report EXCHANGE_NO_RESPONSE.
+ *
+ * @param ip Sender address
+ * @param port Sender port
+ * @param msg_id CoAP message ID
+ * @param response Encoded response, or NULL to mark it answered without one
+ */
+void exchange_cache_store_response(const ip_addr_t *ip, u16_t port,
+                                   uint16_t msg_id, struct pbuf *response)
+{
+    int idx = exchange_find(ip, port, msg_id);
+    if (idx == EXCHANGE_NONE)
+        return;  // Evicted while the request was being handled
+
+    exchange_entry_t *e = &entries[idx];
+    exchange_drop_response(e);
+    e->answered = true;
+    if (!response || response->tot_len > EXCHANGE_RESPONSE_BUDGET)
+        return;
+
+    // Oldest first, starting from the ring head
+    for (int i = 0; i < EXCHANGE_CACHE_SIZE &&
+                    cached_bytes + response->tot_len > EXCHANGE_RESPONSE_BUDGET;
+         i++) {
+        exchange_drop_response(&entries[(ring_head + i) % EXCHANGE_CACHE_SIZE]);
+    }
+
+    pbuf_ref(response);
+    e->response = response;
+    cached_bytes += response->tot_len;
+}
+
+/**
+ * @brief Compare two block keys.
+ */
+static bool block_key_equal(const exchange_block_key_t *a,
+                            const exchange_block_key_t *b)
+{
+    return a->block_num == b->block_num && a->szx == b->szx &&
+           a->content_format == b->content_format && a->port == b->port &&
+           a->token_len == b->token_len && ip_addr_cmp(&a->ip, &b->ip) &&
+           memcmp(a->token, b->token, a->token_len) == 0;
+}
+
+/**
+ * @brief Find the last-sent response for a block.
+ * @param key Block identity
+ * @param response Output: cached response
+ * @return true on a hit
+ */
+bool exchange_cache_find_block(const exchange_block_key_t *key,
+                               struct pbuf **response)
+{
+    for (int i = 0; i < EXCHANGE_BLOCK_SLOTS; i++) {
+        if (blocks[i].used && block_key_equal(&blocks[i].key, key)) {
+            exchange_stats.block_hits++;
+            *response = blocks[i].response;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Keep the response for a block, replacing the oldest slot.
+ *
+ * EXCHANGE_BLOCK_SLOTS matches the client's transfer window, so every block
+ * still in flight can be answered again without an SD read.
+ *
+ * @param key Block identity
+ * @param response Encoded response
+ */
+void exchange_cache_store_block(const exchange_block_key_t *key,
+                                struct pbuf *response)
+{
+    exchange_block_t *slot = NULL;
+    for (int i = 0; i < EXCHANGE_BLOCK_SLOTS && !slot; i++) {
+        if (blocks[i].used && block_key_equal(&blocks[i].key, key))
+            slot = &blocks[i];
+    }
+    if (!slot) {
+        slot = &blocks[block_next];
+        block_next = (uint8_t) ((block_next + 1) % EXCHANGE_BLOCK_SLOTS);
+    }
+
+    if (slot->used)
+        pbuf_free(slot->response);
+    pbuf_ref(response);
+    slot->used = true;
+    slot->key = *key;
+    slot->response = response;
+}
+
+/**
+ * @brief Drop every cached block response.
+ */
+void exchange_cache_forget_blocks(void)
+{
+    for (int i = 0; i < EXCHANGE_BLOCK_SLOTS; i++) {
+        if (blocks[i].used)
+            pbuf_free(blocks[i].response);
+        blocks[i].used = false;
+        blocks[i].response = NULL;
+    }
+    block_next = 0;
+}
+
+/**
+ * @brief Copy a cached response for a request with a new message ID.
+ *
+ * Only the message ID field (header bytes 2-3) changes; the token already
+ * matches because it is part of the block key.
+ *
+ * @param response Cached encoded response
+ * @param msg_id Message ID of the request being answered
+ * @return New pbuf (caller frees), or NULL if out of memory
+ */
+struct pbuf *exchange_cache_rebind(const struct pbuf *response,
+                                   uint16_t msg_id)
+{
+    struct pbuf *p = packet_pool_alloc_pbuf(response->tot_len);
+    if (!p)
+        return NULL;
+
+    pbuf_copy_partial(response, p->payload, response->tot_len, 0);
+    uint8_t *hdr = p->payload;
+    hdr[2] = (uint8_t) (msg_id >> 8);
+    hdr[3] = (uint8_t) (msg_id & 0xFF);
+    return p;
+}
+
+/**
+ * @brief Get the duplicate counters.
+ * @return Pointer to the counters
+ */
+const exchange_cache_stats_t *exchange_cache_get_stats(void)
+{
+    return &exchange_stats;
+}
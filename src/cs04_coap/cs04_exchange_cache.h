@@ -0,0 +1,81 @@
+#ifndef CS04_EXCHANGE_CACHE_H
+#define CS04_EXCHANGE_CACHE_H
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define EXCHANGE_CACHE_SIZE 16             // Exchanges remembered at once
+#define EXCHANGE_HASH_SIZE 32              // Lookup buckets (power of 2)
+#define EXCHANGE_LIFETIME_MS 247000        // RFC 7252 EXCHANGE_LIFETIME
+#define EXCHANGE_RESPONSE_BUDGET 4096      // Bytes of cached responses held
+#define EXCHANGE_BLOCK_SLOTS 4             // Last-sent GET blocks kept
+#define EXCHANGE_TOKEN_LEN 8
+
+// What a received message is, as far as deduplication is concerned.
+typedef enum {
+    EXCHANGE_NEW = 0,      // Not seen within the exchange lifetime
+    EXCHANGE_REPLAY,       // Duplicate; the cached response can be resent
+    EXCHANGE_IN_PROGRESS,  // Duplicate; the response is not ready yet
+    EXCHANGE_NO_RESPONSE,  // Duplicate; no response kept (NON or evicted)
+} exchange_state_t;
+
+// Identity of one Block2 response of a GET transfer. A retransmitted or
+// re-issued block request has a new message ID but the same key.
+typedef struct {
+    ip_addr_t ip;
+    u16_t port;
+    uint8_t token[EXCHANGE_TOKEN_LEN];
+    uint8_t token_len;
+    uint32_t block_num;
+    uint8_t szx;
+    int16_t content_format;  // Tells the text file and the image apart
+} exchange_block_key_t;
+
+// Duplicate counters.
+typedef struct {
+    uint32_t replays;      // Duplicates answered from a cached response
+    uint32_t in_progress;  // Duplicates of requests still being handled
+    uint32_t no_response;  // Duplicates with nothing kept to resend
+    uint32_t block_hits;   // Block requests answered from a kept block
+} exchange_cache_stats_t;
+
+// Forgets every exchange and drops cached responses.
+void exchange_cache_init(void);
+
+// Looks up (ip, port, msg_id). On EXCHANGE_REPLAY *response is the cached
+// encoded response (still owned by the cache).
+exchange_state_t exchange_cache_lookup(const ip_addr_t *ip, u16_t port,
+                                       uint16_t msg_id,
+                                       struct pbuf **response);
+
+// Records a new exchange before it is handled. Evicts the oldest if full.
+void exchange_cache_record(const ip_addr_t *ip, u16_t port, uint16_t msg_id);
+
+// Attaches the encoded response to a recorded exchange (takes a reference).
+// Send it with coap_send_pbuf() so the cached copy stays intact.
+void exchange_cache_store_response(const ip_addr_t *ip, u16_t port,
+                                   uint16_t msg_id, struct pbuf *response);
+
+// Looks up the last-sent response for a block (still owned by the cache).
+bool exchange_cache_find_block(const exchange_block_key_t *key,
+                               struct pbuf **response);
+
+// Keeps the encoded response for a block (takes a reference).
+void exchange_cache_store_block(const exchange_block_key_t *key,
+                                struct pbuf *response);
+
+// Drops every cached block, e.g. after the file was appended to.
+void exchange_cache_forget_blocks(void);
+
+// Copies a cached response into a new pbuf carrying another message ID.
+struct pbuf *exchange_cache_rebind(const struct pbuf *response,
+                                   uint16_t msg_id);
+
+// Returns the duplicate counters.
+const exchange_cache_stats_t *exchange_cache_get_stats(void);
+
+#endif  // CS04_EXCHANGE_CACHE_H
@@ -0,0 +1,387 @@
+#include "cs04_feedback.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include "pico/critical_section.h"
+#include "hardware/pwm.h"
+#include "hardware/clocks.h"
+#include "cs04_hardware.h"
+#include <string.h>
+#include <stdio.h>
+
+// One step of a pattern: LED colour and buzzer tone held for ms.
+typedef struct {
+    uint32_t color;    // FEEDBACK_LED_KEEP leaves the LED alone
+    uint16_t tone_hz;  // 0 = silent
+    uint16_t ms;       // Step duration
+} feedback_step_t;
+
+// A pattern; the idle colour is restored after the last step.
+typedef struct {
+    feedback_step_t steps[FEEDBACK_MAX_STEPS];
+    uint8_t count;
+    bool droppable;  // Skip instead of queueing while another pattern plays
+} feedback_pattern_t;
+
+#define GREEN FEEDBACK_RGB(0, 50, 0, 50)
+#define CYAN FEEDBACK_RGB(0, 50, 50, 50)
+#define RED FEEDBACK_RGB(50, 0, 0, 50)
+#define OFF 0
+
+// Timings follow the blocking hw_play_*() sequences they replace.
+static const feedback_pattern_t patterns[FEEDBACK_PATTERN_COUNT] = {
+    [FEEDBACK_SUCCESS] = { { { GREEN, 1800, 60 }, { GREEN, 0, 70 },
+                             { OFF, 0, 30 }, { GREEN, 1800, 60 },
+                             { GREEN, 0, 80 } }, 5, false },
+    [FEEDBACK_ERROR] = { { { RED, 400, 100 }, { RED, 0, 100 } }, 2, false },
+    [FEEDBACK_PROGRESS] = { { { GREEN, 1500, 30 } }, 1, true },
+    [FEEDBACK_FILE_COMPLETE] = { { { GREEN, 1500, 60 }, { GREEN, 0, 70 },
+                                   { GREEN, 1500, 60 }, { GREEN, 0, 70 },
+                                   { GREEN, 1500, 150 }, { GREEN, 0, 80 } },
+                                 6, false },
+    [FEEDBACK_STRING] = { { { GREEN, 1200, 60 }, { GREEN, 0, 80 },
+                            { OFF, 0, 40 }, { GREEN, 1200, 60 },
+                            { GREEN, 0, 80 } }, 5, false },
+    [FEEDBACK_FETCH] = { { { CYAN, 1800, 40 }, { CYAN, 0, 50 },
+                           { OFF, 0, 30 }, { CYAN, 1800, 40 },
+                           { CYAN, 0, 50 }, { OFF, 0, 30 },
+                           { CYAN, 1800, 40 }, { CYAN, 0, 80 } }, 8, false },
+    [FEEDBACK_APPEND_SUCCESS] = { { { GREEN, 1800, 60 }, { GREEN, 0, 70 },
+                                    { OFF, 0, 30 }, { GREEN, 1800, 60 },
+                                    { GREEN, 0, 80 } }, 5, false },
+    [FEEDBACK_FETCH_SUCCESS] = { { { CYAN, 1800, 40 }, { CYAN, 0, 50 },
+                                   { OFF, 0, 30 }, { CYAN, 1800, 40 },
+                                   { CYAN, 0, 50 }, { OFF, 0, 30 },
+                                   { CYAN, 1800, 40 }, { CYAN, 0, 80 } },
+                                 8, false },
+    [FEEDBACK_TIMEOUT] = { { { RED, 800, 300 }, { RED, 0, 50 } }, 2, false },
+    [FEEDBACK_GET_REQUEST] = { { { GREEN, 1500, 50 } }, 1, true },
+    [FEEDBACK_FETCH_REQUEST] = { { { FEEDBACK_RGB(0, 20, 50, 50), 1600, 50 } },
+                                 1, true },
+    [FEEDBACK_IPATCH_REQUEST] = { { { FEEDBACK_RGB(50, 20, 0, 50), 1400,
+                                      50 } }, 1, true },
+    [FEEDBACK_PUT_REQUEST] = { { { FEEDBACK_RGB(50, 50, 0, 50), 1200, 50 },
+                                 { FEEDBACK_RGB(50, 50, 0, 50), 0, 80 } },
+                               2, true },
+    [FEEDBACK_BLOCK] = { { { GREEN, 1500, 30 } }, 1, true },
+    [FEEDBACK_NOTIFY_BYTE] = { { { GREEN, 1500, 60 }, { GREEN, 0, 80 } }, 2,
+                               false },
+    [FEEDBACK_BUTTON] = { { { GREEN, 0, 100 } }, 1, true },
+};
+
+// FEEDBACK_TONE is filled in by feedback_tone(), FEEDBACK_FLASH by
+// feedback_flash()
+static feedback_pattern_t tone_pattern = { { { FEEDBACK_LED_KEEP, 0, 0 } }, 1,
+                                           true };
+static feedback_pattern_t flash_pattern = { { { OFF, 0, 0 } }, 1, true };
+
+static critical_section_t feedback_lock;
+static bool feedback_ready;
+static uint fb_pin;
+static uint fb_slice;
+static uint fb_chan;
+static uint32_t idle_color = FEEDBACK_RGB(0, 10, 10, 10);
+
+static feedback_pattern_id_t queue[FEEDBACK_QUEUE_DEPTH];
+static uint8_t queue_head;
+static uint8_t queue_count;
+static int current = -1;    // Playing pattern, -1 when idle
+static uint8_t step_index;  // Next step of the playing pattern
+static bool alarm_armed;    // A step timer is pending
+static feedback_stats_t feedback_stats;
+
+/**
+ * @brief Look up a pattern by id.
+ */
+static const feedback_pattern_t *pattern_get(int id)
+{
+    if (id == FEEDBACK_TONE)
+        return &tone_pattern;
+    if (id == FEEDBACK_FLASH)
+        return &flash_pattern;
+    return &patterns[id];
+}
+
+/**
+ * @brief Start a square wave on the buzzer pin, or silence it.
+ * @param frequency Tone in Hz (0 = off)
+ */
+static void buzzer_set(uint frequency)
+{
+    if (frequency < FEEDBACK_MIN_TONE_HZ) {
+        pwm_set_chan_level(fb_slice, fb_chan, 0);
+        return;
+    }
+    uint32_t wrap = FEEDBACK_PWM_TICK_HZ / frequency - 1;
+    pwm_set_wrap(fb_slice, (uint16_t) wrap);
+    pwm_set_chan_level(fb_slice, fb_chan, (uint16_t) ((wrap + 1) / 2));
+}
+
+/**
+ * @brief Check whether a pattern is playing or already queued.
+ * Caller holds feedback_lock.
+ */
+static bool pattern_pending(feedback_pattern_id_t id)
+{
+    if (current == (int) id)
+        return true;
+    for (uint8_t i = 0; i < queue_count; i++) {
+        if (queue[(queue_head + i) % FEEDBACK_QUEUE_DEPTH] == id)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Apply the next step, moving on to queued patterns as they finish.
+ *
+ * Caller holds feedback_lock. Runs from the step alarm (IRQ context) or
+ * from feedback_play() when the engine is idle.
+ *
+ * @return Duration of the applied step in ms, or 0 once nothing is left
+ */
+static uint32_t feedback_advance(void)
+{
+    while (true) {
+        if (current >= 0) {
+            const feedback_pattern_t *pat = pattern_get(current);
+            if (step_index < pat->count) {
+                const feedback_step_t *s = &pat->steps[step_index++];
+                if (s->color != FEEDBACK_LED_KEEP)
+                    hw_led_put(s->color);
+                buzzer_set(s->tone_hz);
+                if (s->ms > 0)
+                    return s->ms;
+                continue;
+            }
+
+            // Pattern finished: silence and return to idle colour
+            buzzer_set(0);
+            hw_led_put(idle_color);
+            feedback_stats.played++;
+            current = -1;
+        }
+
+        if (queue_count == 0)
+            return 0;
+
+        current = queue[queue_head];
+        queue_head = (queue_head + 1) % FEEDBACK_QUEUE_DEPTH;
+        queue_count--;
+        step_index = 0;
+    }
+}
+
+/**
+ * @brief Step timer callback.
+ * @return Negative delay (µs) for the next step relative to this one, or
+ *         0 to stop
+ */
+static int64_t feedback_alarm_cb(alarm_id_t id, void *user_data)
+{
+    (void) id;
+    (void) user_data;
+
+    critical_section_enter_blocking(&feedback_lock);
+    uint32_t ms = feedback_advance();
+    if (ms == 0)
+        alarm_armed = false;
+    critical_section_exit(&feedback_lock);
+
+    return ms ? -(int64_t) ms * 1000 : 0;
+}
+
+/**
+ * @brief Start playback if idle. Caller holds feedback_lock and releases it.
+ */
+static void feedback_kick_locked(void)
+{
+    if (alarm_armed) {
+        critical_section_exit(&feedback_lock);
+        return;
+    }
+
+    uint32_t ms = feedback_advance();
+    alarm_armed = ms > 0;
+    critical_section_exit(&feedback_lock);
+
+    // Arm outside the lock: a past deadline runs the callback immediately
+    if (ms > 0 && add_alarm_in_ms(ms, feedback_alarm_cb, NULL, true) < 0) {
+        LOG_WARN("⚠️ Feedback: no alarm slot\n");
+        critical_section_enter_blocking(&feedback_lock);
+        buzzer_set(0);
+        current = -1;
+        queue_count = 0;
+        alarm_armed = false;
+        critical_section_exit(&feedback_lock);
+    }
+}
+
+/**
+ * @brief Take over the buzzer pin as PWM and bind the WS2812 output to
+ * its DMA channel.
+ * @param pio PIO instance driving the WS2812
+ * @param sm State machine for the WS2812
+ * @param buzzer_pin GPIO pin connected to the buzzer
+ */
+void feedback_init(PIO pio, int sm, uint buzzer_pin)
+{
+    if (!feedback_ready)
+        critical_section_init(&feedback_lock);
+
+    hw_led_init(pio, (uint) sm);
+    fb_pin = buzzer_pin;
+    fb_slice = pwm_gpio_to_slice_num(buzzer_pin);
+    fb_chan = pwm_gpio_to_channel(buzzer_pin);
+
+    gpio_set_function(buzzer_pin, GPIO_FUNC_PWM);
+    pwm_set_clkdiv(fb_slice,
+                   (float) clock_get_hz(clk_sys) / FEEDBACK_PWM_TICK_HZ);
+    pwm_set_chan_level(fb_slice, fb_chan, 0);
+    pwm_set_enabled(fb_slice, true);
+
+    queue_head = 0;
+    queue_count = 0;
+    current = -1;
+    alarm_armed = false;
+    memset(&feedback_stats, 0, sizeof(feedback_stats));
+    feedback_ready = true;
+}
+
+/**
+ * @brief Set the LED colour restored after each pattern.
+ * @param color Packed WS2812 value (see hw_urgb_u32())
+ */
+void feedback_set_idle_color(uint32_t color)
+{
+    idle_color = color;
+}
+
+/**
+ * @brief Set the idle colour and show it unless a pattern is playing.
+ * @param color Packed WS2812 value (see hw_urgb_u32())
+ */
+void feedback_set_status_color(uint32_t color)
+{
+    if (!feedback_ready) {
+        idle_color = color;
+        hw_led_put(color);
+        return;
+    }
+
+    critical_section_enter_blocking(&feedback_lock);
+    idle_color = color;
+    if (current < 0 && queue_count == 0)
+        hw_led_put(color);
+    critical_section_exit(&feedback_lock);
+}
+
+/**
+ * @brief Queue a pattern without blocking.
+ *
+ * A pattern already playing or queued is coalesced. Droppable patterns
+ * (request indicators, ticks) are skipped while anything else plays, so
+ * a burst of requests never builds a backlog of beeps.
+ *
+ * @param id Pattern to play
+ * @return true if the pattern is (or already was) pending, false if dropped
+ */
+bool feedback_play(feedback_pattern_id_t id)
+{
+    if (!feedback_ready || id >= FEEDBACK_PATTERN_COUNT)
+        return false;
+
+    critical_section_enter_blocking(&feedback_lock);
+
+    if (pattern_pending(id)) {
+        feedback_stats.coalesced++;
+        critical_section_exit(&feedback_lock);
+        return true;
+    }
+
+    bool busy = current >= 0 || queue_count > 0;
+    if ((busy && pattern_get(id)->droppable) ||
+        queue_count >= FEEDBACK_QUEUE_DEPTH) {
+        feedback_stats.dropped++;
+        critical_section_exit(&feedback_lock);
+        return false;
+    }
+
+    queue[(queue_head + queue_count) % FEEDBACK_QUEUE_DEPTH] = id;
+    queue_count++;
+    feedback_kick_locked();
+    return true;
+}
+
+/**
+ * @brief Queue a single buzzer tone without touching the LED.
+ * @param frequency Tone frequency (Hz)
+ * @param duration_ms Tone duration (ms)
+ * @return true if queued, false if dropped
+ */
+bool feedback_tone(uint frequency, uint duration_ms)
+{
+    if (!feedback_ready || frequency == 0 || duration_ms == 0)
+        return false;
+
+    critical_section_enter_blocking(&feedback_lock);
+    bool pending = pattern_pending(FEEDBACK_TONE);
+    if (!pending) {
+        tone_pattern.steps[0].tone_hz = (uint16_t) frequency;
+        tone_pattern.steps[0].ms =
+            (uint16_t) (duration_ms > UINT16_MAX ? UINT16_MAX : duration_ms);
+    }
+    critical_section_exit(&feedback_lock);
+
+    return feedback_play(FEEDBACK_TONE);
+}
+
+/**
+ * @brief Queue a single LED colour without sounding the buzzer.
+ * @param color Packed WS2812 value (see hw_urgb_u32())
+ * @param duration_ms Time the colour is held (ms)
+ * @return true if queued, false if dropped
+ */
+bool feedback_flash(uint32_t color, uint duration_ms)
+{
+    if (!feedback_ready || duration_ms == 0)
+        return false;
+
+    critical_section_enter_blocking(&feedback_lock);
+    bool pending = pattern_pending(FEEDBACK_FLASH);
+    if (!pending) {
+        flash_pattern.steps[0].color = color;
+        flash_pattern.steps[0].ms =
+            (uint16_t) (duration_ms > UINT16_MAX ? UINT16_MAX : duration_ms);
+    }
+    critical_section_exit(&feedback_lock);
+
+    return feedback_play(FEEDBACK_FLASH);
+}
+
+/**
+ * @brief Check whether any pattern is playing or queued.
+ * @return true while busy
+ */
+bool feedback_busy(void)
+{
+    return current >= 0 || queue_count > 0;
+}
+
+/**
+ * @brief Check whether the engine drives a buzzer pin.
+ * @param pin GPIO pin
+ * @return true once feedback_init() has claimed the pin
+ */
+bool feedback_owns_pin(uint pin)
+{
+    return feedback_ready && pin == fb_pin;
+}
+
+/**
+ * @brief Get feedback counters.
+ * @return Pointer to the live counters
+ */
+const feedback_stats_t *feedback_get_stats(void)
+{
+    return &feedback_stats;
+}
@@ -0,0 +1,83 @@
+#ifndef CS04_FEEDBACK_H
+#define CS04_FEEDBACK_H
+
+#include "hardware/pio.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define FEEDBACK_QUEUE_DEPTH 4        // Patterns waiting behind the one playing
+#define FEEDBACK_MAX_STEPS 10         // Steps per pattern
+#define FEEDBACK_PWM_TICK_HZ 1000000  // Buzzer PWM counter rate
+#define FEEDBACK_MIN_TONE_HZ 16       // Lowest tone the 16-bit wrap can hold
+
+// Packs an RGB colour scaled by a brightness percentage, matching
+// hw_urgb_u32() but usable in constant tables.
+#define FEEDBACK_RGB(r, g, b, pct)                      \
+    (((uint32_t) ((g) * (pct) / 100) << 16) |           \
+     ((uint32_t) ((r) * (pct) / 100) << 8) |            \
+     (uint32_t) ((b) * (pct) / 100))
+
+// Step colour that leaves the LED unchanged.
+#define FEEDBACK_LED_KEEP 0xFFFFFFFFu
+
+// Feedback patterns. Request indicators are dropped while another pattern
+// is playing; completion and error patterns queue behind it.
+typedef enum {
+    FEEDBACK_SUCCESS,          // Double green beep
+    FEEDBACK_ERROR,            // Red LED, low buzz
+    FEEDBACK_PROGRESS,         // Short buzz, green LED
+    FEEDBACK_FILE_COMPLETE,    // Triple green beep
+    FEEDBACK_STRING,           // Double green beep (notification)
+    FEEDBACK_FETCH,            // Triple cyan beep (FETCH served)
+    FEEDBACK_APPEND_SUCCESS,   // Double green beep (iPATCH acknowledged)
+    FEEDBACK_FETCH_SUCCESS,    // Triple cyan beep (FETCH saved)
+    FEEDBACK_TIMEOUT,          // Long red buzz (retransmission gave up)
+    FEEDBACK_GET_REQUEST,      // Green flash, GET /file
+    FEEDBACK_FETCH_REQUEST,    // Blue flash, FETCH /file
+    FEEDBACK_IPATCH_REQUEST,   // Orange flash, iPATCH /file
+    FEEDBACK_PUT_REQUEST,      // Yellow flash, PUT /actuators
+    FEEDBACK_BLOCK,            // Short tick per received block
+    FEEDBACK_NOTIFY_BYTE,      // Single green beep (byte notification)
+    FEEDBACK_BUTTON,           // Green flash (button notification sent)
+    FEEDBACK_TONE,             // Single tone from feedback_tone()
+    FEEDBACK_FLASH,            // Single colour from feedback_flash()
+    FEEDBACK_PATTERN_COUNT
+} feedback_pattern_id_t;
+
+// Feedback counters.
+typedef struct {
+    uint32_t played;     // Patterns played to the end
+    uint32_t coalesced;  // Requests merged with an identical pending pattern
+    uint32_t dropped;    // Requests discarded (busy or queue full)
+} feedback_stats_t;
+
+// Takes over the buzzer pin as PWM and binds the WS2812 output to a DMA
+// channel (hw_led_init()).
+void feedback_init(PIO pio, int sm, uint buzzer_pin);
+
+// Sets the LED colour shown once a pattern finishes.
+void feedback_set_idle_color(uint32_t color);
+
+// Sets the idle colour and shows it now unless a pattern is playing.
+void feedback_set_status_color(uint32_t color);
+
+// Queues a pattern and returns immediately. Returns false if dropped.
+bool feedback_play(feedback_pattern_id_t id);
+
+// Queues a single tone (LED unchanged). Returns false if dropped.
+bool feedback_tone(uint frequency, uint duration_ms);
+
+// Queues a single LED colour (buzzer silent). Returns false if dropped.
+bool feedback_flash(uint32_t color, uint duration_ms);
+
+// Returns true while a pattern is playing or queued.
+bool feedback_busy(void);
+
+// Returns true if the engine drives this buzzer pin.
+bool feedback_owns_pin(uint pin);
+
+// Returns the feedback counters.
+const feedback_stats_t *feedback_get_stats(void);
+
+#endif  // CS04_FEEDBACK_H
@@ -0,0 +1,222 @@
+#include "cs04_fetch_cursor.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+static fetch_cursor_t fetch_cursors[FETCH_CURSOR_SLOTS];
+
+/**
+ * @brief Check whether a cursor belongs to (token, client).
+ */
+static bool cursor_matches(const fetch_cursor_t *cur, const coap_buffer_t *tok,
+                           const ip_addr_t *ip, u16_t port)
+{
+    return cur->active && cur->port == port && ip_addr_cmp(&cur->ip, ip) &&
+           cur->token_len == tok->len &&
+           memcmp(cur->token, tok->p, tok->len) == 0;
+}
+
+/**
+ * @brief Clear all FETCH cursors.
+ */
+void fetch_cursor_init(void)
+{
+    memset(fetch_cursors, 0, sizeof(fetch_cursors));
+}
+
+/**
+ * @brief Find the cursor for a client's token.
+ * @param tok Request token
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @return Cursor, or NULL if none
+ */
+fetch_cursor_t *fetch_cursor_find(const coap_buffer_t *tok, const ip_addr_t *ip,
+                                  u16_t port)
+{
+    for (int i = 0; i < FETCH_CURSOR_SLOTS; i++) {
+        if (cursor_matches(&fetch_cursors[i], tok, ip, port))
+            return &fetch_cursors[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Create a cursor at the first byte of a FETCH result.
+ *
+ * A new block 0 request with a token already in use restarts that cursor.
+ * Otherwise a free slot is taken, or the least recently used cursor is
+ * recycled. Finished cursors stay in the table so a lost final block can be
+ * requested again.
+ *
+ * @param tok Request token
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @param offset File offset of the start line
+ * @param line Start line number
+ * @param end_line Last line of the requested range (inclusive)
+ * @return Cursor, or NULL if the token is too long
+ */
+fetch_cursor_t *fetch_cursor_open(const coap_buffer_t *tok, const ip_addr_t *ip,
+                                  u16_t port, FSIZE_t offset, uint32_t line,
+                                  uint32_t end_line)
+{
+    if (tok->len > FETCH_CURSOR_TOKEN_LEN)
+        return NULL;
+
+    fetch_cursor_t *cur = fetch_cursor_find(tok, ip, port);
+    if (!cur) {
+        cur = &fetch_cursors[0];
+        for (int i = 0; i < FETCH_CURSOR_SLOTS; i++) {
+            if (!fetch_cursors[i].active) {
+                cur = &fetch_cursors[i];
+                break;
+            }
+            if (fetch_cursors[i].last_used_ms < cur->last_used_ms)
+                cur = &fetch_cursors[i];
+        }
+    }
+
+    cur->active = true;
+    memcpy(cur->token, tok->p, tok->len);
+    cur->token_len = (uint8_t) tok->len;
+    cur->ip = *ip;
+    cur->port = port;
+    cur->end_line = end_line;
+    cur->next_block = 0;
+    cur->pos.offset = offset;
+    cur->pos.line = line;
+    cur->prev = cur->pos;
+    cur->last_used_ms = to_ms_since_boot(get_absolute_time());
+    return cur;
+}
+
+/**
+ * @brief Find where a block of a FETCH result starts.
+ *
+ * Only the next block or a repeat of the block just served (lost response)
+ * can be located; the latter is answered from the saved previous position.
+ *
+ * @param cur Cursor
+ * @param block_num Requested block number
+ * @param start Output: position of the block's first byte
+ * @return True if the cursor can serve the block
+ */
+bool fetch_cursor_locate(const fetch_cursor_t *cur, uint32_t block_num,
+                         fetch_position_t *start)
+{
+    if (block_num == cur->next_block) {
+        *start = cur->pos;
+    } else if (cur->next_block > 0 && block_num == cur->next_block - 1) {
+        *start = cur->prev;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Cut bytes read at a block's start to the range and advance.
+ *
+ * The result is the byte stream of lines start..end_line, so every block
+ * except the last is exactly block_size bytes as RFC 7959 requires.
+ *
+ * @param cur Cursor
+ * @param block_num Block the bytes belong to
+ * @param start Position returned by fetch_cursor_locate()
+ * @param buf Bytes read from start
+ * @param len In: bytes in buf; out: bytes belonging to the result
+ * @param file_size File size, to tell whether more blocks follow
+ * @param more Output: true if further blocks follow
+ */
+void fetch_cursor_advance(fetch_cursor_t *cur, uint32_t block_num,
+                          const fetch_position_t *start, const uint8_t *buf,
+                          UINT *len, FSIZE_t file_size, bool *more)
+{
+    // Stop after the newline that ends end_line
+    uint32_t line = start->line;
+    bool done = false;
+    for (UINT i = 0; i < *len; i++) {
+        if (buf[i] != '\n')
+            continue;
+        if (line == cur->end_line) {
+            *len = i + 1;
+            done = true;
+            break;
+        }
+        line++;
+    }
+
+    FSIZE_t end_offset = start->offset + *len;
+    *more = !done && end_offset < file_size;
+
+    if (block_num == cur->next_block) {
+        cur->prev = *start;
+        cur->pos.offset = end_offset;
+        cur->pos.line = line;
+        cur->next_block++;
+    }
+    cur->last_used_ms = to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * @brief Read one Block2 block of a FETCH result and advance the cursor.
+ * @param cur Cursor
+ * @param fil Open file the cursor refers to
+ * @param block_num Requested block number
+ * @param buf Output buffer of at least block_size bytes
+ * @param block_size Block size in bytes
+ * @param len Output: bytes placed in buf
+ * @param more Output: true if further blocks follow
+ * @return FR_OK, FR_INVALID_PARAMETER for an unreachable block, or a FATFS
+ *         error
+ */
+FRESULT fetch_cursor_read(fetch_cursor_t *cur, FIL *fil, uint32_t block_num,
+                          uint8_t *buf, uint32_t block_size, UINT *len,
+                          bool *more)
+{
+    fetch_position_t start;
+
+    *len = 0;
+    *more = false;
+
+    if (!fetch_cursor_locate(cur, block_num, &start))
+        return FR_INVALID_PARAMETER;
+
+    FRESULT res = f_lseek(fil, start.offset);
+    if (res == FR_OK)
+        res = f_read(fil, buf, block_size, len);
+    if (res != FR_OK) {
+        *len = 0;
+        return res;
+    }
+
+    fetch_cursor_advance(cur, block_num, &start, buf, len, f_size(fil), more);
+    return FR_OK;
+}
+
+/**
+ * @brief Release a cursor.
+ * @param cur Cursor to free
+ */
+void fetch_cursor_close(fetch_cursor_t *cur)
+{
+    if (cur)
+        cur->active = false;
+}
+
+/**
+ * @brief Release cursors that have been idle for FETCH_CURSOR_IDLE_MS.
+ * @param now_ms Current time in ms since boot
+ */
+void fetch_cursor_expire(uint32_t now_ms)
+{
+    for (int i = 0; i < FETCH_CURSOR_SLOTS; i++) {
+        if (fetch_cursors[i].active &&
+            now_ms - fetch_cursors[i].last_used_ms > FETCH_CURSOR_IDLE_MS) {
+            LOG_DEBUG("📖 Dropping idle FETCH cursor\n");
+            fetch_cursors[i].active = false;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef CS04_FETCH_CURSOR_H
+#define CS04_FETCH_CURSOR_H
+
+#include "ff.h"
+#include "lwip/ip_addr.h"
+#include "coap.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define FETCH_CURSOR_SLOTS 4          // Concurrent blockwise FETCH queries
+#define FETCH_CURSOR_IDLE_MS 30000    // Drop cursors unused for this long
+#define FETCH_CURSOR_TOKEN_LEN 8      // Longest CoAP token
+
+// Position in the FETCH result stream (bytes of lines start..end).
+typedef struct {
+    FSIZE_t offset;  // File offset of the next byte to send
+    uint32_t line;   // Line number containing that byte
+} fetch_position_t;
+
+// Resume point of one blockwise FETCH, keyed by client and token.
+typedef struct {
+    bool active;                            // True if slot is in use
+    uint8_t token[FETCH_CURSOR_TOKEN_LEN];  // Request token
+    uint8_t token_len;                      // Token length
+    ip_addr_t ip;                           // Client IP address
+    u16_t port;                             // Client UDP port
+    uint32_t end_line;                      // Last line of the range
+    uint32_t next_block;                    // Block the cursor is positioned at
+    fetch_position_t pos;                   // Start of next_block
+    fetch_position_t prev;                  // Start of next_block - 1
+    uint32_t last_used_ms;                  // For idle expiry
+} fetch_cursor_t;
+
+// Clears all cursors.
+void fetch_cursor_init(void);
+
+// Creates (or restarts) the cursor for a token, positioned at block 0.
+// Recycles the least recently used slot when the table is full.
+fetch_cursor_t *fetch_cursor_open(const coap_buffer_t *tok, const ip_addr_t *ip,
+                                  u16_t port, FSIZE_t offset, uint32_t line,
+                                  uint32_t end_line);
+
+// Returns the cursor for a token, or NULL.
+fetch_cursor_t *fetch_cursor_find(const coap_buffer_t *tok, const ip_addr_t *ip,
+                                  u16_t port);
+
+// Returns the start of block block_num: next_block, or a repeat of the
+// previous block. False if the cursor cannot serve it.
+bool fetch_cursor_locate(const fetch_cursor_t *cur, uint32_t block_num,
+                         fetch_position_t *start);
+
+// Cuts *len bytes read at start to the end of the range and advances the
+// cursor (for results read from somewhere other than fil).
+void fetch_cursor_advance(fetch_cursor_t *cur, uint32_t block_num,
+                          const fetch_position_t *start, const uint8_t *buf,
+                          UINT *len, FSIZE_t file_size, bool *more);
+
+// Reads block block_num of the result into buf and advances the cursor.
+// Only next_block or a repeat of the previous block can be served.
+FRESULT fetch_cursor_read(fetch_cursor_t *cur, FIL *fil, uint32_t block_num,
+                          uint8_t *buf, uint32_t block_size, UINT *len,
+                          bool *more);
+
+// Releases a cursor.
+void fetch_cursor_close(fetch_cursor_t *cur);
+
+// Releases cursors idle for longer than FETCH_CURSOR_IDLE_MS.
+void fetch_cursor_expire(uint32_t now_ms);
+
+#endif  // CS04_FETCH_CURSOR_H
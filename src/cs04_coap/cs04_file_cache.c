@@ -0,0 +1,175 @@
+#include "cs04_file_cache.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+static file_cache_entry_t file_cache[FILE_CACHE_SLOTS];
+
+/**
+ * @brief Close a cache slot and mark it free.
+ * @param entry Slot to release
+ */
+static void file_cache_release(file_cache_entry_t *entry)
+{
+    if (!entry->active)
+        return;
+    f_close(&entry->file);
+    entry->active = false;
+    entry->fastseek = false;
+}
+
+/**
+ * @brief Find the slot for (filename, client).
+ * @return Matching active slot, or NULL
+ */
+static file_cache_entry_t *file_cache_find(const char *filename,
+                                           const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < FILE_CACHE_SLOTS; i++) {
+        file_cache_entry_t *entry = &file_cache[i];
+        if (entry->active && entry->port == port &&
+            ip_addr_cmp(&entry->ip, ip) &&
+            strncmp(entry->filename, filename, FILE_CACHE_NAME_LEN) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Initialize the open-file cache, closing any cached handles.
+ */
+void file_cache_init(void)
+{
+    for (int i = 0; i < FILE_CACHE_SLOTS; i++) {
+        file_cache_release(&file_cache[i]);
+    }
+    memset(file_cache, 0, sizeof(file_cache));
+}
+
+/**
+ * @brief Get an open read handle for a client's file, reusing cached ones.
+ *
+ * On a miss the least recently used slot is recycled. A fresh handle gets its
+ * own FF_USE_FASTSEEK cluster link map so later seeks are O(1) instead of
+ * walking the FAT chain from the start of the file. If the file is too
+ * fragmented for FILE_CACHE_CLTBL_LEN the handle falls back to normal seeks,
+ * which are still cheap for forward sequential access on an open handle.
+ *
+ * @param filename File to open for reading
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @param res Output: FATFS result on failure
+ * @return Open FIL handle owned by the cache, or NULL on failure
+ */
+FIL *file_cache_acquire(const char *filename, const ip_addr_t *ip, u16_t port,
+                        FRESULT *res)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    file_cache_entry_t *entry = file_cache_find(filename, ip, port);
+
+    if (entry) {
+        entry->last_used_ms = now;
+        *res = FR_OK;
+        return &entry->file;
+    }
+
+    // Pick a free slot, else evict the least recently used one
+    file_cache_entry_t *victim = &file_cache[0];
+    for (int i = 0; i < FILE_CACHE_SLOTS; i++) {
+        if (!file_cache[i].active) {
+            victim = &file_cache[i];
+            break;
+        }
+        if (file_cache[i].last_used_ms < victim->last_used_ms)
+            victim = &file_cache[i];
+    }
+    file_cache_release(victim);
+
+    *res = f_open(&victim->file, filename, FA_READ);
+    if (*res != FR_OK)
+        return NULL;
+
+    victim->active = true;
+    strncpy(victim->filename, filename, FILE_CACHE_NAME_LEN - 1);
+    victim->filename[FILE_CACHE_NAME_LEN - 1] = '\0';
+    victim->ip = *ip;
+    victim->port = port;
+    victim->last_used_ms = now;
+
+    victim->cltbl[0] = FILE_CACHE_CLTBL_LEN;
+    victim->file.cltbl = victim->cltbl;
+    victim->fastseek = (f_lseek(&victim->file, CREATE_LINKMAP) == FR_OK);
+    if (!victim->fastseek) {
+        victim->file.cltbl = NULL;
+        f_lseek(&victim->file, 0);
+    }
+
+    LOG_DEBUG("📂 Cached %s for %s:%d (fastseek %s)\n", filename,
+           ip4addr_ntoa(ip), port, victim->fastseek ? "on" : "off");
+    return &victim->file;
+}
+
+/**
+ * @brief Close the cached handle for (filename, client).
+ * @param filename File name
+ * @param ip Client IP address
+ * @param port Client UDP port
+ */
+void file_cache_close(const char *filename, const ip_addr_t *ip, u16_t port)
+{
+    file_cache_entry_t *entry = file_cache_find(filename, ip, port);
+    if (entry)
+        file_cache_release(entry);
+}
+
+/**
+ * @brief Close every cached handle belonging to a client.
+ * @param ip Client IP address
+ * @param port Client UDP port
+ */
+void file_cache_close_peer(const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < FILE_CACHE_SLOTS; i++) {
+        if (file_cache[i].active && file_cache[i].port == port &&
+            ip_addr_cmp(&file_cache[i].ip, ip)) {
+            file_cache_release(&file_cache[i]);
+        }
+    }
+}
+
+/**
+ * @brief Close every cached handle on a file.
+ *
+ * Must be called before the file is modified: with FF_FS_LOCK enabled an
+ * open read handle would make the write open fail, and a cached size and
+ * link map would go stale after an append.
+ *
+ * @param filename File name
+ */
+void file_cache_invalidate(const char *filename)
+{
+    for (int i = 0; i < FILE_CACHE_SLOTS; i++) {
+        if (file_cache[i].active &&
+            strncmp(file_cache[i].filename, filename, FILE_CACHE_NAME_LEN) ==
+                0) {
+            file_cache_release(&file_cache[i]);
+        }
+    }
+}
+
+/**
+ * @brief Close handles that have been idle for FILE_CACHE_IDLE_MS.
+ * @param now_ms Current time in ms since boot
+ */
+void file_cache_expire(uint32_t now_ms)
+{
+    for (int i = 0; i < FILE_CACHE_SLOTS; i++) {
+        if (file_cache[i].active &&
+            now_ms - file_cache[i].last_used_ms > FILE_CACHE_IDLE_MS) {
+            LOG_DEBUG("📂 Closing idle %s\n", file_cache[i].filename);
+            file_cache_release(&file_cache[i]);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef CS04_FILE_CACHE_H
+#define CS04_FILE_CACHE_H
+
+#include "ff.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define FILE_CACHE_SLOTS 4           // Open FIL handles (one per transfer)
+#define FILE_CACHE_IDLE_MS 10000     // Close handles unused for this long
+#define FILE_CACHE_CLTBL_LEN 64      // DWORDs per FF_USE_FASTSEEK link map
+#define FILE_CACHE_NAME_LEN 32
+
+// One cached open file, bound to the client reading it.
+typedef struct {
+    bool active;                         // True if slot holds an open file
+    char filename[FILE_CACHE_NAME_LEN];  // File opened in this slot
+    ip_addr_t ip;                        // Client reading the file
+    u16_t port;                          // Client UDP port
+    FIL file;                            // Open FATFS handle
+    bool fastseek;                       // True if cltbl holds a link map
+    DWORD cltbl[FILE_CACHE_CLTBL_LEN];   // Cluster link map table
+    uint32_t last_used_ms;               // Time of last block served
+} file_cache_entry_t;
+
+// Closes all cached handles and resets the cache.
+void file_cache_init(void);
+
+// Returns an open read handle for (filename, client), opening it on a miss.
+// Returns NULL and sets *res on failure.
+FIL *file_cache_acquire(const char *filename, const ip_addr_t *ip, u16_t port,
+                        FRESULT *res);
+
+// Closes the handle for (filename, client), e.g. when its transfer completes.
+void file_cache_close(const char *filename, const ip_addr_t *ip, u16_t port);
+
+// Closes every handle held for a client.
+void file_cache_close_peer(const ip_addr_t *ip, u16_t port);
+
+// Closes every handle on filename (required before writing to it).
+void file_cache_invalidate(const char *filename);
+
+// Closes handles idle for longer than FILE_CACHE_IDLE_MS (call in main loop).
+void file_cache_expire(uint32_t now_ms);
+
+#endif  // CS04_FILE_CACHE_H
@@ -0,0 +1,91 @@
+#include "cs04_file_tail.h"
+#include <string.h>
+
+static uint8_t tail[FILE_TAIL_BYTES];
+static uint32_t tail_start;  // Oldest position still held
+static uint32_t tail_end;    // Position after the newest byte
+
+/**
+ * @brief Store bytes at the end of the ring, dropping the oldest.
+ */
+static void tail_put(const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        tail[tail_end++ % FILE_TAIL_BYTES] = data[i];
+    if (tail_end - tail_start > FILE_TAIL_BYTES)
+        tail_start = tail_end - FILE_TAIL_BYTES;
+}
+
+/**
+ * @brief Clear the ring.
+ */
+void file_tail_init(void)
+{
+    tail_start = 0;
+    tail_end = 0;
+}
+
+/**
+ * @brief Record a batch of lines appended to the file.
+ * @param data Batch (lines joined by '\n', no trailing newline)
+ * @param len Batch length
+ */
+void file_tail_append(const uint8_t *data, size_t len)
+{
+    tail_put(data, len);
+    tail_put((const uint8_t *) "\n", 1);
+}
+
+/**
+ * @brief Record a change that observers cannot be sent as a delta.
+ *
+ * The end moves by one so every observer's position falls behind it, and
+ * nothing before the new end is held.
+ */
+void file_tail_changed(void)
+{
+    tail_end++;
+    tail_start = tail_end;
+}
+
+/**
+ * @brief Position after the last byte recorded.
+ */
+uint32_t file_tail_end(void)
+{
+    return tail_end;
+}
+
+/**
+ * @brief Check whether an observer at a position can be sent a delta.
+ * @param from Position the observer has been sent up to
+ * @return true if every byte from there is still held
+ */
+bool file_tail_available(uint32_t from)
+{
+    return (int32_t) (from - tail_start) >= 0 &&
+           (int32_t) (tail_end - from) >= 0;
+}
+
+/**
+ * @brief Copy the bytes appended since a position.
+ * @param from Position the observer has been sent up to
+ * @param buf Output buffer
+ * @param cap Buffer size
+ * @param len Output: bytes copied
+ * @return false if the bytes are gone or do not fit
+ */
+bool file_tail_read(uint32_t from, uint8_t *buf, size_t cap, size_t *len)
+{
+    *len = 0;
+    if (!file_tail_available(from) || tail_end - from > cap)
+        return false;
+
+    size_t n = tail_end - from;
+    size_t at = from % FILE_TAIL_BYTES;
+    size_t first = n < FILE_TAIL_BYTES - at ? n : FILE_TAIL_BYTES - at;
+    memcpy(buf, &tail[at], first);
+    memcpy(buf + first, tail, n - first);
+    *len = n;
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef CS04_FILE_TAIL_H
+#define CS04_FILE_TAIL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define FILE_TAIL_BYTES 1024  // Recent appends kept for /file observers
+
+// Ring of the bytes most recently appended to the text file. Positions count
+// bytes appended since boot; an observer remembers the position it has been
+// sent up to and gets [position, end) as its next notification. A change
+// that cannot be replayed (a PUT, or a Block1 append) moves the end without
+// data, so observers behind it get a change marker instead.
+
+// Clears the ring. The end position starts at 0.
+void file_tail_init(void);
+
+// Records a batch appended to the file. Each batch gets a trailing newline,
+// as in the file.
+void file_tail_append(const uint8_t *data, size_t len);
+
+// Records a change to the file that is not in the ring.
+void file_tail_changed(void);
+
+// Returns the position after the last byte appended.
+uint32_t file_tail_end(void);
+
+// Returns true if [from, end) is still held and fits in FILE_TAIL_BYTES.
+bool file_tail_available(uint32_t from);
+
+// Copies [from, end) to buf. Returns false, copying nothing, if those bytes
+// are no longer held or do not fit in cap.
+bool file_tail_read(uint32_t from, uint8_t *buf, size_t cap, size_t *len);
+
+#endif  // CS04_FILE_TAIL_H
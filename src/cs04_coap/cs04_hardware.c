@@ -1,9 +1,15 @@
 #include "cs04_hardware.h"
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
 #include "ws2812.pio.h"
 #include "ws2812.h"
 #include "sd_card.h"
+#include "hw_config.h"
+#include "cs04_feedback.h"
+#include "cs04_event_loop.h"
+#include "cs04_log.h"
 #include <stdio.h>
 
 // External WS2812 state (from main)
@@ -26,8 +32,82 @@ uint32_t hw_urgb_u32(uint8_t r, uint8_t g, uint8_t b, float brightness)
     return ((uint32_t) g << 16) | ((uint32_t) r << 8) | b;
 }
 
+static int led_dma = -1;          // Channel feeding the WS2812 FIFO
+static volatile uint32_t led_word;  // Frame being sent (GRB << 8)
+
+/**
+ * @brief Feed the WS2812 state machine from a DMA channel.
+ *
+ * The channel moves one word from led_word into the TX FIFO, paced by the
+ * FIFO's DREQ, so a colour change is a register write and never waits for
+ * FIFO space.
+ *
+ * @param pio PIO instance running ws2812_program
+ * @param sm State machine for the WS2812
+ */
+void hw_led_init(PIO pio, uint sm)
+{
+    if (led_dma < 0)
+        led_dma = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config((uint) led_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure((uint) led_dma, &c, &pio->txf[sm], &led_word, 1,
+                          false);
+}
+
+/**
+ * @brief Send a colour to the LED without blocking.
+ *
+ * A colour still waiting for FIFO space is dropped in favour of the new
+ * one. Safe from IRQ context (the feedback step alarm).
+ *
+ * @param grb Packed WS2812 value (see hw_urgb_u32())
+ */
+void hw_led_put(uint32_t grb)
+{
+    if (led_dma < 0) {
+        ws2812_put_pixel(pio_ws2812, sm_ws2812, grb);  // Before hw_led_init()
+        return;
+    }
+
+    uint32_t irq = save_and_disable_interrupts();
+    if (dma_channel_is_busy((uint) led_dma))
+        dma_channel_abort((uint) led_dma);
+    led_word = grb << 8u;
+    dma_channel_transfer_from_buffer_now((uint) led_dma, &led_word, 1);
+    restore_interrupts(irq);
+}
+
+/**
+ * @brief Set the status colour.
+ *
+ * Shown at once when no feedback pattern is playing, otherwise when the
+ * playing pattern ends.
+ *
+ * @param grb Packed WS2812 value (see hw_urgb_u32())
+ */
+void hw_led_status(uint32_t grb)
+{
+    feedback_set_status_color(grb);
+}
+
+/**
+ * @brief Queue a colour flash on the feedback engine.
+ * @param grb Packed WS2812 value (see hw_urgb_u32())
+ * @param duration_ms Time the colour is held before the status colour returns
+ * @return true if queued, false if dropped
+ */
+bool hw_led_flash(uint32_t grb, uint32_t duration_ms)
+{
+    return feedback_flash(grb, duration_ms);
+}
+
 /**
- * @brief Set the WS2812 LED to given RGB color/brightness.
+ * @brief Set the WS2812 status colour from RGB/brightness.
  * @param r Red (0-255)
  * @param g Green (0-255)
  * @param b Blue (0-255)
@@ -35,7 +115,7 @@ uint32_t hw_urgb_u32(uint8_t r, uint8_t g, uint8_t b, float brightness)
  */
 void hw_led_set_color(uint8_t r, uint8_t g, uint8_t b, float brightness)
 {
-    ws2812_put_pixel(pio_ws2812, sm_ws2812, hw_urgb_u32(r, g, b, brightness));
+    hw_led_status(hw_urgb_u32(r, g, b, brightness));
 }
 
 /**
@@ -47,22 +127,24 @@ void hw_led_off(void)
 }
 
 /**
- * @brief Blink the WS2812 LED with RGB color, hold duration, then dim to idle
- * color.
+ * @brief Flash the WS2812 LED with RGB colour at half brightness, then return
+ * to the status colour. Returns immediately.
  * @param r Red
  * @param g Green
  * @param b Blue
- * @param duration_ms Duration in ms to show color before dimming.
+ * @param duration_ms Duration in ms to show color.
  */
 void hw_led_blink(uint8_t r, uint8_t g, uint8_t b, uint32_t duration_ms)
 {
-    hw_led_set_color(r, g, b, 0.5f);
-    sleep_ms(duration_ms);
-    hw_led_set_color(0, 10, 10, 0.1f);
+    hw_led_flash(hw_urgb_u32(r, g, b, 0.5f), duration_ms);
 }
 
 /**
  * @brief Sound a buzzer on a pin at a frequency for given duration (ms).
+ *
+ * Once feedback_init() has claimed the pin the tone is queued on the PWM
+ * engine; before that (boot beep) the pin is bit-banged and this blocks.
+ *
  * @param pin GPIO pin of buzzer
  * @param frequency Tone frequency (Hz)
  * @param duration_ms Tone duration (ms)
@@ -71,6 +153,10 @@ void hw_buzz(uint pin, uint frequency, uint duration_ms)
 {
     if (frequency == 0)
         return;
+    if (feedback_owns_pin(pin)) {
+        feedback_tone(frequency, duration_ms);  // PWM, returns immediately
+        return;
+    }
     uint delay_us = 500000 / frequency;
     uint cycles = frequency * duration_ms / 1000;
     for (uint i = 0; i < cycles; i++) {
@@ -82,39 +168,27 @@ void hw_buzz(uint pin, uint frequency, uint duration_ms)
 }
 
 /**
- * @brief Play visual/audio feedback for success (green LED, short buzzer).
+ * @brief Queue visual/audio feedback for success (green LED, double beep).
  */
 void hw_signal_success(void)
 {
-    hw_led_set_color(0, 50, 0, 0.5f);
-    hw_buzz(18, 1800, 60);
-    sleep_ms(70);
-    hw_led_off();
-    sleep_ms(30);
-    hw_led_set_color(0, 50, 0, 0.5f);
-    hw_buzz(18, 1800, 60);
-    sleep_ms(80);
-    hw_led_set_color(0, 10, 10, 0.1f);
+    feedback_play(FEEDBACK_SUCCESS);
 }
 
 /**
- * @brief Play visual/audio signal for error (red LED, lower buzz).
+ * @brief Queue visual/audio signal for error (red LED, lower buzz).
  */
 void hw_signal_error(void)
 {
-    hw_led_set_color(50, 0, 0, 0.5f);
-    hw_buzz(18, 400, 100);
-    sleep_ms(100);
-    hw_led_set_color(0, 10, 10, 0.1f);
+    feedback_play(FEEDBACK_ERROR);
 }
 
 /**
- * @brief Play progress indication (short buzz, orange LED).
+ * @brief Queue progress indication (short buzz, green LED).
  */
 void hw_signal_progress(void)
 {
-    hw_buzz(18, 1500, 30);
-    hw_led_set_color(0, 50, 0, 0.5f);
+    feedback_play(FEEDBACK_PROGRESS);
 }
 
 /**
@@ -144,6 +218,178 @@ bool hw_button_pressed(button_t *btn)
     return pressed;
 }
 
+static hw_button_state_t buttons[HW_BUTTON_MAX];
+static size_t button_count;
+static hw_button_event_t button_ring[HW_BUTTON_QUEUE_DEPTH];
+static volatile uint32_t button_head;  // Written by the IRQ
+static volatile uint32_t button_tail;  // Written by the main loop
+static volatile uint32_t button_dropped;
+static volatile bool recheck_armed;    // Settle alarm pending
+
+/**
+ * @brief Apply a sampled level to a button.
+ *
+ * The first edge after a quiet HW_BUTTON_DEBOUNCE_MS is taken at once and
+ * the contacts are then ignored for that long, so a press costs no latency
+ * and bounce never reaches the queue.
+ *
+ * @param b Button state
+ * @param down Sampled level (true = pressed)
+ * @param now_ms Sample time (ms since boot)
+ * @param ev Filled in when an event results
+ * @return true if ev holds a new event
+ */
+bool hw_button_edge(hw_button_state_t *b, bool down, uint32_t now_ms,
+                    hw_button_event_t *ev)
+{
+    if (down == b->down || now_ms - b->edge_ms < HW_BUTTON_DEBOUNCE_MS)
+        return false;
+
+    b->down = down;
+    b->edge_ms = now_ms;
+    ev->pin = (uint8_t) b->pin;
+    ev->at_ms = now_ms;
+    if (down) {
+        b->down_ms = now_ms;
+        ev->kind = HW_BUTTON_PRESS;
+        ev->held_ms = 0;
+    } else {
+        ev->held_ms = now_ms - b->down_ms;
+        ev->kind = ev->held_ms >= HW_BUTTON_LONG_MS ? HW_BUTTON_LONG
+                                                    : HW_BUTTON_SHORT;
+    }
+    return true;
+}
+
+/**
+ * @brief Sample a button and queue any resulting event. IRQ context.
+ * @return true if the level differs from the accepted state but was
+ *         ignored as bounce
+ */
+static bool button_sample(hw_button_state_t *b, uint32_t now_ms)
+{
+    bool down = !gpio_get(b->pin);  // Active low
+    hw_button_event_t ev;
+    if (!hw_button_edge(b, down, now_ms, &ev))
+        return down != b->down;
+
+    if (button_head - button_tail >= HW_BUTTON_QUEUE_DEPTH) {
+        button_dropped++;
+    } else {
+        button_ring[button_head % HW_BUTTON_QUEUE_DEPTH] = ev;
+        __dmb();
+        button_head++;
+    }
+    event_post(EVENT_BUTTON);
+    return false;
+}
+
+/**
+ * @brief Settle alarm: re-sample buttons whose last edge fell inside the
+ * debounce window, so a release during it is not lost.
+ */
+static int64_t button_recheck_cb(alarm_id_t id, void *user_data)
+{
+    (void) id;
+    (void) user_data;
+
+    uint32_t irq = save_and_disable_interrupts();
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    bool again = false;
+    for (size_t i = 0; i < button_count; i++)
+        again |= button_sample(&buttons[i], now);
+    recheck_armed = again;
+    restore_interrupts(irq);
+
+    return again ? (int64_t) HW_BUTTON_DEBOUNCE_MS * 1000 : 0;
+}
+
+/**
+ * @brief GPIO IRQ: debounce the edge and queue press/release events.
+ */
+static void button_gpio_isr(uint gpio, uint32_t events)
+{
+    (void) events;
+
+    uint32_t irq = save_and_disable_interrupts();
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    bool bounced = false;
+    for (size_t i = 0; i < button_count; i++) {
+        if (buttons[i].pin == gpio)
+            bounced = button_sample(&buttons[i], now);
+    }
+    bool arm = bounced && !recheck_armed;
+    if (arm)
+        recheck_armed = true;
+    restore_interrupts(irq);
+
+    if (arm &&
+        add_alarm_in_ms(HW_BUTTON_DEBOUNCE_MS, button_recheck_cb, NULL,
+                        true) < 0)
+        recheck_armed = false;
+}
+
+/**
+ * @brief Configure button pins and enable both edge IRQs.
+ * @param pins Button GPIO pins (active low)
+ * @param count Number of pins (at most HW_BUTTON_MAX)
+ */
+void hw_buttons_init(const uint *pins, size_t count)
+{
+    if (count > HW_BUTTON_MAX)
+        count = HW_BUTTON_MAX;
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    button_head = 0;
+    button_tail = 0;
+    button_dropped = 0;
+    for (size_t i = 0; i < count; i++) {
+        gpio_init(pins[i]);
+        gpio_set_dir(pins[i], GPIO_IN);
+        gpio_pull_up(pins[i]);
+        buttons[i] = (hw_button_state_t) {
+            .pin = pins[i],
+            .down = !gpio_get(pins[i]),
+            .edge_ms = now,
+            .down_ms = now,
+        };
+    }
+    button_count = count;
+
+    uint32_t edges = GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0)
+            gpio_set_irq_enabled_with_callback(pins[i], edges, true,
+                                               button_gpio_isr);
+        else
+            gpio_set_irq_enabled(pins[i], edges, true);
+    }
+}
+
+/**
+ * @brief Pop the oldest button event.
+ * @param ev Receives the event
+ * @return true if an event was taken
+ */
+bool hw_button_event_get(hw_button_event_t *ev)
+{
+    if (button_head == button_tail)
+        return false;
+    __dmb();
+    *ev = button_ring[button_tail % HW_BUTTON_QUEUE_DEPTH];
+    __dmb();
+    button_tail++;
+    return true;
+}
+
+/**
+ * @brief Number of button events dropped on a full queue.
+ */
+uint32_t hw_buttons_dropped(void)
+{
+    return button_dropped;
+}
+
 /**
  * @brief Initialize SD card, mount filesystem.
  * @param fs FATFS pointer for mount
@@ -152,17 +398,23 @@ bool hw_button_pressed(button_t *btn)
 bool hw_sd_init(FATFS *fs)
 {
     if (!sd_init_driver()) {
-        printf("ERROR: Could not initialize SD card\n");
+        LOG_ERROR("ERROR: Could not initialize SD card\n");
         return false;
     }
 
     FRESULT fr = f_mount(fs, "0:", 1);
     if (fr != FR_OK) {
-        printf("ERROR: Failed to mount SD card: %d\n", fr);
+        LOG_ERROR("ERROR: Failed to mount SD card: %d\n", fr);
         return false;
     }
 
-    printf("SD card mounted successfully.\n");
+    // f_mount() initialized the card and negotiated its SPI clock
+    sd_card_t *sd = sd_get_by_num(0);
+    LOG_INFO("SD card mounted successfully (SPI %u kHz",
+           spi_get_baudrate(sd->spi->hw_inst) / 1000);
+    if (sd->rate_fallbacks)
+        LOG_INFO(", %u faster rate(s) rejected", sd->rate_fallbacks);
+    LOG_INFO(").\n");
     return true;
 }
 
@@ -183,146 +435,94 @@ bool hw_file_exists(const char *filename)
 }
 
 /**
- * @brief Play file transfer complete signal (triple beep with green LED
+ * @brief Queue file transfer complete signal (triple beep with green LED
  * flashes).
  *
  * Used for visual and audible feedback to indicate a file operation (like
- * download) has completed successfully.
+ * download) has completed successfully. Returns immediately; the pattern
+ * plays on the outputs given to feedback_init().
  *
- * @param pio PIO instance for WS2812 LED control.
- * @param sm State machine number for the PIO.
- * @param buzzer_pin GPIO pin connected to the buzzer.
+ * @param pio PIO instance for WS2812 LED control (unused).
+ * @param sm State machine number for the PIO (unused).
+ * @param buzzer_pin GPIO pin connected to the buzzer (unused).
  */
 void hw_play_file_complete_signal(PIO pio, int sm, int buzzer_pin)
 {
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 0, 0.5f));
-    hw_buzz(buzzer_pin, 1500, 60);
-    sleep_ms(70);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 0, 0.5f));
-    hw_buzz(buzzer_pin, 1500, 60);
-    sleep_ms(70);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 0, 0.5f));
-    hw_buzz(buzzer_pin, 1500, 150);
-    sleep_ms(80);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 10, 10, 0.1f));
+    (void) pio;
+    (void) sm;
+    (void) buzzer_pin;
+    feedback_play(FEEDBACK_FILE_COMPLETE);
 }
 
 /**
- * @brief Play string notification received signal (double beep, green LED
+ * @brief Queue string notification received signal (double beep, green LED
  * flashes).
  *
  * Provides feedback that a notification (such as button notification or
  * message) has been successfully received from the server.
  *
- * @param pio PIO instance for WS2812 LED control.
- * @param sm State machine number for the PIO.
- * @param buzzer_pin GPIO pin connected to the buzzer.
+ * @param pio PIO instance for WS2812 LED control (unused).
+ * @param sm State machine number for the PIO (unused).
+ * @param buzzer_pin GPIO pin connected to the buzzer (unused).
  */
 void hw_play_string_signal(PIO pio, int sm, int buzzer_pin)
 {
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 0, 0.5f));
-    hw_buzz(buzzer_pin, 1200, 60);
-    sleep_ms(80);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 0, 0, 0.1f));
-    sleep_ms(40);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 0, 0.5f));
-    hw_buzz(buzzer_pin, 1200, 60);
-    sleep_ms(80);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 10, 10, 0.1f));
+    (void) pio;
+    (void) sm;
+    (void) buzzer_pin;
+    feedback_play(FEEDBACK_STRING);
 }
 
 /**
- * @brief Play progress signal (FETCH operation) as cyan LED flash and beep
+ * @brief Queue progress signal (FETCH operation) as cyan LED flash and beep
  * sequence.
  *
  * Indicates progress or action during blockwise or FETCH operations.
  *
- * @param pio PIO instance for WS2812 LED control.
- * @param sm State machine number for the PIO.
- * @param buzzer_pin Buzzer GPIO pin.
+ * @param pio PIO instance for WS2812 LED control (unused).
+ * @param sm State machine number for the PIO (unused).
+ * @param buzzer_pin Buzzer GPIO pin (unused).
  */
 void hw_play_fetch_signal(PIO pio, int sm, int buzzer_pin)
 {
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 50, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 40);
-    sleep_ms(50);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 0, 0, 0.1f));
-    sleep_ms(30);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 50, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 40);
-    sleep_ms(50);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 0, 0, 0.1f));
-    sleep_ms(30);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 50, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 40);
-    sleep_ms(80);
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 10, 0, 0.1f));
+    (void) pio;
+    (void) sm;
+    (void) buzzer_pin;
+    feedback_play(FEEDBACK_FETCH);
 }
 
 /**
- * @brief Play iPATCH/APPEND success signal (double green beep and LED flashes).
+ * @brief Queue iPATCH/APPEND success signal (double green beep and LED
+ * flashes).
  *
  * Used when an append (iPATCH) operation to file is acknowledged or completes.
  *
- * @param pio PIO instance for LED control.
- * @param sm State machine index for LED.
- * @param buzzer_pin GPIO pin driving the buzzer.
+ * @param pio PIO instance for LED control (unused).
+ * @param sm State machine index for LED (unused).
+ * @param buzzer_pin GPIO pin driving the buzzer (unused).
  */
 void hw_play_append_success_signal(PIO pio, int sm, int buzzer_pin)
 {
-    // First blink
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 0, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 60);
-    sleep_ms(70);
-
-    // Off period
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 0, 0, 0.0f));
-    sleep_ms(30);
-
-    // Second blink
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 0, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 60);
-    sleep_ms(80);
-
-    // Return to idle
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 10, 10, 0.1f));
+    (void) pio;
+    (void) sm;
+    (void) buzzer_pin;
+    feedback_play(FEEDBACK_APPEND_SUCCESS);
 }
 
 /**
- * @brief Play FETCH success signal (triple cyan beep and LED flashes).
+ * @brief Queue FETCH success signal (triple cyan beep and LED flashes).
  *
  * Signals to the user that a FETCH request or file transfer completed
  * successfully.
  *
- * @param pio PIO instance for LED.
- * @param sm State machine number for LED.
- * @param buzzer_pin Buzzer pin number.
+ * @param pio PIO instance for LED (unused).
+ * @param sm State machine number for LED (unused).
+ * @param buzzer_pin Buzzer pin number (unused).
  */
 void hw_play_fetch_success_signal(PIO pio, int sm, int buzzer_pin)
 {
-    // First blink
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 50, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 40);
-    sleep_ms(50);
-
-    // Off period
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 0, 0, 0.0f));
-    sleep_ms(30);
-
-    // Second blink
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 50, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 40);
-    sleep_ms(50);
-
-    // Off period
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 0, 0, 0.0f));
-    sleep_ms(30);
-
-    // Third blink
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 50, 50, 0.5f));
-    hw_buzz(buzzer_pin, 1800, 40);
-    sleep_ms(80);
-
-    // Return to idle
-    ws2812_put_pixel(pio, sm, hw_urgb_u32(0, 10, 10, 0.1f));
+    (void) pio;
+    (void) sm;
+    (void) buzzer_pin;
+    feedback_play(FEEDBACK_FETCH_SUCCESS);
 }
@@ -3,37 +3,85 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "pico/stdlib.h"
 #include "ff.h"
 #include "hardware/pio.h"
 #include "ws2812.pio.h"
 #include "ws2812.h"
 
+// Configuration
+#define HW_BUTTON_MAX 4           // Pins handled by hw_buttons_init()
+#define HW_BUTTON_DEBOUNCE_MS 30  // Edges this soon after an accepted one bounce
+#define HW_BUTTON_LONG_MS 1000    // Held at least this long: long press
+#define HW_BUTTON_QUEUE_DEPTH 16  // Events waiting for the main loop
+
+// Button event kinds. Every press yields PRESS, then SHORT or LONG on
+// release.
+typedef enum {
+    HW_BUTTON_PRESS,  // Pressed (debounced falling edge)
+    HW_BUTTON_SHORT,  // Released before HW_BUTTON_LONG_MS
+    HW_BUTTON_LONG,   // Released after HW_BUTTON_LONG_MS or more
+} hw_button_kind_t;
+
+// Event queued by the button IRQ.
+typedef struct {
+    uint8_t pin;
+    uint8_t kind;      // hw_button_kind_t
+    uint32_t at_ms;    // Edge time (ms since boot)
+    uint32_t held_ms;  // Press duration (SHORT/LONG)
+} hw_button_event_t;
+
+// Debounce state of one IRQ-driven button.
+typedef struct {
+    uint pin;
+    bool down;
+    uint32_t edge_ms;  // Last accepted edge
+    uint32_t down_ms;  // Last accepted press
+} hw_button_state_t;
+
 // Structure representing a hardware button input.
 typedef struct {
     uint pin;         // GPIO pin number
     bool last_state;  // Previous state for edge detection
 } button_t;
 
-// Sets the RGB LED to the specified color and brightness.
+// Binds the WS2812 state machine to a DMA channel. LED writes before this
+// go to the PIO FIFO directly. Called by feedback_init().
+void hw_led_init(PIO pio, uint sm);
+
+// Sends a packed colour to the LED through DMA. Never blocks: a colour
+// still waiting for FIFO space is replaced by the newer one.
+void hw_led_put(uint32_t grb);
+
+// Sets the status colour: shown now, or once the playing feedback pattern
+// ends, and restored after every later pattern.
+void hw_led_status(uint32_t grb);
+
+// Queues a colour held for duration_ms before the status colour returns.
+// Returns false if dropped (another pattern is playing).
+bool hw_led_flash(uint32_t grb, uint32_t duration_ms);
+
+// Sets the status colour from RGB and brightness (see hw_led_status()).
 void hw_led_set_color(uint8_t r, uint8_t g, uint8_t b, float brightness);
 
-// Turns off the RGB LED.
+// Sets the status colour to off.
 void hw_led_off(void);
 
-// Blinks the RGB LED in the specified color for a duration in ms.
+// Queues a flash of the RGB colour for a duration in ms. Returns at once.
 void hw_led_blink(uint8_t r, uint8_t g, uint8_t b, uint32_t duration_ms);
 
 // Sounds the buzzer on the specified pin at a given frequency and duration.
+// Non-blocking once feedback_init() owns the pin.
 void hw_buzz(uint pin, uint frequency, uint duration_ms);
 
-// Visual and audio feedback for operation success (e.g., file written).
+// Queues visual/audio feedback for operation success (e.g., file written).
 void hw_signal_success(void);
 
-// Visual and audio feedback for error condition.
+// Queues visual and audio feedback for error condition.
 void hw_signal_error(void);
 
-// Visual and audio feedback for progress (e.g., block transferred).
+// Queues visual and audio feedback for progress (e.g., block transferred).
 void hw_signal_progress(void);
 
 // Initializes a button state structure and hardware pin.
@@ -42,6 +90,23 @@ void hw_button_init(button_t *btn, uint pin);
 // Checks if button is pressed (with debouncing).
 bool hw_button_pressed(button_t *btn);
 
+// Applies a sampled level to a button: returns true and fills ev if it is
+// a debounced edge (a change at least HW_BUTTON_DEBOUNCE_MS after the last
+// accepted one). Used by the button IRQ; pure, so it can be tested.
+bool hw_button_edge(hw_button_state_t *b, bool down, uint32_t now_ms,
+                    hw_button_event_t *ev);
+
+// Configures pins as pulled-up inputs with edge IRQs (at most
+// HW_BUTTON_MAX). Debouncing and press classification run in the IRQ; each
+// event is queued and posts EVENT_BUTTON. Call after event_loop_init().
+void hw_buttons_init(const uint *pins, size_t count);
+
+// Takes the oldest queued button event. Returns false when empty.
+bool hw_button_event_get(hw_button_event_t *ev);
+
+// Events lost because the queue was full.
+uint32_t hw_buttons_dropped(void);
+
 // Mounts the SD card and initializes the FATFS.
 bool hw_sd_init(FATFS *fs);
 
@@ -51,19 +116,20 @@ bool hw_file_exists(const char *filename);
 // Constructs a 32-bit WS2812 RGB color value.
 uint32_t hw_urgb_u32(uint8_t r, uint8_t g, uint8_t b, float brightness);
 
-// Shows a triple-beep/LED flash for file transfer complete.
+// Queues a triple-beep/LED flash for file transfer complete.
+// The hw_play_*() signals return immediately (see cs04_feedback.h).
 void hw_play_file_complete_signal(PIO pio, int sm, int buzzer_pin);
 
-// Double-beep/flash signal for receiving string notifications.
+// Queues a double-beep/flash signal for receiving string notifications.
 void hw_play_string_signal(PIO pio, int sm, int buzzer_pin);
 
-// Beep/cyan LED pattern for a FETCH transfer event.
+// Queues a beep/cyan LED pattern for a FETCH transfer event.
 void hw_play_fetch_signal(PIO pio, int sm, int buzzer_pin);
 
-// Double-beep/green LED pattern for iPATCH append event.
+// Queues a double-beep/green LED pattern for iPATCH append event.
 void hw_play_append_success_signal(PIO pio, int sm, int buzzer_pin);
 
-// Triple-beep/LED flash for FETCH completion.
+// Queues a triple-beep/LED flash for FETCH completion.
 void hw_play_fetch_success_signal(PIO pio, int sm, int buzzer_pin);
 
 #endif  // CS04_HARDWARE_H
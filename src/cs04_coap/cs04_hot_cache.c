@@ -0,0 +1,299 @@
+#include "cs04_hot_cache.h"
+#include <string.h>
+#include <stdio.h>
+
+static hot_cache_file_t hot_files[HOT_CACHE_FILES];
+static hot_cache_unit_t hot_units[HOT_CACHE_UNITS];
+static hot_cache_stats_t hot_stats;
+static uint32_t hot_stamp;
+
+/**
+ * @brief Find a file's record, optionally taking a slot for it.
+ * @param filename File
+ * @param create Take a free (or the first) slot if the file has none
+ * @return Index into hot_files, or -1
+ */
+static int file_find(const char *filename, bool create)
+{
+    int free_slot = -1;
+    for (int i = 0; i < HOT_CACHE_FILES; i++) {
+        if (hot_files[i].valid &&
+            strncmp(hot_files[i].filename, filename, HOT_CACHE_NAME_LEN) == 0)
+            return i;
+        if (!hot_files[i].valid && free_slot < 0)
+            free_slot = i;
+    }
+    if (!create)
+        return -1;
+
+    if (free_slot < 0) {
+        free_slot = 0;
+        hot_cache_invalidate(hot_files[0].filename);
+    }
+    strncpy(hot_files[free_slot].filename, filename, HOT_CACHE_NAME_LEN - 1);
+    hot_files[free_slot].filename[HOT_CACHE_NAME_LEN - 1] = '\0';
+    return free_slot;
+}
+
+/**
+ * @brief Find a cached block of a file.
+ */
+static hot_cache_unit_t *unit_find(int file, uint32_t unit)
+{
+    for (int i = 0; i < HOT_CACHE_UNITS; i++) {
+        if (hot_units[i].valid && hot_units[i].file == file &&
+            hot_units[i].unit == unit)
+            return &hot_units[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Pick the block to replace: a free one, else the least recently used.
+ */
+static hot_cache_unit_t *unit_victim(void)
+{
+    hot_cache_unit_t *victim = &hot_units[0];
+    for (int i = 0; i < HOT_CACHE_UNITS; i++) {
+        if (!hot_units[i].valid)
+            return &hot_units[i];
+        if (hot_units[i].stamp < victim->stamp)
+            victim = &hot_units[i];
+    }
+    hot_stats.evictions++;
+    return victim;
+}
+
+/**
+ * @brief Make blocks first..last of a file resident, opening it at most once.
+ *
+ * Blocks already cached are only touched, and the read counts as a hit. The
+ * file fits in HOT_CACHE_UNITS, so a block loaded here is never the victim
+ * of a later one in the range.
+ *
+ * @param file Index into hot_files
+ * @param first First block
+ * @param last Last block (inclusive)
+ * @return FATFS result of the open/seek/read
+ */
+static FRESULT units_load(int file, uint32_t first, uint32_t last)
+{
+    FIL fil;
+    bool opened = false;
+    FRESULT res = FR_OK;
+
+    for (uint32_t u = first; u <= last && res == FR_OK; u++) {
+        hot_cache_unit_t *slot = unit_find(file, u);
+        if (slot) {
+            slot->stamp = ++hot_stamp;
+            continue;
+        }
+
+        if (!opened) {
+            res = f_open(&fil, hot_files[file].filename, FA_READ);
+            if (res != FR_OK)
+                break;
+            opened = true;
+        }
+
+        slot = unit_victim();
+        slot->valid = false;
+        UINT bytes_read = 0;
+        res = f_lseek(&fil, (FSIZE_t) u * HOT_CACHE_UNIT);
+        if (res == FR_OK)
+            res = f_read(&fil, slot->data, HOT_CACHE_UNIT, &bytes_read);
+        if (res != FR_OK)
+            break;
+
+        slot->file = (uint8_t) file;
+        slot->unit = u;
+        slot->len = (uint16_t) bytes_read;
+        slot->stamp = ++hot_stamp;
+        slot->valid = true;
+        hot_stats.loads++;
+    }
+
+    if (opened) {
+        f_close(&fil);
+        hot_stats.misses++;
+    } else {
+        hot_stats.hits++;
+    }
+    return res;
+}
+
+/**
+ * @brief Reset the cache and counters.
+ */
+void hot_cache_init(void)
+{
+    memset(hot_files, 0, sizeof(hot_files));
+    memset(hot_units, 0, sizeof(hot_units));
+    memset(&hot_stats, 0, sizeof(hot_stats));
+    hot_stamp = 0;
+}
+
+/**
+ * @brief Check whether a file is small enough to be served from RAM.
+ *
+ * The size is stat'ed once and remembered until the file is invalidated,
+ * so repeated requests for a cached file do not touch FATFS at all.
+ *
+ * @param filename File
+ * @param size Output: file size
+ * @return FR_OK if cacheable, FR_DENIED if over HOT_CACHE_FILE_MAX, or the
+ *         f_stat error
+ */
+FRESULT hot_cache_stat(const char *filename, FSIZE_t *size)
+{
+    int file = file_find(filename, false);
+    if (file < 0) {
+        FILINFO fno;
+        FRESULT res = f_stat(filename, &fno);
+        if (res != FR_OK)
+            return res;
+        file = file_find(filename, true);
+        hot_files[file].size = fno.fsize;
+        hot_files[file].valid = true;
+    }
+
+    *size = hot_files[file].size;
+    return (*size <= HOT_CACHE_FILE_MAX) ? FR_OK : FR_DENIED;
+}
+
+/**
+ * @brief Read a byte range of a small file from RAM.
+ * @param filename File
+ * @param offset First byte
+ * @param buf Destination
+ * @param len Bytes wanted
+ * @param bytes_read Output: bytes copied (short at end of file)
+ * @param file_size Output: file size
+ * @return FR_OK, FR_DENIED if the file is not cacheable, or a FATFS error
+ *         from loading a missing block
+ */
+FRESULT hot_cache_read(const char *filename, FSIZE_t offset, uint8_t *buf,
+                       UINT len, UINT *bytes_read, FSIZE_t *file_size)
+{
+    *bytes_read = 0;
+    FRESULT res = hot_cache_stat(filename, file_size);
+    if (res == FR_DENIED)
+        hot_stats.bypasses++;
+    if (res != FR_OK)
+        return res;
+
+    FSIZE_t end = offset + len;
+    if (end > *file_size)
+        end = *file_size;
+    if (offset >= end) {
+        hot_stats.hits++;
+        return FR_OK;
+    }
+
+    int file = file_find(filename, false);
+    res = units_load(file, (uint32_t) (offset / HOT_CACHE_UNIT),
+                     (uint32_t) ((end - 1) / HOT_CACHE_UNIT));
+    if (res != FR_OK)
+        return res;
+
+    while (offset < end) {
+        const hot_cache_unit_t *slot = unit_find(file,
+                                                 (uint32_t) (offset /
+                                                             HOT_CACHE_UNIT));
+        UINT at = (UINT) (offset % HOT_CACHE_UNIT);
+        if (!slot || at >= slot->len)
+            break;  // File shorter than its recorded size
+        UINT n = slot->len - at;
+        if (n > end - offset)
+            n = (UINT) (end - offset);
+        memcpy(&buf[*bytes_read], &slot->data[at], n);
+        *bytes_read += n;
+        offset += n;
+    }
+    return FR_OK;
+}
+
+/**
+ * @brief Find the byte offset of a line in a cached file.
+ *
+ * Counts newlines the way the FETCH handler's f_gets loop does: an
+ * unterminated last line still counts as a line.
+ *
+ * @param filename File
+ * @param line Line to find (0-based)
+ * @param offset Output: offset of that line (file size if the file ends)
+ * @param found Output: line reached, less than line past the end
+ * @return FR_OK, FR_DENIED if the file is not cacheable, or a FATFS error
+ */
+FRESULT hot_cache_find_line(const char *filename, uint32_t line,
+                            FSIZE_t *offset, uint32_t *found)
+{
+    FSIZE_t size;
+    FRESULT res = hot_cache_stat(filename, &size);
+    if (res == FR_DENIED)
+        hot_stats.bypasses++;
+    if (res != FR_OK)
+        return res;
+
+    *offset = 0;
+    *found = 0;
+    if (line == 0 || size == 0)
+        return FR_OK;
+
+    int file = file_find(filename, false);
+    res = units_load(file, 0, (uint32_t) ((size - 1) / HOT_CACHE_UNIT));
+    if (res != FR_OK)
+        return res;
+
+    FSIZE_t pos = 0;
+    FSIZE_t line_start = 0;
+    while (pos < size) {
+        const hot_cache_unit_t *slot = unit_find(file,
+                                                 (uint32_t) (pos /
+                                                             HOT_CACHE_UNIT));
+        if (!slot || slot->len == 0)
+            break;
+        for (UINT i = 0; i < slot->len; i++) {
+            pos++;
+            if (slot->data[i] != '\n')
+                continue;
+            line_start = pos;
+            if (++*found == line) {
+                *offset = pos;
+                return FR_OK;
+            }
+        }
+        if (slot->len < HOT_CACHE_UNIT)
+            break;
+    }
+
+    // Bytes after the last newline form one more (unterminated) line
+    if (pos > line_start && ++*found == line)
+        *offset = pos;
+    return FR_OK;
+}
+
+/**
+ * @brief Drop everything cached for a file.
+ * @param filename File being written
+ */
+void hot_cache_invalidate(const char *filename)
+{
+    int file = file_find(filename, false);
+    if (file < 0)
+        return;
+    for (int i = 0; i < HOT_CACHE_UNITS; i++) {
+        if (hot_units[i].file == file)
+            hot_units[i].valid = false;
+    }
+    hot_files[file].valid = false;
+}
+
+/**
+ * @brief Get the hot cache counters.
+ * @return Pointer to the counters
+ */
+const hot_cache_stats_t *hot_cache_get_stats(void)
+{
+    return &hot_stats;
+}
@@ -0,0 +1,69 @@
+#ifndef CS04_HOT_CACHE_H
+#define CS04_HOT_CACHE_H
+
+#include "ff.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define HOT_CACHE_UNIT 1024        // Bytes per cached block
+#define HOT_CACHE_UNITS 8          // Blocks held in RAM (8 KiB)
+#define HOT_CACHE_FILES 2          // Files whose size is remembered
+#define HOT_CACHE_FILE_MAX 8192    // Largest file served from RAM
+#define HOT_CACHE_NAME_LEN 32
+
+#if HOT_CACHE_FILE_MAX > HOT_CACHE_UNITS * HOT_CACHE_UNIT
+#error "HOT_CACHE_FILE_MAX must fit in HOT_CACHE_UNITS blocks"
+#endif
+
+// Size of a file as last seen on the card. Files over HOT_CACHE_FILE_MAX
+// are remembered too, so they are not stat'ed on every request.
+typedef struct {
+    bool valid;                         // True if size is current
+    char filename[HOT_CACHE_NAME_LEN];  // File
+    FSIZE_t size;                       // File size in bytes
+} hot_cache_file_t;
+
+// One HOT_CACHE_UNIT-aligned block of a small file.
+typedef struct {
+    bool valid;                   // True if data holds the block
+    uint8_t file;                 // Index into the file table
+    uint32_t unit;                // Block number (offset / HOT_CACHE_UNIT)
+    uint16_t len;                 // Valid bytes (short for the last block)
+    uint32_t stamp;               // Last use, for LRU replacement
+    uint8_t data[HOT_CACHE_UNIT];
+} hot_cache_unit_t;
+
+// Hot cache counters.
+typedef struct {
+    uint32_t hits;       // Reads answered from RAM
+    uint32_t misses;     // Reads that loaded blocks from the card
+    uint32_t loads;      // Blocks read from the card
+    uint32_t evictions;  // Valid blocks replaced (LRU)
+    uint32_t bypasses;   // Reads of files over HOT_CACHE_FILE_MAX
+} hot_cache_stats_t;
+
+// Clears the cache and counters.
+void hot_cache_init(void);
+
+// Returns FR_OK and the size if filename can be served from RAM, FR_DENIED
+// if it is larger than HOT_CACHE_FILE_MAX, or the f_stat error.
+FRESULT hot_cache_stat(const char *filename, FSIZE_t *size);
+
+// Copies up to len bytes at offset into buf, loading missing blocks from
+// the card. FR_DENIED if the file is too large to cache.
+FRESULT hot_cache_read(const char *filename, FSIZE_t offset, uint8_t *buf,
+                       UINT len, UINT *bytes_read, FSIZE_t *file_size);
+
+// Finds the start of a line by scanning the cached file. *found is the line
+// reached, less than line if the file ends first.
+FRESULT hot_cache_find_line(const char *filename, uint32_t line,
+                            FSIZE_t *offset, uint32_t *found);
+
+// Drops a file's blocks and size (it is being written).
+void hot_cache_invalidate(const char *filename);
+
+// Returns the hot cache counters.
+const hot_cache_stats_t *hot_cache_get_stats(void);
+
+#endif  // CS04_HOT_CACHE_H
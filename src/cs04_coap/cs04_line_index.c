@@ -0,0 +1,212 @@
+#include "cs04_line_index.h"
+#include "cs04_log.h"
+#include <string.h>
+#include <stdio.h>
+
+static line_index_t line_index;
+static line_index_stats_t line_index_stats;
+
+/**
+ * @brief Check that the index is valid and describes filename.
+ */
+static bool index_matches(const char *filename)
+{
+    return line_index.valid &&
+           strncmp(line_index.filename, filename, LINE_INDEX_NAME_LEN) == 0;
+}
+
+/**
+ * @brief Record the start offset of a line if it falls on the stride.
+ *
+ * When the table is full every other entry is dropped and the stride
+ * doubles, so memory stays fixed and a seek never skips more than
+ * stride - 1 lines with f_gets().
+ *
+ * @param line Line number that starts at offset
+ * @param offset Byte offset of the first character of the line
+ */
+static void index_line_start(uint32_t line, FSIZE_t offset)
+{
+    if (line % line_index.stride)
+        return;
+
+    if (line_index.count == LINE_INDEX_MAX_ENTRIES) {
+        for (uint16_t i = 0; i < LINE_INDEX_MAX_ENTRIES / 2; i++) {
+            line_index.offsets[i] = line_index.offsets[i * 2];
+        }
+        line_index.count = LINE_INDEX_MAX_ENTRIES / 2;
+        line_index.stride *= 2;
+        if (line % line_index.stride)
+            return;
+    }
+
+    line_index.offsets[line_index.count++] = offset;
+}
+
+/**
+ * @brief Feed file bytes starting at the current indexed size.
+ * @param data Bytes as stored in the file
+ * @param len Number of bytes
+ */
+static void index_scan(const uint8_t *data, UINT len)
+{
+    for (UINT i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            line_index.newlines++;
+            index_line_start(line_index.newlines,
+                             line_index.indexed_size + i + 1);
+        }
+    }
+    line_index.indexed_size += len;
+}
+
+/**
+ * @brief Clear the index and reset counters.
+ */
+void line_index_init(void)
+{
+    memset(&line_index, 0, sizeof(line_index));
+    memset(&line_index_stats, 0, sizeof(line_index_stats));
+}
+
+/**
+ * @brief Start an empty, valid index for a file of size 0.
+ * @param filename Indexed file
+ */
+void line_index_reset(const char *filename)
+{
+    line_index.valid = true;
+    strncpy(line_index.filename, filename, LINE_INDEX_NAME_LEN - 1);
+    line_index.filename[LINE_INDEX_NAME_LEN - 1] = '\0';
+    line_index.indexed_size = 0;
+    line_index.newlines = 0;
+    line_index.stride = LINE_INDEX_STRIDE;
+    line_index.count = 1;
+    line_index.offsets[0] = 0;  // Line 0 always starts at offset 0
+}
+
+/**
+ * @brief Rebuild the index by scanning the whole file once.
+ * @param fil Open file (position is restored to 0 on return)
+ * @param filename Name the file was opened under
+ * @return FATFS result of the scan
+ */
+FRESULT line_index_build(FIL *fil, const char *filename)
+{
+    uint8_t chunk[256];
+    UINT bytes_read = 0;
+
+    line_index_reset(filename);
+    line_index_stats.rebuilds++;
+
+    FRESULT res = f_lseek(fil, 0);
+    while (res == FR_OK) {
+        res = f_read(fil, chunk, sizeof(chunk), &bytes_read);
+        if (res != FR_OK || bytes_read == 0)
+            break;
+        index_scan(chunk, bytes_read);
+    }
+
+    if (res != FR_OK) {
+        line_index.valid = false;
+        return res;
+    }
+
+    LOG_DEBUG("📑 Line index built for %s: %lu lines, stride %lu\n", filename,
+           (unsigned long) line_index.newlines,
+           (unsigned long) line_index.stride);
+    return f_lseek(fil, 0);
+}
+
+/**
+ * @brief Update the index with data appended to the file.
+ * @param filename File that was appended to
+ * @param offset File offset the data was written at
+ * @param data Appended bytes
+ * @param len Number of bytes
+ * @return true if the index was extended, false if it was out of sync
+ */
+bool line_index_append(const char *filename, FSIZE_t offset, const void *data,
+                       UINT len)
+{
+    if (!index_matches(filename))
+        return false;
+
+    if (offset != line_index.indexed_size) {
+        line_index.valid = false;
+        return false;
+    }
+
+    index_scan((const uint8_t *) data, len);
+    line_index_stats.appends++;
+    return true;
+}
+
+/**
+ * @brief Find the closest indexed line at or before a line.
+ * @param filename Indexed file
+ * @param line Wanted line number
+ * @param entry_line Output: indexed line number
+ * @param offset Output: byte offset of entry_line
+ * @return false if the index is not valid for filename
+ */
+bool line_index_lookup(const char *filename, uint32_t line,
+                       uint32_t *entry_line, FSIZE_t *offset)
+{
+    if (!index_matches(filename))
+        return false;
+
+    uint32_t entry = line / line_index.stride;
+    if (entry >= line_index.count)
+        entry = line_index.count - 1;
+
+    *entry_line = entry * line_index.stride;
+    *offset = line_index.offsets[entry];
+    return true;
+}
+
+/**
+ * @brief Position a file at (or just before) a line using the index.
+ *
+ * The index is rebuilt if it is missing or its size no longer matches the
+ * file, e.g. after a write that bypassed line_index_append().
+ *
+ * @param fil Open file on filename
+ * @param filename Name the file was opened under
+ * @param line Wanted line number
+ * @param current_line Output: line the file is positioned at
+ * @return FATFS result
+ */
+FRESULT line_index_seek(FIL *fil, const char *filename, uint32_t line,
+                        uint32_t *current_line)
+{
+    *current_line = 0;
+
+    if (!index_matches(filename) || line_index.indexed_size != f_size(fil)) {
+        FRESULT res = line_index_build(fil, filename);
+        if (res != FR_OK)
+            return res;
+    }
+
+    FSIZE_t offset = 0;
+    line_index_lookup(filename, line, current_line, &offset);
+    line_index_stats.seeks++;
+    return f_lseek(fil, offset);
+}
+
+/**
+ * @brief Mark the index stale.
+ */
+void line_index_invalidate(void)
+{
+    line_index.valid = false;
+}
+
+/**
+ * @brief Get line index counters.
+ * @return Pointer to the live counters
+ */
+const line_index_stats_t *line_index_get_stats(void)
+{
+    return &line_index_stats;
+}
@@ -0,0 +1,60 @@
+#ifndef CS04_LINE_INDEX_H
+#define CS04_LINE_INDEX_H
+
+#include "ff.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define LINE_INDEX_STRIDE 16         // Initial lines between index entries
+#define LINE_INDEX_MAX_ENTRIES 256   // Entries kept; stride doubles when full
+#define LINE_INDEX_NAME_LEN 32
+
+// Sparse in-RAM index: offsets[i] is the byte offset of line i * stride.
+typedef struct {
+    bool valid;                          // True if offsets match the file
+    char filename[LINE_INDEX_NAME_LEN];  // Indexed file
+    FSIZE_t indexed_size;                // File size covered by the index
+    uint32_t newlines;                   // '\n' count (last line number)
+    uint32_t stride;                     // Lines per entry (power of 2)
+    uint16_t count;                      // Entries in use
+    FSIZE_t offsets[LINE_INDEX_MAX_ENTRIES];
+} line_index_t;
+
+// Line index counters.
+typedef struct {
+    uint32_t rebuilds;  // Full scans of the file
+    uint32_t appends;   // Incremental updates from iPATCH
+    uint32_t seeks;     // FETCH requests positioned through the index
+} line_index_stats_t;
+
+// Clears the index and counters.
+void line_index_init(void);
+
+// Starts an empty index for filename (size 0), as if just built.
+void line_index_reset(const char *filename);
+
+// Scans an open file from the start and rebuilds the index.
+FRESULT line_index_build(FIL *fil, const char *filename);
+
+// Extends the index with bytes appended at offset (must equal indexed size).
+// Returns false and invalidates the index if it was not in sync.
+bool line_index_append(const char *filename, FSIZE_t offset, const void *data,
+                       UINT len);
+
+// Returns the nearest indexed line <= line and its byte offset.
+bool line_index_lookup(const char *filename, uint32_t line,
+                       uint32_t *entry_line, FSIZE_t *offset);
+
+// Seeks fil to the nearest indexed line <= line, rebuilding if stale.
+// *current_line receives the line the file is now positioned at.
+FRESULT line_index_seek(FIL *fil, const char *filename, uint32_t line,
+                        uint32_t *current_line);
+
+// Marks the index stale so the next seek rebuilds it.
+void line_index_invalidate(void);
+
+// Returns the line index counters.
+const line_index_stats_t *line_index_get_stats(void);
+
+#endif  // CS04_LINE_INDEX_H
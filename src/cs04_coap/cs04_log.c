@@ -0,0 +1,68 @@
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+// Single-producer/single-consumer ring: the owning core writes head, the
+// draining core writes tail, and the barriers order entries against them.
+typedef struct {
+    log_entry_t entries[LOG_RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;
+} log_ring_t;
+
+static log_ring_t rings[LOG_CORES];
+
+/**
+ * @brief Queue a message for log_drain().
+ * @param fmt Format string (string literal)
+ * @param a First argument
+ * @param b Second argument
+ */
+void log_defer(const char *fmt, uint32_t a, uint32_t b)
+{
+    log_ring_t *r = &rings[get_core_num() & (LOG_CORES - 1)];
+    if (r->head - r->tail >= LOG_RING_SIZE) {
+        r->dropped++;
+        return;
+    }
+
+    log_entry_t *e = &r->entries[r->head & LOG_RING_MASK];
+    e->fmt = fmt;
+    e->a = a;
+    e->b = b;
+    __dmb();  // Entry before the index
+    r->head++;
+}
+
+/**
+ * @brief Print queued messages.
+ * @param max Most messages to print in this call
+ * @return Messages printed
+ */
+size_t log_drain(size_t max)
+{
+    size_t printed = 0;
+    for (int c = 0; c < LOG_CORES; c++) {
+        log_ring_t *r = &rings[c];
+        while (printed < max && r->tail != r->head) {
+            __dmb();  // Index before the entry it covers
+            log_entry_t e = r->entries[r->tail & LOG_RING_MASK];
+            __dmb();  // Entry copied before the slot is released
+            r->tail++;
+            printf(e.fmt, e.a, e.b);
+            printed++;
+        }
+    }
+    return printed;
+}
+
+/**
+ * @brief Messages dropped on a full ring (both cores).
+ */
+uint32_t log_dropped(void)
+{
+    return rings[0].dropped + rings[1].dropped;
+}
@@ -0,0 +1,90 @@
+#ifndef CS04_LOG_H
+#define CS04_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Log levels. CS04_LOG_LEVEL is set per target by CMake; messages above it
+// are compiled out along with their format strings and arguments.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1  // ✗ Failures
+#define LOG_LEVEL_WARN 2   // ⚠️ Recoverable problems (duplicates, drops)
+#define LOG_LEVEL_INFO 3   // Startup, configuration, completed operations
+#define LOG_LEVEL_DEBUG 4  // Per-packet and per-block detail
+
+#ifndef CS04_LOG_LEVEL
+#define CS04_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Configuration
+#define LOG_RING_SIZE 64  // Deferred entries kept per core (power of 2)
+#define LOG_CORES 2
+
+// A disabled level keeps its arguments type-checked (and their variables
+// used) without generating any code.
+#define LOG_DISCARD(...)                                                     \
+    do {                                                                     \
+        if (0)                                                               \
+            printf(__VA_ARGS__);                                             \
+    } while (0)
+
+#if CS04_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if CS04_LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) printf(__VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if CS04_LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) printf(__VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if CS04_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) printf(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+
+// Debug message on the packet path with at most two integer arguments.
+// With CS04_LOG_DEFERRED the format pointer and arguments go into a RAM
+// ring and are printed later by log_drain(), outside the packet path.
+// fmt must be a string literal; %s arguments are not allowed, since the
+// string may be gone by the time the ring is drained.
+#if CS04_LOG_LEVEL < LOG_LEVEL_DEBUG
+#define LOG_DEFER(...) LOG_DISCARD(__VA_ARGS__)
+#elif CS04_LOG_DEFERRED
+#define LOG_DEFER(...) LOG_DEFER_(__VA_ARGS__, 0, 0)
+#define LOG_DEFER_(fmt, a, b, ...)                                           \
+    log_defer((fmt), (uint32_t) (a), (uint32_t) (b))
+#else
+#define LOG_DEFER(...) printf(__VA_ARGS__)
+#endif
+
+// One deferred message.
+typedef struct {
+    const char *fmt;  // String literal with up to two integer conversions
+    uint32_t a;
+    uint32_t b;
+} log_entry_t;
+
+// Queues a message on the calling core's ring. Lock-free: each core writes
+// only its own ring. A full ring drops the message and counts it.
+void log_defer(const char *fmt, uint32_t a, uint32_t b);
+
+// Prints up to max deferred messages, oldest first per core. Call from the
+// main loop when idle. Returns the number printed.
+size_t log_drain(size_t max);
+
+// Deferred messages dropped because a ring was full.
+uint32_t log_dropped(void);
+
+#endif  // CS04_LOG_H
@@ -0,0 +1,161 @@
+#include "cs04_metrics.h"
+#include "cs04_packet_pool.h"
+#include "cs04_coap_reliability.h"
+#include "cs04_radio.h"
+#include "cs04_boot.h"
+#include "pico/stdlib.h"
+#include "lwip/opt.h"
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+#include "sd_card.h"
+#include "hw_config.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+static const char *const pool_names[PACKET_POOL_CLASSES] = {
+    [PACKET_POOL_SMALL] = "small", [PACKET_POOL_MEDIUM] = "medium",
+    [PACKET_POOL_BLOCK] = "block", [PACKET_POOL_BERT] = "bert",
+};
+
+/**
+ * @brief Add one duration to a latency summary.
+ * @param m Summary
+ * @param us Duration in microseconds
+ */
+void metrics_latency_add(metrics_latency_t *m, uint32_t us)
+{
+    m->count++;
+    m->total_us += us;
+    if (us > m->max_us)
+        m->max_us = us;
+}
+
+/**
+ * @brief Start an empty report.
+ * @param w Writer
+ * @param buf Output buffer
+ * @param cap Buffer size
+ */
+void metrics_begin(metrics_writer_t *w, char *buf, size_t cap)
+{
+    w->buf = buf;
+    w->cap = cap;
+    w->len = 0;
+    w->truncated = false;
+    if (cap > 0)
+        buf[0] = '\0';
+}
+
+/**
+ * @brief Append one formatted line, or nothing if it does not fit.
+ * @param w Writer
+ * @param fmt printf format
+ * @return true if the line was appended
+ */
+bool metrics_line(metrics_writer_t *w, const char *fmt, ...)
+{
+    if (w->truncated || w->len >= w->cap)
+        return false;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(&w->buf[w->len], w->cap - w->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t) n >= w->cap - w->len) {
+        w->buf[w->len] = '\0';  // Drop the partial line
+        w->truncated = true;
+        return false;
+    }
+    w->len += (size_t) n;
+    return true;
+}
+
+/**
+ * @brief Append a latency summary line.
+ * @param w Writer
+ * @param name Line name
+ * @param m Summary
+ * @return true if the line was appended
+ */
+bool metrics_put_latency(metrics_writer_t *w, const char *name,
+                         const metrics_latency_t *m)
+{
+    return metrics_line(w, "%s n=%lu avg=%lu max=%lu\n", name,
+                        (unsigned long) m->count,
+                        (unsigned long) (m->count ? m->total_us / m->count : 0),
+                        (unsigned long) m->max_us);
+}
+
+/**
+ * @brief Append the pool, lwIP and retransmission counters.
+ * @param w Writer
+ */
+void metrics_put_common(metrics_writer_t *w)
+{
+    packet_pool_stats_t pool;
+    packet_pool_get_stats(&pool);
+    for (int c = 0; c < PACKET_POOL_CLASSES; c++) {
+        const packet_pool_class_stats_t *cls = &pool.cls[c];
+        metrics_line(w, "pool %s in_use=%u/%u hw=%u allocs=%lu exhausted=%lu\n",
+                     pool_names[c], cls->in_use, cls->count, cls->high_water,
+                     (unsigned long) cls->allocs,
+                     (unsigned long) cls->exhausted);
+    }
+    metrics_line(w, "pool bytes=%u hw=%u heap_fallbacks=%lu\n",
+                 (unsigned) pool.bytes_in_use, (unsigned) pool.bytes_high_water,
+                 (unsigned long) pool.heap_fallbacks);
+
+#if LWIP_STATS && MEMP_STATS
+    const struct stats_mem *pbufs = lwip_stats.memp[MEMP_PBUF_POOL];
+    metrics_line(w, "lwip pbuf_pool used=%u/%u max=%u err=%u\n",
+                 (unsigned) pbufs->used, (unsigned) pbufs->avail,
+                 (unsigned) pbufs->max, (unsigned) pbufs->err);
+#endif
+#if LWIP_STATS && MEM_STATS
+    metrics_line(w, "lwip heap used=%u/%u max=%u err=%u\n",
+                 (unsigned) lwip_stats.mem.used, (unsigned) lwip_stats.mem.avail,
+                 (unsigned) lwip_stats.mem.max, (unsigned) lwip_stats.mem.err);
+#endif
+
+    const sd_card_t *sd = sd_get_by_num(0);
+    if (sd)
+        metrics_line(w,
+                     "sd reads=%lu read_sectors=%lu writes=%lu "
+                     "write_sectors=%lu\n",
+                     (unsigned long) sd->read_cmds,
+                     (unsigned long) sd->read_sectors,
+                     (unsigned long) sd->write_cmds,
+                     (unsigned long) sd->write_sectors);
+
+    const coap_reliability_stats_t *rel = coap_reliability_get_stats();
+    metrics_line(w,
+                 "coap pending=%u/%u hw=%u stored=%lu queued=%lu "
+                 "retransmits=%lu timeouts=%lu acked=%lu full=%lu "
+                 "no_mem=%lu\n",
+                 coap_pending_count(), MAX_PENDING_MESSAGES, rel->high_water,
+                 (unsigned long) rel->stored, (unsigned long) rel->queued,
+                 (unsigned long) rel->retransmits,
+                 (unsigned long) rel->timeouts, (unsigned long) rel->acked,
+                 (unsigned long) rel->table_full,
+                 (unsigned long) rel->no_memory);
+
+    const radio_stats_t *radio = radio_get_stats();
+    metrics_line(w,
+                 "radio rssi=%ld link=%u power_save=%u pm_switches=%lu "
+                 "samples=%lu deferred=%lu\n",
+                 (long) radio->rssi_dbm, (unsigned) radio->link,
+                 (unsigned) radio->power_save,
+                 (unsigned long) radio->pm_switches,
+                 (unsigned long) radio->rssi_samples,
+                 (unsigned long) radio->deferred);
+
+    const boot_stats_t *boot = boot_get_stats();
+    metrics_line(w,
+                 "boot storage_ms=%lu link_ms=%lu first_response_ms=%lu "
+                 "wifi_attempts=%lu\n",
+                 (unsigned long) boot->storage_ready_ms,
+                 (unsigned long) boot->link_up_ms,
+                 (unsigned long) boot->first_response_ms,
+                 (unsigned long) boot->wifi_attempts);
+}
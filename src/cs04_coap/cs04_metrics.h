@@ -0,0 +1,48 @@
+#ifndef CS04_METRICS_H
+#define CS04_METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define METRICS_REPORT_MAX 1024  // Largest report (one Block2-sized payload)
+#define METRICS_DUMP_MS 60000    // Client: period of the console dump
+
+// Durations of one kind of operation.
+typedef struct {
+    uint32_t count;
+    uint32_t total_us;
+    uint32_t max_us;
+} metrics_latency_t;
+
+// Report being written. Lines are kept whole: one that does not fit is left
+// out and marks the report truncated.
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+    bool truncated;
+} metrics_writer_t;
+
+// Adds one duration.
+void metrics_latency_add(metrics_latency_t *m, uint32_t us);
+
+// Starts a report in buf (cap bytes, NUL-terminated as it grows).
+void metrics_begin(metrics_writer_t *w, char *buf, size_t cap);
+
+// Appends one printf-formatted line (the caller supplies the '\n').
+// Returns false if it did not fit.
+bool metrics_line(metrics_writer_t *w, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Appends "<name> n=<count> avg=<us> max=<us>".
+bool metrics_put_latency(metrics_writer_t *w, const char *name,
+                         const metrics_latency_t *m);
+
+// Appends the counters shared by the server and client: packet pool, lwIP
+// pbuf pool and heap (when lwIP keeps them), SD card commands and the
+// retransmission table.
+void metrics_put_common(metrics_writer_t *w);
+
+#endif  // CS04_METRICS_H
@@ -0,0 +1,282 @@
+#include "cs04_notify.h"
+#include "cs04_coap_packet.h"
+#include "cs04_coap_reliability.h"
+#include "cs04_packet_pool.h"
+#include "cs04_log.h"
+#include <string.h>
+#include <stdio.h>
+
+#define NOTIFY_OBSERVE_MAX 3           // Observe is a 24-bit value
+#define NOTIFY_OBSERVE_MASK 0xFFFFFFu
+
+static notify_stats_t stats;
+
+/**
+ * @brief Encode a notification once, with a placeholder Observe option.
+ *
+ * The empty Observe option is inserted in option order. Its header byte
+ * has a delta below 13 and length 0, so the per-recipient value only needs
+ * the length nibble patched in and the value bytes spliced after it; the
+ * deltas of the options that follow do not change.
+ *
+ * @param tmpl Output template
+ * @param pkt Notification to encode (hdr.code, options, payload)
+ * @return true on success
+ */
+bool notify_template_init(notify_template_t *tmpl, const coap_packet_t *pkt)
+{
+    coap_packet_t enc = { 0 };
+    enc.hdr.ver = 1;
+    enc.hdr.t = COAP_TYPE_NONCON;
+    enc.hdr.code = pkt->hdr.code;
+    enc.payload = pkt->payload;
+
+    bool observe_added = false;
+    for (int i = 0; i < pkt->numopts; i++) {
+        if (!observe_added && pkt->opts[i].num > COAP_OPTION_OBSERVE) {
+            coap_add_option(&enc, COAP_OPTION_OBSERVE, NULL, 0);
+            observe_added = true;
+        }
+        if (coap_add_option(&enc, pkt->opts[i].num, pkt->opts[i].buf.p,
+                            pkt->opts[i].buf.len) != 0)
+            return false;
+    }
+    if (!observe_added &&
+        coap_add_option(&enc, COAP_OPTION_OBSERVE, NULL, 0) != 0)
+        return false;
+
+    size_t max_len = coap_packet_max_len(&enc);
+    tmpl->buf = packet_pool_alloc(max_len);
+    if (!tmpl->buf) {
+        LOG_ERROR("✗ Notify: no pool buffer for %u-byte template\n",
+               (unsigned) max_len);
+        return false;
+    }
+
+    size_t len = max_len;
+    coap_packet_t parsed;
+    uint8_t count = 0;
+    const coap_option_t *obs = NULL;
+    if (coap_build(tmpl->buf, &len, &enc) == COAP_ERR_NONE &&
+        coap_parse(&parsed, tmpl->buf, len) == 0)
+        obs = coap_findOptions(&parsed, COAP_OPTION_OBSERVE, &count);
+    if (!obs) {
+        notify_template_free(tmpl);
+        return false;
+    }
+
+    tmpl->len = (uint16_t) len;
+    tmpl->observe_at = (uint16_t) (obs->buf.p - 1 - tmpl->buf);
+    return true;
+}
+
+/**
+ * @brief Release a template's buffer.
+ */
+void notify_template_free(notify_template_t *tmpl)
+{
+    packet_pool_free(tmpl->buf);
+    tmpl->buf = NULL;
+}
+
+/**
+ * @brief Send a notification template to one observer.
+ *
+ * The message is assembled by copying the encoded template around the
+ * recipient's header, token and Observe value; nothing is re-encoded.
+ *
+ * @param pcb UDP protocol control block
+ * @param tmpl Template from notify_template_init()
+ * @param ip Observer address
+ * @param port Observer port
+ * @param token Observer's registration token
+ * @param observe_seq Observe sequence number
+ * @param confirmable Send as CON (stored for retransmission) or NON
+ * @return Message ID; 0 on error
+ */
+uint16_t notify_send(struct udp_pcb *pcb, const notify_template_t *tmpl,
+                     const ip_addr_t *ip, u16_t port,
+                     const coap_buffer_t *token, uint32_t observe_seq,
+                     bool confirmable)
+{
+    uint8_t obs[NOTIFY_OBSERVE_MAX];
+    size_t obs_len = coap_set_option_uint(obs,
+                                          observe_seq & NOTIFY_OBSERVE_MASK);
+
+    struct pbuf *p = packet_pool_alloc_pbuf(tmpl->len + token->len + obs_len);
+    if (!p) {
+        LOG_ERROR("ERROR: Failed to allocate notification\n");
+        stats.dropped++;
+        return 0;
+    }
+
+    uint16_t msg_id = coap_generate_msg_id();
+    uint8_t type = confirmable ? COAP_TYPE_CON : COAP_TYPE_NONCON;
+    uint8_t *out = p->payload;
+
+    *out++ = (uint8_t) (0x40 | (type << 4) | token->len);
+    *out++ = tmpl->buf[1];
+    *out++ = (uint8_t) (msg_id >> 8);
+    *out++ = (uint8_t) (msg_id & 0xFF);
+    memcpy(out, token->p, token->len);
+    out += token->len;
+
+    // Options before Observe, then Observe with its real length and value
+    memcpy(out, tmpl->buf + 4, tmpl->observe_at - 4);
+    out += tmpl->observe_at - 4;
+    *out++ = (uint8_t) (tmpl->buf[tmpl->observe_at] | obs_len);
+    memcpy(out, obs, obs_len);
+    out += obs_len;
+    memcpy(out, tmpl->buf + tmpl->observe_at + 1,
+           tmpl->len - tmpl->observe_at - 1);
+
+    err_t err;
+    if (confirmable) {
+        // The queue keeps its own reference. Without a slot the CON could
+        // never be retransmitted, so the caller keeps the state pending.
+        if (!coap_send_reliable(pcb, msg_id, ip, port, p)) {
+            pbuf_free(p);
+            stats.dropped++;
+            return 0;
+        }
+        err = ERR_OK;  // Sent or waiting for the peer's window
+        stats.sent_con++;
+    } else {
+        err = udp_sendto(pcb, p, ip, port);
+        stats.sent_non++;
+    }
+    pbuf_free(p);
+
+    if (err != ERR_OK) {
+        LOG_WARN("⚠️ Notification to %s:%d failed (%d)\n", ip4addr_ntoa(ip),
+               port, err);
+    }
+    return msg_id;
+}
+
+/**
+ * @brief Pick CON or NON for one observer's notification.
+ *
+ * A handful of observers all get CON, as before. With more, most
+ * notifications are NON and each observer gets a CON every
+ * NOTIFY_CON_EVERY notifications, which keeps its liveness check going
+ * without holding a retransmit copy per observer. Slots are staggered so
+ * the CONs of one fan-out are spread across observers.
+ *
+ * @param observers Number of active observers
+ * @param observe_seq Observe sequence number of this notification
+ * @param slot Observer's slot index
+ * @return true to send CON
+ */
+bool notify_wants_con(size_t observers, uint32_t observe_seq, size_t slot)
+{
+    if (observers <= NOTIFY_CON_ALL_MAX)
+        return true;
+    return (observe_seq + slot) % NOTIFY_CON_EVERY == 0;
+}
+
+/**
+ * @brief Check whether an observer still has a CON outstanding.
+ *
+ * A CON whose ACK or failure was never reported (e.g. its msg_id link was
+ * lost) stops counting after NOTIFY_IN_FLIGHT_MAX_MS, so the observer
+ * cannot be stuck pending forever.
+ */
+static bool gate_busy(const notify_gate_t *gate, uint32_t now_ms)
+{
+    return gate->in_flight &&
+           now_ms - gate->last_sent_ms < NOTIFY_IN_FLIGHT_MAX_MS;
+}
+
+/**
+ * @brief Offer new state to an observer.
+ * @param gate Observer's coalescing state
+ * @param now_ms Current time (ms since boot)
+ * @return true if the caller should send it now
+ */
+bool notify_gate_offer(notify_gate_t *gate, uint32_t now_ms)
+{
+    if (gate->pending)
+        stats.coalesced++;
+    gate->pending = true;
+
+    if (gate_busy(gate, now_ms))
+        return false;
+    if (!notify_gate_ready(gate, now_ms)) {
+        stats.rate_limited++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Record that the latest state was sent.
+ * @param gate Observer's coalescing state
+ * @param now_ms Send time
+ * @param confirmable true if it went as CON (an ACK is now awaited)
+ */
+void notify_gate_sent(notify_gate_t *gate, uint32_t now_ms, bool confirmable)
+{
+    gate->pending = false;
+    gate->in_flight = confirmable;
+    gate->last_sent_ms = now_ms;
+}
+
+/**
+ * @brief Record a failed send, retrying after one interval.
+ */
+void notify_gate_failed(notify_gate_t *gate, uint32_t now_ms)
+{
+    gate->pending = true;
+    gate->last_sent_ms = now_ms;
+}
+
+/**
+ * @brief Hold pending state back until a later time.
+ *
+ * Moves the interval start so notify_gate_ready_at() is until_ms; a hold
+ * never shortens a wait already in place.
+ */
+void notify_gate_hold(notify_gate_t *gate, uint32_t until_ms)
+{
+    gate->pending = true;
+    uint32_t from = until_ms - NOTIFY_MIN_INTERVAL_MS;
+    if ((int32_t) (from - gate->last_sent_ms) > 0)
+        gate->last_sent_ms = from;
+}
+
+/**
+ * @brief The in-flight CON is finished (ACKed or given up on).
+ * @return true if pending state may be sent now
+ */
+bool notify_gate_settle(notify_gate_t *gate, uint32_t now_ms)
+{
+    gate->in_flight = false;
+    return notify_gate_ready(gate, now_ms);
+}
+
+/**
+ * @brief Check whether pending state may be sent now.
+ */
+bool notify_gate_ready(const notify_gate_t *gate, uint32_t now_ms)
+{
+    return gate->pending && !gate_busy(gate, now_ms) &&
+           now_ms - gate->last_sent_ms >= NOTIFY_MIN_INTERVAL_MS;
+}
+
+/**
+ * @brief Earliest time pending state may be sent (ignores in_flight).
+ */
+uint32_t notify_gate_ready_at(const notify_gate_t *gate)
+{
+    return gate->last_sent_ms + NOTIFY_MIN_INTERVAL_MS;
+}
+
+/**
+ * @brief Copy the notification counters.
+ * @param out Output snapshot
+ */
+void notify_get_stats(notify_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,87 @@
+#ifndef CS04_NOTIFY_H
+#define CS04_NOTIFY_H
+
+#include "coap.h"
+#include "lwip/udp.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define NOTIFY_CON_ALL_MAX 5  // Up to this many observers, every notification is CON
+#define NOTIFY_CON_EVERY 8    // Beyond that, each observer gets every 8th as CON
+#define NOTIFY_MIN_INTERVAL_MS 200  // Per observer, between two notifications
+#define NOTIFY_IN_FLIGHT_MAX_MS 93000  // RFC 7252 MAX_TRANSMIT_WAIT
+
+// A notification encoded once for all observers. Only the header, token and
+// Observe value differ per recipient, and they are written when sending.
+typedef struct {
+    uint8_t *buf;         // Encoded with no token and an empty Observe option
+    uint16_t len;
+    uint16_t observe_at;  // Offset of the Observe option header byte
+} notify_template_t;
+
+// Per-observer coalescing state (RFC 7641 section 4.5.2). While a CON is
+// unacknowledged or the minimum interval has not passed, newer state only
+// marks the observer pending; it then gets the latest state once.
+typedef struct {
+    bool in_flight;         // CON sent, not yet ACKed or given up
+    bool pending;           // Holds state newer than the last one sent
+    uint32_t last_sent_ms;
+} notify_gate_t;
+
+// Notification counters.
+typedef struct {
+    uint32_t sent_con;
+    uint32_t sent_non;
+    uint32_t coalesced;     // Pending states replaced by newer ones unsent
+    uint32_t rate_limited;  // Offers held back by NOTIFY_MIN_INTERVAL_MS
+    uint32_t dropped;       // Sends that failed (no buffer or retransmit slot)
+} notify_stats_t;
+
+// Encodes pkt (code, options, payload) once. pkt must not carry Observe or
+// a token. Returns false if the pool has no room or encoding fails.
+bool notify_template_init(notify_template_t *tmpl, const coap_packet_t *pkt);
+
+// Returns the template's buffer to the packet pool.
+void notify_template_free(notify_template_t *tmpl);
+
+// Sends the template to one observer. CON notifications are stored for
+// retransmission, and are not sent at all if the queue is full; NON ones are
+// sent and forgotten. Returns the message ID, or 0 if nothing was sent.
+uint16_t notify_send(struct udp_pcb *pcb, const notify_template_t *tmpl,
+                     const ip_addr_t *ip, u16_t port,
+                     const coap_buffer_t *token, uint32_t observe_seq,
+                     bool confirmable);
+
+// RFC 7641 section 4.5: whether the notification with observe_seq for the
+// observer in slot should be confirmable, given how many are observing.
+bool notify_wants_con(size_t observers, uint32_t observe_seq, size_t slot);
+
+// New state for an observer. Returns true if it may be sent now; otherwise
+// it is left pending (replacing any older pending state).
+bool notify_gate_offer(notify_gate_t *gate, uint32_t now_ms);
+
+// Records a successful send.
+void notify_gate_sent(notify_gate_t *gate, uint32_t now_ms, bool confirmable);
+
+// Records a failed send; the state stays pending for one more interval.
+void notify_gate_failed(notify_gate_t *gate, uint32_t now_ms);
+
+// Keeps the pending state back until at least until_ms (e.g. while the
+// link is poor). Newer state keeps coalescing into it meanwhile.
+void notify_gate_hold(notify_gate_t *gate, uint32_t until_ms);
+
+// The in-flight CON was ACKed or given up on. Returns true if pending state
+// may be sent now.
+bool notify_gate_settle(notify_gate_t *gate, uint32_t now_ms);
+
+// Whether pending state may be sent now, and when it may be at the earliest.
+bool notify_gate_ready(const notify_gate_t *gate, uint32_t now_ms);
+uint32_t notify_gate_ready_at(const notify_gate_t *gate);
+
+// Copies the counters.
+void notify_get_stats(notify_stats_t *stats);
+
+#endif  // CS04_NOTIFY_H
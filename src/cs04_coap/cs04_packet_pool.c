@@ -0,0 +1,229 @@
+#include "cs04_packet_pool.h"
+#include "cs04_log.h"
+#include <string.h>
+#include <stdio.h>
+
+// Every buffer keeps room for the UDP/IP/link headers in front, so a pool
+// pbuf can be passed to udp_sendto() without lwIP chaining a header pbuf.
+#define POOL_HEADROOM LWIP_MEM_ALIGN_SIZE((size_t) PBUF_TRANSPORT)
+#define POOL_STRIDE(size) (POOL_HEADROOM + LWIP_MEM_ALIGN_SIZE(size))
+#define POOL_TOTAL                                                           \
+    (PACKET_POOL_SMALL_COUNT + PACKET_POOL_MEDIUM_COUNT +                    \
+     PACKET_POOL_BLOCK_COUNT + PACKET_POOL_BERT_COUNT)
+
+// One size class: a contiguous arena of equal buffers and a free bitmap.
+typedef struct {
+    uint8_t *arena;
+    size_t stride;       // Headroom + usable size
+    uint16_t size;       // Usable size
+    uint8_t count;
+    uint8_t first_slot;  // Index of this class's first wrapper
+    uint32_t free_mask;  // Bit i set = buffer i free
+    packet_pool_class_stats_t stats;
+} pool_class_t;
+
+// Custom pbuf header for a pool buffer. pbuf_custom must come first.
+typedef struct {
+    struct pbuf_custom pc;
+    void *buf;
+} pool_pbuf_t;
+
+static uint8_t small_arena[PACKET_POOL_SMALL_COUNT]
+                          [POOL_STRIDE(PACKET_POOL_SMALL_SIZE)]
+    __attribute__((aligned(4)));
+static uint8_t medium_arena[PACKET_POOL_MEDIUM_COUNT]
+                           [POOL_STRIDE(PACKET_POOL_MEDIUM_SIZE)]
+    __attribute__((aligned(4)));
+static uint8_t block_arena[PACKET_POOL_BLOCK_COUNT]
+                          [POOL_STRIDE(PACKET_POOL_BLOCK_SIZE)]
+    __attribute__((aligned(4)));
+static uint8_t bert_arena[PACKET_POOL_BERT_COUNT]
+                         [POOL_STRIDE(PACKET_POOL_BERT_SIZE)]
+    __attribute__((aligned(4)));
+
+#define POOL_CLASS(arena, size, count, first)                                \
+    { (uint8_t *) (arena), POOL_STRIDE(size), (size), (count), (first),      \
+      (uint32_t) ((1ull << (count)) - 1), { (size), (count), 0, 0, 0, 0 } }
+
+static pool_class_t classes[PACKET_POOL_CLASSES] = {
+    POOL_CLASS(small_arena, PACKET_POOL_SMALL_SIZE, PACKET_POOL_SMALL_COUNT,
+               0),
+    POOL_CLASS(medium_arena, PACKET_POOL_MEDIUM_SIZE, PACKET_POOL_MEDIUM_COUNT,
+               PACKET_POOL_SMALL_COUNT),
+    POOL_CLASS(block_arena, PACKET_POOL_BLOCK_SIZE, PACKET_POOL_BLOCK_COUNT,
+               PACKET_POOL_SMALL_COUNT + PACKET_POOL_MEDIUM_COUNT),
+    POOL_CLASS(bert_arena, PACKET_POOL_BERT_SIZE, PACKET_POOL_BERT_COUNT,
+               PACKET_POOL_SMALL_COUNT + PACKET_POOL_MEDIUM_COUNT +
+                   PACKET_POOL_BLOCK_COUNT),
+};
+
+static pool_pbuf_t wrappers[POOL_TOTAL];
+static size_t bytes_in_use;
+static size_t bytes_high_water;
+static uint32_t heap_fallbacks;
+
+/**
+ * @brief Take a free buffer from a class.
+ * @param c Size class
+ * @param idx Output: buffer index within the class
+ * @return true if a buffer was free
+ */
+static bool pool_take(pool_class_t *c, int *idx)
+{
+    if (c->free_mask == 0)
+        return false;
+
+    *idx = __builtin_ctz(c->free_mask);
+    c->free_mask &= ~(1u << *idx);
+
+    c->stats.allocs++;
+    c->stats.in_use++;
+    if (c->stats.in_use > c->stats.high_water)
+        c->stats.high_water = c->stats.in_use;
+
+    bytes_in_use += c->stride;
+    if (bytes_in_use > bytes_high_water)
+        bytes_high_water = bytes_in_use;
+    return true;
+}
+
+/**
+ * @brief Find the class and index owning a buffer pointer.
+ * @param buf Pointer returned by packet_pool_alloc()
+ * @param idx Output: buffer index within the class
+ * @return Owning class, or NULL if buf is not a pool buffer
+ */
+static pool_class_t *pool_owner(const void *buf, int *idx)
+{
+    const uint8_t *b = buf;
+
+    for (int i = 0; i < PACKET_POOL_CLASSES; i++) {
+        pool_class_t *c = &classes[i];
+        if (b < c->arena || b >= c->arena + c->stride * c->count)
+            continue;
+        *idx = (int) ((size_t) (b - c->arena) / c->stride);
+        return c;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocate from the smallest class that fits and has a free buffer.
+ * @param len Bytes needed
+ * @param cls_out Output: class served from
+ * @param idx_out Output: buffer index within the class
+ * @return true on success
+ */
+static bool pool_alloc_slot(size_t len, pool_class_t **cls_out, int *idx_out)
+{
+    bool first_fit = true;
+
+    for (int i = 0; i < PACKET_POOL_CLASSES; i++) {
+        pool_class_t *c = &classes[i];
+        if (len > c->size)
+            continue;
+        if (pool_take(c, idx_out)) {
+            *cls_out = c;
+            return true;
+        }
+        if (first_fit)
+            c->stats.exhausted++;  // Spill to the next class up
+        first_fit = false;
+    }
+    return false;
+}
+
+/**
+ * @brief Take a buffer of at least len bytes from the pool.
+ * @param len Bytes needed
+ * @return Buffer, or NULL if no class can serve it
+ */
+void *packet_pool_alloc(size_t len)
+{
+    pool_class_t *c;
+    int idx;
+
+    if (!pool_alloc_slot(len, &c, &idx))
+        return NULL;
+    return c->arena + (size_t) idx * c->stride + POOL_HEADROOM;
+}
+
+/**
+ * @brief Return a pool buffer.
+ * @param buf Buffer from packet_pool_alloc() (NULL and foreign pointers are
+ *        ignored)
+ */
+void packet_pool_free(void *buf)
+{
+    int idx;
+    pool_class_t *c = buf ? pool_owner(buf, &idx) : NULL;
+
+    if (!c || (c->free_mask & (1u << idx))) {
+        if (buf)
+            LOG_WARN("⚠️ Packet pool: bad free %p\n", buf);
+        return;
+    }
+
+    c->free_mask |= 1u << idx;
+    c->stats.in_use--;
+    bytes_in_use -= c->stride;
+}
+
+/**
+ * @brief lwIP custom-free hook: hand the buffer back once the last pbuf
+ * reference is dropped.
+ */
+static void pool_pbuf_free(struct pbuf *p)
+{
+    pool_pbuf_t *w = (pool_pbuf_t *) p;
+    packet_pool_free(w->buf);
+}
+
+/**
+ * @brief Allocate a pool-backed pbuf for an encoded CoAP message.
+ *
+ * The pbuf behaves like a PBUF_RAM pbuf with transport headroom. Held
+ * references (retransmission queue, ARP queue) keep the buffer out of the
+ * pool until they are released.
+ *
+ * @param len Payload length
+ * @return pbuf, or NULL if neither the pool nor the lwIP heap has room
+ */
+struct pbuf *packet_pool_alloc_pbuf(size_t len)
+{
+    pool_class_t *c;
+    int idx;
+
+    if (len > UINT16_MAX)
+        return NULL;
+
+    if (pool_alloc_slot(len, &c, &idx)) {
+        pool_pbuf_t *w = &wrappers[c->first_slot + idx];
+        uint8_t *mem = c->arena + (size_t) idx * c->stride;
+
+        w->buf = mem + POOL_HEADROOM;
+        w->pc.custom_free_function = pool_pbuf_free;
+        struct pbuf *p = pbuf_alloced_custom(PBUF_TRANSPORT, (u16_t) len,
+                                             PBUF_RAM, &w->pc, mem,
+                                             (u16_t) c->stride);
+        if (p)
+            return p;
+        packet_pool_free(w->buf);
+    }
+
+    heap_fallbacks++;
+    return pbuf_alloc(PBUF_TRANSPORT, (u16_t) len, PBUF_RAM);
+}
+
+/**
+ * @brief Copy the pool counters.
+ * @param stats Output snapshot
+ */
+void packet_pool_get_stats(packet_pool_stats_t *stats)
+{
+    for (int i = 0; i < PACKET_POOL_CLASSES; i++)
+        stats->cls[i] = classes[i].stats;
+    stats->bytes_in_use = bytes_in_use;
+    stats->bytes_high_water = bytes_high_water;
+    stats->heap_fallbacks = heap_fallbacks;
+}
@@ -0,0 +1,62 @@
+#ifndef CS04_PACKET_POOL_H
+#define CS04_PACKET_POOL_H
+
+#include "lwip/pbuf.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define PACKET_POOL_SMALL_SIZE 128    // ACKs, requests, handler scratch
+#define PACKET_POOL_SMALL_COUNT 8
+#define PACKET_POOL_MEDIUM_SIZE 256   // FETCH requests with a query payload
+#define PACKET_POOL_MEDIUM_COUNT 4
+#define PACKET_POOL_BLOCK_SIZE 1232   // 1024-byte Block2 payload + header
+#define PACKET_POOL_BLOCK_COUNT 8     // Notifications + last-sent blocks
+#define PACKET_POOL_BERT_SIZE 2256    // 2 KiB BERT (SZX 7) payload + header
+#define PACKET_POOL_BERT_COUNT 5      // Block cache slots + one being sent
+
+// Size classes, smallest first.
+typedef enum {
+    PACKET_POOL_SMALL = 0,
+    PACKET_POOL_MEDIUM,
+    PACKET_POOL_BLOCK,
+    PACKET_POOL_BERT,
+    PACKET_POOL_CLASSES
+} packet_pool_class_t;
+
+// Usage counters for one size class.
+typedef struct {
+    uint16_t size;        // Usable bytes per buffer
+    uint8_t count;        // Buffers in the class
+    uint8_t in_use;       // Buffers currently handed out
+    uint8_t high_water;   // Most buffers ever in use at once
+    uint32_t allocs;      // Buffers handed out from this class
+    uint32_t exhausted;   // Requests sized for this class that found it full
+} packet_pool_class_stats_t;
+
+// Snapshot of the whole pool.
+typedef struct {
+    packet_pool_class_stats_t cls[PACKET_POOL_CLASSES];
+    size_t bytes_in_use;      // Arena bytes held (whole buffers)
+    size_t bytes_high_water;  // Peak of bytes_in_use
+    uint32_t heap_fallbacks;  // pbufs served from the lwIP heap instead
+} packet_pool_stats_t;
+
+// Takes a buffer of at least len bytes from the smallest class with one free.
+// Returns NULL if len is too large or every fitting class is exhausted.
+// Core0 only (lwIP context), like the rest of the packet code.
+void *packet_pool_alloc(size_t len);
+
+// Returns a buffer from packet_pool_alloc(). Ignores pointers it does not own.
+void packet_pool_free(void *buf);
+
+// Allocates a PBUF_TRANSPORT pbuf of len bytes backed by a pool buffer, which
+// goes back to the pool when the last reference is freed. Falls back to the
+// lwIP heap when the pool cannot serve it (counted in heap_fallbacks).
+struct pbuf *packet_pool_alloc_pbuf(size_t len);
+
+// Copies the current counters.
+void packet_pool_get_stats(packet_pool_stats_t *stats);
+
+#endif  // CS04_PACKET_POOL_H
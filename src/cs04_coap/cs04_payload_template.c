@@ -0,0 +1,78 @@
+#include "cs04_payload_template.h"
+#include <string.h>
+
+/**
+ * @brief Rebuild a template's text from its layout and field values.
+ * @return false (text untouched) if the result does not fit
+ */
+static bool template_compose(payload_template_t *tmpl)
+{
+    size_t len = 0;
+    uint8_t field = 0;
+    for (const char *c = tmpl->layout; *c; c++)
+        len += (*c == '%') ? strlen(tmpl->values[field++]) : 1;
+    if (len >= PAYLOAD_TEMPLATE_LEN)
+        return false;
+
+    char *out = tmpl->text;
+    field = 0;
+    for (const char *c = tmpl->layout; *c; c++) {
+        if (*c != '%') {
+            *out++ = *c;
+            continue;
+        }
+        size_t n = strlen(tmpl->values[field]);
+        memcpy(out, tmpl->values[field++], n);
+        out += n;
+    }
+    *out = '\0';
+    tmpl->len = (uint8_t) len;
+    return true;
+}
+
+/**
+ * @brief Bind a layout to a template and compose it once.
+ * @param tmpl Template
+ * @param layout Literal text with one '%' per field
+ * @param value Initial value of every field
+ * @return true on success
+ */
+bool payload_template_init(payload_template_t *tmpl, const char *layout,
+                           const char *value)
+{
+    memset(tmpl, 0, sizeof(*tmpl));
+    for (const char *c = layout; *c; c++) {
+        if (*c != '%')
+            continue;
+        if (tmpl->fields == PAYLOAD_TEMPLATE_FIELDS)
+            return false;
+        tmpl->values[tmpl->fields++] = value;
+    }
+    tmpl->layout = layout;
+    return template_compose(tmpl);
+}
+
+/**
+ * @brief Update one field, recomposing the text if it changed.
+ *
+ * A value that would not fit leaves the template unchanged.
+ *
+ * @param tmpl Template
+ * @param field Field index (order of '%' in the layout)
+ * @param value New field string
+ * @return true if the text changed
+ */
+bool payload_template_set(payload_template_t *tmpl, uint8_t field,
+                          const char *value)
+{
+    if (field >= tmpl->fields || strcmp(tmpl->values[field], value) == 0)
+        return false;
+
+    const char *old = tmpl->values[field];
+    tmpl->values[field] = value;
+    if (!template_compose(tmpl)) {
+        tmpl->values[field] = old;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef CS04_PAYLOAD_TEMPLATE_H
+#define CS04_PAYLOAD_TEMPLATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define PAYLOAD_TEMPLATE_LEN 48     // Longest composed payload
+#define PAYLOAD_TEMPLATE_FIELDS 4   // '%' fields per layout
+
+// A text payload kept ready to send. The layout is literal text with one
+// '%' per field; the text is recomposed (memcpy only) when a field changes,
+// so requests and notifications send it as is.
+typedef struct {
+    const char *layout;                           // Literal text, '%' per field
+    const char *values[PAYLOAD_TEMPLATE_FIELDS];  // Current field strings
+    uint8_t fields;                               // '%' count in layout
+    uint8_t len;                                  // Bytes in text
+    char text[PAYLOAD_TEMPLATE_LEN];              // Composed payload
+} payload_template_t;
+
+// Binds a layout and sets every field to value. Returns false if the layout
+// has too many fields or does not fit. layout and values must stay valid.
+bool payload_template_init(payload_template_t *tmpl, const char *layout,
+                           const char *value);
+
+// Sets one field; the text is recomposed only if the value differs.
+// Returns true if the text changed.
+bool payload_template_set(payload_template_t *tmpl, uint8_t field,
+                          const char *value);
+
+#endif  // CS04_PAYLOAD_TEMPLATE_H
@@ -0,0 +1,60 @@
+#ifndef CS04_PLATFORM_H
+#define CS04_PLATFORM_H
+
+// Clock and datagram output of the packet and reliability layers. Firmware
+// builds map these onto the Pico SDK timer and lwIP's udp_sendto(). With
+// CS04_HOST set (test/host) the host program defines them instead: the
+// simulator supplies a virtual clock and a simulated link. Buffers stay
+// lwIP pbufs on both, since lwIP's pbuf code builds on a host as is.
+
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+
+#if CS04_HOST
+
+// Milliseconds since start (wraps like to_ms_since_boot()).
+uint32_t platform_now_ms(void);
+
+// Microseconds since start (wraps like time_us_32()).
+uint32_t platform_now_us(void);
+
+// Sends one datagram; same contract as udp_sendto() (p is not freed).
+err_t platform_udp_send(struct udp_pcb *pcb, struct pbuf *p,
+                        const ip_addr_t *dest_ip, u16_t dest_port);
+
+// 64 unpredictable bits (message ID start, tokens).
+uint64_t platform_random64(void);
+
+#else
+
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+
+static inline uint32_t platform_now_ms(void)
+{
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static inline uint32_t platform_now_us(void)
+{
+    return time_us_32();
+}
+
+static inline err_t platform_udp_send(struct udp_pcb *pcb, struct pbuf *p,
+                                      const ip_addr_t *dest_ip,
+                                      u16_t dest_port)
+{
+    return udp_sendto(pcb, p, dest_ip, dest_port);
+}
+
+// pico_rand: seeded from the ROSC random bit and other hardware entropy
+static inline uint64_t platform_random64(void)
+{
+    return get_rand_64();
+}
+
+#endif  // CS04_HOST
+
+#endif  // CS04_PLATFORM_H
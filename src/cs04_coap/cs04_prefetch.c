@@ -0,0 +1,535 @@
+#include "cs04_prefetch.h"
+#include "cs04_packet_pool.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+// Read-ahead request left by the last block served to one client.
+typedef struct {
+    bool active;                         // True if blocks remain to prefetch
+    char filename[FILE_CACHE_NAME_LEN];  // File being transferred
+    ip_addr_t ip;                        // Client of the transfer
+    u16_t port;                          // Client UDP port
+    uint32_t block_size;                 // Block size of the transfer
+    FSIZE_t file_size;                   // File size seen by the handler
+    uint32_t first_block;                // First block to read ahead
+    uint32_t last_block;                 // Last block to read ahead
+    uint32_t stamp;                      // Schedule order, for recycling
+} prefetch_stream_t;
+
+// A PBUF_REF onto a slot's data; freeing it unpins the slot.
+typedef struct {
+    struct pbuf_custom pc;  // Must be first (lwIP passes the pbuf)
+    prefetch_slot_t *slot;  // Pinned slot, NULL if this entry is free
+} prefetch_ref_t;
+
+static prefetch_slot_t prefetch_ring[PREFETCH_RING_SLOTS];
+static prefetch_ref_t prefetch_refs[PREFETCH_PIN_MAX * 2];  // BERT: 2 per pin
+static uint8_t prefetch_pinned;  // Slots with pins > 0
+static prefetch_stream_t prefetch_streams[PREFETCH_STREAMS];
+static uint8_t prefetch_turn;  // Stream polled first next time
+static prefetch_stats_t prefetch_stats;
+static uint32_t prefetch_stamp;
+
+// Staging area for read-ahead runs longer than one block
+static uint8_t prefetch_run_buf[PREFETCH_DEPTH * PREFETCH_BLOCK_SIZE]
+    __attribute__((aligned(4)));
+
+/**
+ * @brief Check whether a slot holds a given block of a client's file.
+ */
+static bool slot_matches(const prefetch_slot_t *slot, const char *filename,
+                         const ip_addr_t *ip, u16_t port, uint32_t block_num,
+                         uint32_t block_size)
+{
+    return slot->valid && slot->block_num == block_num &&
+           slot->block_size == block_size && slot->port == port &&
+           ip_addr_cmp(&slot->ip, ip) &&
+           strncmp(slot->filename, filename, FILE_CACHE_NAME_LEN) == 0;
+}
+
+/**
+ * @brief Find a slot holding a block, without touching the counters.
+ */
+static prefetch_slot_t *slot_find(const char *filename, const ip_addr_t *ip,
+                                  u16_t port, uint32_t block_num,
+                                  uint32_t block_size)
+{
+    for (int i = 0; i < PREFETCH_RING_SLOTS; i++) {
+        if (slot_matches(&prefetch_ring[i], filename, ip, port, block_num,
+                         block_size)) {
+            return &prefetch_ring[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check whether a stream belongs to a client's file.
+ */
+static bool stream_matches(const prefetch_stream_t *st, const char *filename,
+                           const ip_addr_t *ip, u16_t port)
+{
+    return st->active && st->port == port && ip_addr_cmp(&st->ip, ip) &&
+           strncmp(st->filename, filename, FILE_CACHE_NAME_LEN) == 0;
+}
+
+/**
+ * @brief Check whether a slot holds a block an active stream still needs.
+ */
+static bool slot_reserved(const prefetch_slot_t *slot)
+{
+    if (!slot->valid)
+        return false;
+    for (int i = 0; i < PREFETCH_STREAMS; i++) {
+        const prefetch_stream_t *st = &prefetch_streams[i];
+        if (stream_matches(st, slot->filename, &slot->ip, slot->port) &&
+            slot->block_num >= st->first_block &&
+            slot->block_num <= st->last_block &&
+            slot->block_size == st->block_size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Pick the slot to overwrite: free first, then oldest unreserved.
+ *
+ * Pinned slots are never picked, valid or not: a sent response still
+ * points at their data.
+ *
+ * @param allow_reserved Allow evicting read-ahead blocks (for misses)
+ * @param skip Bit i set = slot i already taken by the caller
+ * @return Slot to reuse, or NULL if every slot is reserved
+ */
+static prefetch_slot_t *slot_victim(bool allow_reserved, uint32_t skip)
+{
+    prefetch_slot_t *victim = NULL;
+    for (int i = 0; i < PREFETCH_RING_SLOTS; i++) {
+        prefetch_slot_t *slot = &prefetch_ring[i];
+        if ((skip & (1u << i)) || slot->pins > 0)
+            continue;
+        if (!slot->valid)
+            return slot;
+        if (!allow_reserved && slot_reserved(slot))
+            continue;
+        if (!victim || slot->stamp < victim->stamp)
+            victim = slot;
+    }
+    return victim;
+}
+
+/**
+ * @brief Read consecutive blocks from SD via the open-file cache.
+ *
+ * One f_read of a sector-aligned run lets FATFS hand the whole run to
+ * disk_read(), which the SD driver issues as a single CMD18.
+ *
+ * @param offset File offset of the first byte
+ * @param buf Destination
+ * @param len Bytes to read
+ * @param bytes_read Output: bytes actually read (short at end of file)
+ * @param file_size Output: file size seen by the read
+ * @return FATFS result of the open/seek/read
+ */
+static FRESULT file_read_run(const char *filename, const ip_addr_t *ip,
+                             u16_t port, FSIZE_t offset, uint8_t *buf,
+                             UINT len, UINT *bytes_read, FSIZE_t *file_size)
+{
+    FRESULT res = FR_OK;
+    FIL *fil = file_cache_acquire(filename, ip, port, &res);
+    if (!fil)
+        return res;
+
+    *file_size = f_size(fil);
+    if (offset > *file_size)
+        offset = *file_size;
+
+    *bytes_read = 0;
+    res = f_lseek(fil, offset);
+    if (res == FR_OK)
+        res = f_read(fil, buf, len, bytes_read);
+    if (res != FR_OK)
+        file_cache_close(filename, ip, port);
+    return res;
+}
+
+/**
+ * @brief Mark a slot as holding a block, copying the payload in if needed.
+ * @param data Block payload (may already be slot->data)
+ * @param len Valid bytes in data
+ */
+static void slot_fill(prefetch_slot_t *slot, const char *filename,
+                      const ip_addr_t *ip, u16_t port, uint32_t block_num,
+                      uint32_t block_size, FSIZE_t file_size,
+                      const uint8_t *data, UINT len)
+{
+    if (data != slot->data)
+        memcpy(slot->data, data, len);
+
+    strncpy(slot->filename, filename, FILE_CACHE_NAME_LEN - 1);
+    slot->filename[FILE_CACHE_NAME_LEN - 1] = '\0';
+    slot->ip = *ip;
+    slot->port = port;
+    slot->block_num = block_num;
+    slot->block_size = block_size;
+    slot->file_size = file_size;
+    slot->len = (uint16_t) len;
+    slot->stamp = ++prefetch_stamp;
+    slot->valid = true;
+}
+
+/**
+ * @brief Read one block from SD into a ring slot via the open-file cache.
+ * @return FATFS result of the open/seek/read
+ */
+static FRESULT slot_read(prefetch_slot_t *slot, const char *filename,
+                         const ip_addr_t *ip, u16_t port, uint32_t block_num,
+                         uint32_t block_size)
+{
+    slot->valid = false;
+    if (block_size > PREFETCH_BLOCK_SIZE)
+        return FR_INVALID_PARAMETER;
+
+    UINT bytes_read;
+    FSIZE_t file_size;
+    FRESULT res = file_read_run(filename, ip, port,
+                                (FSIZE_t) block_num * block_size, slot->data,
+                                block_size, &bytes_read, &file_size);
+    if (res != FR_OK)
+        return res;
+
+    slot_fill(slot, filename, ip, port, block_num, block_size, file_size,
+              slot->data, bytes_read);
+    return FR_OK;
+}
+
+/**
+ * @brief Reset the prefetch ring, pending read-ahead and counters.
+ */
+void prefetch_init(void)
+{
+    memset(prefetch_ring, 0, sizeof(prefetch_ring));
+    memset(prefetch_streams, 0, sizeof(prefetch_streams));
+    prefetch_turn = 0;
+    memset(&prefetch_stats, 0, sizeof(prefetch_stats));
+    prefetch_stamp = 0;
+}
+
+/**
+ * @brief Look a block up in the ring, counting a hit or miss.
+ * @param filename Source file
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @param block_num Requested block number
+ * @param block_size Requested block size
+ * @return Slot holding the block, or NULL on a miss
+ */
+const prefetch_slot_t *prefetch_lookup(const char *filename,
+                                       const ip_addr_t *ip, u16_t port,
+                                       uint32_t block_num,
+                                       uint32_t block_size)
+{
+    prefetch_slot_t *slot = slot_find(filename, ip, port, block_num,
+                                      block_size);
+    if (slot) {
+        prefetch_stats.hits++;
+    } else {
+        prefetch_stats.misses++;
+    }
+    return slot;
+}
+
+/**
+ * @brief Read a block into the ring on the request path (prefetch miss).
+ * @param filename Source file
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @param block_num Block number to read
+ * @param block_size Block size in bytes
+ * @param res Output: FATFS result on failure
+ * @return Slot holding the block, or NULL on failure
+ */
+const prefetch_slot_t *prefetch_load(const char *filename, const ip_addr_t *ip,
+                                     u16_t port, uint32_t block_num,
+                                     uint32_t block_size, FRESULT *res)
+{
+    prefetch_slot_t *slot = slot_victim(true, 0);
+    if (!slot) {
+        *res = FR_NOT_ENOUGH_CORE;  // Every slot pinned by sent responses
+        return NULL;
+    }
+    *res = slot_read(slot, filename, ip, port, block_num, block_size);
+    return (*res == FR_OK) ? slot : NULL;
+}
+
+/**
+ * @brief Unpin a slot when the last reference to its PBUF_REF goes.
+ */
+static void prefetch_ref_free(struct pbuf *p)
+{
+    prefetch_ref_t *ref = (prefetch_ref_t *) p;
+    prefetch_slot_t *slot = ref->slot;
+    ref->slot = NULL;
+    if (slot && slot->pins > 0 && --slot->pins == 0)
+        prefetch_pinned--;
+}
+
+/**
+ * @brief Wrap a slot's bytes in a pbuf for the response chain.
+ *
+ * A response payload can then go from the ring to lwIP without being
+ * copied into a result buffer and again into the encoded message. The
+ * block cache keeps sent responses, so a slot stays pinned until the
+ * cache drops the response; PREFETCH_PIN_MAX bounds how much of the ring
+ * that takes, leaving PREFETCH_DEPTH slots for read-ahead.
+ *
+ * @param slot Slot returned by prefetch_lookup() or prefetch_load()
+ * @return pbuf (caller frees), or NULL if out of memory
+ */
+struct pbuf *prefetch_payload_pbuf(const prefetch_slot_t *slot)
+{
+    prefetch_slot_t *s = &prefetch_ring[slot - prefetch_ring];
+    prefetch_ref_t *ref = NULL;
+    if (s->pins > 0 || prefetch_pinned < PREFETCH_PIN_MAX) {
+        for (size_t i = 0; i < sizeof(prefetch_refs) / sizeof(prefetch_refs[0]);
+             i++) {
+            if (!prefetch_refs[i].slot) {
+                ref = &prefetch_refs[i];
+                break;
+            }
+        }
+    }
+
+    if (!ref) {
+        struct pbuf *p = packet_pool_alloc_pbuf(s->len);
+        if (p) {
+            memcpy(p->payload, s->data, s->len);
+            prefetch_stats.copies++;
+        }
+        return p;
+    }
+
+    ref->pc.custom_free_function = prefetch_ref_free;
+    struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, s->len, PBUF_REF, &ref->pc,
+                                         s->data, s->len);
+    if (!p)
+        return NULL;
+    ref->slot = s;
+    if (s->pins++ == 0)
+        prefetch_pinned++;
+    prefetch_stats.refs++;
+    return p;
+}
+
+/**
+ * @brief Queue read-ahead of the blocks after block_num.
+ *
+ * The client's stream is updated in place; a new client takes a free
+ * stream, or the one scheduled longest ago. Read-ahead depth is the
+ * stream's share of PREFETCH_READ_SLOTS, so one fast client cannot fill
+ * the ring with blocks the others then have to evict.
+ *
+ * @param filename Source file
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @param block_num Block just served
+ * @param block_size Block size in bytes
+ * @param file_size File size, used to stop at the last block
+ */
+void prefetch_schedule(const char *filename, const ip_addr_t *ip, u16_t port,
+                       uint32_t block_num, uint32_t block_size,
+                       FSIZE_t file_size)
+{
+    prefetch_stream_t *st = NULL;
+    for (int i = 0; i < PREFETCH_STREAMS && !st; i++) {
+        if (stream_matches(&prefetch_streams[i], filename, ip, port))
+            st = &prefetch_streams[i];
+    }
+    uint32_t total_blocks =
+        block_size ? (file_size + block_size - 1) / block_size : 0;
+
+    if (block_num + 1 >= total_blocks) {
+        if (st)
+            st->active = false;
+        return;
+    }
+
+    if (!st) {
+        st = &prefetch_streams[0];
+        for (int i = 0; i < PREFETCH_STREAMS; i++) {
+            if (!prefetch_streams[i].active) {
+                st = &prefetch_streams[i];
+                break;
+            }
+            if (prefetch_streams[i].stamp < st->stamp)
+                st = &prefetch_streams[i];
+        }
+    }
+    st->active = true;
+
+    uint32_t active = 0;
+    for (int i = 0; i < PREFETCH_STREAMS; i++)
+        active += prefetch_streams[i].active;
+    uint32_t depth = PREFETCH_READ_SLOTS / active;
+    if (depth > PREFETCH_DEPTH)
+        depth = PREFETCH_DEPTH;
+    if (depth == 0)
+        depth = 1;
+
+    st->stamp = ++prefetch_stamp;
+    strncpy(st->filename, filename, FILE_CACHE_NAME_LEN - 1);
+    st->filename[FILE_CACHE_NAME_LEN - 1] = '\0';
+    st->ip = *ip;
+    st->port = port;
+    st->block_size = block_size;
+    st->file_size = file_size;
+    st->first_block = block_num + 1;
+    st->last_block = block_num + depth;
+    if (st->last_block > total_blocks - 1)
+        st->last_block = total_blocks - 1;
+}
+
+/**
+ * @brief Read ahead the next run of one stream's pending blocks.
+ *
+ * Consecutive missing blocks are loaded with one f_read, so a 1024-byte
+ * transfer moves 2 sectors per block in a single multi-block SD command.
+ * While the client's next block is already in the ring, the read waits
+ * until PREFETCH_RUN_MIN blocks are missing rather than fetching one block
+ * per request.
+ *
+ * @param st Active stream
+ * @return true if an SD read was performed
+ */
+static bool stream_poll(prefetch_stream_t *st)
+{
+    uint32_t first = st->first_block;
+    while (first <= st->last_block &&
+           slot_find(st->filename, &st->ip, st->port, first, st->block_size))
+        first++;
+    if (first > st->last_block) {
+        st->active = false;
+        return false;
+    }
+
+    prefetch_slot_t *run[PREFETCH_DEPTH];
+    uint32_t taken = 0;
+    uint32_t count = 0;
+    while (count < PREFETCH_DEPTH && first + count <= st->last_block &&
+           !slot_find(st->filename, &st->ip, st->port, first + count,
+                      st->block_size)) {
+        prefetch_slot_t *slot = slot_victim(false, taken);
+        if (!slot)
+            break;
+        taken |= 1u << (slot - prefetch_ring);
+        run[count++] = slot;
+    }
+    if (count == 0)
+        return false;  // Ring full of other streams' blocks; retry later
+
+    // Wait for a longer run unless the client is about to need this block
+    // or the window has already reached the end of the file
+    uint32_t total_blocks =
+        (st->file_size + st->block_size - 1) / st->block_size;
+    if (count < PREFETCH_RUN_MIN && first > st->first_block &&
+        st->last_block + 1 < total_blocks)
+        return false;
+
+    uint8_t *buf = (count == 1) ? run[0]->data : prefetch_run_buf;
+    for (uint32_t i = 0; i < count; i++)
+        run[i]->valid = false;
+
+    UINT bytes_read;
+    FSIZE_t file_size;
+    if (st->block_size > PREFETCH_BLOCK_SIZE ||
+        file_read_run(st->filename, &st->ip, st->port,
+                      (FSIZE_t) first * st->block_size, buf,
+                      count * st->block_size, &bytes_read,
+                      &file_size) != FR_OK) {
+        st->active = false;
+        return true;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        UINT start = i * st->block_size;
+        UINT len = 0;
+        if (bytes_read > start)
+            len = bytes_read - start;
+        if (len > st->block_size)
+            len = st->block_size;
+        slot_fill(run[i], st->filename, &st->ip, st->port, first + i,
+                  st->block_size, file_size, &buf[start], len);
+    }
+    prefetch_stats.reads += count;
+    prefetch_stats.runs++;
+    return true;
+}
+
+/**
+ * @brief Read ahead for the next stream that has work (call when idle).
+ *
+ * Streams are polled round robin starting after the last one served, so
+ * with several transfers active each gets one SD run in turn.
+ *
+ * @return true if an SD read was performed
+ */
+bool prefetch_poll(void)
+{
+    for (int i = 0; i < PREFETCH_STREAMS; i++) {
+        int idx = (prefetch_turn + i) % PREFETCH_STREAMS;
+        prefetch_stream_t *st = &prefetch_streams[idx];
+        if (st->active && stream_poll(st)) {
+            prefetch_turn = (uint8_t) ((idx + 1) % PREFETCH_STREAMS);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Drop pending read-ahead for a client.
+ * @param ip Client IP address
+ * @param port Client UDP port
+ */
+void prefetch_close_peer(const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < PREFETCH_STREAMS; i++) {
+        if (prefetch_streams[i].active && prefetch_streams[i].port == port &&
+            ip_addr_cmp(&prefetch_streams[i].ip, ip)) {
+            prefetch_streams[i].active = false;
+        }
+    }
+}
+
+/**
+ * @brief Drop ring contents and read-ahead for a file (e.g. after append).
+ * @param filename File that changed
+ */
+void prefetch_invalidate(const char *filename)
+{
+    for (int i = 0; i < PREFETCH_RING_SLOTS; i++) {
+        if (prefetch_ring[i].valid &&
+            strncmp(prefetch_ring[i].filename, filename,
+                    FILE_CACHE_NAME_LEN) == 0) {
+            prefetch_ring[i].valid = false;
+        }
+    }
+    for (int i = 0; i < PREFETCH_STREAMS; i++) {
+        if (prefetch_streams[i].active &&
+            strncmp(prefetch_streams[i].filename, filename,
+                    FILE_CACHE_NAME_LEN) == 0) {
+            prefetch_streams[i].active = false;
+        }
+    }
+}
+
+/**
+ * @brief Get hit/miss/read-ahead counters.
+ * @return Pointer to the live counters
+ */
+const prefetch_stats_t *prefetch_get_stats(void)
+{
+    return &prefetch_stats;
+}
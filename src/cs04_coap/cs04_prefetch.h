@@ -0,0 +1,86 @@
+#ifndef CS04_PREFETCH_H
+#define CS04_PREFETCH_H
+
+#include "ff.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "cs04_file_cache.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define PREFETCH_BLOCK_SIZE 1024  // Largest Block2 payload served
+#define PREFETCH_DEPTH 4          // Blocks read ahead of the last one served
+#define PREFETCH_RUN_MIN 2        // Missing blocks gathered into one SD read
+#define PREFETCH_PIN_MAX 5        // Slots held by sent responses (4 cached + 1)
+#define PREFETCH_STREAMS 4        // Transfers read ahead at once (sessions)
+#define PREFETCH_READ_SLOTS (PREFETCH_DEPTH * 2)  // Shared by active streams
+#define PREFETCH_RING_SLOTS (PREFETCH_READ_SLOTS + PREFETCH_PIN_MAX)
+
+// One Block2 payload held in RAM.
+typedef struct {
+    bool valid;                          // True if data holds a loaded block
+    char filename[FILE_CACHE_NAME_LEN];  // Source file
+    ip_addr_t ip;                        // Client the block was read for
+    u16_t port;                          // Client UDP port
+    uint32_t block_num;                  // Block number within the file
+    uint32_t block_size;                 // Block size used for the offset
+    FSIZE_t file_size;                   // File size when the block was read
+    uint16_t len;                        // Valid bytes in data
+    uint32_t stamp;                      // Load order, for slot recycling
+    uint8_t pins;                        // Live pbufs referencing data
+    uint8_t data[PREFETCH_BLOCK_SIZE];   // Block payload
+} prefetch_slot_t;
+
+// Prefetcher counters.
+typedef struct {
+    uint32_t hits;    // Requests answered from the ring
+    uint32_t misses;  // Requests that had to read the SD card
+    uint32_t reads;   // Blocks read ahead during idle time
+    uint32_t runs;    // f_read calls that loaded those blocks
+    uint32_t refs;    // Payloads handed out as PBUF_REF (no copy)
+    uint32_t copies;  // Payloads copied because PREFETCH_PIN_MAX were pinned
+} prefetch_stats_t;
+
+// Clears the ring, pending read-ahead and counters.
+void prefetch_init(void);
+
+// Returns the ring slot holding the block, or NULL (counts a hit or miss).
+const prefetch_slot_t *prefetch_lookup(const char *filename,
+                                       const ip_addr_t *ip, u16_t port,
+                                       uint32_t block_num,
+                                       uint32_t block_size);
+
+// Reads a block synchronously into the ring (used on a miss).
+// Returns NULL and sets *res on failure.
+const prefetch_slot_t *prefetch_load(const char *filename, const ip_addr_t *ip,
+                                     u16_t port, uint32_t block_num,
+                                     uint32_t block_size, FRESULT *res);
+
+// Returns a PBUF_RAW pbuf of the slot's bytes: a PBUF_REF to the slot, which
+// is not reused until the pbuf is freed, or a pool copy once PREFETCH_PIN_MAX
+// slots are pinned. NULL if out of memory. Core0 only (inline storage builds).
+struct pbuf *prefetch_payload_pbuf(const prefetch_slot_t *slot);
+
+// Queues read-ahead of the blocks following block_num for that client's
+// stream. Each active stream reads ahead an equal share of
+// PREFETCH_READ_SLOTS (at most PREFETCH_DEPTH blocks).
+void prefetch_schedule(const char *filename, const ip_addr_t *ip, u16_t port,
+                       uint32_t block_num, uint32_t block_size,
+                       FSIZE_t file_size);
+
+// Performs at most one queued read-ahead, loading a run of consecutive
+// blocks with a single f_read. Streams take turns, so concurrent transfers
+// share the card evenly. Returns true if SD work was done.
+bool prefetch_poll(void);
+
+// Drops pending read-ahead for a client (its transfers ended).
+void prefetch_close_peer(const ip_addr_t *ip, u16_t port);
+
+// Drops cached blocks and pending read-ahead for a file.
+void prefetch_invalidate(const char *filename);
+
+// Returns the prefetcher counters.
+const prefetch_stats_t *prefetch_get_stats(void);
+
+#endif  // CS04_PREFETCH_H
@@ -0,0 +1,332 @@
+#include "cs04_proxy_cache.h"
+#include <string.h>
+
+static proxy_entry_t entries[PROXY_RES_COUNT];
+static proxy_peer_t peers[PROXY_PEER_MAX];
+static proxy_stats_t stats;
+
+/**
+ * @brief Check whether a deadline is still ahead (wrap-safe).
+ */
+static bool before(uint32_t deadline_ms, uint32_t now_ms)
+{
+    return (int32_t) (deadline_ms - now_ms) > 0;
+}
+
+/**
+ * @brief Compare an option value with the cached ETag.
+ */
+static bool etag_matches(const proxy_entry_t *e, const coap_buffer_t *etag)
+{
+    return etag && e->etag_len > 0 && etag->len == e->etag_len &&
+           memcmp(etag->p, e->etag, e->etag_len) == 0;
+}
+
+/**
+ * @brief Transfer of a peer, or NULL if it is not tracked.
+ */
+static proxy_peer_t *peer_find(int8_t res, uint32_t addr, uint16_t port)
+{
+    for (int i = 0; i < PROXY_PEER_MAX; i++) {
+        if (peers[i].addr == addr && peers[i].port == port &&
+            peers[i].res == res)
+            return &peers[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Record that a peer began a transfer on the current copy.
+ *
+ * Reuses the peer's slot, else a free one, else the least recently served.
+ */
+static void peer_begin(int8_t res, uint32_t addr, uint16_t port,
+                       uint32_t version, uint32_t now_ms)
+{
+    proxy_peer_t *p = peer_find(res, addr, port);
+    for (int i = 0; !p && i < PROXY_PEER_MAX; i++) {
+        if (peers[i].addr == 0)
+            p = &peers[i];
+    }
+    if (!p) {
+        p = &peers[0];
+        for (int i = 1; i < PROXY_PEER_MAX; i++) {
+            if ((int32_t) (peers[i].last_ms - p->last_ms) < 0)
+                p = &peers[i];
+        }
+    }
+    p->addr = addr;
+    p->port = port;
+    p->res = res;
+    p->version = version;
+    p->last_ms = now_ms;
+}
+
+/**
+ * @brief Pick the resource from a path and query.
+ * @param path "file" selects the file resource (no leading slash)
+ * @param query Query text after '?', or NULL
+ */
+static proxy_resource_t resource_from_parts(const uint8_t *path,
+                                            size_t path_len,
+                                            const uint8_t *query,
+                                            size_t query_len)
+{
+    if (path_len != 4 || memcmp(path, "file", 4) != 0)
+        return PROXY_RES_NONE;
+    if (query && query_len >= 10 && memcmp(query, "type=image", 10) == 0)
+        return PROXY_RES_IMAGE;
+    return PROXY_RES_FILE;
+}
+
+/**
+ * @brief Resource named by a Proxy-Uri ("coap://host[:port]/file[?q]").
+ */
+static proxy_resource_t resource_from_uri(const coap_buffer_t *uri,
+                                          const char *origin_host)
+{
+    static const char scheme[] = "coap://";
+    const size_t scheme_len = sizeof(scheme) - 1;
+    if (uri->len <= scheme_len || memcmp(uri->p, scheme, scheme_len) != 0)
+        return PROXY_RES_NONE;
+
+    const uint8_t *p = uri->p + scheme_len;
+    const uint8_t *end = uri->p + uri->len;
+    const uint8_t *host = p;
+    while (p < end && *p != ':' && *p != '/')
+        p++;
+    size_t host_len = (size_t) (p - host);
+    if (host_len != strlen(origin_host) ||
+        memcmp(host, origin_host, host_len) != 0)
+        return PROXY_RES_NONE;  // Only the configured origin is proxied
+
+    while (p < end && *p != '/')
+        p++;  // Skip the port
+    if (p == end)
+        return PROXY_RES_NONE;
+    const uint8_t *path = ++p;
+    while (p < end && *p != '?')
+        p++;
+    size_t path_len = (size_t) (p - path);
+    const uint8_t *query = p < end ? p + 1 : NULL;
+    return resource_from_parts(path, path_len, query,
+                               query ? (size_t) (end - query) : 0);
+}
+
+/**
+ * @brief Forget every copy and clear the counters.
+ */
+void proxy_cache_init(void)
+{
+    memset(entries, 0, sizeof(entries));
+    memset(peers, 0, sizeof(peers));
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Cache entry of a resource.
+ */
+proxy_entry_t *proxy_cache_entry(proxy_resource_t res)
+{
+    if (res < 0 || res >= PROXY_RES_COUNT)
+        return NULL;
+    return &entries[res];
+}
+
+/**
+ * @brief Resource a downstream request asks for.
+ *
+ * A forward-proxy request (RFC 7252 section 5.7.2) carries the origin's URI
+ * in Proxy-Uri; one addressed to the proxy directly uses Uri-Path as it
+ * would with the origin.
+ *
+ * @param pkt Request
+ * @param origin_host Origin address as it appears in a Proxy-Uri
+ * @return Resource, or PROXY_RES_NONE
+ */
+proxy_resource_t proxy_resource_for(const coap_packet_t *pkt,
+                                    const char *origin_host)
+{
+    uint8_t count = 0;
+    const coap_option_t *uri = coap_findOptions(pkt, COAP_OPTION_PROXY_URI,
+                                                &count);
+    if (uri && count > 0)
+        return resource_from_uri(&uri->buf, origin_host);
+
+    const coap_option_t *path = coap_findOptions(pkt, COAP_OPTION_URI_PATH,
+                                                 &count);
+    if (!path || count != 1)
+        return PROXY_RES_NONE;
+    uint8_t query_count = 0;
+    const coap_option_t *query = coap_findOptions(pkt, COAP_OPTION_URI_QUERY,
+                                                  &query_count);
+    return resource_from_parts(path->buf.p, path->buf.len,
+                               query ? query->buf.p : NULL,
+                               query ? query->buf.len : 0);
+}
+
+/**
+ * @brief Decide how to answer a request for one block.
+ * @param e Cache entry of the resource
+ * @param addr IPv4 address of the requesting peer
+ * @param port Its UDP port
+ * @param block_num Requested block number
+ * @param etag Request ETag option (conditional GET), or NULL
+ * @param if_match Request If-Match option (resumed download), or NULL
+ * @param now_ms Current time (ms since boot)
+ * @return Action for the caller
+ */
+proxy_action_t proxy_lookup(proxy_entry_t *e, uint32_t addr, uint16_t port,
+                            uint32_t block_num, const coap_buffer_t *etag,
+                            const coap_buffer_t *if_match, uint32_t now_ms)
+{
+    int8_t res = (int8_t) (e - entries);
+    bool fresh = e->cached && before(e->fresh_until_ms, now_ms);
+
+    // A new transfer needs a fresh copy; blocks of one under way may come
+    // from a stale copy, which is the version the client started on
+    if (!e->cached || (block_num == 0 && !fresh && !if_match)) {
+        if (e->filling) {
+            stats.waits++;
+            return PROXY_WAIT;
+        }
+        stats.misses++;
+        return PROXY_FILL;
+    }
+
+    if (if_match && !etag_matches(e, if_match))
+        return PROXY_MISMATCH;
+    if (block_num == 0) {
+        peer_begin(res, addr, port, e->version, now_ms);
+        if (etag_matches(e, etag)) {
+            stats.validated++;
+            return PROXY_VALID;
+        }
+    } else if (!if_match) {
+        // Without If-Match only the peer's block 0 says which version it
+        // is assembling; a rewrite since then would mix two versions
+        proxy_peer_t *p = peer_find(res, addr, port);
+        if (!p || p->version != e->version) {
+            stats.restarted++;
+            return PROXY_MISMATCH;
+        }
+        p->last_ms = now_ms;
+    }
+    stats.hits++;
+    return PROXY_SERVE;
+}
+
+/**
+ * @brief Seconds of freshness left.
+ */
+uint32_t proxy_max_age_left(const proxy_entry_t *e, uint32_t now_ms)
+{
+    if (!e->cached || !before(e->fresh_until_ms, now_ms))
+        return 0;
+    return (e->fresh_until_ms - now_ms) / 1000;
+}
+
+/**
+ * @brief Note that an origin fetch is running.
+ */
+void proxy_fill_started(proxy_entry_t *e)
+{
+    e->filling = true;
+}
+
+/**
+ * @brief Note that the origin sent a new version and the card copy is
+ * being overwritten.
+ */
+void proxy_fill_replacing(proxy_entry_t *e)
+{
+    e->cached = false;
+    e->version++;  // Transfers begun on the old copy must start over
+}
+
+/**
+ * @brief Record a complete new version.
+ * @param e Cache entry
+ * @param etag Origin ETag (may be empty)
+ * @param etag_len ETag length
+ * @param size Body size on the card
+ * @param max_age_s Origin Max-Age
+ * @param now_ms Current time (ms since boot)
+ */
+void proxy_fill_content(proxy_entry_t *e, const uint8_t *etag,
+                        uint8_t etag_len, uint32_t size, uint32_t max_age_s,
+                        uint32_t now_ms)
+{
+    if (etag_len > COAP_ETAG_MAX)
+        etag_len = 0;
+    memcpy(e->etag, etag, etag_len);
+    e->etag_len = etag_len;
+    e->size = size;
+    e->cached = true;
+    e->filling = false;
+    e->fresh_until_ms = now_ms + max_age_s * 1000;
+    stats.origin_content++;
+}
+
+/**
+ * @brief Record that the origin confirmed the cached version (2.03).
+ */
+void proxy_fill_valid(proxy_entry_t *e, uint32_t max_age_s, uint32_t now_ms)
+{
+    e->filling = false;
+    e->fresh_until_ms = now_ms + max_age_s * 1000;
+    stats.origin_valid++;
+}
+
+/**
+ * @brief Record an origin fetch that ended without a new copy.
+ *
+ * A copy that was not touched stays, stale, for the next revalidation.
+ */
+void proxy_fill_failed(proxy_entry_t *e)
+{
+    e->filling = false;
+    stats.origin_failed++;
+}
+
+/**
+ * @brief Register a complete copy left on the card by an earlier run.
+ */
+void proxy_cache_restore(proxy_resource_t res, const uint8_t *etag,
+                         uint8_t etag_len, uint32_t size, uint32_t now_ms)
+{
+    proxy_entry_t *e = proxy_cache_entry(res);
+    if (!e || etag_len == 0 || etag_len > COAP_ETAG_MAX)
+        return;
+    memcpy(e->etag, etag, etag_len);
+    e->etag_len = etag_len;
+    e->size = size;
+    e->cached = true;
+    e->fresh_until_ms = now_ms;
+}
+
+/**
+ * @brief Mark a copy stale so the next transfer revalidates it.
+ */
+void proxy_cache_invalidate(proxy_resource_t res, uint32_t now_ms)
+{
+    proxy_entry_t *e = proxy_cache_entry(res);
+    if (e)
+        e->fresh_until_ms = now_ms;
+}
+
+/**
+ * @brief Count a request the proxy does not handle.
+ */
+void proxy_note_refused(void)
+{
+    stats.refused++;
+}
+
+/**
+ * @brief Get the proxy counters.
+ */
+const proxy_stats_t *proxy_cache_get_stats(void)
+{
+    return &stats;
+}
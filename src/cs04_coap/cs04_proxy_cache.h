@@ -0,0 +1,116 @@
+#ifndef CS04_PROXY_CACHE_H
+#define CS04_PROXY_CACHE_H
+
+#include "coap.h"
+#include "cs04_coap_codec.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define PROXY_RETRY_AFTER_S 2       // Max-Age of the 5.03 sent while filling
+#define PROXY_MAX_SZX 6             // Largest block served downstream (no BERT)
+#define PROXY_PEER_MAX 8            // Downstream transfers tracked at once
+
+// Response codes missing from microcoap's table (RFC 7252 section 5.9).
+#define PROXY_RSPCODE_METHOD_NOT_ALLOWED MAKE_RSPCODE(4, 5)
+#define PROXY_RSPCODE_NOT_SUPPORTED MAKE_RSPCODE(5, 5)
+
+// Origin resources the proxy caches.
+typedef enum {
+    PROXY_RES_NONE = -1,
+    PROXY_RES_FILE = 0,  // GET /file
+    PROXY_RES_IMAGE,     // GET /file?type=image
+    PROXY_RES_COUNT
+} proxy_resource_t;
+
+// How to answer a downstream request.
+typedef enum {
+    PROXY_SERVE,         // 2.05 from the cached copy
+    PROXY_VALID,         // The request's ETag is the cached one: 2.03
+    PROXY_MISMATCH,      // Another version than the transfer began on: 4.12
+    PROXY_FILL,          // Start an origin fetch, answer 5.03 meanwhile
+    PROXY_WAIT,          // Origin fetch running: 5.03
+} proxy_action_t;
+
+// Cached copy of one resource. The body lives on the SD card.
+typedef struct {
+    bool cached;              // A complete copy is on the card
+    bool filling;             // Origin fetch running
+    uint8_t etag_len;
+    uint8_t etag[COAP_ETAG_MAX];
+    uint32_t size;
+    uint32_t fresh_until_ms;  // Max-Age deadline (ms since boot)
+    uint32_t version;         // Bumped each time the card copy is rewritten
+} proxy_entry_t;
+
+// A downstream transfer: the peer and the copy version its block 0 was.
+typedef struct {
+    uint32_t addr;     // IPv4 address of the downstream client (0: free)
+    uint16_t port;
+    int8_t res;        // proxy_resource_t
+    uint32_t version;
+    uint32_t last_ms;  // Last block served (oldest is replaced first)
+} proxy_peer_t;
+
+// Proxy counters.
+typedef struct {
+    uint32_t hits;            // Blocks served from a cached copy
+    uint32_t validated;       // 2.03 sent downstream
+    uint32_t misses;          // Requests that started an origin fetch
+    uint32_t waits;           // 5.03 sent while a fetch was running
+    uint32_t origin_content;  // Origin fetches that brought a new version
+    uint32_t origin_valid;    // Origin 2.03: copy refreshed, nothing moved
+    uint32_t origin_failed;   // Origin fetches that ended without a copy
+    uint32_t refused;         // Requests for anything else (4.04 / 5.05)
+    uint32_t restarted;       // 4.12 to transfers begun on a replaced copy
+} proxy_stats_t;
+
+// Forgets every copy and clears the counters.
+void proxy_cache_init(void);
+
+proxy_entry_t *proxy_cache_entry(proxy_resource_t res);
+
+// Resource a request asks for: a Proxy-Uri naming origin_host, or Uri-Path
+// "file" with an optional "type=image" query. PROXY_RES_NONE otherwise.
+proxy_resource_t proxy_resource_for(const coap_packet_t *pkt,
+                                    const char *origin_host);
+
+// Decides the answer to peer (addr, port) for block_num of a resource.
+// etag/if_match are the request's ETag and If-Match options (NULL if
+// absent). Block 0 starts a transfer and needs a fresh copy; later blocks
+// of a transfer under way are served from the copy it began on. One without
+// If-Match is matched by peer, so a copy rewritten in the meantime (or a
+// peer no longer tracked) gets PROXY_MISMATCH and the client starts over.
+proxy_action_t proxy_lookup(proxy_entry_t *e, uint32_t addr, uint16_t port,
+                            uint32_t block_num, const coap_buffer_t *etag,
+                            const coap_buffer_t *if_match, uint32_t now_ms);
+
+// Seconds of freshness left, the Max-Age to send (0 once stale).
+uint32_t proxy_max_age_left(const proxy_entry_t *e, uint32_t now_ms);
+
+// Origin fetch bookkeeping: started; new content arriving (the copy on the
+// card is being replaced); complete new version; 2.03 for the current one;
+// ended without a copy.
+void proxy_fill_started(proxy_entry_t *e);
+void proxy_fill_replacing(proxy_entry_t *e);
+void proxy_fill_content(proxy_entry_t *e, const uint8_t *etag,
+                        uint8_t etag_len, uint32_t size, uint32_t max_age_s,
+                        uint32_t now_ms);
+void proxy_fill_valid(proxy_entry_t *e, uint32_t max_age_s, uint32_t now_ms);
+void proxy_fill_failed(proxy_entry_t *e);
+
+// Registers a complete copy found on the card at boot. It starts stale, so
+// the first transfer revalidates it with the origin.
+void proxy_cache_restore(proxy_resource_t res, const uint8_t *etag,
+                         uint8_t etag_len, uint32_t size, uint32_t now_ms);
+
+// Marks a copy stale (e.g. the origin notified a change); kept for
+// revalidation.
+void proxy_cache_invalidate(proxy_resource_t res, uint32_t now_ms);
+
+// Counts a request for a resource the proxy does not cache.
+void proxy_note_refused(void);
+
+const proxy_stats_t *proxy_cache_get_stats(void);
+
+#endif  // CS04_PROXY_CACHE_H
@@ -0,0 +1,201 @@
+#include "cs04_radio.h"
+#include "cs04_coap_codec.h"
+#include "cs04_log.h"
+#include "pico/cyw43_arch.h"
+
+static const char *const link_names[] = { "good", "fair", "poor" };
+
+static radio_stats_t stats;
+static bool sampled;
+static uint32_t next_sample_ms;
+static uint32_t last_active_ms;
+
+/**
+ * @brief Link level for an RSSI against thresholds raised by margin dB.
+ */
+static radio_link_t radio_level(int32_t rssi_dbm, int32_t margin)
+{
+    if (rssi_dbm < RADIO_RSSI_POOR + margin)
+        return RADIO_LINK_POOR;
+    if (rssi_dbm < RADIO_RSSI_FAIR + margin)
+        return RADIO_LINK_FAIR;
+    return RADIO_LINK_GOOD;
+}
+
+/**
+ * @brief Classify an RSSI sample.
+ *
+ * A worse level is taken at once, so transfers back off on the first bad
+ * sample; a better one only once the RSSI clears its threshold by
+ * RADIO_RSSI_HYSTERESIS.
+ *
+ * @param prev Current link quality
+ * @param rssi_dbm Smoothed RSSI
+ * @return New link quality
+ */
+radio_link_t radio_link_from_rssi(radio_link_t prev, int32_t rssi_dbm)
+{
+    radio_link_t level = radio_level(rssi_dbm, 0);
+    if (level >= prev)
+        return level;
+    level = radio_level(rssi_dbm, RADIO_RSSI_HYSTERESIS);
+    return level < prev ? level : prev;
+}
+
+/**
+ * @brief Largest block size for a link quality.
+ *
+ * BERT payloads are two IP fragments and losing either loses both, so they
+ * are kept for good links; a poor link gets blocks that fit one small
+ * datagram.
+ */
+uint8_t radio_szx_limit_for(radio_link_t link)
+{
+    switch (link) {
+    case RADIO_LINK_GOOD:
+        return COAP_BLOCK_SZX_BERT;
+    case RADIO_LINK_FAIR:
+        return COAP_BLOCK_SZX_MAX;
+    default:
+        return 5;
+    }
+}
+
+/**
+ * @brief Window size for a link quality.
+ *
+ * Fewer blocks in flight on a weak link means fewer retransmission timers
+ * expiring together after a fade.
+ *
+ * @param link Link quality
+ * @param window Window the caller would use on a good link
+ * @return Window to use (1..window)
+ */
+uint8_t radio_window_for(radio_link_t link, uint8_t window)
+{
+    if (link == RADIO_LINK_FAIR)
+        window = (uint8_t) ((window + 1) / 2);
+    else if (link == RADIO_LINK_POOR && window > RADIO_POOR_WINDOW)
+        window = RADIO_POOR_WINDOW;
+    return window ? window : 1;
+}
+
+/**
+ * @brief Switch CYW43 power management.
+ *
+ * With power-save on the radio sleeps between beacons, which saves power
+ * when idle but adds up to a beacon interval to every exchange.
+ */
+static void radio_set_power_save(bool on)
+{
+    int err = cyw43_wifi_pm(&cyw43_state,
+                            on ? CYW43_DEFAULT_PM : CYW43_NO_POWERSAVE_MODE);
+    if (err != 0) {
+        LOG_WARN("⚠️ cyw43_wifi_pm failed: %d\n", err);
+        return;
+    }
+    stats.power_save = on;
+    stats.pm_switches++;
+    LOG_DEBUG("Radio power-save %s\n", on ? "on" : "off");
+}
+
+/**
+ * @brief Take one RSSI sample and update the link quality.
+ */
+static void radio_sample(void)
+{
+    int32_t rssi = 0;
+    if (cyw43_wifi_get_rssi(&cyw43_state, &rssi) != 0) {
+        stats.rssi_failures++;
+        return;
+    }
+    stats.rssi_samples++;
+    stats.rssi_dbm = sampled ? (3 * stats.rssi_dbm + rssi) / 4 : rssi;
+    sampled = true;
+
+    radio_link_t link = radio_link_from_rssi(stats.link, stats.rssi_dbm);
+    if (link != stats.link) {
+        LOG_INFO("Radio link %s (RSSI %ld dBm)\n", link_names[link],
+                 (long) stats.rssi_dbm);
+        stats.link = link;
+    }
+}
+
+/**
+ * @brief Start the scheduler idle, with power-save on.
+ */
+void radio_init(void)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    stats = (radio_stats_t) { 0 };
+    sampled = false;
+    radio_sample();
+    radio_set_power_save(true);
+    next_sample_ms = now + RADIO_RSSI_PERIOD_MS;
+    last_active_ms = now;
+}
+
+/**
+ * @brief Update power-save and the RSSI sample.
+ * @param now_ms Current time (ms since boot)
+ * @param active true while block transfers are running
+ */
+void radio_poll(uint32_t now_ms, bool active)
+{
+    if (active) {
+        last_active_ms = now_ms;
+        if (stats.power_save)
+            radio_set_power_save(false);
+    } else if (!stats.power_save &&
+               now_ms - last_active_ms >= RADIO_IDLE_HOLD_MS) {
+        radio_set_power_save(true);
+    }
+
+    if ((int32_t) (now_ms - next_sample_ms) >= 0) {
+        radio_sample();
+        next_sample_ms = now_ms + RADIO_RSSI_PERIOD_MS;
+    }
+}
+
+/**
+ * @brief Current link quality.
+ */
+radio_link_t radio_link(void)
+{
+    return stats.link;
+}
+
+/**
+ * @brief Largest SZX for the current link.
+ */
+uint8_t radio_szx_limit(void)
+{
+    return radio_szx_limit_for(stats.link);
+}
+
+/**
+ * @brief Window size for the current link.
+ */
+uint8_t radio_window(uint8_t window)
+{
+    return radio_window_for(stats.link, window);
+}
+
+/**
+ * @brief Whether non-urgent traffic should wait for a better link.
+ */
+bool radio_defer_non_urgent(void)
+{
+    if (stats.link != RADIO_LINK_POOR)
+        return false;
+    stats.deferred++;
+    return true;
+}
+
+/**
+ * @brief Get the scheduler state and counters.
+ */
+const radio_stats_t *radio_get_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,63 @@
+#ifndef CS04_RADIO_H
+#define CS04_RADIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define RADIO_RSSI_PERIOD_MS 2000  // Between RSSI samples
+#define RADIO_RSSI_FAIR (-70)      // dBm: below this the link is fair
+#define RADIO_RSSI_POOR (-80)      // dBm: below this the link is poor
+#define RADIO_RSSI_HYSTERESIS 3    // dB above a threshold to climb back
+#define RADIO_IDLE_HOLD_MS 3000    // Idle this long before power-save resumes
+#define RADIO_POOR_DEFER_MS 5000   // Non-urgent notifications held on a poor link
+#define RADIO_POOR_WINDOW 2        // Blocks in flight on a poor link
+
+// Link quality from the smoothed RSSI.
+typedef enum {
+    RADIO_LINK_GOOD = 0,
+    RADIO_LINK_FAIR,  // Single-datagram blocks, half the window
+    RADIO_LINK_POOR,  // 512-byte blocks, RADIO_POOR_WINDOW, defer Observe
+} radio_link_t;
+
+// Radio scheduler state and counters.
+typedef struct {
+    int32_t rssi_dbm;        // Smoothed RSSI (0 before the first sample)
+    radio_link_t link;
+    bool power_save;         // CYW43 power management enabled
+    uint32_t pm_switches;    // Power-save changes
+    uint32_t rssi_samples;
+    uint32_t rssi_failures;  // cyw43_wifi_get_rssi() errors
+    uint32_t deferred;       // Notifications held for a poor link
+} radio_stats_t;
+
+// Link quality for an RSSI, given the previous quality. Moving to a better
+// level needs RADIO_RSSI_HYSTERESIS dB of margin, so a link near a
+// threshold does not flap.
+radio_link_t radio_link_from_rssi(radio_link_t prev, int32_t rssi_dbm);
+
+// Largest SZX worth sending or asking for at a link quality.
+uint8_t radio_szx_limit_for(radio_link_t link);
+
+// Blocks to keep in flight at a link quality, at most window (at least 1).
+uint8_t radio_window_for(radio_link_t link, uint8_t window);
+
+// Samples RSSI and enables power-save. Call once Wi-Fi is connected.
+void radio_init(void);
+
+// Main loop: power-save off while active (block transfers running), back
+// on after RADIO_IDLE_HOLD_MS idle; samples RSSI every RADIO_RSSI_PERIOD_MS.
+void radio_poll(uint32_t now_ms, bool active);
+
+// Current link quality and the limits that follow from it.
+radio_link_t radio_link(void);
+uint8_t radio_szx_limit(void);
+uint8_t radio_window(uint8_t window);
+
+// True if non-urgent traffic (e.g. /file notifications) should wait.
+// Counts each call that returns true.
+bool radio_defer_non_urgent(void);
+
+const radio_stats_t *radio_get_stats(void);
+
+#endif  // CS04_RADIO_H
@@ -0,0 +1,156 @@
+#include "cs04_storage_worker.h"
+#include "cs04_event_loop.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include <string.h>
+#include <stdio.h>
+
+#if CS04_STORAGE_CORE1
+#include "pico/multicore.h"
+#endif
+
+static storage_exec_fn worker_exec;
+static storage_idle_fn worker_idle;
+
+#if CS04_STORAGE_CORE1
+// Single-producer/single-consumer ring indices. Each index is written by
+// one core only; 32-bit aligned stores are atomic on the M0+, and the
+// barriers order slot contents against the index update.
+typedef struct {
+    volatile uint32_t head;  // Written by the producer
+    volatile uint32_t tail;  // Written by the consumer
+} spsc_index_t;
+
+static storage_request_t request_ring[STORAGE_QUEUE_DEPTH];
+static spsc_index_t request_idx;
+static storage_result_t result_ring[STORAGE_QUEUE_DEPTH];
+static spsc_index_t result_idx;
+
+/**
+ * @brief Check whether a ring has no free slot.
+ */
+static bool spsc_full(const spsc_index_t *idx)
+{
+    return idx->head - idx->tail >= STORAGE_QUEUE_DEPTH;
+}
+
+/**
+ * @brief Check whether a ring has nothing to consume.
+ */
+static bool spsc_empty(const spsc_index_t *idx)
+{
+    return idx->head == idx->tail;
+}
+#endif
+
+/**
+ * @brief Register the request executor and idle callback.
+ * @param exec Runs one storage request
+ * @param idle Background storage work, called when no request is queued
+ */
+void storage_worker_init(storage_exec_fn exec, storage_idle_fn idle)
+{
+    worker_exec = exec;
+    worker_idle = idle;
+#if CS04_STORAGE_CORE1
+    memset(&request_idx, 0, sizeof(request_idx));
+    memset(&result_idx, 0, sizeof(result_idx));
+#endif
+}
+
+/**
+ * @brief Queue a request for the storage core (core0 side).
+ * @param req Request to copy into the ring
+ * @return false if the ring is full
+ */
+bool storage_worker_submit(const storage_request_t *req)
+{
+#if !CS04_STORAGE_CORE1
+    (void) req;
+    return false;  // Requests run inline in single-core builds
+#else
+    if (spsc_full(&request_idx))
+        return false;
+
+    request_ring[request_idx.head % STORAGE_QUEUE_DEPTH] = *req;
+    __dmb();
+    request_idx.head++;
+    __sev();  // Wake core1 from __wfe
+    return true;
+#endif
+}
+
+/**
+ * @brief Take a completed result (core0 side).
+ * @param res Output: copy of the result
+ * @return false if no result is ready
+ */
+bool storage_worker_poll(storage_result_t *res)
+{
+#if !CS04_STORAGE_CORE1
+    (void) res;
+    return false;
+#else
+    if (spsc_empty(&result_idx))
+        return false;
+
+    __dmb();
+    *res = result_ring[result_idx.tail % STORAGE_QUEUE_DEPTH];
+    __dmb();
+    result_idx.tail++;
+    return true;
+#endif
+}
+
+#if CS04_STORAGE_CORE1
+/**
+ * @brief Core1 entry: run queued requests, otherwise do background work.
+ *
+ * A request is only taken once a result slot is free, so core1 never has
+ * to drop a completed response while core0 is busy.
+ */
+static void storage_core1_main(void)
+{
+    LOG_DEBUG("🧵 Storage worker running on core %u\n", get_core_num());
+
+    while (true) {
+        if (!spsc_empty(&request_idx) && !spsc_full(&result_idx)) {
+            __dmb();
+            const storage_request_t *req =
+                &request_ring[request_idx.tail % STORAGE_QUEUE_DEPTH];
+            storage_result_t *res =
+                &result_ring[result_idx.head % STORAGE_QUEUE_DEPTH];
+
+            bool respond = worker_exec(req, res);
+            __dmb();
+            request_idx.tail++;
+            if (respond) {
+                result_idx.head++;
+                event_post(EVENT_STORAGE);  // Wake core0 to send the ACK
+            }
+            continue;
+        }
+
+        bool busy = worker_idle &&
+                    worker_idle(to_ms_since_boot(get_absolute_time()));
+
+        if (!busy && spsc_empty(&request_idx))
+            best_effort_wfe_or_timeout(
+                make_timeout_time_ms(STORAGE_IDLE_WAIT_MS));
+    }
+}
+#endif
+
+/**
+ * @brief Launch the storage worker on core1.
+ *
+ * Without CS04_STORAGE_CORE1 the server runs storage requests inline and
+ * this is a no-op.
+ */
+void storage_worker_launch(void)
+{
+#if CS04_STORAGE_CORE1
+    multicore_launch_core1(storage_core1_main);
+#endif
+}
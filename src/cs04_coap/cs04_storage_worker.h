@@ -0,0 +1,102 @@
+#ifndef CS04_STORAGE_WORKER_H
+#define CS04_STORAGE_WORKER_H
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Configuration
+#define STORAGE_QUEUE_DEPTH 4        // Slots per direction (power of 2)
+#define STORAGE_REQUEST_DATA 512     // Largest iPATCH batch / Block1 block
+#define STORAGE_RESULT_DATA 2048     // Largest payload (a 2-unit BERT block)
+#define STORAGE_TOKEN_LEN 8
+#define STORAGE_NAME_LEN 32
+#define STORAGE_ETAG_LEN 8           // Longest ETag carried (RFC 7252 limit)
+#define STORAGE_IDLE_WAIT_MS 10      // Core1 sleep between idle ticks
+
+// Storage operations run on behalf of a CoAP request.
+typedef enum {
+    STORAGE_OP_GET_BLOCK,  // Read one Block2 block of a file
+    STORAGE_OP_FETCH,      // Read one block of a FETCH line range
+    STORAGE_OP_APPEND,     // Append a batch of lines (iPATCH)
+    STORAGE_OP_UPLOAD,     // Write one Block1 block of a PUT/iPATCH
+    STORAGE_OP_PEER_LOST   // Drop per-client state (no response)
+} storage_op_t;
+
+// Fields shared by requests and results to route the response.
+typedef struct {
+    uint8_t id_hi;                      // Message ID of the CON request
+    uint8_t id_lo;
+    uint8_t token[STORAGE_TOKEN_LEN];   // Request token
+    uint8_t token_len;
+    ip_addr_t ip;                       // Client address
+    u16_t port;                         // Client UDP port
+    bool confirmable;                   // Request was CON (needs the ACK)
+} storage_route_t;
+
+// Work item passed from the network side to the storage side.
+typedef struct {
+    storage_op_t op;
+    storage_route_t route;
+    char filename[STORAGE_NAME_LEN];     // GET: file to read; UPLOAD: target
+    uint32_t block_num;                  // GET/FETCH: requested block
+                                         // UPLOAD: Block1 NUM
+    uint8_t szx;                         // GET/FETCH/UPLOAD: block size
+                                         // exponent
+    bool more;                           // UPLOAD: Block1 M bit
+    bool replace;                        // UPLOAD: PUT (replace the file)
+    uint8_t etag[STORAGE_ETAG_LEN];      // GET: ETag the client holds
+    uint8_t etag_len;                    // GET: 0 if unconditional
+    bool if_match;                       // GET: etag is If-Match (resume)
+    bool blockwise;                      // FETCH: request carried Block2
+    int32_t start_line;                  // FETCH: first line (inclusive)
+    int32_t end_line;                    // FETCH: last line (inclusive)
+    bool durable;                        // APPEND: sync before responding
+    uint16_t lines;                      // APPEND: lines in data
+    uint16_t len;                        // APPEND/UPLOAD: payload length
+    uint8_t data[STORAGE_REQUEST_DATA];  // APPEND/UPLOAD: payload
+} storage_request_t;
+
+// Response description passed back to the network side.
+typedef struct {
+    storage_op_t op;
+    storage_route_t route;
+    uint8_t code;                       // CoAP response code
+    int16_t content_type;               // coap_content_type_t
+    bool block2;                        // Include a Block2 option
+    bool block1;                        // Include a Block1 option instead
+    uint32_t block_num;                 // Block2/Block1 NUM
+    bool more;                          // Block2/Block1 M bit
+    uint8_t szx;                        // Block2/Block1 SZX
+    bool complete;                      // Last block / operation finished
+    uint8_t etag[STORAGE_ETAG_LEN];     // GET block 0 / 2.03: file's ETag
+    uint8_t etag_len;                   // 0 if no ETag option
+    bool file_changed;                  // APPEND/UPLOAD: text file changed
+    uint16_t appended_len;              // APPEND: batch, in data after payload
+    struct pbuf *payload;               // Inline GET: payload chain, data unused
+    uint16_t len;                       // Payload length
+    uint8_t data[STORAGE_RESULT_DATA];  // Payload
+} storage_result_t;
+
+// Runs one request. Returns false if no response should be sent.
+typedef bool (*storage_exec_fn)(const storage_request_t *req,
+                                storage_result_t *res);
+
+// Background storage work (read-ahead, journal flushes, expiry).
+// Returns true if it did SD work and wants to be called again soon.
+typedef bool (*storage_idle_fn)(uint32_t now_ms);
+
+// Registers the functions run by the worker. Call before launch.
+void storage_worker_init(storage_exec_fn exec, storage_idle_fn idle);
+
+// Starts the worker loop on core1 (CS04_STORAGE_CORE1 builds only).
+void storage_worker_launch(void);
+
+// Core0: queues a request. Returns false if the request queue is full.
+bool storage_worker_submit(const storage_request_t *req);
+
+// Core0: takes the next completed result. Returns false if none is ready.
+bool storage_worker_poll(storage_result_t *res);
+
+#endif  // CS04_STORAGE_WORKER_H
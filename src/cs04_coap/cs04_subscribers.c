@@ -0,0 +1,408 @@
+#include "cs04_subscribers.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+#define SUB_NONE (-1)
+#define SUB_HASH_MASK (SUBSCRIBER_HASH_SIZE - 1)
+#define LINK_HASH_MASK (SUBSCRIBER_PENDING_SLOTS - 1)
+
+// msg_id of an outstanding CON notification and who it went to. Links are
+// reused oldest first; the retransmission queue gives up on a message long
+// before SUBSCRIBER_PENDING_SLOTS newer ones have been sent.
+typedef struct {
+    bool used;
+    uint16_t msg_id;
+    int8_t slot;
+    int8_t next;  // Next link in the same bucket
+} msg_link_t;
+
+static subscriber_t table[SUBSCRIBER_MAX];
+static int8_t buckets[SUBSCRIBER_HASH_SIZE];
+static int8_t free_head;  // Free entries, chained through hash_next
+static int8_t oldest;     // Least recently heard (next to go idle)
+static int8_t newest;
+static size_t active_count;
+
+static msg_link_t links[SUBSCRIBER_PENDING_SLOTS];
+static int8_t link_buckets[SUBSCRIBER_PENDING_SLOTS];
+static uint8_t link_head;
+
+/**
+ * @brief Hash a registration key to a bucket.
+ */
+static uint8_t sub_hash(const ip_addr_t *ip, u16_t port,
+                        const coap_buffer_t *token)
+{
+    uint32_t h = ip4_addr_get_u32(ip_2_ip4(ip)) ^ port;
+    for (size_t i = 0; i < token->len; i++)
+        h = (h ^ token->p[i]) * 0x01000193u;  // FNV-1a step
+    h *= 0x9E3779B1u;
+    return (uint8_t) ((h >> 24) & SUB_HASH_MASK);
+}
+
+/**
+ * @brief Check whether an entry matches a registration key.
+ */
+static bool sub_matches(const subscriber_t *s, const ip_addr_t *ip,
+                        u16_t port, const coap_buffer_t *token)
+{
+    return s->port == port && s->token.len == token->len &&
+           ip_addr_cmp(&s->ip, ip) &&
+           memcmp(s->token_data, token->p, token->len) == 0;
+}
+
+/**
+ * @brief Unlink an entry from the recency list.
+ */
+static void list_unlink(int idx)
+{
+    subscriber_t *s = &table[idx];
+    if (s->older != SUB_NONE)
+        table[s->older].newer = s->newer;
+    else
+        oldest = s->newer;
+    if (s->newer != SUB_NONE)
+        table[s->newer].older = s->older;
+    else
+        newest = s->older;
+}
+
+/**
+ * @brief Append an entry as the most recently heard.
+ */
+static void list_append(int idx)
+{
+    subscriber_t *s = &table[idx];
+    s->older = newest;
+    s->newer = SUB_NONE;
+    if (newest != SUB_NONE)
+        table[newest].newer = (int8_t) idx;
+    else
+        oldest = (int8_t) idx;
+    newest = (int8_t) idx;
+}
+
+/**
+ * @brief Mark an entry as just heard from: resets its idle timer.
+ */
+static void sub_touch(subscriber_t *s, uint32_t now_ms)
+{
+    int idx = (int) (s - table);
+    s->last_ack_ms = now_ms;
+    list_unlink(idx);
+    list_append(idx);
+}
+
+/**
+ * @brief Detach a link from its bucket and free it.
+ */
+static void link_release(int idx)
+{
+    msg_link_t *l = &links[idx];
+    if (!l->used)
+        return;
+
+    int8_t *p = &link_buckets[l->msg_id & LINK_HASH_MASK];
+    while (*p != SUB_NONE && *p != idx)
+        p = &links[*p].next;
+    if (*p == idx)
+        *p = l->next;
+    l->used = false;
+}
+
+/**
+ * @brief Find and forget the link for a msg_id.
+ * @return Subscriber slot it named, or SUB_NONE
+ */
+static int link_take(uint16_t msg_id)
+{
+    int idx = link_buckets[msg_id & LINK_HASH_MASK];
+    while (idx != SUB_NONE && links[idx].msg_id != msg_id)
+        idx = links[idx].next;
+    if (idx == SUB_NONE)
+        return SUB_NONE;
+
+    int slot = links[idx].slot;
+    link_release(idx);
+    return table[slot].active ? slot : SUB_NONE;
+}
+
+/**
+ * @brief Reset the registry.
+ */
+void subscribers_init(void)
+{
+    memset(table, 0, sizeof(table));
+    memset(buckets, SUB_NONE, sizeof(buckets));
+    for (int i = 0; i < SUBSCRIBER_MAX; i++)
+        table[i].hash_next = (int8_t) (i + 1 < SUBSCRIBER_MAX ? i + 1
+                                                             : SUB_NONE);
+    free_head = 0;
+    oldest = newest = SUB_NONE;
+    active_count = 0;
+
+    memset(links, 0, sizeof(links));
+    memset(link_buckets, SUB_NONE, sizeof(link_buckets));
+    link_head = 0;
+}
+
+/**
+ * @brief Find a registration.
+ * @param ip Observer address
+ * @param port Observer port
+ * @param token Registration token
+ * @return Subscriber, or NULL
+ */
+subscriber_t *subscriber_find(const ip_addr_t *ip, u16_t port,
+                              const coap_buffer_t *token)
+{
+    for (int idx = buckets[sub_hash(ip, port, token)]; idx != SUB_NONE;
+         idx = table[idx].hash_next) {
+        if (sub_matches(&table[idx], ip, port, token))
+            return &table[idx];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Register an observer.
+ *
+ * A repeated registration (same ip, port and token) refreshes the existing
+ * entry instead of taking a second slot.
+ *
+ * @param ip Observer address
+ * @param port Observer port
+ * @param token Registration token (truncated to SUBSCRIBER_TOKEN_LEN)
+ * @return Subscriber, or NULL if the registry is full
+ */
+subscriber_t *subscriber_add(const ip_addr_t *ip, u16_t port,
+                             const coap_buffer_t *token)
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    coap_buffer_t key = { token->p, token->len > SUBSCRIBER_TOKEN_LEN
+                                        ? SUBSCRIBER_TOKEN_LEN
+                                        : token->len };
+
+    subscriber_t *s = subscriber_find(ip, port, &key);
+    if (s) {
+        s->timeout_sessions = 0;
+        sub_touch(s, now);
+        return s;
+    }
+    if (free_head == SUB_NONE)
+        return NULL;
+
+    int idx = free_head;
+    s = &table[idx];
+    free_head = s->hash_next;
+
+    s->active = true;
+    s->ip = *ip;
+    s->port = port;
+    memcpy(s->token_data, key.p, key.len);
+    s->token.p = s->token_data;
+    s->token.len = key.len;
+    s->observe_seq = 0;
+    s->resource = SUBSCRIBER_BUTTONS;  // Unless the caller says otherwise
+    s->accept = 0;  // text/plain unless the caller records an Accept
+    s->file_pos = 0;
+    s->last_ack_ms = now;
+    s->timeout_sessions = 0;
+    s->sent = 0;
+    s->acked = 0;
+    s->failed = 0;
+    memset(&s->gate, 0, sizeof(s->gate));
+
+    int8_t *bucket = &buckets[sub_hash(ip, port, &s->token)];
+    s->hash_next = *bucket;
+    *bucket = (int8_t) idx;
+    list_append(idx);
+    active_count++;
+    return s;
+}
+
+/**
+ * @brief Remove a registration.
+ * @param sub Subscriber to drop
+ */
+void subscriber_remove(subscriber_t *sub)
+{
+    if (!sub || !sub->active)
+        return;
+
+    int idx = (int) (sub - table);
+    int8_t *p = &buckets[sub_hash(&sub->ip, sub->port, &sub->token)];
+    while (*p != SUB_NONE && *p != idx)
+        p = &table[*p].hash_next;
+    if (*p == idx)
+        *p = sub->hash_next;
+
+    list_unlink(idx);
+    for (int i = 0; i < SUBSCRIBER_PENDING_SLOTS; i++) {
+        if (links[i].used && links[i].slot == idx)
+            link_release(i);
+    }
+
+    sub->active = false;
+    sub->hash_next = free_head;
+    free_head = (int8_t) idx;
+    active_count--;
+}
+
+/**
+ * @brief Number of active registrations.
+ */
+size_t subscriber_count(void)
+{
+    return active_count;
+}
+
+/**
+ * @brief First registration in recency order (least recently heard).
+ */
+subscriber_t *subscriber_first(void)
+{
+    return oldest == SUB_NONE ? NULL : &table[oldest];
+}
+
+/**
+ * @brief Registration after sub in recency order, or NULL at the end.
+ */
+subscriber_t *subscriber_next(const subscriber_t *sub)
+{
+    return sub->newer == SUB_NONE ? NULL : &table[sub->newer];
+}
+
+/**
+ * @brief Slot number of a registration.
+ */
+int subscriber_slot(const subscriber_t *sub)
+{
+    return (int) (sub - table);
+}
+
+/**
+ * @brief Remember which subscriber a CON notification went to.
+ * @param sub Recipient
+ * @param msg_id Message ID of the notification
+ */
+void subscriber_track_msg(subscriber_t *sub, uint16_t msg_id)
+{
+    int idx = link_head;
+    link_head = (uint8_t) ((link_head + 1) % SUBSCRIBER_PENDING_SLOTS);
+    link_release(idx);
+
+    msg_link_t *l = &links[idx];
+    l->used = true;
+    l->msg_id = msg_id;
+    l->slot = (int8_t) subscriber_slot(sub);
+
+    int8_t *bucket = &link_buckets[msg_id & LINK_HASH_MASK];
+    l->next = *bucket;
+    *bucket = (int8_t) idx;
+}
+
+/**
+ * @brief Attribute an ACK to the subscriber its notification went to.
+ * @param msg_id Message ID being acknowledged
+ * @return Subscriber, or NULL if msg_id was not a tracked notification
+ */
+subscriber_t *subscriber_on_ack(uint16_t msg_id)
+{
+    int slot = link_take(msg_id);
+    if (slot == SUB_NONE)
+        return NULL;
+
+    subscriber_t *s = &table[slot];
+    s->timeout_sessions = 0;
+    s->acked++;
+    sub_touch(s, to_ms_since_boot(get_absolute_time()));
+    return s;
+}
+
+/**
+ * @brief Drop the subscriber that rejected a notification with RST.
+ * @param msg_id Message ID of the rejected notification
+ * @return true if msg_id was a tracked notification
+ */
+bool subscriber_on_reset(uint16_t msg_id)
+{
+    int slot = link_take(msg_id);
+    if (slot == SUB_NONE)
+        return false;
+
+    LOG_WARN("⚠ Subscriber %d reset the notification, removing\n", slot);
+    subscriber_remove(&table[slot]);
+    return true;
+}
+
+/**
+ * @brief Count a timeout session for a notification that was never ACKed.
+ * @param msg_id Message ID that ran out of retransmissions
+ * @return Subscriber if msg_id was its notification and it is still
+ *         registered, otherwise NULL
+ */
+subscriber_t *subscriber_on_timeout(uint16_t msg_id)
+{
+    int slot = link_take(msg_id);
+    if (slot == SUB_NONE)
+        return NULL;
+
+    subscriber_t *s = &table[slot];
+    s->timeout_sessions++;
+    LOG_WARN("⚠ Subscriber %d timeout session count: %lu\n", slot,
+           s->timeout_sessions);
+    if (s->timeout_sessions >= SUBSCRIBER_MAX_TIMEOUTS) {
+        LOG_WARN("⚠ Removing subscriber %d after %lu timeout sessions\n", slot,
+               s->timeout_sessions);
+        subscriber_remove(s);
+        return NULL;
+    }
+    return s;
+}
+
+/**
+ * @brief Handle subscribers that have not ACKed for the idle timeout.
+ *
+ * Only the head of the recency list can be due, so this stops at the first
+ * subscriber still within its timeout. An idle subscriber counts a timeout
+ * session and gets another idle period, and is removed at
+ * SUBSCRIBER_MAX_TIMEOUTS.
+ *
+ * @param now_ms Current time (ms since boot)
+ */
+void subscribers_expire(uint32_t now_ms)
+{
+    while (oldest != SUB_NONE) {
+        subscriber_t *s = &table[oldest];
+        uint32_t idle = now_ms - s->last_ack_ms;
+        if (idle < SUBSCRIBER_IDLE_TIMEOUT_MS)
+            break;
+
+        LOG_WARN("⚠ Subscriber %d timed out (no ACK for %lu ms)\n", oldest,
+               idle);
+        s->timeout_sessions++;
+        if (s->timeout_sessions >= SUBSCRIBER_MAX_TIMEOUTS) {
+            LOG_WARN("⚠ Removing subscriber %d after %lu timeout sessions\n",
+                   oldest, s->timeout_sessions);
+            subscriber_remove(s);
+        } else {
+            sub_touch(s, now_ms);
+        }
+    }
+}
+
+/**
+ * @brief When the least recently heard subscriber goes idle.
+ * @param deadline_ms Output: time (ms since boot)
+ * @return false if there are no subscribers
+ */
+bool subscriber_next_deadline(uint32_t *deadline_ms)
+{
+    if (oldest == SUB_NONE)
+        return false;
+    *deadline_ms = table[oldest].last_ack_ms + SUBSCRIBER_IDLE_TIMEOUT_MS;
+    return true;
+}
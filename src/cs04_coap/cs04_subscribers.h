@@ -0,0 +1,94 @@
+#ifndef CS04_SUBSCRIBERS_H
+#define CS04_SUBSCRIBERS_H
+
+#include "coap.h"
+#include "cs04_notify.h"
+#include "lwip/ip_addr.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#ifndef SUBSCRIBER_MAX
+#define SUBSCRIBER_MAX 32                  // Observers kept (build-time)
+#endif
+#define SUBSCRIBER_HASH_SIZE 64            // (ip, port, token) buckets, power of 2
+#define SUBSCRIBER_PENDING_SLOTS 32        // msg_id links (power of 2, >= SUBSCRIBER_MAX)
+#define SUBSCRIBER_TOKEN_LEN 8
+#define SUBSCRIBER_IDLE_TIMEOUT_MS (3 * 60 * 60 * 1000)  // No ACK for this long
+#define SUBSCRIBER_MAX_TIMEOUTS 3          // Timeout sessions before removal
+
+// Resources that can be observed.
+typedef enum {
+    SUBSCRIBER_BUTTONS = 0,  // /buttons: latest button state
+    SUBSCRIBER_FILE          // /file: lines appended to the text file
+} subscriber_resource_t;
+
+// One Observe registration, identified by (ip, port, token).
+typedef struct {
+    bool active;
+    uint8_t resource;                          // subscriber_resource_t
+    ip_addr_t ip;
+    u16_t port;
+    coap_buffer_t token;                       // Points at token_data
+    uint8_t token_data[SUBSCRIBER_TOKEN_LEN];
+    uint16_t observe_seq;                      // Next Observe value to send
+    uint16_t accept;                           // Content-Format of notifications
+    uint32_t file_pos;                         // /file: tail position sent up to
+    uint32_t last_ack_ms;                      // Last ACK (or registration)
+    uint32_t timeout_sessions;                 // Consecutive failed sessions
+    uint32_t sent;                             // Notifications sent
+    uint32_t acked;                            // CON notifications ACKed
+    uint32_t failed;                           // Sends that failed
+    notify_gate_t gate;                        // Notification coalescing
+    int8_t hash_next;                          // Registry links (internal)
+    int8_t older;
+    int8_t newer;
+} subscriber_t;
+
+// Clears the registry.
+void subscribers_init(void);
+
+// Registers an observer, or refreshes the existing registration with the
+// same (ip, port, token). Returns NULL if the registry is full.
+subscriber_t *subscriber_add(const ip_addr_t *ip, u16_t port,
+                             const coap_buffer_t *token);
+
+// Finds the registration for (ip, port, token), or NULL.
+subscriber_t *subscriber_find(const ip_addr_t *ip, u16_t port,
+                              const coap_buffer_t *token);
+
+// Drops a registration and any msg_ids linked to it.
+void subscriber_remove(subscriber_t *sub);
+
+// Active registrations, and iteration from least to most recently heard.
+size_t subscriber_count(void);
+subscriber_t *subscriber_first(void);
+subscriber_t *subscriber_next(const subscriber_t *sub);
+
+// Stable slot number of a registration (0..SUBSCRIBER_MAX-1).
+int subscriber_slot(const subscriber_t *sub);
+
+// Links the msg_id of a CON notification to its subscriber.
+void subscriber_track_msg(subscriber_t *sub, uint16_t msg_id);
+
+// ACK for msg_id: returns the subscriber it was sent to (NULL if it was not
+// a tracked notification) after resetting its timeouts and idle timer.
+subscriber_t *subscriber_on_ack(uint16_t msg_id);
+
+// RST for msg_id: the observer has gone away (RFC 7641 section 3.6), so its
+// registration is removed. Returns true if msg_id was a notification.
+bool subscriber_on_reset(uint16_t msg_id);
+
+// Retransmissions of msg_id gave up: counts a timeout session for its
+// subscriber and removes it at SUBSCRIBER_MAX_TIMEOUTS. Returns the
+// subscriber if it is still registered, otherwise NULL.
+subscriber_t *subscriber_on_timeout(uint16_t msg_id);
+
+// Handles subscribers idle for SUBSCRIBER_IDLE_TIMEOUT_MS.
+void subscribers_expire(uint32_t now_ms);
+
+// Time the least recently heard subscriber goes idle. false if none.
+bool subscriber_next_deadline(uint32_t *deadline_ms);
+
+#endif  // CS04_SUBSCRIBERS_H
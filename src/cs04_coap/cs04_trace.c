@@ -0,0 +1,186 @@
+#include "cs04_trace.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include <string.h>
+#include <stdio.h>
+
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+// State written by one core only. head counts events ever recorded; a
+// reader on the other core may see a slot being overwritten, which only
+// costs a stale entry in a diagnostic dump.
+typedef struct {
+    trace_event_t ring[TRACE_RING_SIZE];
+    volatile uint32_t head;
+    trace_histogram_t hist[TRACE_STAGES];
+} trace_core_t;
+
+static trace_core_t cores[TRACE_CORES];
+
+static const char *const stage_names[TRACE_STAGES] = {
+    [TRACE_PARSE] = "parse",     [TRACE_HANDLER] = "handler",
+    [TRACE_STORAGE] = "storage", [TRACE_BUILD] = "build",
+    [TRACE_SEND] = "send",       [TRACE_ACK] = "ack",
+    [TRACE_REQUEST] = "request",
+};
+
+/**
+ * @brief Histogram bucket of a duration: floor(log2(us)), capped.
+ */
+static unsigned trace_bucket(uint32_t us)
+{
+    unsigned b = 0;
+    while (us > 1 && b < TRACE_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/**
+ * @brief Clear all rings and histograms.
+ */
+void trace_init(void)
+{
+    memset(cores, 0, sizeof(cores));
+}
+
+/**
+ * @brief Read the 1 MHz system timer.
+ */
+uint32_t trace_now(void)
+{
+    return time_us_32();
+}
+
+/**
+ * @brief Record one stage on the calling core.
+ * @param stage Stage that just finished
+ * @param start_us trace_now() when it started
+ * @return End time, to start the next stage from
+ */
+uint32_t trace_lap(trace_stage_t stage, uint32_t start_us)
+{
+    uint32_t now = time_us_32();
+    uint32_t us = now - start_us;
+    trace_core_t *c = &cores[get_core_num() & (TRACE_CORES - 1)];
+
+    trace_event_t *e = &c->ring[c->head & TRACE_RING_MASK];
+    e->start_us = start_us;
+    e->duration_us = us;
+    e->stage = (uint8_t) stage;
+    __dmb();  // Slot contents before the index
+    c->head++;
+
+    trace_histogram_t *h = &c->hist[stage];
+    h->count++;
+    h->total_us += us;
+    if (us > h->max_us)
+        h->max_us = us;
+    h->buckets[trace_bucket(us)]++;
+    return now;
+}
+
+/**
+ * @brief Sum a stage's histograms over both cores.
+ * @param stage Stage
+ * @param out Output histogram
+ */
+void trace_get_histogram(trace_stage_t stage, trace_histogram_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < TRACE_CORES; i++) {
+        const trace_histogram_t *h = &cores[i].hist[stage];
+        out->count += h->count;
+        out->total_us += h->total_us;
+        if (h->max_us > out->max_us)
+            out->max_us = h->max_us;
+        for (int b = 0; b < TRACE_BUCKETS; b++)
+            out->buckets[b] += h->buckets[b];
+    }
+}
+
+/**
+ * @brief Estimate a percentile from the log2 buckets.
+ * @param h Histogram
+ * @param pct Percentile (1-100)
+ * @return Upper bound of its bucket in us, or 0 if empty
+ */
+uint32_t trace_percentile_us(const trace_histogram_t *h, unsigned pct)
+{
+    if (h->count == 0)
+        return 0;
+
+    uint32_t rank = (uint32_t) (((uint64_t) h->count * pct + 99) / 100);
+    uint32_t seen = 0;
+    for (unsigned b = 0; b < TRACE_BUCKETS - 1; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank)
+            return 2u << b;
+    }
+    return h->max_us;
+}
+
+/**
+ * @brief Copy a core's most recent events.
+ * @param core Core number
+ * @param out Output events, oldest first
+ * @param max Capacity of out
+ * @return Events copied
+ */
+size_t trace_recent(unsigned core, trace_event_t *out, size_t max)
+{
+    if (core >= TRACE_CORES)
+        return 0;
+
+    const trace_core_t *c = &cores[core];
+    uint32_t head = c->head;
+    __dmb();  // Index before the slots it covers
+    size_t n = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    if (n > max)
+        n = max;
+    for (size_t i = 0; i < n; i++)
+        out[i] = c->ring[(head - n + i) & TRACE_RING_MASK];
+    return n;
+}
+
+/**
+ * @brief Name of a stage.
+ */
+const char *trace_stage_name(trace_stage_t stage)
+{
+    return stage < TRACE_STAGES ? stage_names[stage] : "?";
+}
+
+/**
+ * @brief Format the per-stage summary as text.
+ * @param buf Output buffer
+ * @param cap Buffer size
+ * @return Length written
+ */
+size_t trace_format(char *buf, size_t cap)
+{
+    size_t len = 0;
+    if (cap == 0)
+        return 0;
+    buf[0] = '\0';
+
+    for (int s = 0; s < TRACE_STAGES && len < cap; s++) {
+        trace_histogram_t h;
+        trace_get_histogram((trace_stage_t) s, &h);
+        if (h.count == 0)
+            continue;
+
+        int n = snprintf(&buf[len], cap - len,
+                         "%s n=%lu avg=%lu max=%lu p50<%lu p99<%lu\n",
+                         stage_names[s], (unsigned long) h.count,
+                         (unsigned long) (h.total_us / h.count),
+                         (unsigned long) h.max_us,
+                         (unsigned long) trace_percentile_us(&h, 50),
+                         (unsigned long) trace_percentile_us(&h, 99));
+        if (n < 0)
+            break;
+        len += (size_t) n < cap - len ? (size_t) n : cap - len - 1;
+    }
+    return len;
+}
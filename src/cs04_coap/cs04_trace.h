@@ -0,0 +1,89 @@
+#ifndef CS04_TRACE_H
+#define CS04_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define TRACE_RING_SIZE 64  // Events kept per core (power of 2)
+#define TRACE_BUCKETS 16    // log2(us) buckets: 0-1 us ... 32 ms and up
+#define TRACE_CORES 2
+
+// Stages timed on the server's request path.
+typedef enum {
+    TRACE_PARSE = 0,  // Datagram received -> CoAP parsed
+    TRACE_HANDLER,    // Route lookup and handler (inline SD work included)
+    TRACE_STORAGE,    // One storage request, on whichever core runs it
+    TRACE_BUILD,      // Response encoded into a pbuf
+    TRACE_SEND,       // udp_sendto of the response
+    TRACE_ACK,        // Handling of an ACK for one of our CONs
+    TRACE_REQUEST,    // Datagram received -> response sent
+    TRACE_STAGES
+} trace_stage_t;
+
+// One timed stage, as kept in the per-core event ring.
+typedef struct {
+    uint32_t start_us;     // time_us_32() at the start
+    uint32_t duration_us;
+    uint8_t stage;         // trace_stage_t
+} trace_event_t;
+
+// Durations of one stage. Bucket b holds durations of 2^b to 2^(b+1) - 1
+// us (bucket 0 also holds 0); the last bucket has no upper bound.
+typedef struct {
+    uint32_t count;
+    uint32_t total_us;
+    uint32_t max_us;
+    uint32_t buckets[TRACE_BUCKETS];
+} trace_histogram_t;
+
+// Instrumentation points. With CS04_TRACE unset they compile to nothing, so
+// an untraced build pays no cost:
+//   uint32_t t = TRACE_START();
+//   ...parse...
+//   t = TRACE_LAP(TRACE_PARSE, t);  // Records the stage, restarts the clock
+#if CS04_TRACE
+#define TRACE_START() trace_now()
+#define TRACE_LAP(stage, start) trace_lap((stage), (start))
+#else
+static inline uint32_t trace_off(uint32_t start)
+{
+    (void) start;
+    return 0;
+}
+#define TRACE_START() 0u
+#define TRACE_LAP(stage, start) trace_off(start)
+#endif
+
+// Clears the rings and histograms.
+void trace_init(void);
+
+// Current time from the 1 MHz system timer.
+uint32_t trace_now(void);
+
+// Records a stage that started at start_us on the calling core. Lock-free:
+// each core only writes its own ring and histograms. Returns the time used
+// as the end, so the next stage can start from it.
+uint32_t trace_lap(trace_stage_t stage, uint32_t start_us);
+
+// Sums a stage's histograms over both cores.
+void trace_get_histogram(trace_stage_t stage, trace_histogram_t *out);
+
+// Upper bound (us) of the bucket holding the pct-th percentile; max_us for
+// the last bucket. 0 if the histogram is empty.
+uint32_t trace_percentile_us(const trace_histogram_t *h, unsigned pct);
+
+// Copies up to max of a core's most recent events, oldest first. Returns
+// the number copied.
+size_t trace_recent(unsigned core, trace_event_t *out, size_t max);
+
+// Short name of a stage ("parse", "handler", ...).
+const char *trace_stage_name(trace_stage_t stage);
+
+// Writes one text line per stage that has samples:
+// "<stage> n=<count> avg=<us> max=<us> p50<<us> p99<<us>". Returns the
+// length written (truncated to fit cap).
+size_t trace_format(char *buf, size_t cap);
+
+#endif  // CS04_TRACE_H
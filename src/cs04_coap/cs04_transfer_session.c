@@ -0,0 +1,157 @@
+#include "cs04_transfer_session.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+static transfer_session_t sessions[TRANSFER_SESSION_MAX];
+
+/**
+ * @brief Check whether a session belongs to (token, client).
+ */
+static bool session_matches(const transfer_session_t *s,
+                            const coap_buffer_t *tok, const ip_addr_t *ip,
+                            u16_t port)
+{
+    return s->active && s->port == port && ip_addr_cmp(&s->ip, ip) &&
+           s->token_len == tok->len &&
+           memcmp(s->token, tok->p, tok->len) == 0;
+}
+
+/**
+ * @brief Clear all transfer sessions.
+ */
+void transfer_session_init(void)
+{
+    memset(sessions, 0, sizeof(sessions));
+}
+
+/**
+ * @brief Find the session for a client's token.
+ * @param tok Request token
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @return Session, or NULL if none
+ */
+transfer_session_t *transfer_session_find(const coap_buffer_t *tok,
+                                          const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < TRANSFER_SESSION_MAX; i++) {
+        if (session_matches(&sessions[i], tok, ip, port))
+            return &sessions[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start a session, or restart the one already using the token.
+ *
+ * Unlike FETCH cursors, a live session is never recycled for a newcomer:
+ * that would only trade one stalled transfer for another. Idle sessions
+ * are dropped first, so a client that vanished does not hold a slot for
+ * longer than TRANSFER_SESSION_IDLE_MS.
+ *
+ * @param tok Request token
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @param filename File the transfer reads
+ * @return Session, or NULL if the table is full or the token too long
+ */
+transfer_session_t *transfer_session_open(const coap_buffer_t *tok,
+                                          const ip_addr_t *ip, u16_t port,
+                                          const char *filename)
+{
+    if (tok->len > TRANSFER_SESSION_TOKEN_LEN)
+        return NULL;
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    transfer_session_t *s = transfer_session_find(tok, ip, port);
+    if (!s) {
+        transfer_session_expire(now);
+        for (int i = 0; i < TRANSFER_SESSION_MAX && !s; i++) {
+            if (!sessions[i].active)
+                s = &sessions[i];
+        }
+        if (!s)
+            return NULL;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->active = true;
+    s->token_len = (uint8_t) tok->len;
+    memcpy(s->token, tok->p, tok->len);
+    s->ip = *ip;
+    s->port = port;
+    strncpy(s->filename, filename, TRANSFER_SESSION_NAME_LEN - 1);
+    s->started_ms = now;
+    s->last_used_ms = now;
+    return s;
+}
+
+/**
+ * @brief Record a served response.
+ * @param s Session
+ * @param last_block Last block number the response covers
+ * @param len Payload bytes
+ */
+void transfer_session_note_block(transfer_session_t *s, uint32_t last_block,
+                                 size_t len)
+{
+    if (last_block + 1 > s->next_block)
+        s->next_block = last_block + 1;
+    s->blocks++;
+    s->bytes += len;
+    s->last_used_ms = to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * @brief End a session.
+ * @param s Session to release
+ */
+void transfer_session_close(transfer_session_t *s)
+{
+    s->active = false;
+}
+
+/**
+ * @brief End every session belonging to a client.
+ * @param ip Client IP address
+ * @param port Client UDP port
+ */
+void transfer_session_close_peer(const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < TRANSFER_SESSION_MAX; i++) {
+        if (sessions[i].active && sessions[i].port == port &&
+            ip_addr_cmp(&sessions[i].ip, ip)) {
+            sessions[i].active = false;
+        }
+    }
+}
+
+/**
+ * @brief Count active sessions.
+ * @return Sessions in use
+ */
+size_t transfer_session_count(void)
+{
+    size_t n = 0;
+    for (int i = 0; i < TRANSFER_SESSION_MAX; i++)
+        n += sessions[i].active;
+    return n;
+}
+
+/**
+ * @brief End sessions that have been idle for TRANSFER_SESSION_IDLE_MS.
+ * @param now_ms Current time in ms since boot
+ */
+void transfer_session_expire(uint32_t now_ms)
+{
+    for (int i = 0; i < TRANSFER_SESSION_MAX; i++) {
+        transfer_session_t *s = &sessions[i];
+        if (s->active && now_ms - s->last_used_ms > TRANSFER_SESSION_IDLE_MS) {
+            LOG_DEBUG("📂 Ending idle transfer of %s for %s:%d (block %lu)\n",
+                   s->filename, ip4addr_ntoa(&s->ip), s->port, s->next_block);
+            s->active = false;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef CS04_TRANSFER_SESSION_H
+#define CS04_TRANSFER_SESSION_H
+
+#include "ff.h"
+#include "lwip/ip_addr.h"
+#include "coap.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#ifndef TRANSFER_SESSION_MAX
+#define TRANSFER_SESSION_MAX 4          // Concurrent GET /file transfers
+#endif
+#define TRANSFER_SESSION_IDLE_MS 10000  // End sessions without a request
+#define TRANSFER_SESSION_TOKEN_LEN 8    // Longest CoAP token
+#define TRANSFER_SESSION_NAME_LEN 32
+
+// One blockwise GET in progress, keyed by client and token. Its file handle
+// (cs04_file_cache) and read-ahead stream (cs04_prefetch) are keyed by the
+// same client, so each session keeps its own cursor and buffered blocks.
+typedef struct {
+    bool active;                                // True if slot is in use
+    uint8_t token[TRANSFER_SESSION_TOKEN_LEN];  // Request token
+    uint8_t token_len;                          // Token length
+    ip_addr_t ip;                               // Client IP address
+    u16_t port;                                 // Client UDP port
+    char filename[TRANSFER_SESSION_NAME_LEN];   // File being sent
+    uint32_t next_block;                        // One past the highest served
+    uint32_t blocks;                            // Responses built (repeats too)
+    uint32_t bytes;                             // Payload bytes sent
+    uint32_t started_ms;                        // Time of the first request
+    uint32_t last_used_ms;                      // For idle expiry
+} transfer_session_t;
+
+// Clears the table.
+void transfer_session_init(void);
+
+// Returns the session for (token, client), or NULL.
+transfer_session_t *transfer_session_find(const coap_buffer_t *tok,
+                                          const ip_addr_t *ip, u16_t port);
+
+// Starts (or restarts) the session for (token, client) on filename. Returns
+// NULL when TRANSFER_SESSION_MAX other transfers are active, or the token is
+// too long.
+transfer_session_t *transfer_session_open(const coap_buffer_t *tok,
+                                          const ip_addr_t *ip, u16_t port,
+                                          const char *filename);
+
+// Records a response covering blocks up to last_block.
+void transfer_session_note_block(transfer_session_t *s, uint32_t last_block,
+                                 size_t len);
+
+// Ends a session.
+void transfer_session_close(transfer_session_t *s);
+
+// Ends every session of a client.
+void transfer_session_close_peer(const ip_addr_t *ip, u16_t port);
+
+// Returns the number of active sessions.
+size_t transfer_session_count(void);
+
+// Ends sessions idle for longer than TRANSFER_SESSION_IDLE_MS.
+void transfer_session_expire(uint32_t now_ms);
+
+#endif  // CS04_TRANSFER_SESSION_H
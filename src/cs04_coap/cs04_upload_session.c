@@ -0,0 +1,301 @@
+#include "cs04_upload_session.h"
+#include "cs04_append_journal.h"
+#include "cs04_file_cache.h"
+#include "cs04_prefetch.h"
+#include "cs04_hot_cache.h"
+#include "cs04_line_index.h"
+#include "cs04_coap_packet.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+static upload_session_t uploads[UPLOAD_SESSION_MAX];
+static uint8_t copy_buf[512];  // Staging file to target, one sector at a time
+
+/**
+ * @brief Check whether a session belongs to (token, client).
+ */
+static bool upload_matches(const upload_session_t *s, const coap_buffer_t *tok,
+                           const ip_addr_t *ip, u16_t port)
+{
+    return s->active && s->port == port && ip_addr_cmp(&s->ip, ip) &&
+           s->token_len == tok->len &&
+           memcmp(s->token, tok->p, tok->len) == 0;
+}
+
+/**
+ * @brief Clear all upload sessions.
+ */
+void upload_session_init(void)
+{
+    memset(uploads, 0, sizeof(uploads));
+}
+
+/**
+ * @brief Find the upload for a client's token.
+ * @param tok Request token
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @return Session, or NULL if none
+ */
+upload_session_t *upload_session_find(const coap_buffer_t *tok,
+                                      const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < UPLOAD_SESSION_MAX; i++) {
+        if (upload_matches(&uploads[i], tok, ip, port))
+            return &uploads[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start an upload, or restart the one already using the token.
+ *
+ * Each slot has its own staging file, created empty here, so an aborted
+ * upload never touches the target.
+ *
+ * @param tok Request token
+ * @param ip Client IP address
+ * @param port Client UDP port
+ * @param target File the upload replaces or appends to
+ * @param replace PUT (replace) rather than iPATCH (append)
+ * @param szx Block size exponent of the upload
+ * @return Session, or NULL if full, the token is too long, or the staging
+ *         file cannot be created
+ */
+upload_session_t *upload_session_open(const coap_buffer_t *tok,
+                                      const ip_addr_t *ip, u16_t port,
+                                      const char *target, bool replace,
+                                      uint8_t szx)
+{
+    if (tok->len > UPLOAD_TOKEN_LEN)
+        return NULL;
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    upload_session_t *s = upload_session_find(tok, ip, port);
+    if (s) {
+        f_close(&s->file);
+    } else {
+        upload_session_expire(now);
+        for (int i = 0; i < UPLOAD_SESSION_MAX && !s; i++) {
+            if (!uploads[i].active)
+                s = &uploads[i];
+        }
+        if (!s)
+            return NULL;
+    }
+
+    memset(s, 0, sizeof(*s));
+    snprintf(s->staging, UPLOAD_NAME_LEN, "upload%d.tmp",
+             (int) (s - uploads));
+    if (f_open(&s->file, s->staging, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+        return NULL;
+
+    s->active = true;
+    s->token_len = (uint8_t) tok->len;
+    memcpy(s->token, tok->p, tok->len);
+    s->ip = *ip;
+    s->port = port;
+    strncpy(s->target, target, UPLOAD_NAME_LEN - 1);
+    s->replace = replace;
+    s->szx = szx;
+    block_window_init(&s->window, UPLOAD_WINDOW);
+    s->last_used_ms = now;
+    return s;
+}
+
+/**
+ * @brief Write one block to its place in the staging file.
+ *
+ * The window only accepts blocks within UPLOAD_WINDOW of the oldest hole,
+ * so the staging file never grows far past what has been received.
+ *
+ * @param s Session
+ * @param block_num Block number from the Block1 option
+ * @param more M bit from the Block1 option
+ * @param data Block payload
+ * @param len Payload length
+ * @return What happened to the block
+ */
+upload_result_t upload_session_put(upload_session_t *s, uint32_t block_num,
+                                   bool more, const uint8_t *data, size_t len)
+{
+    uint32_t size = coap_block_size_from_szx(s->szx);
+    if (len > size || (more && len != size))
+        return UPLOAD_BAD_BLOCK;
+    if ((uint64_t) block_num * size + len > UPLOAD_MAX_BYTES)
+        return UPLOAD_TOO_LARGE;
+
+    s->last_used_ms = to_ms_since_boot(get_absolute_time());
+    block_window_result_t r = block_window_on_block(&s->window, block_num,
+                                                    more, false);
+    if (r == BLOCK_WINDOW_DUPLICATE)
+        return UPLOAD_DUPLICATE;
+    if (r != BLOCK_WINDOW_ACCEPTED)
+        return UPLOAD_OUT_OF_RANGE;
+
+    // Seeking past the end extends the file, leaving room for the holes
+    UINT written = 0;
+    FRESULT fr = f_lseek(&s->file, (FSIZE_t) block_num * size);
+    if (fr == FR_OK && len > 0)
+        fr = f_write(&s->file, data, (UINT) len, &written);
+    if (fr != FR_OK || written != len)
+        return UPLOAD_WRITE_ERROR;
+
+    s->bytes += len;
+    return block_window_complete(&s->window) ? UPLOAD_COMPLETE
+                                             : UPLOAD_STORED;
+}
+
+/**
+ * @brief Copy the staging file onto the end of the target.
+ *
+ * The line index follows each chunk, and a missing final newline is added
+ * so the next iPATCH line starts on its own line, as a single-datagram
+ * append would.
+ *
+ * @param s Session (staging file closed)
+ * @param lines Output: newlines appended
+ * @return FATFS result
+ */
+static FRESULT upload_append(upload_session_t *s, uint32_t *lines)
+{
+    FIL src, dst;
+    FRESULT fr = f_open(&src, s->staging, FA_READ);
+    if (fr != FR_OK)
+        return fr;
+    fr = f_open(&dst, s->target, FA_OPEN_APPEND | FA_WRITE);
+    if (fr != FR_OK) {
+        f_close(&src);
+        return fr;
+    }
+
+    uint8_t last = '\n';
+    UINT n = 0;
+    while (fr == FR_OK) {
+        fr = f_read(&src, copy_buf, sizeof(copy_buf), &n);
+        if (fr != FR_OK || n == 0)
+            break;
+        FSIZE_t offset = f_size(&dst);
+        UINT written = 0;
+        fr = f_write(&dst, copy_buf, n, &written);
+        if (fr == FR_OK && written != n)
+            fr = FR_DENIED;  // Card full
+        if (fr != FR_OK)
+            break;
+        line_index_append(s->target, offset, copy_buf, n);
+        for (UINT i = 0; i < n; i++)
+            *lines += copy_buf[i] == '\n';
+        last = copy_buf[n - 1];
+    }
+
+    if (fr == FR_OK && last != '\n') {
+        FSIZE_t offset = f_size(&dst);
+        UINT written = 0;
+        fr = f_write(&dst, "\n", 1, &written);
+        if (fr == FR_OK) {
+            line_index_append(s->target, offset, "\n", 1);
+            (*lines)++;
+        }
+    }
+
+    f_close(&src);
+    FRESULT close_fr = f_close(&dst);
+    if (fr != FR_OK)
+        line_index_invalidate();
+    return fr != FR_OK ? fr : close_fr;
+}
+
+/**
+ * @brief Move a complete upload into its target.
+ *
+ * Journalled lines are flushed first and readers' caches of the target are
+ * dropped, as for any other write. A PUT is an f_rename over the old file,
+ * so readers see the old or the new contents, never a mix.
+ *
+ * @param s Session whose last block has been written
+ * @param lines Output: newlines appended (iPATCH), 0 for a PUT
+ * @return FATFS result
+ */
+FRESULT upload_session_commit(upload_session_t *s, uint32_t *lines)
+{
+    *lines = 0;
+    FRESULT fr = f_close(&s->file);
+    if (fr == FR_OK)
+        fr = append_journal_sync_for_read();
+
+    file_cache_invalidate(s->target);
+    prefetch_invalidate(s->target);
+    hot_cache_invalidate(s->target);
+
+    if (fr == FR_OK && s->replace) {
+        fr = f_unlink(s->target);
+        if (fr == FR_OK || fr == FR_NO_FILE)
+            fr = f_rename(s->staging, s->target);
+        line_index_invalidate();
+    } else if (fr == FR_OK) {
+        fr = upload_append(s, lines);
+    }
+
+    if (fr != FR_OK || !s->replace)
+        f_unlink(s->staging);
+    s->active = false;
+    return fr;
+}
+
+/**
+ * @brief Abort an upload and delete its staging file.
+ * @param s Session to release
+ */
+void upload_session_close(upload_session_t *s)
+{
+    if (!s->active)
+        return;
+    f_close(&s->file);
+    f_unlink(s->staging);
+    s->active = false;
+}
+
+/**
+ * @brief Abort every upload belonging to a client.
+ * @param ip Client IP address
+ * @param port Client UDP port
+ */
+void upload_session_close_peer(const ip_addr_t *ip, u16_t port)
+{
+    for (int i = 0; i < UPLOAD_SESSION_MAX; i++) {
+        if (uploads[i].active && uploads[i].port == port &&
+            ip_addr_cmp(&uploads[i].ip, ip)) {
+            upload_session_close(&uploads[i]);
+        }
+    }
+}
+
+/**
+ * @brief Abort uploads that have been idle for UPLOAD_IDLE_MS.
+ * @param now_ms Current time in ms since boot
+ */
+void upload_session_expire(uint32_t now_ms)
+{
+    for (int i = 0; i < UPLOAD_SESSION_MAX; i++) {
+        upload_session_t *s = &uploads[i];
+        if (s->active && now_ms - s->last_used_ms > UPLOAD_IDLE_MS) {
+            LOG_DEBUG("📂 Aborting idle upload to %s from %s:%d (%lu bytes)\n",
+                   s->target, ip4addr_ntoa(&s->ip), s->port, s->bytes);
+            upload_session_close(s);
+        }
+    }
+}
+
+/**
+ * @brief Count uploads in progress.
+ * @return Sessions in use
+ */
+size_t upload_session_count(void)
+{
+    size_t n = 0;
+    for (int i = 0; i < UPLOAD_SESSION_MAX; i++)
+        n += uploads[i].active;
+    return n;
+}
@@ -0,0 +1,88 @@
+#ifndef CS04_UPLOAD_SESSION_H
+#define CS04_UPLOAD_SESSION_H
+
+#include "ff.h"
+#include "lwip/ip_addr.h"
+#include "coap.h"
+#include "cs04_block_window.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define UPLOAD_SESSION_MAX 2            // Concurrent Block1 uploads
+#define UPLOAD_SZX_MAX 5                // 512-byte blocks fit a storage request
+#define UPLOAD_WINDOW BLOCK_WINDOW_MAX  // Blocks accepted past the oldest hole
+#define UPLOAD_MAX_BYTES (256 * 1024)   // Largest upload accepted
+#define UPLOAD_IDLE_MS 10000            // Abort uploads without a block
+#define UPLOAD_TOKEN_LEN 8              // Longest CoAP token
+#define UPLOAD_NAME_LEN 32
+
+// Outcome of writing one Block1 block.
+typedef enum {
+    UPLOAD_STORED = 0,    // Written; more blocks to come (2.31 Continue)
+    UPLOAD_COMPLETE,      // Written, and every block is in
+    UPLOAD_DUPLICATE,     // Already written (2.31 again)
+    UPLOAD_OUT_OF_RANGE,  // Past the window or after the last block
+    UPLOAD_BAD_BLOCK,     // Wrong size: only the last block may be short
+    UPLOAD_TOO_LARGE,     // Beyond UPLOAD_MAX_BYTES
+    UPLOAD_WRITE_ERROR    // f_lseek/f_write failed
+} upload_result_t;
+
+// One Block1 PUT/iPATCH in progress, keyed by client and token. Blocks are
+// written to a staging file at their offsets, so they may arrive out of
+// order; the target only changes once the last hole is filled.
+typedef struct {
+    bool active;                       // True if slot is in use
+    uint8_t token[UPLOAD_TOKEN_LEN];   // Request token
+    uint8_t token_len;                 // Token length
+    ip_addr_t ip;                      // Client IP address
+    u16_t port;                        // Client UDP port
+    char target[UPLOAD_NAME_LEN];      // File replaced (PUT) or extended
+    bool replace;                      // PUT rather than iPATCH
+    char staging[UPLOAD_NAME_LEN];     // File the blocks are written to
+    FIL file;                          // Open staging file
+    uint8_t szx;                       // Block size of the session
+    block_window_t window;             // Blocks received so far
+    uint32_t bytes;                    // Payload bytes written
+    uint32_t last_used_ms;             // For idle expiry
+} upload_session_t;
+
+// Clears the table.
+void upload_session_init(void);
+
+// Returns the session for (token, client), or NULL.
+upload_session_t *upload_session_find(const coap_buffer_t *tok,
+                                      const ip_addr_t *ip, u16_t port);
+
+// Starts (or restarts) an upload to target with blocks of szx and creates
+// its staging file. Returns NULL if the table is full, the token too long
+// or the staging file cannot be created.
+upload_session_t *upload_session_open(const coap_buffer_t *tok,
+                                      const ip_addr_t *ip, u16_t port,
+                                      const char *target, bool replace,
+                                      uint8_t szx);
+
+// Writes one block to the staging file.
+upload_result_t upload_session_put(upload_session_t *s, uint32_t block_num,
+                                   bool more, const uint8_t *data,
+                                   size_t len);
+
+// Moves a complete upload into its target: replaces it, or appends the
+// staging file (ending it with a newline). *lines receives the newlines
+// appended. Ends the session either way.
+FRESULT upload_session_commit(upload_session_t *s, uint32_t *lines);
+
+// Aborts an upload and deletes its staging file.
+void upload_session_close(upload_session_t *s);
+
+// Aborts every upload of a client.
+void upload_session_close_peer(const ip_addr_t *ip, u16_t port);
+
+// Aborts uploads idle for longer than UPLOAD_IDLE_MS.
+void upload_session_expire(uint32_t now_ms);
+
+// Number of uploads in progress.
+size_t upload_session_count(void);
+
+#endif  // CS04_UPLOAD_SESSION_H
@@ -0,0 +1,175 @@
+#include "cs04_write_behind.h"
+#include "cs04_log.h"
+#include "pico/stdlib.h"
+#include <string.h>
+#include <stdio.h>
+
+// Ring slot of a file offset. The ring always covers
+// [wb_flushed, wb_flushed + WRITE_BEHIND_BYTES), so every offset in that span
+// has its own byte.
+#define WB_POS(offset) ((size_t) ((offset) % WRITE_BEHIND_BYTES))
+
+static uint8_t wb_ring[WRITE_BEHIND_BYTES] __attribute__((aligned(4)));
+static FIL *wb_file;
+static FSIZE_t wb_flushed;       // Bytes already written to the card
+static FSIZE_t wb_committed;     // Bytes known to be received without holes
+static FSIZE_t wb_received_end;  // Highest received offset + 1
+static write_behind_stats_t wb_stats;
+
+/**
+ * @brief Start buffering a new sequential file.
+ * @param file Open file to drain into
+ * @param start File offset of the first byte to come (already on the card
+ *              below it)
+ */
+void write_behind_init(FIL *file, FSIZE_t start)
+{
+    wb_file = file;
+    wb_flushed = start;
+    wb_committed = start;
+    wb_received_end = start;
+    memset(&wb_stats, 0, sizeof(wb_stats));
+}
+
+/**
+ * @brief Check whether data up to a file offset can be buffered now.
+ * @param end File offset one past the last byte
+ * @return true if the ring has room
+ */
+bool write_behind_fits(FSIZE_t end)
+{
+    return end <= wb_flushed + WRITE_BEHIND_BYTES;
+}
+
+/**
+ * @brief Count a block request held back by a full ring.
+ */
+void write_behind_note_stall(void)
+{
+    wb_stats.stalls++;
+}
+
+/**
+ * @brief Copy a received payload into the ring at its file offset.
+ * @param offset File offset of the payload
+ * @param data Payload
+ * @param len Payload length
+ * @return false if the payload lies outside the ring's span
+ */
+bool write_behind_put(FSIZE_t offset, const uint8_t *data, size_t len)
+{
+    if (offset < wb_flushed || !write_behind_fits(offset + len))
+        return false;
+
+    // The span may wrap past the end of the ring
+    size_t pos = WB_POS(offset);
+    size_t first = WRITE_BEHIND_BYTES - pos;
+    if (first > len)
+        first = len;
+    memcpy(&wb_ring[pos], data, first);
+    memcpy(wb_ring, data + first, len - first);
+
+    if (offset + len > wb_received_end)
+        wb_received_end = offset + len;
+    size_t buffered = (size_t) (wb_received_end - wb_flushed);
+    if (buffered > wb_stats.high_water)
+        wb_stats.high_water = buffered;
+    return true;
+}
+
+/**
+ * @brief Advance the contiguous received edge.
+ * @param end File offset below which every byte has been put
+ */
+void write_behind_commit(FSIZE_t end)
+{
+    if (end > wb_committed)
+        wb_committed = end;
+}
+
+/**
+ * @brief Write buffered bytes up to a file offset.
+ *
+ * The file is written sequentially and chunks start on sector boundaries,
+ * so FATFS passes whole sectors of each chunk straight to disk_write() as
+ * one multi-block command. A wrapped span takes two f_write calls.
+ *
+ * @param end File offset to write up to (at most wb_committed)
+ * @return FATFS result
+ */
+static FRESULT wb_drain(FSIZE_t end)
+{
+    if (end <= wb_flushed)
+        return FR_OK;
+    if (!wb_file)
+        return FR_INVALID_OBJECT;
+
+    while (wb_flushed < end) {
+        size_t pos = WB_POS(wb_flushed);
+        size_t n = WRITE_BEHIND_BYTES - pos;
+        if (n > end - wb_flushed)
+            n = (size_t) (end - wb_flushed);
+
+        UINT bytes_written = 0;
+        uint32_t started = time_us_32();
+        FRESULT res = f_write(wb_file, &wb_ring[pos], (UINT) n,
+                              &bytes_written);
+        metrics_latency_add(&wb_stats.latency, time_us_32() - started);
+        if (res == FR_OK && bytes_written != n)
+            res = FR_DENIED;  // Card full
+        if (res != FR_OK) {
+            LOG_ERROR("✗ Write-behind failed at offset %lu: %d\n",
+                   (unsigned long) wb_flushed, res);
+            return res;
+        }
+
+        wb_flushed += n;
+        wb_stats.writes++;
+        wb_stats.bytes += n;
+    }
+    return FR_OK;
+}
+
+/**
+ * @brief Drain whole sectors once enough contiguous data is buffered.
+ *
+ * A request is only sent when its block fits (write_behind_fits()), so
+ * WRITE_BEHIND_FLUSH_BYTES plus the transfer window must stay below
+ * WRITE_BEHIND_BYTES or the client could stop requesting before a drain
+ * is due.
+ *
+ * @return FATFS result
+ */
+FRESULT write_behind_poll(void)
+{
+    if (wb_committed - wb_flushed < WRITE_BEHIND_FLUSH_BYTES)
+        return FR_OK;
+    return wb_drain(wb_committed - (wb_committed % WRITE_BEHIND_SECTOR));
+}
+
+/**
+ * @brief Write every committed byte, including a partial last sector.
+ * @return FATFS result
+ */
+FRESULT write_behind_finish(void)
+{
+    return wb_drain(wb_committed);
+}
+
+/**
+ * @brief Get the number of committed bytes still in RAM.
+ * @return Bytes waiting for the drain
+ */
+size_t write_behind_pending(void)
+{
+    return (size_t) (wb_committed - wb_flushed);
+}
+
+/**
+ * @brief Get the drain counters.
+ * @return Pointer to the live counters
+ */
+const write_behind_stats_t *write_behind_get_stats(void)
+{
+    return &wb_stats;
+}
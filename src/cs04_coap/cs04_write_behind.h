@@ -0,0 +1,56 @@
+#ifndef CS04_WRITE_BEHIND_H
+#define CS04_WRITE_BEHIND_H
+
+#include "ff.h"
+#include "cs04_metrics.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Configuration
+#define WRITE_BEHIND_BYTES 8192        // RAM ring, a multiple of the sector
+#define WRITE_BEHIND_SECTOR 512        // SD sector; drains end on this boundary
+#define WRITE_BEHIND_FLUSH_BYTES 2048  // Drain once this much is contiguous
+
+// Write-behind counters.
+typedef struct {
+    uint32_t writes;            // f_write calls made by the drain
+    uint32_t bytes;             // Bytes written to the card
+    uint32_t stalls;            // Block requests held back (ring full)
+    size_t high_water;          // Most bytes buffered at once
+    metrics_latency_t latency;  // f_write durations
+} write_behind_stats_t;
+
+// Starts buffering writes to file, which is written sequentially from offset
+// start (0, or the end of a resumed download, where the file must be
+// positioned). Clears the ring and counters.
+void write_behind_init(FIL *file, FSIZE_t start);
+
+// Returns true if bytes up to file offset end fit in the ring now. Callers
+// request a block only when it fits, which is the ring's backpressure.
+bool write_behind_fits(FSIZE_t end);
+
+// Counts a request held back because write_behind_fits() was false.
+void write_behind_note_stall(void);
+
+// Copies a received payload to its file offset in the ring. Returns false if
+// it does not fit (the caller asked for more than write_behind_fits allows).
+bool write_behind_put(FSIZE_t offset, const uint8_t *data, size_t len);
+
+// Marks every byte below end as received, so the drain may write it.
+void write_behind_commit(FSIZE_t end);
+
+// Writes whole sectors of committed data once WRITE_BEHIND_FLUSH_BYTES are
+// ready (call when the loop is idle). Returns the FATFS result.
+FRESULT write_behind_poll(void);
+
+// Writes everything committed, including a partial last sector.
+FRESULT write_behind_finish(void);
+
+// Returns the number of committed bytes not yet written.
+size_t write_behind_pending(void);
+
+// Returns the write-behind counters.
+const write_behind_stats_t *write_behind_get_stats(void);
+
+#endif  // CS04_WRITE_BEHIND_H
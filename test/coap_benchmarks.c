@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"  // For the notification fan-out sink
+#include "hardware/clocks.h"
+#include "lwip/udp.h"
+#include "ff.h"
+#include "sd_card.h"
+#include "sd_spi.h"
+#include "hw_config.h"
+
+// Include project headers
+#include "cs04_coap_packet.h"
+#include "cs04_coap_reliability.h"
+#include "cs04_packet_pool.h"
+#include "cs04_exchange_cache.h"
+#include "cs04_notify.h"
+#include "cs04_subscribers.h"
+#include "cs04_line_index.h"
+#include "cs04_hardware.h"
+
+// --- WI-FI CREDENTIALS ---
+#define BENCH_WIFI_SSID "lomohomo"
+#define BENCH_WIFI_PASS "K0piP3ng"
+
+// Notifications are sent here (discard port); without Wi-Fi they fail at
+// routing, which still times the per-observer encode
+#define BENCH_SINK_IP "192.168.137.1"
+#define BENCH_SINK_PORT 9
+
+#define BENCH_SD_FILE "BENCH.BIN"
+#define BENCH_SD_BYTES (64 * 1024)
+#define BENCH_SD_READS 64  // 1 KiB reads per SD run
+
+// ==========================================
+// BENCHMARK FRAMEWORK
+// ==========================================
+// One line per result, space-separated key=value pairs:
+//   BENCH name=<name> iters=<n> total_us=<us> ns_per_op=<ns> cycles_per_op=<c>
+// The M0+ has no cycle counter, so cycles are derived from the 1 MHz timer
+// and clk_sys; run enough iterations that the total is well above 1 ms.
+static uint32_t clk_sys_hz;
+static volatile uint32_t bench_sink;  // Keeps results from being optimised out
+
+static void bench_report(const char *name, uint32_t iters, uint32_t total_us)
+{
+    uint64_t ns = (uint64_t) total_us * 1000u / iters;
+    uint64_t cycles = (uint64_t) total_us * (clk_sys_hz / 1000000u) / iters;
+    printf("BENCH name=%s iters=%lu total_us=%lu ns_per_op=%llu "
+           "cycles_per_op=%llu\n",
+           name, (unsigned long) iters, (unsigned long) total_us,
+           (unsigned long long) ns, (unsigned long long) cycles);
+}
+
+static void bench_skip(const char *name, const char *why)
+{
+    printf("BENCH name=%s skipped=%s\n", name, why);
+}
+
+// Runs body iters times and reports the total.
+#define BENCH_RUN(name, iters, body)                               \
+    do {                                                           \
+        uint32_t bench_start = time_us_32();                       \
+        for (uint32_t bench_i = 0; bench_i < (iters); bench_i++) { \
+            body;                                                  \
+        }                                                          \
+        bench_report(name, iters, time_us_32() - bench_start);     \
+    } while (0)
+
+// ==========================================
+// PART 1: PROTOCOL PATHS (RAM only)
+// ==========================================
+
+void bench_parse_build()
+{
+    // GET /file with Block2 and ETag, as the client sends it
+    uint8_t tok_data[4] = { 0x01, 0x02, 0x03, 0x04 };
+    coap_buffer_t tok = { tok_data, sizeof(tok_data) };
+    uint8_t tag[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+    coap_buffer_t etag = { tag, sizeof(tag) };
+    uint8_t req[64];
+    size_t req_len = sizeof(req);
+    uint16_t msg_id = 0;
+    coap_build_get_with_block2(req, &req_len, &tok, "file", NULL, 12, 6, NULL,
+                               &etag, &msg_id);
+
+    coap_packet_t pkt;
+    BENCH_RUN("coap_parse", 20000,
+              bench_sink += coap_parse(&pkt, req, req_len));
+
+    uint8_t out[64];
+    BENCH_RUN("coap_build", 20000, {
+        size_t len = sizeof(out);
+        bench_sink += coap_build(out, &len, &pkt);
+    });
+}
+
+void bench_block2_response()
+{
+    static uint8_t payload[1024];
+    memset(payload, 'x', sizeof(payload));
+    uint8_t tok_data[4] = { 0x01, 0x02, 0x03, 0x04 };
+    coap_packet_t req = { 0 };
+    req.tok.p = tok_data;
+    req.tok.len = sizeof(tok_data);
+    uint8_t tag[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+    coap_buffer_t etag = { tag, sizeof(tag) };
+
+    uint8_t scratch_buf[16];
+    coap_rw_buffer_t scratch = { scratch_buf, sizeof(scratch_buf) };
+    coap_packet_t resp;
+    BENCH_RUN("coap_build_block2_response", 20000,
+              bench_sink += coap_build_block2_response(
+                  &scratch, &resp, &req, 0x12, 0x34, bench_i, true, 6, payload,
+                  sizeof(payload), COAP_CONTENTTYPE_TEXT_PLAIN, &etag));
+
+    // The same response encoded into a pool pbuf, as the server sends it
+    BENCH_RUN("coap_build_pbuf_block2", 5000, {
+        struct pbuf *p = coap_build_pbuf(&resp);
+        if (p) {
+            bench_sink += p->tot_len;
+            pbuf_free(p);
+        }
+    });
+}
+
+void bench_retransmit_table()
+{
+    coap_reliability_init();
+    ip_addr_t dest;
+    ip4addr_aton("192.168.137.1", &dest);
+    uint8_t packet[16] = { 0x40, 0x01, 0x00, 0x01 };
+
+    // All slots but one in use: store and clear work against a full table
+    for (uint16_t i = 0; i < MAX_PENDING_MESSAGES - 1; i++)
+        coap_store_for_retransmit(0x1000 + i, &dest, 5683, packet,
+                                  sizeof(packet));
+    BENCH_RUN("retransmit_store_clear_full", 5000, {
+        uint16_t id = (uint16_t) (0x8000 + bench_i);
+        coap_store_for_retransmit(id, &dest, 5683, packet, sizeof(packet));
+        coap_clear_pending_message(id);
+    });
+    bench_sink += coap_pending_count();
+    coap_reliability_init();
+}
+
+void bench_duplicate_lookup()
+{
+    exchange_cache_init();
+    ip_addr_t peer;
+    ip4addr_aton("192.168.137.10", &peer);
+    for (uint16_t i = 0; i < EXCHANGE_CACHE_SIZE; i++)
+        exchange_cache_record(&peer, 5683, (uint16_t) (0x2000 + i));
+
+    struct pbuf *cached = NULL;
+    BENCH_RUN("exchange_lookup_hit", 20000,
+              bench_sink += exchange_cache_lookup(
+                  &peer, 5683,
+                  (uint16_t) (0x2000 + bench_i % EXCHANGE_CACHE_SIZE),
+                  &cached));
+    BENCH_RUN("exchange_lookup_miss", 20000,
+              bench_sink += exchange_cache_lookup(
+                  &peer, 5683, (uint16_t) (0x6000 + bench_i), &cached));
+    exchange_cache_init();
+
+    // Client side: linear scan of the recent-ID ring
+    duplicate_detector_t det;
+    coap_duplicate_detector_init(&det);
+    for (uint16_t i = 0; i < RECENT_MSG_HISTORY; i++)
+        coap_record_message_id(&det, i);
+    BENCH_RUN("duplicate_detector_miss", 20000,
+              bench_sink += coap_is_duplicate_message(
+                  &det, (uint16_t) (0x4000 + bench_i)));
+}
+
+// ==========================================
+// PART 2: STORAGE PATHS (SD card)
+// ==========================================
+
+static bool bench_sd_prepare(void)
+{
+    FILINFO info;
+    if (f_stat(BENCH_SD_FILE, &info) == FR_OK &&
+        info.fsize == BENCH_SD_BYTES)
+        return true;
+
+    FIL fil;
+    if (f_open(&fil, BENCH_SD_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return false;
+    static uint8_t chunk[1024];
+    UINT bw = 0;
+    FRESULT fr = FR_OK;
+    for (uint32_t off = 0; off < BENCH_SD_BYTES && fr == FR_OK;
+         off += sizeof(chunk)) {
+        memset(chunk, (int) (off >> 10), sizeof(chunk));
+        fr = f_write(&fil, chunk, sizeof(chunk), &bw);
+    }
+    f_close(&fil);
+    return fr == FR_OK;
+}
+
+// Sequential and random 1 KiB reads at each rate of the driver's ladder up
+// to the negotiated one, which is restored afterwards.
+void bench_sd_reads()
+{
+    static const uint rates[] = { 25 * 1000 * 1000, 12500 * 1000,
+                                  5 * 1000 * 1000, 1000 * 1000 };
+    sd_card_t *sd = sd_get_by_num(0);
+    if (!sd || !bench_sd_prepare()) {
+        bench_skip("sd_read", "no_card");
+        return;
+    }
+
+    FIL fil;
+    if (f_open(&fil, BENCH_SD_FILE, FA_READ) != FR_OK) {
+        bench_skip("sd_read", "open_failed");
+        return;
+    }
+
+    static uint8_t buf[1024];
+    uint negotiated = sd->baud_rate;
+    for (size_t r = 0; r < count_of(rates); r++) {
+        if (rates[r] > negotiated)
+            continue;
+        uint actual = sd_spi_set_frequency(sd, rates[r]);
+        printf("BENCH_NOTE sd_rate_hz=%u actual_hz=%u\n", rates[r], actual);
+
+        char name[40];
+        UINT br = 0;
+        snprintf(name, sizeof(name), "sd_seq_read_1k_%ukhz", rates[r] / 1000);
+        f_lseek(&fil, 0);
+        BENCH_RUN(name, BENCH_SD_READS, {
+            f_read(&fil, buf, sizeof(buf), &br);
+            bench_sink += br;
+        });
+
+        snprintf(name, sizeof(name), "sd_rand_read_1k_%ukhz", rates[r] / 1000);
+        uint32_t seed = 12345;
+        BENCH_RUN(name, BENCH_SD_READS, {
+            seed = seed * 1664525u + 1013904223u;
+            f_lseek(&fil, (FSIZE_t) ((seed >> 16) % (BENCH_SD_BYTES / 1024)) *
+                              1024);
+            f_read(&fil, buf, sizeof(buf), &br);
+            bench_sink += br;
+        });
+    }
+    sd_spi_set_frequency(sd, negotiated);
+    f_close(&fil);
+}
+
+// FETCH positioning as handle_fetch_file() does it: the line index seek,
+// then f_gets over the lines between the indexed entry and the target.
+void bench_fetch_seek()
+{
+    static const uint32_t sizes[] = { 100, 1000, 10000 };
+    char name[40];
+    char line[32];
+
+    line_index_init();
+    for (size_t s = 0; s < count_of(sizes); s++) {
+        char filename[16];
+        snprintf(filename, sizeof(filename), "BENCH%lu.TXT",
+                 (unsigned long) sizes[s]);
+
+        FIL fil;
+        if (f_open(&fil, filename, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+            bench_skip("fetch_seek", "no_card");
+            return;
+        }
+        for (uint32_t i = 0; i < sizes[s]; i++)
+            f_printf(&fil, "line %05lu\n", (unsigned long) i);
+        f_close(&fil);
+
+        f_open(&fil, filename, FA_READ);
+        uint32_t current = 0;
+        snprintf(name, sizeof(name), "fetch_index_build_%lu",
+                 (unsigned long) sizes[s]);
+        BENCH_RUN(name, 1, {
+            line_index_invalidate();
+            line_index_seek(&fil, filename, 0, &current);
+        });
+
+        snprintf(name, sizeof(name), "fetch_seek_%lu",
+                 (unsigned long) sizes[s]);
+        uint32_t seed = 54321;
+        BENCH_RUN(name, 50, {
+            seed = seed * 1664525u + 1013904223u;
+            uint32_t target = (seed >> 16) % sizes[s];
+            line_index_seek(&fil, filename, target, &current);
+            while (current < target && f_gets(line, sizeof(line), &fil))
+                current++;
+            bench_sink += current;
+        });
+        f_close(&fil);
+        f_unlink(filename);
+    }
+}
+
+// ==========================================
+// PART 3: NOTIFICATION FAN-OUT
+// ==========================================
+
+// One button notification to SUBSCRIBER_MAX observers (NON, like the
+// server's sends past NOTIFY_CON_ALL_MAX), timed per fan-out.
+void bench_notify_fanout(bool wifi)
+{
+    struct udp_pcb *pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        bench_skip("notify_fanout", "no_pcb");
+        return;
+    }
+    printf("BENCH_NOTE wifi=%d observers=%d\n", wifi ? 1 : 0, SUBSCRIBER_MAX);
+
+    coap_packet_t pkt = { 0 };
+    pkt.hdr.code = COAP_RSPCODE_CONTENT;
+    pkt.payload.p = (const uint8_t *) "BTN1=1,BTN2=0,BTN3=0";
+    pkt.payload.len = 20;
+    notify_template_t tmpl;
+    if (!notify_template_init(&tmpl, &pkt)) {
+        bench_skip("notify_fanout", "no_buffer");
+        udp_remove(pcb);
+        return;
+    }
+
+    ip_addr_t sink;
+    ip4addr_aton(BENCH_SINK_IP, &sink);
+    uint8_t tok_data[4] = { 0xB0, 0x00, 0x00, 0x00 };
+    coap_buffer_t tok = { tok_data, sizeof(tok_data) };
+
+    const uint32_t iters = 50;
+    uint32_t total_us = 0;
+    for (uint32_t i = 0; i < iters; i++) {
+        uint32_t start = time_us_32();
+        for (int s = 0; s < SUBSCRIBER_MAX; s++) {
+            tok_data[3] = (uint8_t) s;
+            bench_sink += notify_send(pcb, &tmpl, &sink, BENCH_SINK_PORT, &tok,
+                                      i, false);
+        }
+        total_us += time_us_32() - start;
+        cyw43_arch_poll();  // Let the driver drain its queue between runs
+    }
+    bench_report("notify_fanout_32", iters, total_us);
+
+    notify_template_free(&tmpl);
+    udp_remove(pcb);
+}
+
+// ==========================================
+// MAIN RUNNER
+// ==========================================
+int main(void)
+{
+    stdio_init_all();
+    sleep_ms(3000);  // Wait for USB Serial
+
+    clk_sys_hz = clock_get_hz(clk_sys);
+    printf("\n\nBENCH_BEGIN clk_sys_hz=%lu\n", (unsigned long) clk_sys_hz);
+
+    // --- PROTOCOL ---
+    bench_parse_build();
+    bench_block2_response();
+    bench_retransmit_table();
+    bench_duplicate_lookup();
+
+    // --- STORAGE ---
+    FATFS fs;
+    if (hw_sd_init(&fs)) {
+        bench_sd_reads();
+        bench_fetch_seek();
+    } else {
+        bench_skip("sd_read", "mount_failed");
+        bench_skip("fetch_seek", "mount_failed");
+    }
+
+    // --- NETWORK ---
+    bool wifi = false;
+    if (cyw43_arch_init() == 0) {
+        cyw43_arch_enable_sta_mode();
+        wifi = cyw43_arch_wifi_connect_timeout_ms(BENCH_WIFI_SSID,
+                                                  BENCH_WIFI_PASS,
+                                                  CYW43_AUTH_WPA2_AES_PSK,
+                                                  10000) == 0;
+        bench_notify_fanout(wifi);
+        cyw43_arch_deinit();
+    } else {
+        bench_skip("notify_fanout", "no_wifi_chip");
+    }
+
+    printf("BENCH_END sink=%lu\n", (unsigned long) bench_sink);
+
+    while (1)
+        sleep_ms(1000);
+    return 0;
+}
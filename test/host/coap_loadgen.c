@@ -0,0 +1,930 @@
+/**
+ * @file coap_loadgen.c
+ * @brief Host (Linux) CoAP load generator for the Pico server.
+ *
+ * Runs a mix of flows against coap_server, each on its own UDP socket so
+ * the server sees a separate endpoint per flow:
+ *   get      GET /file block transfers (Block2), one block in flight
+ *   fetch    FETCH /file "start,end" line ranges
+ *   patch    bursts of concurrent iPATCH /file appends
+ *   observe  GET /file (or another path) with Observe: 0, then counts and
+ *            ACKs notifications
+ * Requests are CON with RFC 7252 retransmission, and datagrams can be
+ * dropped in both directions to emulate a lossy link. Packets are encoded
+ * and parsed with microcoap and cs04_coap_codec, the same code the firmware
+ * uses.
+ *
+ * At the end it prints, per flow kind, requests, failures, retransmit rate
+ * and p50/p99/max latency (first transmission to response), plus GET
+ * throughput and notification rate.
+ *
+ * Build: see test/host/CMakeLists.txt. Usage: coap_loadgen --help
+ */
+
+#include "coap.h"
+#include "cs04_coap_codec.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Configuration
+#define LOADGEN_FLOWS_MAX 256      // All kinds together
+#define LOADGEN_WINDOW_MAX 16      // Requests in flight per flow
+#define LOADGEN_TX_MAX 256         // Longest request we build
+#define LOADGEN_RX_MAX 4096        // Largest datagram accepted (BERT fits)
+#define LOADGEN_TOKEN_LEN 4
+#define LOADGEN_RECENT_CON 8       // Received CON IDs kept per flow (dedup)
+#define LOADGEN_SEPARATE_WAIT_MS 10000  // Empty ACK -> separate response
+#define LOADGEN_RETRY_MS 1000      // Pause before re-registering an observer
+#define LOADGEN_POLL_MAX_MS 50
+
+// Same retransmission parameters as cs04_coap_reliability.h (RFC 7252)
+#define ACK_TIMEOUT_MS 2000
+#define ACK_RANDOM_FACTOR_PCT 150
+#define MAX_RETRANSMITS 4
+
+typedef enum {
+    KIND_GET = 0,
+    KIND_FETCH,
+    KIND_PATCH,
+    KIND_OBSERVE,
+    KIND_COUNT
+} flow_kind_t;
+
+static const char *const kind_names[KIND_COUNT] = {
+    [KIND_GET] = "get",
+    [KIND_FETCH] = "fetch",
+    [KIND_PATCH] = "patch",
+    [KIND_OBSERVE] = "observe",
+};
+
+// One CON request awaiting its response.
+typedef struct {
+    bool active;
+    bool acked;           // Empty ACK seen, waiting for a separate response
+    uint16_t msg_id;
+    uint8_t token[LOADGEN_TOKEN_LEN];
+    uint8_t buf[LOADGEN_TX_MAX];
+    size_t len;
+    uint8_t tries;        // Transmissions so far
+    uint64_t first_us;
+    uint64_t next_us;     // Retransmit (or give-up) deadline
+    uint32_t timeout_us;
+} txn_t;
+
+typedef struct {
+    flow_kind_t kind;
+    int fd;
+    unsigned index;
+    uint16_t next_msg_id;
+    uint32_t seq;
+    txn_t txn[LOADGEN_WINDOW_MAX];
+    unsigned in_flight;
+    uint64_t resume_us;   // Do not start requests before this
+    uint32_t block;       // get: next Block2 number
+    unsigned burst_left;  // patch: requests of this burst not yet sent
+    bool registered;      // observe: registration answered
+    uint8_t obs_token[LOADGEN_TOKEN_LEN];
+    uint16_t recent_con[LOADGEN_RECENT_CON];
+    unsigned recent_head;
+    unsigned recent_count;
+} flow_t;
+
+typedef struct {
+    uint64_t requests;       // Exchanges started
+    uint64_t ok;             // Answered 2.xx
+    uint64_t errors;         // Answered 4.xx/5.xx
+    uint64_t failed;         // No answer after MAX_RETRANSMITS, or RST
+    uint64_t transmissions;
+    uint64_t retransmits;
+    uint64_t bytes;          // Response payload
+    uint64_t transfers;      // get: files completed
+    uint64_t notifications;  // observe: distinct notifications
+    uint64_t duplicates;     // observe: CON notifications seen again
+    uint32_t *lat_us;
+    size_t lat_count;
+    size_t lat_cap;
+} kind_stats_t;
+
+typedef struct {
+    struct sockaddr_in server;
+    unsigned flows[KIND_COUNT];
+    double duration_s;
+    double interval_s;
+    unsigned loss_pct_x10;   // Per direction, in 0.1 %
+    uint8_t szx;
+    bool image;
+    unsigned burst;
+    unsigned patch_gap_ms;
+    unsigned fetch_lines;
+    unsigned fetch_span;
+    const char *observe_path;
+    uint32_t seed;
+} loadgen_config_t;
+
+static loadgen_config_t cfg = {
+    .duration_s = 30.0,
+    .szx = 6,
+    .burst = 4,
+    .patch_gap_ms = 1000,
+    .fetch_lines = 100,
+    .fetch_span = 5,
+    .observe_path = "file",
+};
+
+static flow_t flows[LOADGEN_FLOWS_MAX];
+static unsigned flow_count;
+static kind_stats_t stats[KIND_COUNT];
+static uint64_t rx_datagrams, tx_datagrams, dropped_rx, dropped_tx;
+static uint64_t late_responses, bad_datagrams;
+static uint32_t rng_state;
+
+/**
+ * @brief Monotonic time in microseconds.
+ */
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000u + (uint64_t) ts.tv_nsec / 1000u;
+}
+
+/**
+ * @brief xorshift32, seeded from --seed so loss patterns can be repeated.
+ */
+static uint32_t rng_next(void)
+{
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+/**
+ * @brief Decide whether to drop one datagram.
+ */
+static bool loss_drop(void)
+{
+    return cfg.loss_pct_x10 > 0 && rng_next() % 1000 < cfg.loss_pct_x10;
+}
+
+/**
+ * @brief Record one latency sample for a kind.
+ */
+static void stats_add_latency(kind_stats_t *s, uint32_t us)
+{
+    if (s->lat_count == s->lat_cap) {
+        size_t cap = s->lat_cap ? s->lat_cap * 2 : 1024;
+        uint32_t *p = realloc(s->lat_us, cap * sizeof(*p));
+        if (!p)
+            return;
+        s->lat_us = p;
+        s->lat_cap = cap;
+    }
+    s->lat_us[s->lat_count++] = us;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Percentile of sorted samples (nearest rank).
+ */
+static uint32_t percentile(const uint32_t *sorted, size_t n, unsigned pct)
+{
+    if (n == 0)
+        return 0;
+    size_t rank = (n * pct + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+/**
+ * @brief Send a datagram on a flow's socket, unless the loss model drops it.
+ */
+static void flow_send_raw(flow_t *f, const uint8_t *buf, size_t len)
+{
+    if (loss_drop()) {
+        dropped_tx++;
+        return;
+    }
+    if (send(f->fd, buf, len, 0) < 0 && errno != ECONNREFUSED)
+        perror("send");
+    tx_datagrams++;
+}
+
+/**
+ * @brief Transmit (or retransmit) a request and arm its timer.
+ */
+static void txn_transmit(flow_t *f, txn_t *t, uint64_t now)
+{
+    kind_stats_t *s = &stats[f->kind];
+    s->transmissions++;
+    if (t->tries > 0) {
+        s->retransmits++;
+        t->timeout_us *= 2;
+    }
+    t->tries++;
+    flow_send_raw(f, t->buf, t->len);
+    t->next_us = now + t->timeout_us;
+}
+
+/**
+ * @brief Claim a free transaction slot and give it an ID and token.
+ * @return Slot, or NULL if the flow's window is full
+ */
+static txn_t *txn_new(flow_t *f)
+{
+    for (int i = 0; i < LOADGEN_WINDOW_MAX; i++) {
+        txn_t *t = &f->txn[i];
+        if (t->active)
+            continue;
+
+        memset(t, 0, sizeof(*t));
+        t->active = true;
+        t->msg_id = f->next_msg_id++;
+        f->seq++;
+        t->token[0] = (uint8_t) (f->index >> 8);
+        t->token[1] = (uint8_t) f->index;
+        t->token[2] = (uint8_t) (f->seq >> 8);
+        t->token[3] = (uint8_t) f->seq;
+        // RFC 7252 4.8: initial timeout between ACK_TIMEOUT and 1.5x that
+        uint32_t span = ACK_TIMEOUT_MS * (ACK_RANDOM_FACTOR_PCT - 100) / 100;
+        t->timeout_us = (ACK_TIMEOUT_MS + rng_next() % (span + 1)) * 1000u;
+        return t;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Release a transaction slot.
+ */
+static void txn_free(flow_t *f, txn_t *t)
+{
+    t->active = false;
+    f->in_flight--;
+}
+
+/**
+ * @brief Encode a CON request into a transaction and send it.
+ * @return true if it was started
+ */
+static bool txn_start(flow_t *f, txn_t *t, coap_packet_t *pkt, uint64_t now)
+{
+    pkt->hdr.ver = 1;
+    pkt->hdr.t = COAP_TYPE_CON;
+    pkt->hdr.tkl = LOADGEN_TOKEN_LEN;
+    pkt->hdr.id[0] = (uint8_t) (t->msg_id >> 8);
+    pkt->hdr.id[1] = (uint8_t) t->msg_id;
+    pkt->tok.p = t->token;
+    pkt->tok.len = LOADGEN_TOKEN_LEN;
+
+    t->len = sizeof(t->buf);
+    if (coap_build(t->buf, &t->len, pkt) != 0) {
+        fprintf(stderr, "coap_build failed (%s flow %u)\n",
+                kind_names[f->kind], f->index);
+        t->active = false;
+        return false;
+    }
+
+    f->in_flight++;
+    stats[f->kind].requests++;
+    t->first_us = now;
+    txn_transmit(f, t, now);
+    return true;
+}
+
+/**
+ * @brief Start the next request of a GET, FETCH, iPATCH or Observe flow.
+ */
+static bool flow_start_request(flow_t *f, uint64_t now)
+{
+    txn_t *t = txn_new(f);
+    if (!t)
+        return false;
+
+    // Option values must outlive coap_build() in txn_start()
+    coap_packet_t pkt = { 0 };
+    uint8_t block_buf[3];
+    uint8_t ct = COAP_CONTENTTYPE_TEXT_PLAIN;
+    uint8_t obs = 0;
+    char payload[64];
+    int n = 0;
+
+    switch (f->kind) {
+    case KIND_GET:
+        pkt.hdr.code = COAP_METHOD_GET;
+        coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) "file",
+                        4);
+        if (cfg.image)
+            coap_add_option(&pkt, COAP_OPTION_URI_QUERY,
+                            (const uint8_t *) "type=image", 10);
+        coap_add_option(&pkt, COAP_OPTION_BLOCK2, block_buf,
+                        coap_encode_block2_option(block_buf, f->block, false,
+                                                  cfg.szx));
+        break;
+
+    case KIND_FETCH: {
+        unsigned start = cfg.fetch_lines ? rng_next() % cfg.fetch_lines : 0;
+        n = snprintf(payload, sizeof(payload), "%u,%u", start,
+                     start + cfg.fetch_span - 1);
+        pkt.hdr.code = COAP_METHOD_FETCH;
+        coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) "file",
+                        4);
+        coap_add_option(&pkt, COAP_OPTION_CONTENT_FORMAT, &ct, 1);
+        break;
+    }
+
+    case KIND_PATCH:
+        n = snprintf(payload, sizeof(payload), "loadgen %u-%lu\n", f->index,
+                     (unsigned long) f->seq);
+        pkt.hdr.code = COAP_METHOD_iPATCH;
+        coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) "file",
+                        4);
+        coap_add_option(&pkt, COAP_OPTION_CONTENT_FORMAT, &ct, 1);
+        break;
+
+    case KIND_OBSERVE:
+        pkt.hdr.code = COAP_METHOD_GET;
+        coap_add_option(&pkt, COAP_OPTION_OBSERVE, &obs, 0);  // Observe: 0
+        coap_add_option(&pkt, COAP_OPTION_URI_PATH,
+                        (const uint8_t *) cfg.observe_path,
+                        strlen(cfg.observe_path));
+        memcpy(f->obs_token, t->token, LOADGEN_TOKEN_LEN);
+        break;
+
+    default:
+        t->active = false;
+        return false;
+    }
+
+    if (n > 0) {
+        pkt.payload.p = (const uint8_t *) payload;
+        pkt.payload.len = (size_t) n;
+    }
+    return txn_start(f, t, &pkt, now);
+}
+
+/**
+ * @brief Start whatever requests a flow is due to send.
+ */
+static void flow_pump(flow_t *f, uint64_t now)
+{
+    if (now < f->resume_us)
+        return;
+
+    switch (f->kind) {
+    case KIND_GET:
+    case KIND_FETCH:
+        if (f->in_flight == 0)
+            flow_start_request(f, now);
+        break;
+
+    case KIND_PATCH:
+        // A burst goes out back to back, then the flow rests for the gap
+        if (f->burst_left == 0 && f->in_flight == 0)
+            f->burst_left = cfg.burst;
+        while (f->burst_left > 0 && flow_start_request(f, now))
+            f->burst_left--;
+        break;
+
+    case KIND_OBSERVE:
+        if (!f->registered && f->in_flight == 0)
+            flow_start_request(f, now);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Handle the response that completes a transaction.
+ */
+static void txn_complete(flow_t *f, txn_t *t, const coap_packet_t *rsp,
+                         uint64_t now)
+{
+    kind_stats_t *s = &stats[f->kind];
+    stats_add_latency(s, (uint32_t) (now - t->first_us));
+    bool success = (rsp->hdr.code >> 5) == 2;
+    if (success)
+        s->ok++;
+    else
+        s->errors++;
+    s->bytes += rsp->payload.len;
+    txn_free(f, t);
+
+    uint8_t count = 0;
+    switch (f->kind) {
+    case KIND_GET: {
+        const coap_option_t *opt = coap_findOptions(rsp, COAP_OPTION_BLOCK2,
+                                                    &count);
+        uint32_t num = 0;
+        bool more = false;
+        uint8_t szx = 0;
+        if (success && opt &&
+            coap_parse_block2_option(opt, &num, &more, &szx) && more) {
+            f->block = num + coap_block_units(szx, rsp->payload.len);
+        } else {
+            if (success)
+                s->transfers++;
+            f->block = 0;
+        }
+        break;
+    }
+
+    case KIND_PATCH:
+        if (f->burst_left == 0 && f->in_flight == 0)
+            f->resume_us = now + (uint64_t) cfg.patch_gap_ms * 1000u;
+        break;
+
+    case KIND_OBSERVE:
+        f->registered = success && coap_findOptions(rsp, COAP_OPTION_OBSERVE,
+                                                    &count);
+        if (!f->registered)
+            f->resume_us = now + LOADGEN_RETRY_MS * 1000u;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Give up on a transaction (no response, or reset).
+ */
+static void txn_fail(flow_t *f, txn_t *t, uint64_t now)
+{
+    stats[f->kind].failed++;
+    txn_free(f, t);
+    if (f->kind == KIND_OBSERVE)
+        f->resume_us = now + LOADGEN_RETRY_MS * 1000u;
+    else if (f->kind == KIND_PATCH && f->burst_left == 0 && f->in_flight == 0)
+        f->resume_us = now + (uint64_t) cfg.patch_gap_ms * 1000u;
+}
+
+/**
+ * @brief Retransmit or give up on transactions whose timer expired.
+ */
+static void flow_timers(flow_t *f, uint64_t now)
+{
+    for (int i = 0; i < LOADGEN_WINDOW_MAX; i++) {
+        txn_t *t = &f->txn[i];
+        if (!t->active || now < t->next_us)
+            continue;
+        if (t->acked || t->tries > MAX_RETRANSMITS)
+            txn_fail(f, t, now);
+        else
+            txn_transmit(f, t, now);
+    }
+}
+
+/**
+ * @brief Remember a received CON message ID.
+ * @return true if it was already seen (a retransmission)
+ */
+static bool flow_seen_con(flow_t *f, uint16_t msg_id)
+{
+    for (unsigned i = 0; i < f->recent_count; i++) {
+        if (f->recent_con[i] == msg_id)
+            return true;
+    }
+    f->recent_con[f->recent_head] = msg_id;
+    f->recent_head = (f->recent_head + 1) % LOADGEN_RECENT_CON;
+    if (f->recent_count < LOADGEN_RECENT_CON)
+        f->recent_count++;
+    return false;
+}
+
+/**
+ * @brief Send an empty ACK for a received CON.
+ */
+static void flow_send_empty_ack(flow_t *f, const coap_packet_t *con)
+{
+    uint8_t ack[4] = { 0x60, 0x00, con->hdr.id[0], con->hdr.id[1] };
+    flow_send_raw(f, ack, sizeof(ack));
+}
+
+/**
+ * @brief Handle one datagram received on a flow's socket.
+ */
+static void flow_receive(flow_t *f, const uint8_t *buf, size_t len,
+                         uint64_t now)
+{
+    coap_packet_t pkt;
+    if (coap_parse(&pkt, buf, len) != 0) {
+        bad_datagrams++;
+        return;
+    }
+    uint16_t msg_id = coap_extract_msg_id(&pkt);
+
+    if (pkt.hdr.t == COAP_TYPE_ACK || pkt.hdr.t == COAP_TYPE_RESET) {
+        txn_t *t = NULL;
+        for (int i = 0; i < LOADGEN_WINDOW_MAX; i++) {
+            if (f->txn[i].active && f->txn[i].msg_id == msg_id) {
+                t = &f->txn[i];
+                break;
+            }
+        }
+        if (!t || t->acked) {
+            late_responses++;  // Answer to a retransmission already handled
+            return;
+        }
+        if (pkt.hdr.t == COAP_TYPE_RESET) {
+            txn_fail(f, t, now);
+        } else if (pkt.hdr.code == 0) {
+            t->acked = true;
+            t->next_us = now + LOADGEN_SEPARATE_WAIT_MS * 1000u;
+        } else {
+            txn_complete(f, t, &pkt, now);
+        }
+        return;
+    }
+
+    // CON or NON: a separate response or a notification
+    bool dup = false;
+    if (pkt.hdr.t == COAP_TYPE_CON) {
+        flow_send_empty_ack(f, &pkt);
+        dup = flow_seen_con(f, msg_id);
+    }
+
+    coap_buffer_t obs_tok = { f->obs_token, LOADGEN_TOKEN_LEN };
+    for (int i = 0; i < LOADGEN_WINDOW_MAX && !dup; i++) {
+        txn_t *t = &f->txn[i];
+        coap_buffer_t tok = { t->token, LOADGEN_TOKEN_LEN };
+        if (t->active && coap_token_matches(&pkt.tok, &tok)) {
+            txn_complete(f, t, &pkt, now);
+            return;
+        }
+    }
+
+    if (f->kind == KIND_OBSERVE && f->registered &&
+        coap_token_matches(&pkt.tok, &obs_tok)) {
+        if (dup) {
+            stats[KIND_OBSERVE].duplicates++;
+        } else {
+            stats[KIND_OBSERVE].notifications++;
+            stats[KIND_OBSERVE].bytes += pkt.payload.len;
+        }
+    } else if (!dup) {
+        late_responses++;
+    }
+}
+
+/**
+ * @brief Open one flow's socket, connected to the server.
+ */
+static bool flow_open(flow_t *f, flow_kind_t kind, unsigned index)
+{
+    memset(f, 0, sizeof(*f));
+    f->kind = kind;
+    f->index = index;
+    f->next_msg_id = (uint16_t) rng_next();  // Random start, then +1
+    f->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (f->fd < 0) {
+        perror("socket");
+        return false;
+    }
+    if (connect(f->fd, (const struct sockaddr *) &cfg.server,
+                sizeof(cfg.server)) < 0) {
+        perror("connect");
+        close(f->fd);
+        return false;
+    }
+    // Spread the first requests so every flow does not start in one burst
+    f->resume_us = now_us() + (rng_next() % 200) * 1000u;
+    return true;
+}
+
+/**
+ * @brief Deregister observers (Observe: 1, NON) and close the sockets.
+ */
+static void flows_close(void)
+{
+    for (unsigned i = 0; i < flow_count; i++) {
+        flow_t *f = &flows[i];
+        if (f->kind == KIND_OBSERVE && f->registered) {
+            coap_packet_t pkt = { 0 };
+            uint8_t obs = 1;
+            uint16_t id = f->next_msg_id++;
+            pkt.hdr.ver = 1;
+            pkt.hdr.t = COAP_TYPE_NONCON;
+            pkt.hdr.tkl = LOADGEN_TOKEN_LEN;
+            pkt.hdr.code = COAP_METHOD_GET;
+            pkt.hdr.id[0] = (uint8_t) (id >> 8);
+            pkt.hdr.id[1] = (uint8_t) id;
+            pkt.tok.p = f->obs_token;
+            pkt.tok.len = LOADGEN_TOKEN_LEN;
+            coap_add_option(&pkt, COAP_OPTION_OBSERVE, &obs, 1);
+            coap_add_option(&pkt, COAP_OPTION_URI_PATH,
+                            (const uint8_t *) cfg.observe_path,
+                            strlen(cfg.observe_path));
+            uint8_t buf[LOADGEN_TX_MAX];
+            size_t len = sizeof(buf);
+            if (coap_build(buf, &len, &pkt) == 0)
+                send(f->fd, buf, len, 0);
+        }
+        close(f->fd);
+    }
+}
+
+/**
+ * @brief Print a one-line progress summary.
+ */
+static void print_progress(double t)
+{
+    printf("t=%.0fs", t);
+    for (int k = 0; k < KIND_COUNT; k++) {
+        if (cfg.flows[k] == 0)
+            continue;
+        printf(" %s=%lu/%lu", kind_names[k], (unsigned long) stats[k].ok,
+               (unsigned long) stats[k].requests);
+    }
+    if (cfg.flows[KIND_OBSERVE])
+        printf(" notifications=%lu",
+               (unsigned long) stats[KIND_OBSERVE].notifications);
+    printf(" retx=%lu\n", (unsigned long) (stats[KIND_GET].retransmits +
+                                           stats[KIND_FETCH].retransmits +
+                                           stats[KIND_PATCH].retransmits +
+                                           stats[KIND_OBSERVE].retransmits));
+    fflush(stdout);
+}
+
+/**
+ * @brief Print the final report.
+ */
+static void print_report(double elapsed_s)
+{
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &cfg.server.sin_addr, ip, sizeof(ip));
+    printf("\n=== coap_loadgen %s:%u, %.1f s, loss %u.%u%% per direction ===\n",
+           ip, ntohs(cfg.server.sin_port), elapsed_s, cfg.loss_pct_x10 / 10,
+           cfg.loss_pct_x10 % 10);
+    printf("%-8s %5s %8s %8s %6s %6s %7s %6s %8s %8s %8s %8s\n", "kind",
+           "flows", "requests", "ok", "error", "failed", "retx", "retx%",
+           "p50_ms", "p99_ms", "max_ms", "req/s");
+
+    unsigned in_flight[KIND_COUNT] = { 0 };
+    for (unsigned i = 0; i < flow_count; i++)
+        in_flight[flows[i].kind] += flows[i].in_flight;
+
+    for (int k = 0; k < KIND_COUNT; k++) {
+        kind_stats_t *s = &stats[k];
+        if (cfg.flows[k] == 0)
+            continue;
+
+        qsort(s->lat_us, s->lat_count, sizeof(uint32_t), cmp_u32);
+        uint32_t max = s->lat_count ? s->lat_us[s->lat_count - 1] : 0;
+        double retx_pct = s->transmissions
+                              ? 100.0 * s->retransmits / s->transmissions
+                              : 0.0;
+        printf("%-8s %5u %8lu %8lu %6lu %6lu %7lu %6.1f %8.1f %8.1f %8.1f "
+               "%8.1f\n",
+               kind_names[k], cfg.flows[k], (unsigned long) s->requests,
+               (unsigned long) s->ok, (unsigned long) s->errors,
+               (unsigned long) s->failed, (unsigned long) s->retransmits,
+               retx_pct, percentile(s->lat_us, s->lat_count, 50) / 1000.0,
+               percentile(s->lat_us, s->lat_count, 99) / 1000.0, max / 1000.0,
+               (s->ok + s->errors) / elapsed_s);
+        if (in_flight[k])
+            printf("%-8s %u requests still in flight at the end\n", "",
+                   in_flight[k]);
+    }
+
+    if (cfg.flows[KIND_GET]) {
+        const kind_stats_t *s = &stats[KIND_GET];
+        printf("get: %lu payload bytes, %lu transfers, %.1f kB/s\n",
+               (unsigned long) s->bytes, (unsigned long) s->transfers,
+               s->bytes / elapsed_s / 1000.0);
+    }
+    if (cfg.flows[KIND_FETCH]) {
+        const kind_stats_t *s = &stats[KIND_FETCH];
+        printf("fetch: %lu payload bytes, %.1f kB/s\n",
+               (unsigned long) s->bytes, s->bytes / elapsed_s / 1000.0);
+    }
+    if (cfg.flows[KIND_OBSERVE]) {
+        const kind_stats_t *s = &stats[KIND_OBSERVE];
+        unsigned registered = 0;
+        for (unsigned i = 0; i < flow_count; i++)
+            registered += flows[i].kind == KIND_OBSERVE && flows[i].registered;
+        printf("observe: %u/%u registered, %lu notifications (%lu repeated), "
+               "%.1f/s\n",
+               registered, cfg.flows[KIND_OBSERVE],
+               (unsigned long) s->notifications,
+               (unsigned long) s->duplicates, s->notifications / elapsed_s);
+    }
+    printf("net: tx=%lu rx=%lu dropped_tx=%lu dropped_rx=%lu late=%lu "
+           "bad=%lu\n",
+           (unsigned long) tx_datagrams, (unsigned long) rx_datagrams,
+           (unsigned long) dropped_tx, (unsigned long) dropped_rx,
+           (unsigned long) late_responses, (unsigned long) bad_datagrams);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options] <server-ip>\n"
+           "  -p, --port N          Server port (5683)\n"
+           "  -d, --duration S      Run time in seconds (30)\n"
+           "  -i, --interval S      Progress line every S seconds (off)\n"
+           "  -g, --get N           GET /file block transfer flows (1)\n"
+           "  -f, --fetch N         FETCH /file line-range flows (0)\n"
+           "  -P, --patch N         iPATCH /file burst flows (0)\n"
+           "  -o, --observe N       Observe flows (0)\n"
+           "  -l, --loss PCT        Drop PCT %% of datagrams each way (0)\n"
+           "      --szx N           Block2 SZX for GET, 0-7 (6 = 1024 B)\n"
+           "      --image           GET /file?type=image\n"
+           "      --burst N         iPATCH requests per burst (4)\n"
+           "      --patch-gap MS    Pause between bursts (1000)\n"
+           "      --fetch-lines N   FETCH start lines drawn from 0..N-1 (100)\n"
+           "      --fetch-span N    Lines per FETCH (5)\n"
+           "      --observe-path P  Resource to observe (file)\n"
+           "      --seed N          Random seed for IDs, jitter and loss\n",
+           prog);
+}
+
+enum {
+    OPT_SZX = 256,
+    OPT_IMAGE,
+    OPT_BURST,
+    OPT_PATCH_GAP,
+    OPT_FETCH_LINES,
+    OPT_FETCH_SPAN,
+    OPT_OBSERVE_PATH,
+    OPT_SEED,
+};
+
+/**
+ * @brief Parse the command line into cfg.
+ * @return true if the configuration is usable
+ */
+static bool parse_args(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "port", required_argument, NULL, 'p' },
+        { "duration", required_argument, NULL, 'd' },
+        { "interval", required_argument, NULL, 'i' },
+        { "get", required_argument, NULL, 'g' },
+        { "fetch", required_argument, NULL, 'f' },
+        { "patch", required_argument, NULL, 'P' },
+        { "observe", required_argument, NULL, 'o' },
+        { "loss", required_argument, NULL, 'l' },
+        { "szx", required_argument, NULL, OPT_SZX },
+        { "image", no_argument, NULL, OPT_IMAGE },
+        { "burst", required_argument, NULL, OPT_BURST },
+        { "patch-gap", required_argument, NULL, OPT_PATCH_GAP },
+        { "fetch-lines", required_argument, NULL, OPT_FETCH_LINES },
+        { "fetch-span", required_argument, NULL, OPT_FETCH_SPAN },
+        { "observe-path", required_argument, NULL, OPT_OBSERVE_PATH },
+        { "seed", required_argument, NULL, OPT_SEED },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    unsigned port = 5683;
+    cfg.flows[KIND_GET] = 1;
+    cfg.seed = (uint32_t) time(NULL);
+
+    int c;
+    while ((c = getopt_long(argc, argv, "p:d:i:g:f:P:o:l:h", long_opts,
+                            NULL)) != -1) {
+        switch (c) {
+        case 'p': port = (unsigned) atoi(optarg); break;
+        case 'd': cfg.duration_s = atof(optarg); break;
+        case 'i': cfg.interval_s = atof(optarg); break;
+        case 'g': cfg.flows[KIND_GET] = (unsigned) atoi(optarg); break;
+        case 'f': cfg.flows[KIND_FETCH] = (unsigned) atoi(optarg); break;
+        case 'P': cfg.flows[KIND_PATCH] = (unsigned) atoi(optarg); break;
+        case 'o': cfg.flows[KIND_OBSERVE] = (unsigned) atoi(optarg); break;
+        case 'l': cfg.loss_pct_x10 = (unsigned) (atof(optarg) * 10 + 0.5); break;
+        case OPT_SZX: cfg.szx = (uint8_t) atoi(optarg); break;
+        case OPT_IMAGE: cfg.image = true; break;
+        case OPT_BURST: cfg.burst = (unsigned) atoi(optarg); break;
+        case OPT_PATCH_GAP: cfg.patch_gap_ms = (unsigned) atoi(optarg); break;
+        case OPT_FETCH_LINES: cfg.fetch_lines = (unsigned) atoi(optarg); break;
+        case OPT_FETCH_SPAN: cfg.fetch_span = (unsigned) atoi(optarg); break;
+        case OPT_OBSERVE_PATH: cfg.observe_path = optarg; break;
+        case OPT_SEED: cfg.seed = (uint32_t) strtoul(optarg, NULL, 0); break;
+        case 'h': usage(argv[0]); exit(0);
+        default: return false;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return false;
+    }
+    memset(&cfg.server, 0, sizeof(cfg.server));
+    cfg.server.sin_family = AF_INET;
+    cfg.server.sin_port = htons((uint16_t) port);
+    if (inet_pton(AF_INET, argv[optind], &cfg.server.sin_addr) != 1) {
+        fprintf(stderr, "Bad server address: %s\n", argv[optind]);
+        return false;
+    }
+
+    unsigned total = 0;
+    for (int k = 0; k < KIND_COUNT; k++)
+        total += cfg.flows[k];
+    if (total == 0 || total > LOADGEN_FLOWS_MAX) {
+        fprintf(stderr, "Need 1-%d flows in total\n", LOADGEN_FLOWS_MAX);
+        return false;
+    }
+    if (cfg.szx > COAP_BLOCK_SZX_BERT || cfg.loss_pct_x10 > 1000 ||
+        cfg.fetch_span == 0) {
+        fprintf(stderr, "Bad --szx, --loss or --fetch-span\n");
+        return false;
+    }
+    if (cfg.burst == 0 || cfg.burst > LOADGEN_WINDOW_MAX)
+        cfg.burst = cfg.burst ? LOADGEN_WINDOW_MAX : 1;
+    rng_state = cfg.seed ? cfg.seed : 1;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_args(argc, argv))
+        return 2;
+
+    for (int k = 0; k < KIND_COUNT; k++) {
+        for (unsigned i = 0; i < cfg.flows[k]; i++) {
+            if (!flow_open(&flows[flow_count], (flow_kind_t) k, flow_count))
+                return 1;
+            flow_count++;
+        }
+    }
+    printf("coap_loadgen: %u flows (get=%u fetch=%u patch=%u observe=%u), "
+           "seed %lu\n",
+           flow_count, cfg.flows[KIND_GET], cfg.flows[KIND_FETCH],
+           cfg.flows[KIND_PATCH], cfg.flows[KIND_OBSERVE],
+           (unsigned long) cfg.seed);
+
+    static struct pollfd pfds[LOADGEN_FLOWS_MAX];
+    for (unsigned i = 0; i < flow_count; i++) {
+        pfds[i].fd = flows[i].fd;
+        pfds[i].events = POLLIN;
+    }
+
+    uint64_t start = now_us();
+    uint64_t end = start + (uint64_t) (cfg.duration_s * 1e6);
+    uint64_t interval_us = (uint64_t) (cfg.interval_s * 1e6);
+    uint64_t next_progress = interval_us ? start + interval_us : UINT64_MAX;
+    uint64_t now = start;
+
+    while (now < end) {
+        for (unsigned i = 0; i < flow_count; i++) {
+            flow_timers(&flows[i], now);
+            flow_pump(&flows[i], now);
+        }
+
+        if (poll(pfds, flow_count, LOADGEN_POLL_MAX_MS) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        now = now_us();
+
+        for (unsigned i = 0; i < flow_count; i++) {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+            uint8_t buf[LOADGEN_RX_MAX];
+            ssize_t n;
+            while ((n = recv(pfds[i].fd, buf, sizeof(buf), MSG_DONTWAIT)) >
+                   0) {
+                rx_datagrams++;
+                if (loss_drop()) {
+                    dropped_rx++;
+                    continue;
+                }
+                flow_receive(&flows[i], buf, (size_t) n, now);
+            }
+        }
+
+        if (now >= next_progress) {
+            print_progress((now - start) / 1e6);
+            next_progress += interval_us;
+        }
+    }
+
+    print_report((now - start) / 1e6);
+    flows_close();
+    return 0;
+}
+
+// coap_handle_req() in microcoap walks this table; the load generator never
+// calls it, but the symbol must exist to link coap.c.
+const coap_endpoint_t endpoints[] = {
+    { (coap_method_t) 0, NULL, NULL, NULL },
+};
@@ -0,0 +1,23 @@
+#ifndef CS04_HOST_ARCH_CC_H
+#define CS04_HOST_ARCH_CC_H
+
+// lwIP compiler/platform port for the host build (test/host).
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LWIP_PLATFORM_DIAG(x)                                                \
+    do {                                                                     \
+        printf x;                                                            \
+    } while (0)
+
+#define LWIP_PLATFORM_ASSERT(x)                                              \
+    do {                                                                     \
+        fprintf(stderr, "lwIP assertion \"%s\" failed at %s:%d\n", x,        \
+                __FILE__, __LINE__);                                         \
+        abort();                                                             \
+    } while (0)
+
+#define LWIP_RAND() ((u32_t) rand())
+
+#endif  // CS04_HOST_ARCH_CC_H
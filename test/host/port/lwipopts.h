@@ -0,0 +1,30 @@
+#ifndef CS04_HOST_LWIPOPTS_H
+#define CS04_HOST_LWIPOPTS_H
+
+// lwIP options for the host build (test/host). Only the pbuf, memory and
+// address code is compiled: no netif, no stack, no timers. Buffer-related
+// options follow the firmware's lwipopts.h so pbufs behave the same.
+
+#define NO_SYS                      1
+#define SYS_LIGHTWEIGHT_PROT        0
+#define LWIP_SOCKET                 0
+#define LWIP_NETCONN                0
+#define MEM_LIBC_MALLOC             1  // As the firmware (cyw43 poll arch)
+#define MEMP_MEM_MALLOC             1
+#define MEM_ALIGNMENT               4
+#define MEM_SIZE                    4000
+#define PBUF_POOL_SIZE              24
+#define LWIP_IPV4                   1
+#define LWIP_IPV6                   0
+#define LWIP_UDP                    1
+#define LWIP_TCP                    0
+#define LWIP_ARP                    1
+#define LWIP_ETHERNET               1
+#define LWIP_ICMP                   0
+#define LWIP_RAW                    0
+#define LWIP_DHCP                   0
+#define LWIP_DNS                    0
+#define LWIP_SUPPORT_CUSTOM_PBUF    1  // Pool-backed pbufs (cs04_packet_pool)
+#define LWIP_STATS                  0
+
+#endif  // CS04_HOST_LWIPOPTS_H
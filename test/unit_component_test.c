@@ -8,7 +8,28 @@
 // Include project headers
 #include "cs04_coap_packet.h"
 #include "cs04_coap_reliability.h"
+#include "cs04_packet_pool.h"
+#include "cs04_exchange_cache.h"
+#include "cs04_dispatch.h"
+#include "cs04_notify.h"
+#include "cs04_payload_template.h"
+#include "cs04_cbor.h"
+#include "cs04_append_batch.h"
+#include "cs04_subscribers.h"
+#include "cs04_file_tail.h"
 #include "cs04_hardware.h"
+#include "cs04_block_window.h"
+#include "cs04_block_size.h"
+#include "cs04_write_behind.h"
+#include "cs04_transfer_session.h"
+#include "cs04_hot_cache.h"
+#include "cs04_upload_session.h"
+#include "cs04_line_index.h"
+#include "cs04_trace.h"
+#include "cs04_log.h"
+#include "cs04_metrics.h"
+#include "cs04_radio.h"
+#include "cs04_proxy_cache.h"
 
 // --- WI-FI CREDENTIALS ---
 #define TEST_WIFI_SSID "lomohomo"
@@ -85,7 +106,12 @@ void unit_test_block_size_math()
     TEST_ASSERT(coap_block_size_from_szx(0) == 16, "SZX 0 -> 16 bytes");
     TEST_ASSERT(coap_block_size_from_szx(6) == 1024, "SZX 6 -> 1024 bytes");
     TEST_ASSERT(coap_block_size_from_szx(7) == 1024,
-                "SZX 7 (Max) -> 1024 bytes");
+                "SZX 7 (BERT unit) -> 1024 bytes");
+    TEST_ASSERT(coap_szx_from_block_size(1024) == 6, "1024 bytes -> SZX 6");
+    TEST_ASSERT(coap_szx_from_block_size(700) == 5, "700 bytes -> SZX 5");
+    TEST_ASSERT(coap_block_units(6, 1024) == 1, "Plain block is one number");
+    TEST_ASSERT(coap_block_units(7, 2048) == 2, "BERT 2 KiB covers 2 numbers");
+    TEST_ASSERT(coap_block_units(7, 1100) == 2, "Short BERT tail rounds up");
 }
 
 void unit_test_block2_encoding()
@@ -103,6 +129,17 @@ void unit_test_block2_encoding()
     TEST_ASSERT(len == 2, "Medium Block2 should be 2 bytes");
     TEST_ASSERT_EQUAL_HEX(0x06, buf[0], "Upper Byte Match");
     TEST_ASSERT_EQUAL_HEX(0x46, buf[1], "Lower Byte Match");
+
+    // Block1 shares the layout: block 20, More 1, SZX 5 -> 0x014D
+    len = coap_encode_block1_option(buf, 20, true, 5);
+    coap_option_t opt = { COAP_OPTION_BLOCK1, { buf, len } };
+    uint32_t num = 0;
+    bool more = false;
+    uint8_t szx = 0;
+    TEST_ASSERT(len == 2 && buf[0] == 0x01 && buf[1] == 0x4D &&
+                    coap_parse_block1_option(&opt, &num, &more, &szx) &&
+                    num == 20 && more && szx == 5,
+                "Block1 option round trip");
 }
 
 void unit_test_reliability_basic()
@@ -141,6 +178,1083 @@ void unit_test_reliability_circular_buffer()
     TEST_ASSERT(coap_is_duplicate_message(&det, 17) == true, "ID 17 present");
 }
 
+void unit_test_retransmit_queue()
+{
+    printf("\n[UNIT] Testing Retransmission Queue...\n");
+    coap_reliability_init();
+
+    ip_addr_t dest;
+    ip4addr_aton("192.168.137.1", &dest);
+    uint8_t packet[4] = { 0x40, 0x01, 0x00, 0x01 };
+    uint32_t deadline = 0;
+
+    TEST_ASSERT(!coap_next_retransmit_deadline(&deadline),
+                "Empty queue has no deadline");
+
+    coap_store_for_retransmit(0x0101, &dest, 5683, packet, sizeof(packet));
+    coap_store_for_retransmit(0x0102, &dest, 5683, packet, sizeof(packet));
+    coap_store_for_retransmit(0x0121, &dest, 5683, packet, sizeof(packet));
+    coap_store_for_retransmit(0x0101, &dest, 5683, packet, sizeof(packet));
+    TEST_ASSERT(coap_next_retransmit_deadline(&deadline),
+                "Stored messages set a deadline");
+
+    // 0x0101 and 0x0121 share a hash bucket; clearing one keeps the other
+    coap_clear_pending_message(0x0101);
+    coap_clear_pending_message(0x0102);
+    TEST_ASSERT(coap_next_retransmit_deadline(&deadline),
+                "Colliding ID still pending");
+    coap_clear_pending_message(0x0121);
+    TEST_ASSERT(!coap_next_retransmit_deadline(&deadline),
+                "Re-stored ID was not duplicated");
+}
+
+void unit_test_rto_estimator()
+{
+    printf("\n[UNIT] Testing RTO Estimator...\n");
+    coap_reliability_init();
+
+    ip_addr_t dest;
+    ip4addr_aton("192.168.137.1", &dest);
+    uint8_t packet[4] = { 0x40, 0x01, 0x00, 0x01 };
+    uint32_t deadline = 0;
+
+    TEST_ASSERT(coap_peer_rto(&dest, 5683) == COAP_RTO_INITIAL_MS,
+                "Unknown peer starts at the initial RTO");
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    coap_store_for_retransmit(0x0201, &dest, 5683, packet, sizeof(packet));
+    coap_next_retransmit_deadline(&deadline);
+    TEST_ASSERT(deadline - now >= COAP_RTO_INITIAL_MS &&
+                    deadline - now <
+                        COAP_RTO_INITIAL_MS * ACK_RANDOM_FACTOR_PCT / 100 + 2,
+                "First timeout lies in [RTO, RTO * ACK_RANDOM_FACTOR)");
+
+    // A send failure is not an answer and must not be sampled
+    coap_cancel_pending_message(0x0201);
+    const coap_peer_t *peer = coap_peer_lookup(&dest, 5683);
+    TEST_ASSERT(peer && peer->strong_samples == 0, "Cancel takes no sample");
+
+    // Immediate ACKs pull the RTO down to the floor
+    for (uint16_t id = 0x0202; id < 0x0212; id++) {
+        coap_store_for_retransmit(id, &dest, 5683, packet, sizeof(packet));
+        coap_clear_pending_message(id);
+    }
+    TEST_ASSERT(peer->strong_samples == 16, "ACKs feed the strong estimator");
+    TEST_ASSERT(coap_peer_rto(&dest, 5683) == COAP_RTO_MIN_MS,
+                "Fast peer converges to COAP_RTO_MIN_MS");
+
+    ip_addr_t other;
+    ip4addr_aton("192.168.137.2", &other);
+    TEST_ASSERT(coap_peer_rto(&other, 5683) == COAP_RTO_INITIAL_MS,
+                "RTO state is per peer");
+}
+
+void unit_test_congestion_window()
+{
+    printf("\n[UNIT] Testing Congestion Window...\n");
+    coap_reliability_init();
+
+    ip_addr_t dest;
+    ip4addr_aton("192.168.137.1", &dest);
+    uint8_t packet[4] = { 0x40, 0x01, 0x00, 0x01 };
+    uint32_t deadline = 0;
+
+    // One message already sent fills the NSTART = 1 window
+    coap_store_for_retransmit(0x0301, &dest, 5683, packet, sizeof(packet));
+    const coap_peer_t *peer = coap_peer_lookup(&dest, 5683);
+    TEST_ASSERT(peer && peer->cwnd_x16 == COAP_NSTART * 16 &&
+                    peer->in_flight == 1,
+                "Window starts at NSTART");
+
+    // With the window full nothing is transmitted, so no pcb is needed
+    struct pbuf *p = packet_pool_alloc_pbuf(sizeof(packet));
+    memcpy(p->payload, packet, sizeof(packet));
+    coap_send_reliable(NULL, 0x0302, &dest, 5683, p);
+    coap_send_reliable(NULL, 0x0303, &dest, 5683, p);
+    pbuf_free(p);
+    TEST_ASSERT(peer->queued == 2 && peer->in_flight == 1,
+                "Messages beyond the window are queued");
+
+    coap_clear_pending_message(0x0301);
+    TEST_ASSERT(peer->cwnd_x16 == 2 * 16, "Clean ACK opens the window");
+    TEST_ASSERT(peer->queued == 0 && peer->in_flight == 2,
+                "Queued messages are let out in the window");
+    TEST_ASSERT(coap_next_retransmit_deadline(&deadline) &&
+                    (int32_t) (deadline -
+                               to_ms_since_boot(get_absolute_time())) <= 0,
+                "Released messages are due at once");
+
+    coap_cancel_pending_message(0x0302);
+    coap_cancel_pending_message(0x0303);
+    TEST_ASSERT(peer->in_flight == 0 &&
+                    !coap_next_retransmit_deadline(&deadline),
+                "Cancelled messages leave the window");
+}
+
+void unit_test_send_table_full()
+{
+    printf("\n[UNIT] Testing Send With Full Pending Table...\n");
+    coap_reliability_init();
+
+    ip_addr_t dest;
+    ip4addr_aton("192.168.137.1", &dest);
+    uint8_t packet[4] = { 0x40, 0x01, 0x00, 0x01 };
+    const uint8_t tok_data[2] = { 0x01, 0x02 };
+    coap_buffer_t token = { tok_data, sizeof(tok_data) };
+    const uint8_t query[] = "1,5";
+
+    // The first message fills the window, so the rest are only queued and
+    // no pcb is needed
+    coap_store_for_retransmit(0x0401, &dest, 5683, packet, sizeof(packet));
+    uint16_t taken = 1;
+    while (coap_pending_count() < MAX_PENDING_MESSAGES) {
+        if (!coap_send_con_request(NULL, &dest, 5683, COAP_METHOD_GET, "file",
+                                   &token, NULL, 0, true))
+            break;
+        taken++;
+    }
+    TEST_ASSERT(taken == MAX_PENDING_MESSAGES, "Requests fill the table");
+
+    TEST_ASSERT(coap_send_con_request(NULL, &dest, 5683, COAP_METHOD_iPATCH,
+                                      "file", &token, query, 3, true) == 0,
+                "CON request refused by a full table returns 0");
+    TEST_ASSERT(coap_send_con_notification(NULL, &dest, 5683, &token, 2,
+                                           query, 3, true, 0, true,
+                                           false) == 0,
+                "Notification refused by a full table returns 0");
+    TEST_ASSERT(coap_send_fetch_block_request(
+                    NULL, &dest, 5683, "file", &token, query, 3,
+                    COAP_CONTENTTYPE_TEXT_PLAIN, 1, 6, true) == 0,
+                "FETCH block refused by a full table returns 0");
+    TEST_ASSERT(coap_pending_count() == MAX_PENDING_MESSAGES,
+                "Refused messages are not stored");
+
+    coap_reliability_init();
+}
+
+void unit_test_block_size_choice()
+{
+    printf("\n[UNIT] Testing Block Size Negotiation...\n");
+    packet_pool_stats_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.cls[PACKET_POOL_BLOCK].size = PACKET_POOL_BLOCK_SIZE;
+    pool.cls[PACKET_POOL_BLOCK].count = PACKET_POOL_BLOCK_COUNT;
+    pool.cls[PACKET_POOL_BERT].size = PACKET_POOL_BERT_SIZE;
+    pool.cls[PACKET_POOL_BERT].count = PACKET_POOL_BERT_COUNT;
+
+    TEST_ASSERT(block_size_pick(7, &pool, 0, 0) == 7,
+                "Idle server keeps BERT");
+    TEST_ASSERT(block_size_pick(5, &pool, 0, 0) == 5,
+                "Never larger than the client asked");
+
+    pool.cls[PACKET_POOL_BERT].in_use = PACKET_POOL_BERT_COUNT;
+    TEST_ASSERT(block_size_pick(7, &pool, 0, 0) == 6,
+                "No BERT buffer free -> 1024 bytes");
+    pool.cls[PACKET_POOL_BERT].in_use = 0;
+
+    TEST_ASSERT(block_size_pick(7, &pool, BLOCK_SIZE_PENDING_BUSY, 0) == 6,
+                "Busy pending table rules out BERT");
+    TEST_ASSERT(block_size_pick(7, &pool, 0, BLOCK_SIZE_LOSS_512) == 5,
+                "Lossy peer gets 512-byte blocks");
+    TEST_ASSERT(block_size_pick(7, &pool, 0, 255) == BLOCK_SIZE_SZX_MIN,
+                "Loss never goes below the minimum size");
+
+    // Repeated requests raise a peer's loss estimate
+    coap_reliability_init();
+    ip_addr_t peer_ip;
+    ip4addr_aton("192.168.137.7", &peer_ip);
+    for (int i = 0; i < 8; i++)
+        coap_peer_note_request(&peer_ip, 5683, i % 2 == 0);
+    const coap_peer_t *peer = coap_peer_lookup(&peer_ip, 5683);
+    TEST_ASSERT(peer && peer->loss_x256 >= BLOCK_SIZE_LOSS_256,
+                "Half the requests repeated counts as heavy loss");
+}
+
+void unit_test_packet_pool()
+{
+    printf("\n[UNIT] Testing Packet Pool...\n");
+    packet_pool_stats_t before, after;
+    packet_pool_get_stats(&before);
+
+    // A small request takes a small buffer; the hold shows in the stats
+    uint8_t *small = packet_pool_alloc(40);
+    TEST_ASSERT(small != NULL, "Small buffer allocated");
+    packet_pool_get_stats(&after);
+    TEST_ASSERT(after.cls[PACKET_POOL_SMALL].in_use ==
+                    before.cls[PACKET_POOL_SMALL].in_use + 1,
+                "Small class in use");
+    TEST_ASSERT(after.bytes_high_water >= after.bytes_in_use,
+                "High-water mark covers current use");
+
+    // Block-sized pbufs come from the block class and return on pbuf_free
+    struct pbuf *p = packet_pool_alloc_pbuf(PACKET_POOL_BLOCK_SIZE);
+    TEST_ASSERT(p != NULL && p->len == PACKET_POOL_BLOCK_SIZE,
+                "Block pbuf allocated");
+    packet_pool_get_stats(&after);
+    TEST_ASSERT(after.cls[PACKET_POOL_BLOCK].in_use ==
+                    before.cls[PACKET_POOL_BLOCK].in_use + 1,
+                "Block class in use");
+
+    pbuf_free(p);
+    packet_pool_free(small);
+    packet_pool_get_stats(&after);
+    TEST_ASSERT(after.bytes_in_use == before.bytes_in_use,
+                "Buffers returned to pool");
+    TEST_ASSERT(packet_pool_alloc(PACKET_POOL_BERT_SIZE + 1) == NULL,
+                "Oversized request rejected");
+}
+
+void unit_test_exchange_cache()
+{
+    printf("\n[UNIT] Testing Exchange Deduplication Cache...\n");
+    exchange_cache_init();
+
+    ip_addr_t peer_a, peer_b;
+    ip4addr_aton("192.168.137.10", &peer_a);
+    ip4addr_aton("192.168.137.11", &peer_b);
+    struct pbuf *cached = NULL;
+
+    exchange_cache_record(&peer_a, 5683, 0x1234);
+    TEST_ASSERT(exchange_cache_lookup(&peer_a, 5683, 0x1234, &cached) ==
+                    EXCHANGE_IN_PROGRESS,
+                "Recorded exchange is in progress");
+    TEST_ASSERT(exchange_cache_lookup(&peer_b, 5683, 0x1234, &cached) ==
+                    EXCHANGE_NEW,
+                "Same ID from another peer is new");
+
+    struct pbuf *resp = packet_pool_alloc_pbuf(16);
+    exchange_cache_store_response(&peer_a, 5683, 0x1234, resp);
+    pbuf_free(resp);
+    TEST_ASSERT(exchange_cache_lookup(&peer_a, 5683, 0x1234, &cached) ==
+                        EXCHANGE_REPLAY &&
+                    cached == resp,
+                "Duplicate replays cached response");
+
+    exchange_cache_record(&peer_b, 5683, 0x0001);
+    exchange_cache_store_response(&peer_b, 5683, 0x0001, NULL);
+    TEST_ASSERT(exchange_cache_lookup(&peer_b, 5683, 0x0001, &cached) ==
+                    EXCHANGE_NO_RESPONSE,
+                "Answered without response");
+
+    // A block re-requested under a new message ID is served from the
+    // last-sent copy, rebound to the new ID
+    exchange_block_key_t key = { 0 };
+    key.ip = peer_a;
+    key.port = 5683;
+    key.token_len = 2;
+    key.block_num = 3;
+    key.szx = 6;
+    uint8_t block_resp[6] = { 0x62, 0x45, 0x00, 0x10, 0xAA, 0xBB };
+    resp = packet_pool_alloc_pbuf(sizeof(block_resp));
+    memcpy(resp->payload, block_resp, sizeof(block_resp));
+    exchange_cache_store_block(&key, resp);
+    pbuf_free(resp);
+
+    TEST_ASSERT(exchange_cache_find_block(&key, &cached), "Block cached");
+    struct pbuf *again = exchange_cache_rebind(cached, 0x5678);
+    uint8_t *hdr = again->payload;
+    TEST_ASSERT(hdr[2] == 0x56 && hdr[3] == 0x78 && hdr[5] == 0xBB,
+                "Rebound copy carries new msg ID");
+    pbuf_free(again);
+
+    key.block_num = 4;
+    TEST_ASSERT(!exchange_cache_find_block(&key, &cached),
+                "Other block not cached");
+    key.block_num = 3;
+    exchange_cache_forget_blocks();
+    TEST_ASSERT(!exchange_cache_find_block(&key, &cached),
+                "Forget drops cached blocks");
+
+    exchange_cache_init();
+    TEST_ASSERT(exchange_cache_lookup(&peer_a, 5683, 0x1234, &cached) ==
+                    EXCHANGE_NEW,
+                "Init forgets exchanges");
+}
+
+void unit_test_option_index()
+{
+    printf("\n[UNIT] Testing Parsed Option Index...\n");
+    // CON GET, two Uri-Path, Uri-Query, Block2, Proxy-Scheme (unindexed)
+    const uint8_t msg[] = { 0x40, 0x01, 0x12, 0x34, 0xB4, 'f', 'i', 'l', 'e',
+                            0x01, 'x',  0x43, 'a',  '=',  'b', 0x81, 0x06,
+                            0xD1, 0x03, 'c' };
+    coap_packet_t pkt;
+    TEST_ASSERT(coap_parse(&pkt, msg, sizeof(msg)) == 0, "Packet parsed");
+
+    uint8_t count = 0;
+    const coap_option_t *opt = coap_findOptions(&pkt, COAP_OPTION_URI_PATH,
+                                                &count);
+    TEST_ASSERT(opt == &pkt.opts[0] && count == 2, "Uri-Path run found");
+    opt = coap_findOptions(&pkt, COAP_OPTION_BLOCK2, &count);
+    TEST_ASSERT(opt == &pkt.opts[3] && count == 1, "Block2 found");
+    opt = coap_findOptions(&pkt, COAP_OPTION_PROXY_SCHEME, &count);
+    TEST_ASSERT(opt == &pkt.opts[4] && count == 1,
+                "Unindexed option found by scan");
+    TEST_ASSERT(coap_findOptions(&pkt, COAP_OPTION_OBSERVE, &count) == NULL &&
+                    count == 0,
+                "Absent option not found");
+
+    // Reusing the packet for a response must not leave stale entries
+    coap_make_response(&(coap_rw_buffer_t){ NULL, 0 }, &pkt, NULL, 0, 0, 0,
+                       NULL, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_NONE);
+    TEST_ASSERT(coap_findOptions(&pkt, COAP_OPTION_URI_PATH, &count) == NULL,
+                "Index cleared by coap_make_response");
+}
+
+void unit_test_chained_parse()
+{
+    printf("\n[UNIT] Testing Chained pbuf Parsing...\n");
+    // CON GET /file, Block2, then a 6-byte payload
+    const uint8_t msg[] = { 0x40, 0x01, 0x12, 0x34, 0xB4, 'f', 'i', 'l',
+                            'e',  0xC1, 0x0E, 0xFF, 'a',  'b', 'c', 'd',
+                            'e',  'f' };
+    static uint8_t gather[16];
+    coap_packet_t pkt;
+
+    // Split after two payload bytes: options parsed in place, payload gathered
+    struct pbuf *head = pbuf_alloc(PBUF_RAW, 14, PBUF_RAM);
+    struct pbuf *tail = pbuf_alloc(PBUF_RAW, sizeof(msg) - 14, PBUF_RAM);
+    memcpy(head->payload, msg, 14);
+    memcpy(tail->payload, msg + 14, sizeof(msg) - 14);
+    pbuf_cat(head, tail);
+    TEST_ASSERT(coap_parse_pbuf(&pkt, head, gather, sizeof(gather)) == 0,
+                "Chain parsed");
+    TEST_ASSERT(pkt.numopts == 2 &&
+                    pkt.opts[0].buf.p == (uint8_t *) head->payload + 5,
+                "Options point into the first segment");
+    TEST_ASSERT(pkt.payload.len == 6 && pkt.payload.p == gather &&
+                    memcmp(pkt.payload.p, "abcdef", 6) == 0,
+                "Spanning payload gathered");
+    TEST_ASSERT(coap_parse_pbuf(&pkt, head, gather, 4) ==
+                    COAP_ERR_BUFFER_TOO_SMALL,
+                "Short gather buffer rejected");
+    pbuf_free(head);
+
+    // Split inside the Block2 option: the whole datagram is gathered
+    head = pbuf_alloc(PBUF_RAW, 10, PBUF_RAM);
+    tail = pbuf_alloc(PBUF_RAW, sizeof(msg) - 10, PBUF_RAM);
+    memcpy(head->payload, msg, 10);
+    memcpy(tail->payload, msg + 10, sizeof(msg) - 10);
+    pbuf_cat(head, tail);
+    static uint8_t whole[sizeof(msg)];
+    TEST_ASSERT(coap_parse_pbuf(&pkt, head, whole, sizeof(whole)) == 0 &&
+                    pkt.numopts == 2 && pkt.payload.len == 6 &&
+                    memcmp(pkt.payload.p, "abcdef", 6) == 0,
+                "Option cut by a segment boundary parsed");
+    pbuf_free(head);
+}
+
+void unit_test_chain_build()
+{
+    printf("\n[UNIT] Testing Zero-Copy Response Encoding...\n");
+    static const uint8_t block[6] = { 'a', 'b', 'c', 'd', 'e', 'f' };
+    uint8_t tok_data[2] = { 0x12, 0x34 };
+    coap_packet_t req = { 0 };
+    req.tok.p = tok_data;
+    req.tok.len = sizeof(tok_data);
+    uint8_t scratch_buf[16];
+    coap_rw_buffer_t scratch = { scratch_buf, sizeof(scratch_buf) };
+    coap_packet_t resp;
+    TEST_ASSERT(coap_build_block2_response(&scratch, &resp, &req, 0x01, 0x02,
+                                           0, false, 6, NULL, sizeof(block),
+                                           0, NULL) == 0,
+                "Response described without payload bytes");
+
+    // The payload stays where it is; only header and options are encoded
+    struct pbuf *ref = pbuf_alloc(PBUF_RAW, sizeof(block), PBUF_REF);
+    ref->payload = (void *) block;
+    struct pbuf *q = coap_build_pbuf_chain(&resp, ref);
+    TEST_ASSERT(q != NULL && q->next == ref &&
+                    q->tot_len == q->len + sizeof(block),
+                "Payload chained by reference");
+
+    static uint8_t gather[sizeof(block)];
+    coap_packet_t parsed;
+    TEST_ASSERT(coap_parse_pbuf(&parsed, q, gather, sizeof(gather)) == 0 &&
+                    parsed.payload.p == block &&
+                    parsed.payload.len == sizeof(block),
+                "Encoded chain parses back to the same payload");
+    pbuf_free(q);
+}
+
+void unit_test_conditional_get()
+{
+    printf("\n[UNIT] Testing Conditional GET Encoding...\n");
+    uint8_t tag[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
+    coap_buffer_t etag = { tag, sizeof(tag) };
+    uint8_t tok_data[2] = { 0x12, 0x34 };
+    coap_buffer_t tok = { tok_data, sizeof(tok_data) };
+
+    uint8_t buf[64];
+    size_t len = sizeof(buf);
+    uint16_t msg_id = 0;
+    TEST_ASSERT(coap_build_get_with_block2(buf, &len, &tok, "file", NULL, 0,
+                                           6, NULL, &etag, &msg_id) == 0,
+                "Conditional block 0 request built");
+    coap_packet_t parsed;
+    uint8_t count = 0;
+    TEST_ASSERT(coap_parse(&parsed, buf, len) == 0 && parsed.numopts == 2 &&
+                    parsed.opts[0].num == COAP_OPTION_ETAG &&
+                    parsed.opts[1].num == COAP_OPTION_URI_PATH,
+                "ETag option precedes Uri-Path");
+    const coap_option_t *opt = coap_findOptions(&parsed, COAP_OPTION_ETAG,
+                                                &count);
+    TEST_ASSERT(opt && opt->buf.len == 4 && memcmp(opt->buf.p, tag, 4) == 0,
+                "Request carries the held ETag");
+
+    // 2.03 Valid: same ETag back, nothing else
+    coap_packet_t req = { 0 };
+    req.tok = tok;
+    coap_packet_t resp;
+    TEST_ASSERT(coap_build_valid_response(&resp, &req, 0x01, 0x02, &etag) ==
+                    0,
+                "Valid response built");
+    len = sizeof(buf);
+    TEST_ASSERT(coap_build(buf, &len, &resp) == 0 &&
+                    coap_parse(&parsed, buf, len) == 0,
+                "Valid response round-trips");
+    opt = coap_findOptions(&parsed, COAP_OPTION_ETAG, &count);
+    TEST_ASSERT(parsed.hdr.code == COAP_RSPCODE_VALID && opt &&
+                    memcmp(opt->buf.p, tag, 4) == 0 &&
+                    parsed.payload.len == 0,
+                "2.03 echoes the ETag without payload");
+
+    uint8_t long_tag[COAP_ETAG_MAX + 1] = { 0 };
+    coap_buffer_t too_long = { long_tag, sizeof(long_tag) };
+    TEST_ASSERT(coap_build_valid_response(&resp, &req, 0x01, 0x02,
+                                          &too_long) != 0,
+                "Over-long ETag rejected");
+}
+
+static int dispatch_test_a(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                           coap_packet_t *outpkt, uint8_t id_hi,
+                           uint8_t id_lo, const ip_addr_t *addr, u16_t port)
+{
+    return 1;
+}
+
+static int dispatch_test_b(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt,
+                           coap_packet_t *outpkt, uint8_t id_hi,
+                           uint8_t id_lo, const ip_addr_t *addr, u16_t port)
+{
+    return 2;
+}
+
+void unit_test_dispatch()
+{
+    printf("\n[UNIT] Testing Endpoint Dispatch Table...\n");
+    static const dispatch_route_t get_routes[] = {
+        DISPATCH_ROUTE(dispatch_test_a, "ct=0", DISPATCH_SEG("file")),
+        DISPATCH_ROUTE(dispatch_test_b, "ct=0", DISPATCH_SEG("file"),
+                       DISPATCH_SEG("meta")),
+    };
+    static const dispatch_table_t table = {
+        .by_method = { [COAP_METHOD_GET] = DISPATCH_BUCKET(get_routes) },
+    };
+
+    TEST_ASSERT(get_routes[1].segment_count == 2 &&
+                    get_routes[1].segments[1].len == 4,
+                "Segment count and lengths precomputed");
+
+    coap_packet_t pkt = { 0 };
+    pkt.hdr.code = COAP_METHOD_GET;
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) "file", 4);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *) "meta", 4);
+
+    const dispatch_route_t *route = dispatch_lookup(&table, &pkt);
+    TEST_ASSERT(route && route->handler == dispatch_test_b,
+                "Two-segment path matched");
+
+    pkt.numopts = 1;
+    route = dispatch_lookup(&table, &pkt);
+    TEST_ASSERT(route && route->handler == dispatch_test_a,
+                "One-segment path matched");
+
+    pkt.opts[0].buf.len = 3;  // "fil"
+    TEST_ASSERT(dispatch_lookup(&table, &pkt) == NULL,
+                "Prefix does not match");
+
+    pkt.opts[0].buf.len = 4;
+    pkt.hdr.code = COAP_METHOD_PUT;
+    TEST_ASSERT(dispatch_lookup(&table, &pkt) == NULL,
+                "Other method has no routes");
+}
+
+void unit_test_notify_template()
+{
+    printf("\n[UNIT] Testing Notification Template...\n");
+    static const uint8_t etag[] = { 0x11, 0x22 };
+    coap_packet_t pkt = { 0 };
+    pkt.hdr.code = COAP_RSPCODE_CONTENT;
+    coap_add_option(&pkt, COAP_OPTION_ETAG, etag, sizeof(etag));
+    pkt.payload.p = (const uint8_t *) "BTN1=1";
+    pkt.payload.len = 6;
+
+    notify_template_t tmpl;
+    TEST_ASSERT(notify_template_init(&tmpl, &pkt), "Template encoded");
+
+    // Header, ETag (1 + 2 bytes), then the empty Observe (delta 2, len 0)
+    TEST_ASSERT(tmpl.observe_at == 7, "Observe placed after ETag");
+    TEST_ASSERT_EQUAL_HEX(0x20, tmpl.buf[tmpl.observe_at],
+                          "Observe header has delta 2, length 0");
+    TEST_ASSERT(tmpl.len == 8 + 1 + 6, "Payload follows Observe");
+    notify_template_free(&tmpl);
+
+    TEST_ASSERT(notify_wants_con(NOTIFY_CON_ALL_MAX, 3, 1),
+                "Few observers: always CON");
+    int con = 0;
+    for (uint32_t seq = 0; seq < NOTIFY_CON_EVERY; seq++)
+        con += notify_wants_con(NOTIFY_CON_ALL_MAX + 1, seq, 2);
+    TEST_ASSERT(con == 1, "Many observers: one CON per period");
+
+    // Coalescing: state offered while a CON is unacknowledged waits, and
+    // two such offers collapse into one pending send
+    notify_gate_t gate = { 0 };
+    notify_stats_t before, after;
+    notify_get_stats(&before);
+    uint32_t t0 = 10000;
+    TEST_ASSERT(notify_gate_offer(&gate, t0), "Idle observer sent at once");
+    notify_gate_sent(&gate, t0, true);
+    TEST_ASSERT(!notify_gate_offer(&gate, t0 + 500) &&
+                    !notify_gate_offer(&gate, t0 + 600),
+                "Held while CON in flight");
+    TEST_ASSERT(notify_gate_settle(&gate, t0 + 700), "Sent once ACKed");
+    notify_gate_sent(&gate, t0 + 700, false);
+    TEST_ASSERT(!notify_gate_offer(&gate, t0 + 750) &&
+                    notify_gate_ready_at(&gate) ==
+                        t0 + 700 + NOTIFY_MIN_INTERVAL_MS,
+                "Rate limited within minimum interval");
+    notify_get_stats(&after);
+    TEST_ASSERT(after.coalesced == before.coalesced + 1 &&
+                    after.rate_limited == before.rate_limited + 1,
+                "Coalesced and rate-limited counted");
+}
+
+void unit_test_payload_template()
+{
+    printf("\n[UNIT] Testing Payload Template...\n");
+    payload_template_t tmpl;
+    TEST_ASSERT(payload_template_init(&tmpl, "LED=%,BUZZER=%", "OFF") &&
+                    strcmp(tmpl.text, "LED=OFF,BUZZER=OFF") == 0 &&
+                    tmpl.len == 18,
+                "Layout composed with initial values");
+    TEST_ASSERT(payload_template_set(&tmpl, 0, "ON") &&
+                    strcmp(tmpl.text, "LED=ON,BUZZER=OFF") == 0 &&
+                    tmpl.len == 17,
+                "Changed field recomposes text");
+    TEST_ASSERT(!payload_template_set(&tmpl, 0, "ON"),
+                "Same value leaves text alone");
+    TEST_ASSERT(!payload_template_set(&tmpl, 2, "ON"),
+                "Field past the layout rejected");
+
+    char big[PAYLOAD_TEMPLATE_LEN + 1];
+    memset(big, 'x', PAYLOAD_TEMPLATE_LEN);
+    big[PAYLOAD_TEMPLATE_LEN] = '\0';
+    TEST_ASSERT(!payload_template_set(&tmpl, 1, big) &&
+                    strcmp(tmpl.text, "LED=ON,BUZZER=OFF") == 0,
+                "Oversized value keeps previous text");
+}
+
+void unit_test_cbor()
+{
+    printf("\n[UNIT] Testing CBOR Codec...\n");
+    uint8_t buf[16];
+    cbor_writer_t w;
+    cbor_writer_init(&w, buf, sizeof(buf));
+    cbor_put_map(&w, 2);
+    cbor_put_uint(&w, 0);
+    cbor_put_bool(&w, true);
+    cbor_put_uint(&w, 1);
+    cbor_put_bool(&w, false);
+    const uint8_t expect[] = { 0xA2, 0x00, 0xF5, 0x01, 0xF4 };
+    TEST_ASSERT(!w.error && w.len == sizeof(expect) &&
+                    memcmp(buf, expect, sizeof(expect)) == 0,
+                "Map {0: true, 1: false} encoded");
+
+    cbor_writer_init(&w, buf, sizeof(buf));
+    cbor_put_uint(&w, 23);
+    cbor_put_uint(&w, 24);
+    cbor_put_uint(&w, 1000);
+    const uint8_t heads[] = { 0x17, 0x18, 0x18, 0x19, 0x03, 0xE8 };
+    TEST_ASSERT(w.len == sizeof(heads) && memcmp(buf, heads, w.len) == 0,
+                "Integers use shortest heads");
+
+    cbor_writer_init(&w, buf, 2);
+    cbor_put_bytes(&w, (const uint8_t *) "AB", 2);
+    TEST_ASSERT(w.error, "Writer overflow flagged");
+
+    cbor_reader_t r;
+    uint32_t key;
+    bool on;
+    uint8_t major;
+    uint32_t arg;
+    cbor_reader_init(&r, expect, sizeof(expect));
+    TEST_ASSERT(cbor_get_head(&r, &major, &arg) && major == CBOR_MAJOR_MAP &&
+                    arg == 2 && cbor_get_uint(&r, &key) && key == 0 &&
+                    cbor_get_bool(&r, &on) && on && cbor_get_uint(&r, &key) &&
+                    key == 1 && cbor_get_bool(&r, &on) && !on &&
+                    cbor_reader_done(&r),
+                "Map decoded in one pass");
+
+    // Batch: [{0: true}, {1: true}]
+    const uint8_t batch[] = { 0x82, 0xA1, 0x00, 0xF5, 0xA1, 0x01, 0xF5 };
+    cbor_reader_init(&r, batch, sizeof(batch));
+    TEST_ASSERT(cbor_get_head(&r, &major, &arg) &&
+                    major == CBOR_MAJOR_ARRAY && arg == 2,
+                "Batch array head decoded");
+
+    cbor_reader_init(&r, expect, 3);
+    cbor_get_head(&r, &major, &arg);
+    cbor_get_uint(&r, &key);
+    cbor_get_bool(&r, &on);
+    TEST_ASSERT(!cbor_get_uint(&r, &key) && !cbor_reader_done(&r),
+                "Truncated payload rejected");
+
+    const uint8_t indefinite[] = { 0xBF, 0x00, 0xF5, 0xFF };
+    cbor_reader_init(&r, indefinite, sizeof(indefinite));
+    TEST_ASSERT(!cbor_get_head(&r, &major, &arg),
+                "Indefinite-length map rejected");
+
+    const uint8_t wrong_type[] = { 0xF5 };
+    cbor_reader_init(&r, wrong_type, sizeof(wrong_type));
+    TEST_ASSERT(!cbor_get_uint(&r, &key), "Type mismatch rejected");
+
+    cbor_reader_init(&r, expect, sizeof(expect));
+    cbor_get_head(&r, &major, &arg);
+    TEST_ASSERT(!cbor_reader_done(&r), "Unread bytes leave reader unfinished");
+}
+
+void unit_test_append_batch()
+{
+    printf("\n[UNIT] Testing Append Batch...\n");
+    append_batch_t batch;
+    append_batch_clear(&batch);
+    TEST_ASSERT(!append_batch_due(&batch, 0), "Empty batch not due");
+
+    TEST_ASSERT(append_batch_add(&batch, "one", 3, 100) &&
+                    append_batch_add(&batch, "two", 3, 200) &&
+                    batch.lines == 2 && batch.len == 7 &&
+                    memcmp(batch.data, "one\ntwo", 7) == 0,
+                "Lines joined with newlines");
+    TEST_ASSERT(!append_batch_due(&batch, 100 + APPEND_BATCH_MS - 1) &&
+                    append_batch_due(&batch, 100 + APPEND_BATCH_MS),
+                "Due once the oldest line is old enough");
+    TEST_ASSERT(!append_batch_add(&batch, "a\nb", 3, 300) && batch.lines == 2,
+                "Line with a newline rejected");
+
+    char big[APPEND_BATCH_BYTES];
+    memset(big, 'x', sizeof(big));
+    TEST_ASSERT(!append_batch_add(&batch, big, sizeof(big) - 7, 300) &&
+                    batch.len == 7,
+                "Line that does not fit leaves batch unchanged");
+
+    append_batch_clear(&batch);
+    for (int i = 0; i < APPEND_BATCH_LINES; i++)
+        append_batch_add(&batch, "x", 1, 0);
+    TEST_ASSERT(append_batch_due(&batch, 0), "Due at the line limit");
+
+    const uint8_t two_lines[] = "one\ntwo";
+    const uint8_t trailing[] = "one\n";
+    TEST_ASSERT(append_batch_count_lines(two_lines, 7) == 2 &&
+                    append_batch_count_lines(trailing, 4) == 1 &&
+                    append_batch_count_lines(NULL, 0) == 0,
+                "Server counts lines in a batch");
+}
+
+void unit_test_subscriber_registry()
+{
+    printf("\n[UNIT] Testing Subscriber Registry...\n");
+    subscribers_init();
+
+    ip_addr_t peer;
+    ip4addr_aton("192.168.137.10", &peer);
+    uint8_t tok_a[] = { 0xA1, 0xA2 };
+    uint8_t tok_b[] = { 0xB1, 0xB2 };
+    coap_buffer_t token_a = { tok_a, sizeof(tok_a) };
+    coap_buffer_t token_b = { tok_b, sizeof(tok_b) };
+
+    subscriber_t *a = subscriber_add(&peer, 5683, &token_a);
+    subscriber_t *b = subscriber_add(&peer, 5683, &token_b);
+    TEST_ASSERT(a && b && a != b, "Two tokens from one peer registered");
+    TEST_ASSERT(subscriber_add(&peer, 5683, &token_a) == a &&
+                    subscriber_count() == 2,
+                "Re-registration reuses entry");
+
+    // ACK attribution follows the msg_id, not the address
+    subscriber_track_msg(a, 0x1111);
+    subscriber_track_msg(b, 0x2222);
+    TEST_ASSERT(subscriber_on_ack(0x2222) == b, "ACK attributed by msg_id");
+    TEST_ASSERT(subscriber_on_ack(0x2222) == NULL, "Link used once");
+
+    for (int i = 0; i < SUBSCRIBER_MAX_TIMEOUTS; i++) {
+        subscriber_track_msg(a, (uint16_t) (0x3000 + i));
+        subscriber_on_timeout((uint16_t) (0x3000 + i));
+    }
+    TEST_ASSERT(subscriber_find(&peer, 5683, &token_a) == NULL &&
+                    subscriber_count() == 1,
+                "Removed after repeated timeouts");
+
+    uint32_t deadline;
+    TEST_ASSERT(subscriber_next_deadline(&deadline), "Idle deadline armed");
+    subscriber_remove(b);
+    TEST_ASSERT(!subscriber_next_deadline(&deadline) &&
+                    subscriber_first() == NULL,
+                "Empty after remove");
+}
+
+void unit_test_file_tail()
+{
+    printf("\n[UNIT] Testing File Tail...\n");
+    file_tail_init();
+    uint8_t buf[FILE_TAIL_BYTES];
+    size_t len = 0;
+
+    uint32_t start = file_tail_end();
+    file_tail_append((const uint8_t *) "one", 3);
+    uint32_t mid = file_tail_end();
+    file_tail_append((const uint8_t *) "two\nthree", 9);
+    TEST_ASSERT(file_tail_read(start, buf, sizeof(buf), &len) && len == 14 &&
+                    memcmp(buf, "one\ntwo\nthree\n", 14) == 0,
+                "Delta since registration");
+    TEST_ASSERT(file_tail_read(mid, buf, sizeof(buf), &len) && len == 10 &&
+                    memcmp(buf, "two\nthree\n", 10) == 0,
+                "Delta since the last notification");
+    TEST_ASSERT(file_tail_read(file_tail_end(), buf, sizeof(buf), &len) &&
+                    len == 0,
+                "Observer in sync has nothing new");
+    TEST_ASSERT(!file_tail_read(start, buf, 8, &len) && len == 0,
+                "Delta larger than the buffer refused");
+
+    // Wrap the ring: the oldest bytes are dropped, the newest read back
+    uint8_t line[100];
+    memset(line, 'x', sizeof(line));
+    for (int i = 0; i < FILE_TAIL_BYTES / 100 + 1; i++)
+        file_tail_append(line, sizeof(line));
+    TEST_ASSERT(!file_tail_available(start), "Overwritten delta unavailable");
+    uint32_t recent = file_tail_end() - 101;
+    TEST_ASSERT(file_tail_read(recent, buf, sizeof(buf), &len) &&
+                    len == 101 && buf[99] == 'x' && buf[100] == '\n',
+                "Wrapped delta read back");
+
+    file_tail_changed();
+    TEST_ASSERT(!file_tail_available(recent) &&
+                    file_tail_available(file_tail_end()),
+                "Upload leaves a change marker");
+}
+
+void unit_test_block_window()
+{
+    printf("\n[UNIT] Testing Block2 Transfer Window...\n");
+    block_window_t win;
+    block_window_init(&win, 3);
+
+    // Fill the window: blocks 0, 1, 2 in flight
+    while (block_window_can_request(&win)) {
+        uint32_t n = block_window_next_request(&win);
+        block_window_set_msg_id(&win, n, (uint16_t) (0x100 + n));
+    }
+    TEST_ASSERT(win.next_block == 3, "Window opens 3 requests");
+    TEST_ASSERT(block_window_owns_msg_id(&win, 0x101) &&
+                    !block_window_owns_msg_id(&win, 0x200),
+                "Only the window's own requests are claimed");
+
+    // Out-of-order arrival does not advance base past the hole
+    TEST_ASSERT(block_window_on_block(&win, 1, true, false) ==
+                    BLOCK_WINDOW_ACCEPTED,
+                "Block 1 accepted out of order");
+    TEST_ASSERT(win.base == 0, "Base waits for block 0");
+    TEST_ASSERT(block_window_on_block(&win, 1, true, false) ==
+                    BLOCK_WINDOW_DUPLICATE,
+                "Repeated block 1 is duplicate");
+    TEST_ASSERT(!block_window_owns_msg_id(&win, 0x101) &&
+                    block_window_owns_msg_id(&win, 0x100),
+                "Answered request is no longer in flight");
+    uint16_t open_ids[BLOCK_WINDOW_MAX];
+    TEST_ASSERT(block_window_open_msg_ids(&win, open_ids) == 2 &&
+                    open_ids[0] == 0x100 && open_ids[1] == 0x102,
+                "Open requests listed for cancelling");
+
+    block_window_on_block(&win, 0, true, false);
+    TEST_ASSERT(win.base == 2, "Base slides over blocks 0-1");
+    TEST_ASSERT(block_window_can_request(&win), "Window reopens after slide");
+
+    // Block 2 is the last one; a speculative block 3 comes back empty
+    block_window_next_request(&win);
+    block_window_on_block(&win, 3, false, true);
+    TEST_ASSERT(win.last_block == 2, "Empty block 3 caps last block at 2");
+    TEST_ASSERT(!block_window_complete(&win), "Incomplete until block 2");
+    block_window_on_block(&win, 2, false, false);
+    TEST_ASSERT(block_window_complete(&win), "Transfer complete");
+}
+
+void unit_test_write_behind()
+{
+    printf("\n[UNIT] Testing Write-Behind Ring...\n");
+    static uint8_t block[1024];
+    memset(block, 0xA5, sizeof(block));
+
+    // No file: nothing may reach the drain in this test
+    write_behind_init(NULL, 0);
+    TEST_ASSERT(write_behind_fits(WRITE_BEHIND_BYTES), "Empty ring fits");
+    TEST_ASSERT(!write_behind_fits(WRITE_BEHIND_BYTES + 1),
+                "Ring span is bounded");
+
+    // Blocks 1 and 0 arrive out of order; only the commit makes them ready
+    TEST_ASSERT(write_behind_put(1024, block, sizeof(block)),
+                "Out-of-order block buffered");
+    TEST_ASSERT(write_behind_put(0, block, sizeof(block)), "Block 0 buffered");
+    TEST_ASSERT(write_behind_pending() == 0, "Nothing committed yet");
+    write_behind_commit(2048);
+    TEST_ASSERT(write_behind_pending() == 2048, "Commit exposes both blocks");
+    write_behind_commit(1024);
+    TEST_ASSERT(write_behind_pending() == 2048, "Commit never moves back");
+
+    TEST_ASSERT(!write_behind_put(WRITE_BEHIND_BYTES, block, sizeof(block)),
+                "Block past the ring span rejected");
+    TEST_ASSERT(write_behind_get_stats()->high_water == 2048,
+                "High water tracks buffered bytes");
+
+    // A resumed download continues at the bytes already on the card
+    write_behind_init(NULL, 4096);
+    TEST_ASSERT(!write_behind_put(0, block, sizeof(block)),
+                "Bytes below the resume point rejected");
+    TEST_ASSERT(write_behind_put(4096, block, sizeof(block)) &&
+                    write_behind_fits(4096 + WRITE_BEHIND_BYTES),
+                "Ring span starts at the resume point");
+    write_behind_commit(5120);
+    TEST_ASSERT(write_behind_pending() == 1024,
+                "Only bytes after the resume point pending");
+}
+
+void unit_test_transfer_sessions()
+{
+    printf("\n[UNIT] Testing Transfer Session Table...\n");
+    transfer_session_init();
+
+    ip_addr_t peer_a, peer_b;
+    ip4addr_aton("192.168.137.10", &peer_a);
+    ip4addr_aton("192.168.137.11", &peer_b);
+    uint8_t tok_data[1] = { 0 };
+    coap_buffer_t tok = { tok_data, 1 };
+
+    // Same token from two clients is two sessions
+    TEST_ASSERT(transfer_session_open(&tok, &peer_a, 5683, "server.jpg") &&
+                    transfer_session_open(&tok, &peer_b, 5683, "server.jpg") &&
+                    transfer_session_count() == 2,
+                "Sessions keyed by client and token");
+    transfer_session_t *s = transfer_session_find(&tok, &peer_a, 5683);
+    transfer_session_note_block(s, 3, 1024);
+    TEST_ASSERT(s && s->next_block == 4 && s->bytes == 1024,
+                "Progress recorded per session");
+    TEST_ASSERT(transfer_session_open(&tok, &peer_a, 5683, "server.txt") == s &&
+                    s->next_block == 0 && transfer_session_count() == 2,
+                "Reopening a token restarts its session");
+
+    // Fill the table; the next transfer is refused, not swapped in
+    for (int i = 2; i < TRANSFER_SESSION_MAX; i++) {
+        tok_data[0] = (uint8_t) i;
+        transfer_session_open(&tok, &peer_a, 5683, "server.jpg");
+    }
+    tok_data[0] = 0xEE;
+    TEST_ASSERT(transfer_session_count() == TRANSFER_SESSION_MAX &&
+                    !transfer_session_open(&tok, &peer_b, 5683, "server.jpg"),
+                "Transfers beyond TRANSFER_SESSION_MAX refused");
+
+    transfer_session_close_peer(&peer_a, 5683);
+    TEST_ASSERT(transfer_session_count() == 1 &&
+                    transfer_session_open(&tok, &peer_b, 5683, "server.jpg"),
+                "Lost client frees its slots");
+}
+
+void unit_test_line_index()
+{
+    printf("\n[UNIT] Testing FETCH Line Index...\n");
+    char text[LINE_INDEX_STRIDE * 3 * 4];
+    int len = 0;
+    for (int i = 0; i < LINE_INDEX_STRIDE * 3; i++) {
+        len += sprintf(&text[len], "%02d\n", i);  // 3 bytes per line
+    }
+
+    line_index_init();
+    line_index_reset("idx.txt");
+    TEST_ASSERT(line_index_append("idx.txt", 0, text, len),
+                "Append in sync extends index");
+
+    uint32_t entry_line = 0;
+    FSIZE_t offset = 0;
+    line_index_lookup("idx.txt", LINE_INDEX_STRIDE + 3, &entry_line, &offset);
+    TEST_ASSERT(entry_line == LINE_INDEX_STRIDE, "Lookup rounds down to entry");
+    TEST_ASSERT(offset == LINE_INDEX_STRIDE * 3, "Entry offset is line start");
+
+    TEST_ASSERT(!line_index_append("idx.txt", 1, "x\n", 2),
+                "Append at wrong offset rejected");
+    TEST_ASSERT(!line_index_lookup("idx.txt", 0, &entry_line, &offset),
+                "Out-of-sync index is invalidated");
+}
+
+void unit_test_trace()
+{
+    printf("\n[UNIT] Testing Latency Trace...\n");
+    trace_init();
+    trace_histogram_t h;
+    trace_get_histogram(TRACE_STORAGE, &h);
+    TEST_ASSERT(h.count == 0 && trace_percentile_us(&h, 50) == 0,
+                "Empty after init");
+
+    // Back-dated starts give durations in known log2 buckets
+    uint32_t now = trace_now();
+    trace_lap(TRACE_STORAGE, now - 1500);  // 1024-2047 us
+    trace_lap(TRACE_STORAGE, now - 1500);
+    trace_lap(TRACE_STORAGE, now - 5000);  // 4096-8191 us
+    trace_get_histogram(TRACE_STORAGE, &h);
+    TEST_ASSERT(h.count == 3 && h.buckets[10] == 2 && h.buckets[12] == 1 &&
+                    h.max_us >= 5000,
+                "Durations bucketed by log2");
+    TEST_ASSERT(trace_percentile_us(&h, 50) == 2048 &&
+                    trace_percentile_us(&h, 99) == 8192,
+                "Percentiles from bucket bounds");
+
+    trace_event_t events[4];
+    size_t n = trace_recent(get_core_num(), events, 4);
+    TEST_ASSERT(n == 3 && events[2].stage == TRACE_STORAGE &&
+                    events[2].start_us == now - 5000,
+                "Events kept oldest first");
+
+    char report[128];
+    size_t len = trace_format(report, sizeof(report));
+    TEST_ASSERT(len > 0 && strncmp(report, "storage n=3 ", 12) == 0 &&
+                    strchr(report, '\n') == &report[len - 1],
+                "Only stages with samples reported");
+}
+
+void unit_test_log_ring()
+{
+    printf("\n[UNIT] Testing Deferred Log Ring...\n");
+    int evaluated = 0;
+    LOG_DISCARD("%d\n", ++evaluated);
+    TEST_ASSERT(evaluated == 0, "Disabled level does not evaluate arguments");
+
+    log_drain(LOG_CORES * LOG_RING_SIZE);
+    log_defer("  (deferred %lu of %lu)\n", 1, 2);
+    log_defer("  (deferred %lu of %lu)\n", 2, 2);
+    TEST_ASSERT(log_drain(1) == 1 && log_drain(8) == 1 && log_drain(8) == 0,
+                "Drained oldest first, up to max");
+
+    // One more than the ring holds: the newest is dropped and counted
+    uint32_t dropped = log_dropped();
+    for (int i = 0; i <= LOG_RING_SIZE; i++)
+        log_defer(".", 0, 0);
+    TEST_ASSERT(log_dropped() == dropped + 1, "Full ring drops and counts");
+    TEST_ASSERT(log_drain(LOG_CORES * LOG_RING_SIZE) == LOG_RING_SIZE,
+                "Full ring drained");
+    printf("\n");
+}
+
+void unit_test_metrics()
+{
+    printf("\n[UNIT] Testing Metrics Report...\n");
+    metrics_latency_t lat = { 0 };
+    metrics_latency_add(&lat, 100);
+    metrics_latency_add(&lat, 300);
+    TEST_ASSERT(lat.count == 2 && lat.total_us == 400 && lat.max_us == 300,
+                "Latency count, total and max");
+
+    char buf[48];
+    metrics_writer_t w;
+    metrics_begin(&w, buf, sizeof(buf));
+    TEST_ASSERT(metrics_put_latency(&w, "sd", &lat) &&
+                    strcmp(buf, "sd n=2 avg=200 max=300\n") == 0,
+                "Latency line");
+
+    // A line that does not fit is left out whole
+    size_t len = w.len;
+    TEST_ASSERT(!metrics_line(&w, "long %s\n", "xxxxxxxxxxxxxxxxxxxxxxxxxx") &&
+                    w.truncated && w.len == len && strlen(buf) == len,
+                "Partial line dropped");
+    TEST_ASSERT(!metrics_line(&w, "x\n"), "Nothing added after truncation");
+
+    static char report[METRICS_REPORT_MAX];
+    metrics_begin(&w, report, sizeof(report));
+    metrics_put_common(&w);
+    TEST_ASSERT(!w.truncated && strncmp(report, "pool small ", 11) == 0 &&
+                    strstr(report, "\ncoap pending=") != NULL,
+                "Common counters reported");
+}
+
+void unit_test_msg_id_generation()
+{
+    printf("\n[UNIT] Testing Message ID and Token Generation...\n");
+    coap_reliability_init();
+
+    ip_addr_t dest;
+    ip4addr_aton("192.168.137.1", &dest);
+    uint8_t packet[4] = { 0x40, 0x01, 0x00, 0x01 };
+
+    uint16_t a = coap_generate_msg_id();
+    TEST_ASSERT(a != 0, "Message ID is never 0");
+    uint16_t b = coap_generate_msg_id();
+    TEST_ASSERT(b == (uint16_t) (a + 1) || (a == 0xFFFF && b == 1),
+                "Message IDs are sequential");
+
+    // The next ID is still awaiting an ACK, so it is skipped
+    uint16_t held = (uint16_t) (b + 1);
+    if (held == 0) {
+        held = 1;
+    }
+    coap_store_for_retransmit(held, &dest, 5683, packet, sizeof(packet));
+    TEST_ASSERT(coap_msg_id_pending(held), "Stored ID is pending");
+    uint16_t c = coap_generate_msg_id();
+    TEST_ASSERT(c != held && c != 0, "Pending ID skipped");
+    coap_reliability_init();
+
+    coap_buffer_t t1, t2;
+    uint8_t d1[8], d2[8];
+    coap_generate_token(&t1, d1, sizeof(d1));
+    coap_generate_token(&t2, d2, sizeof(d2));
+    TEST_ASSERT(t1.p == d1 && t1.len == sizeof(d1), "Token points at data");
+    TEST_ASSERT(memcmp(d1, d2, sizeof(d1)) != 0, "Tokens differ");
+}
+
+void unit_test_radio_policy()
+{
+    printf("\n[UNIT] Testing Radio Scheduling Policy...\n");
+
+    radio_link_t link = radio_link_from_rssi(RADIO_LINK_GOOD, -60);
+    TEST_ASSERT(link == RADIO_LINK_GOOD, "Strong signal is good");
+    link = radio_link_from_rssi(link, RADIO_RSSI_POOR - 1);
+    TEST_ASSERT(link == RADIO_LINK_POOR, "Weak signal is poor at once");
+    link = radio_link_from_rssi(link, RADIO_RSSI_POOR + 1);
+    TEST_ASSERT(link == RADIO_LINK_POOR, "Stays poor inside the hysteresis");
+    link = radio_link_from_rssi(link, RADIO_RSSI_POOR + RADIO_RSSI_HYSTERESIS);
+    TEST_ASSERT(link == RADIO_LINK_FAIR, "Recovers past the hysteresis");
+
+    TEST_ASSERT(
+        radio_szx_limit_for(RADIO_LINK_GOOD) == COAP_BLOCK_SZX_BERT &&
+            radio_szx_limit_for(RADIO_LINK_FAIR) == COAP_BLOCK_SZX_MAX &&
+            radio_szx_limit_for(RADIO_LINK_POOR) == 5,
+        "Block size shrinks with the link");
+    TEST_ASSERT(radio_window_for(RADIO_LINK_GOOD, 4) == 4 &&
+                    radio_window_for(RADIO_LINK_FAIR, 4) == 2 &&
+                    radio_window_for(RADIO_LINK_FAIR, 1) == 1 &&
+                    radio_window_for(RADIO_LINK_POOR, 8) == RADIO_POOR_WINDOW,
+                "Window shrinks with the link");
+
+    // A held notification waits for the hold, not just the interval
+    notify_gate_t gate = { 0 };
+    uint32_t t0 = 10000;
+    notify_gate_sent(&gate, t0, false);
+    TEST_ASSERT(!notify_gate_offer(&gate, t0 + 50), "Rate limited first");
+    notify_gate_hold(&gate, t0 + RADIO_POOR_DEFER_MS);
+    TEST_ASSERT(!notify_gate_ready(&gate, t0 + NOTIFY_MIN_INTERVAL_MS) &&
+                    notify_gate_ready_at(&gate) == t0 + RADIO_POOR_DEFER_MS,
+                "Hold delays the notification");
+    notify_gate_hold(&gate, t0 + 1000);
+    TEST_ASSERT(notify_gate_ready_at(&gate) == t0 + RADIO_POOR_DEFER_MS,
+                "Shorter hold does not cut the wait");
+    TEST_ASSERT(notify_gate_ready(&gate, t0 + RADIO_POOR_DEFER_MS),
+                "Sent once the hold ends");
+}
+
 void unit_test_led_math()
 {
     printf("\n[UNIT] Testing LED Color Math...\n");
@@ -154,6 +1268,130 @@ void unit_test_led_math()
     TEST_ASSERT_EQUAL_HEX(0, result, "Brightness 0 should be black");
 }
 
+void unit_test_button_edges()
+{
+    printf("\n[UNIT] Testing Button Debounce and Press Classification...\n");
+    hw_button_state_t b = { .pin = 20, .down = false, .edge_ms = 0 };
+    hw_button_event_t ev;
+    uint32_t t = 1000;
+
+    TEST_ASSERT(hw_button_edge(&b, true, t, &ev) &&
+                    ev.kind == HW_BUTTON_PRESS && ev.pin == 20,
+                "First edge is a press, without delay");
+    TEST_ASSERT(!hw_button_edge(&b, false, t + 2, &ev) &&
+                    !hw_button_edge(&b, true, t + 4, &ev),
+                "Bounce inside the debounce window is ignored");
+    TEST_ASSERT(!hw_button_edge(&b, true, t + HW_BUTTON_DEBOUNCE_MS, &ev),
+                "Unchanged level is not an edge");
+    TEST_ASSERT(hw_button_edge(&b, false, t + 200, &ev) &&
+                    ev.kind == HW_BUTTON_SHORT && ev.held_ms == 200,
+                "Quick release is a short press");
+
+    t += 5000;
+    hw_button_edge(&b, true, t, &ev);
+    TEST_ASSERT(hw_button_edge(&b, false, t + HW_BUTTON_LONG_MS, &ev) &&
+                    ev.kind == HW_BUTTON_LONG,
+                "Held release is a long press");
+}
+
+void unit_test_proxy_cache()
+{
+    printf("\n[UNIT] Testing Proxy Cache...\n");
+    const char *origin = "192.168.137.50";
+
+    // Requests: Uri-Path/Uri-Query, or the origin's URI in Proxy-Uri
+    coap_packet_t req = { 0 };
+    coap_add_option(&req, COAP_OPTION_URI_PATH, (const uint8_t *) "file", 4);
+    TEST_ASSERT(proxy_resource_for(&req, origin) == PROXY_RES_FILE,
+                "Uri-Path /file is the text resource");
+    coap_add_option(&req, COAP_OPTION_URI_QUERY,
+                    (const uint8_t *) "type=image", 10);
+    TEST_ASSERT(proxy_resource_for(&req, origin) == PROXY_RES_IMAGE,
+                "type=image query is the image resource");
+
+    static const char uri[] = "coap://192.168.137.50:5683/file?type=image";
+    static const char other[] = "coap://10.0.0.1/file";
+    coap_packet_t fwd = { 0 };
+    coap_add_option(&fwd, COAP_OPTION_PROXY_URI, (const uint8_t *) uri,
+                    sizeof(uri) - 1);
+    TEST_ASSERT(proxy_resource_for(&fwd, origin) == PROXY_RES_IMAGE,
+                "Proxy-Uri naming the origin is resolved");
+    coap_clear_options(&fwd);
+    coap_add_option(&fwd, COAP_OPTION_PROXY_URI, (const uint8_t *) other,
+                    sizeof(other) - 1);
+    TEST_ASSERT(proxy_resource_for(&fwd, origin) == PROXY_RES_NONE,
+                "Proxy-Uri for another host is refused");
+
+    // Miss, then wait while the origin fetch runs
+    uint8_t tag[2] = { 0xAB, 0xCD };
+    uint8_t old_tag[2] = { 0x01, 0x02 };
+    coap_buffer_t etag = { tag, sizeof(tag) };
+    coap_buffer_t old_etag = { old_tag, sizeof(old_tag) };
+    uint32_t t = 5000;
+    uint32_t peer = 0x0A89A8C0;  // 192.168.137.10
+    proxy_cache_init();
+    proxy_entry_t *e = proxy_cache_entry(PROXY_RES_FILE);
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 0, NULL, NULL, t) == PROXY_FILL,
+                "Empty cache starts an origin fetch");
+    proxy_fill_started(e);
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 0, NULL, NULL, t) == PROXY_WAIT,
+                "Second request waits for the fetch");
+
+    // Filled: blocks served, conditional GET validated, stale ETag mismatched
+    proxy_fill_content(e, tag, sizeof(tag), 3000, 60, t);
+    uint32_t soon = t + 1000;
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 0, NULL, NULL, soon) ==
+                        PROXY_SERVE &&
+                    proxy_lookup(e, peer, 5683, 2, NULL, NULL, soon) ==
+                        PROXY_SERVE,
+                "Fresh copy serves every block");
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 0, &etag, NULL, soon) ==
+                    PROXY_VALID,
+                "Matching ETag gets 2.03");
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 1, NULL, &old_etag, soon) ==
+                    PROXY_MISMATCH,
+                "If-Match on another version gets 4.12");
+    TEST_ASSERT(proxy_max_age_left(e, soon) == 59,
+                "Max-Age counts down from the origin's");
+
+    // Stale: block 0 revalidates, a transfer under way keeps its blocks
+    uint32_t later = t + 61000;
+    TEST_ASSERT(proxy_max_age_left(e, later) == 0 &&
+                    proxy_lookup(e, peer, 5683, 0, NULL, NULL, later) ==
+                        PROXY_FILL,
+                "Stale copy is revalidated on block 0");
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 1, NULL, &etag, later) ==
+                    PROXY_SERVE,
+                "Resumed transfer is served from the stale copy");
+    proxy_fill_started(e);
+    proxy_fill_valid(e, 30, later);
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 0, NULL, NULL, later) ==
+                        PROXY_SERVE &&
+                    proxy_cache_get_stats()->origin_valid == 1,
+                "Origin 2.03 refreshes the copy");
+
+    // A rewrite under a transfer without If-Match makes the peer start over
+    TEST_ASSERT(proxy_lookup(e, peer + 1, 5683, 1, NULL, NULL, later) ==
+                    PROXY_MISMATCH,
+                "Block 1 from a peer that never had block 0 gets 4.12");
+    proxy_fill_replacing(e);
+    proxy_fill_content(e, old_tag, sizeof(old_tag), 2000, 60, later);
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 1, NULL, NULL, later) ==
+                    PROXY_MISMATCH,
+                "Block 1 after the copy was replaced gets 4.12");
+    TEST_ASSERT(proxy_lookup(e, peer, 5683, 0, NULL, NULL, later) ==
+                    PROXY_SERVE &&
+                    proxy_lookup(e, peer, 5683, 1, NULL, NULL, later) ==
+                        PROXY_SERVE,
+                "Restarted transfer is served the new copy");
+
+    // A boot-time copy is stale until the first revalidation
+    proxy_cache_restore(PROXY_RES_IMAGE, tag, sizeof(tag), 9000, t);
+    TEST_ASSERT(proxy_lookup(proxy_cache_entry(PROXY_RES_IMAGE), peer, 5683,
+                             0, NULL, NULL, t) == PROXY_FILL,
+                "Restored copy is revalidated first");
+}
+
 // ==========================================
 // PART 2: COMPONENT TESTS (Hardware Drivers)
 // ==========================================
@@ -183,7 +1421,51 @@ void component_test_sd_storage()
         TEST_ASSERT(false, "File Open Failed");
     }
 
-    // 3. File Cleanup
+    // 3. Hot cache: the first read loads the file, the second is from RAM
+    uint8_t buf[8];
+    UINT n = 0;
+    FSIZE_t size = 0;
+    hot_cache_init();
+    fr = hot_cache_read("COMP_TEST.TXT", 0, buf, sizeof(buf), &n, &size);
+    TEST_ASSERT(fr == FR_OK && n == 4 && memcmp(buf, "TEST", 4) == 0,
+                "Hot cache loads small file");
+    hot_cache_read("COMP_TEST.TXT", 1, buf, 2, &n, &size);
+    TEST_ASSERT(hot_cache_get_stats()->hits == 1 && n == 2 && buf[0] == 'E',
+                "Hot cache serves repeat read from RAM");
+    hot_cache_invalidate("COMP_TEST.TXT");
+
+    // 4. Block1 upload: 16-byte blocks out of order replace the file
+    ip_addr_t peer;
+    ip4addr_aton("192.168.137.10", &peer);
+    uint8_t tok_data[] = { 0xC1 };
+    coap_buffer_t tok = { tok_data, sizeof(tok_data) };
+    const uint8_t body[] = "0123456789abcdef0123456789ABCDEFtail";
+    upload_session_init();
+    upload_session_t *up = upload_session_open(&tok, &peer, 5683,
+                                               "COMP_TEST.TXT", true, 0);
+    TEST_ASSERT(up != NULL, "Upload session opened");
+    if (up) {
+        upload_result_t r2 = upload_session_put(up, 2, false, &body[32], 4);
+        upload_result_t r0 = upload_session_put(up, 0, true, body, 16);
+        upload_result_t again = upload_session_put(up, 0, true, body, 16);
+        upload_result_t r1 = upload_session_put(up, 1, true, &body[16], 16);
+        TEST_ASSERT(r2 == UPLOAD_STORED && r0 == UPLOAD_STORED &&
+                        again == UPLOAD_DUPLICATE && r1 == UPLOAD_COMPLETE,
+                    "Out-of-order blocks complete the upload");
+
+        uint32_t lines = 0;
+        fr = upload_session_commit(up, &lines);
+        uint8_t back[40];
+        n = 0;
+        if (fr == FR_OK && f_open(&fil, "COMP_TEST.TXT", FA_READ) == FR_OK) {
+            f_read(&fil, back, sizeof(back), &n);
+            f_close(&fil);
+        }
+        TEST_ASSERT(fr == FR_OK && n == 36 && memcmp(back, body, 36) == 0,
+                    "Committed upload replaces the file");
+    }
+
+    // 5. File Cleanup
     f_unlink("COMP_TEST.TXT");
 }
 
@@ -232,7 +1514,36 @@ int main(void)
     unit_test_block2_encoding();  // Restored
     unit_test_reliability_basic();
     unit_test_reliability_circular_buffer();  // Restored
+    unit_test_retransmit_queue();
+    unit_test_rto_estimator();
+    unit_test_congestion_window();
+    unit_test_send_table_full();
+    unit_test_block_size_choice();
+    unit_test_packet_pool();
+    unit_test_exchange_cache();
+    unit_test_option_index();
+    unit_test_chained_parse();
+    unit_test_chain_build();
+    unit_test_conditional_get();
+    unit_test_dispatch();
+    unit_test_notify_template();
+    unit_test_payload_template();
+    unit_test_cbor();
+    unit_test_append_batch();
+    unit_test_subscriber_registry();
+    unit_test_file_tail();
+    unit_test_block_window();
+    unit_test_write_behind();
+    unit_test_transfer_sessions();
+    unit_test_line_index();
+    unit_test_trace();
+    unit_test_log_ring();
+    unit_test_metrics();
+    unit_test_msg_id_generation();
+    unit_test_radio_policy();
     unit_test_led_math();                     // Restored
+    unit_test_button_edges();
+    unit_test_proxy_cache();
 
     // --- COMPONENT TESTS (Hardware Dependent) ---
     component_test_sd_storage();